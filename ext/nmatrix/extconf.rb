@@ -153,6 +153,16 @@ have_func("dgesvd_", "clapack.h")
 
 have_func("cblas_dgemm", "cblas.h")
 
+# Threads for the native (non-ATLAS) gemm and gemv.
+have_header("pthread.h")
+
+# For aligned (and optionally huge-page backed) dense element buffers.
+have_func("posix_memalign", "stdlib.h")
+have_func("madvise", "sys/mman.h")
+
+# So the garbage collector knows about element buffers that don't come from Ruby's allocator.
+have_func("rb_gc_adjust_memory_usage", "ruby.h")
+
 
 #find_library("cblas", "cblas_dgemm")
 #find_library("atlas", "ATL_dgemmNN")
@@ -115,6 +115,11 @@
 
 #include <algorithm>
 #include <limits>
+#include <unistd.h> // sysconf
+
+#ifdef HAVE_PTHREAD_H
+  #include <pthread.h>
+#endif
 
 #include "math/inc.h"
 #include "data/data.h"
@@ -128,9 +133,13 @@
 #include "math/getf2.h"
 #include "math/laswp.h"
 #include "math/trsm.h"
+#include "math/syrk.h" // for gemm.h and math.h
 #include "math/long_dtype.h" // for gemm.h
+#include "math/parallel.h" // for gemm.h and gemv.h
 #include "math/gemm.h"
+#include "math/strassen.h"
 #include "math/gemv.h"
+#include "math/batched.h"
 #include "math/asum.h"
 #include "math/nrm2.h"
 #include "math/getrf.h"
@@ -139,8 +148,10 @@
 #include "math/potrs.h"
 #include "math/rot.h"
 #include "math/rotg.h"
+#include "math/krylov.h"
 #include "math/math.h"
 #include "storage/dense.h"
+#include "storage/yale.h"
 
 #include "nmatrix.h"
 #include "ruby_constants.h"
@@ -185,8 +196,23 @@ extern "C" {
   static VALUE nm_lapack_gesvd(VALUE self, VALUE jobu, VALUE jobvt, VALUE m, VALUE n, VALUE a, VALUE lda, VALUE s, VALUE u, VALUE ldu, VALUE vt, VALUE ldvt, VALUE lworkspace_size);
   static VALUE nm_lapack_gesdd(VALUE self, VALUE jobz, VALUE m, VALUE n, VALUE a, VALUE lda, VALUE s, VALUE u, VALUE ldu, VALUE vt, VALUE ldvt, VALUE lworkspace_size);
   static VALUE nm_lapack_geev(VALUE self, VALUE compute_left, VALUE compute_right, VALUE n, VALUE a, VALUE lda, VALUE w, VALUE wi, VALUE vl, VALUE ldvl, VALUE vr, VALUE ldvr, VALUE lwork);
+
+  static VALUE nm_blas_num_threads(VALUE self);
+  static VALUE nm_blas_set_num_threads(VALUE self, VALUE n);
+  static VALUE nm_blas_strassen_cutoff(VALUE self);
+  static VALUE nm_blas_set_strassen_cutoff(VALUE self, VALUE n);
 } // end of extern "C" block
 
+/*
+ * Global Variables
+ */
+
+// Threads used by the native gemm and gemv; 0 until first asked for, when it defaults to the number of online CPUs.
+static size_t math_num_threads = 0;
+
+// Smallest dimension for which integer and rational products recurse with Strassen-Winograd; 0 turns it off.
+static size_t math_strassen_cutoff = NM_STRASSEN_CUTOFF;
+
 ////////////////////
 // Math Functions //
 ////////////////////
@@ -328,6 +354,164 @@ inline static void cblas_syrk(const enum CBLAS_ORDER order, const enum CBLAS_UPL
 
 
 
+/*
+ * Run a batched operation, across threads if DType allows and there's enough work, and raise if any thread ran out
+ * of memory. task must start with failed at -1 and nomem false. Returns the lowest index of a singular problem in the
+ * batch, or -1.
+ */
+template <typename DType>
+static int batch_run(nm_parallel_func fn, BatchTask<DType>* task, const int batch, double flops) {
+  if (parallel_threads<DType>(flops) > 1) nm_math_parallel_for(batch, 1, fn, task);
+  else                                    fn(task, 0, batch);
+
+  if (task->nomem) rb_raise(rb_eNoMemError, "unable to allocate workspace for a batched operation");
+
+  return task->failed;
+}
+
+template <typename DType>
+void batch_gemm(const int batch, const int M, const int N, const int K, const void* A, const size_t strideA, const int lda,
+                const void* B, const size_t strideB, const int ldb, void* C, const size_t strideC, const int ldc)
+{
+  BatchTask<DType> task = { M, N, K,
+                            reinterpret_cast<const DType*>(A), strideA, lda,
+                            reinterpret_cast<const DType*>(B), strideB, ldb,
+                            reinterpret_cast<DType*>(C),       strideC, ldc,
+                            -1, false };
+
+  batch_run<DType>(batch_gemm_task_run<DType>, &task, batch, (double)(batch) * M * N * K);
+}
+
+template <typename DType>
+int batch_inverse(const int batch, const int N, const void* A, const size_t strideA, const int lda, void* C,
+                  const size_t strideC, const int ldc)
+{
+  BatchTask<DType> task = { N, N, N,
+                            reinterpret_cast<const DType*>(A), strideA, lda,
+                            NULL,                              0,       0,
+                            reinterpret_cast<DType*>(C),       strideC, ldc,
+                            -1, false };
+
+  return batch_run<DType>(batch_inverse_task_run<DType>, &task, batch, (double)(batch) * N * N * N);
+}
+
+template <typename DType>
+int batch_solve(const int batch, const int N, const int NRHS, const void* A, const size_t strideA, const int lda,
+                const void* B, const size_t strideB, const int ldb, void* X, const size_t strideX, const int ldx)
+{
+  BatchTask<DType> task = { N, N, NRHS,
+                            reinterpret_cast<const DType*>(A), strideA, lda,
+                            reinterpret_cast<const DType*>(B), strideB, ldb,
+                            reinterpret_cast<DType*>(X),       strideX, ldx,
+                            -1, false };
+
+  return batch_run<DType>(batch_solve_task_run<DType>, &task, batch, (double)(batch) * N * N * (N + NRHS));
+}
+
+
+/*
+ * The operator of a Krylov solve on a dense matrix: y = A*x, with A row-major n-by-n.
+ */
+template <typename DType>
+struct DenseOperator {
+  int          n;
+  const DType* a;
+};
+
+template <typename DType>
+static void dense_matvec(const void* op_, const void* x, void* y) {
+  const DenseOperator<DType>* op = reinterpret_cast<const DenseOperator<DType>*>(op_);
+  const DType one = 1, zero = 0;
+
+  gemv<DType>(CblasNoTrans, op->n, op->n, &one, op->a, op->n, reinterpret_cast<const DType*>(x), 1, &zero,
+              reinterpret_cast<DType*>(y), 1);
+}
+
+/*
+ * The Jacobi preconditioner: z = D**-1 * r, with the reciprocals of the diagonal worked out beforehand.
+ */
+template <typename DType>
+struct JacobiPreconditioner {
+  int    n;
+  DType* inverse_diagonal;
+};
+
+template <typename DType>
+static void jacobi_solve(const void* m_, const void* r_, void* z_) {
+  const JacobiPreconditioner<DType>* m = reinterpret_cast<const JacobiPreconditioner<DType>*>(m_);
+  const DType* r = reinterpret_cast<const DType*>(r_);
+  DType*       z = reinterpret_cast<DType*>(z_);
+
+  for (int i = 0; i < m->n; ++i) z[i] = m->inverse_diagonal[i] * r[i];
+}
+
+/*
+ * Solve A*x = b by a Krylov method (see krylov.h), starting from the x given, for a square dense or Yale matrix A. The
+ * preconditioner is set up here, once: Jacobi for either storage, ILU(0) or IC(0) for Yale only. Returns the number of
+ * iterations done, with the residual history as described for KrylovSolve.
+ */
+template <typename DType>
+int krylov(const STORAGE* a, const nm::stype_t stype, const int method, const int preconditioner, const void* b, void* x,
+           const double tol, const int max_iter, const int restart, double* history)
+{
+  const int n = a->shape[0];
+
+  DenseOperator<DType> dense = { n, NULL };
+
+  KrylovSolve<DType> k = { n, NULL, NULL, NULL, NULL, reinterpret_cast<const DType*>(b), reinterpret_cast<DType*>(x),
+                           tol, max_iter, restart, history };
+
+  if (stype == nm::YALE_STORE) {
+    k.matvec = nm_yale_storage_spmv;
+    k.a      = a;
+  } else {
+    dense.a  = reinterpret_cast<const DType*>(reinterpret_cast<const DENSE_STORAGE*>(a)->elements);
+    k.matvec = dense_matvec<DType>;
+    k.a      = &dense;
+  }
+
+  JacobiPreconditioner<DType> jacobi = { n, NULL };
+  void* factor = NULL;
+
+  if (preconditioner == NM_PRECONDITIONER_JACOBI) {
+    const DType* diagonal = stype == nm::YALE_STORE ? reinterpret_cast<const DType*>(reinterpret_cast<const YALE_STORAGE*>(a)->a)
+                                                    : dense.a;
+    const int    stride   = stype == nm::YALE_STORE ? 1 : n + 1;
+
+    jacobi.inverse_diagonal = ALLOC_N(DType, n);
+    for (int i = 0; i < n; ++i) {
+      if (diagonal[i*stride] == 0) {
+        xfree(jacobi.inverse_diagonal);
+        rb_raise(rb_eZeroDivError, "Jacobi preconditioner needs a nonzero diagonal: zero in row %d", i);
+      }
+      jacobi.inverse_diagonal[i] = 1 / diagonal[i*stride];
+    }
+
+    k.psolve = jacobi_solve<DType>;
+    k.m      = &jacobi;
+
+  } else if (preconditioner == NM_PRECONDITIONER_ILU0 || preconditioner == NM_PRECONDITIONER_IC0) {
+    if (stype != nm::YALE_STORE)
+      rb_raise(rb_eNotImpError, "ILU(0) and IC(0) preconditioners are only implemented for Yale matrices");
+
+    factor   = nm_yale_storage_incomplete_factor(a, preconditioner == NM_PRECONDITIONER_IC0);
+    k.psolve = nm_yale_storage_incomplete_solve;
+    k.m      = factor;
+  }
+
+  int iterations;
+  switch (method) {
+  case NM_KRYLOV_CG:       iterations = cg<DType>(k);       break;
+  case NM_KRYLOV_BICGSTAB: iterations = bicgstab<DType>(k); break;
+  default:                 iterations = gmres<DType>(k);
+  }
+
+  if (jacobi.inverse_diagonal) xfree(jacobi.inverse_diagonal);
+  if (factor)                  nm_yale_storage_incomplete_factor_delete(factor);
+
+  return iterations;
+}
+
 
 }} // end of namespace nm::math
 
@@ -370,6 +554,11 @@ void nm_math_init_blas() {
 	rb_define_singleton_method(cNMatrix_BLAS, "cblas_trmm", (METHOD)nm_cblas_trmm, 12);
 	rb_define_singleton_method(cNMatrix_BLAS, "cblas_syrk", (METHOD)nm_cblas_syrk, 11);
 	rb_define_singleton_method(cNMatrix_BLAS, "cblas_herk", (METHOD)nm_cblas_herk, 11);
+
+  rb_define_singleton_method(cNMatrix_BLAS, "num_threads",  (METHOD)nm_blas_num_threads, 0);
+  rb_define_singleton_method(cNMatrix_BLAS, "num_threads=", (METHOD)nm_blas_set_num_threads, 1);
+  rb_define_singleton_method(cNMatrix_BLAS, "strassen_cutoff",  (METHOD)nm_blas_strassen_cutoff, 0);
+  rb_define_singleton_method(cNMatrix_BLAS, "strassen_cutoff=", (METHOD)nm_blas_set_strassen_cutoff, 1);
 }
 
 /*
@@ -507,8 +696,8 @@ static VALUE nm_cblas_rotg(VALUE self, VALUE ab) {
          *pS = ALLOCA_N(char, DTYPE_SIZES[dtype]);
 
     // extract A and B from the NVector (first two elements)
-    void* pA = NM_STORAGE_DENSE(ab)->elements;
-    void* pB = (char*)(NM_STORAGE_DENSE(ab)->elements) + DTYPE_SIZES[dtype];
+    void* pA = NM_DENSE_WRITABLE_ELEMENTS(ab);
+    void* pB = (char*)(NM_DENSE_WRITABLE_ELEMENTS(ab)) + DTYPE_SIZES[dtype];
     // c and s are output
 
     ttable[dtype](pA, pB, pC, pS);
@@ -592,7 +781,7 @@ static VALUE nm_cblas_rot(VALUE self, VALUE n, VALUE x, VALUE incx, VALUE y, VAL
     }
 
 
-    ttable[dtype](FIX2INT(n), NM_STORAGE_DENSE(x)->elements, FIX2INT(incx), NM_STORAGE_DENSE(y)->elements, FIX2INT(incy), pC, pS);
+    ttable[dtype](FIX2INT(n), NM_DENSE_WRITABLE_ELEMENTS(x), FIX2INT(incx), NM_DENSE_WRITABLE_ELEMENTS(y), FIX2INT(incy), pC, pS);
 
     return Qtrue;
   }
@@ -708,6 +897,38 @@ static VALUE nm_cblas_asum(VALUE self, VALUE n, VALUE x, VALUE incx) {
 
 
 
+/*
+ * Whether a Yale operand should be read transposed. The conjugate transpose is the transpose for real dtypes; the
+ * Yale kernels don't conjugate, so it raises for complex ones.
+ */
+static bool yale_transpose(nm::dtype_t dtype, const enum CBLAS_TRANSPOSE trans) {
+  if (trans == CblasConjTrans && (dtype == nm::COMPLEX64 || dtype == nm::COMPLEX128))
+    rb_raise(rb_eNotImpError, "the conjugate transpose of a complex Yale matrix is not yet supported");
+
+  return trans != CblasNoTrans;
+}
+
+/*
+ * First element of a dense operand of a Yale kernel, which may be a reference; its rows are stride[0] elements apart.
+ * elements are s's own, or what NM_DENSE_WRITABLE_ELEMENTS gave for them.
+ */
+static void* dense_origin(const DENSE_STORAGE* s, void* elements) {
+  size_t origin[2] = {0, 0};
+  return reinterpret_cast<char*>(elements) + nm_dense_storage_pos(s, origin) * DTYPE_SIZES[s->dtype];
+}
+
+/*
+ * Whether a dense matrix is a vector (one row or one column, possibly a reference) holding at least n elements when
+ * read every inc'th one. If so, step is set to the distance between those elements.
+ */
+static bool dense_vector_fits(const DENSE_STORAGE* s, const size_t n, const int inc, int* step) {
+  if (s->dim != 2 || inc < 1 || (s->shape[0] != 1 && s->shape[1] != 1)) return false;
+
+  *step = inc * (s->shape[1] == 1 ? s->stride[0] : s->stride[1]);
+  return n == 0 || (n - 1) * inc < s->shape[0] * s->shape[1];
+}
+
+
 /* Call any of the cblas_xgemm functions as directly as possible.
  *
  * The cblas_xgemm functions (dgemm, sgemm, cgemm, and zgemm) define the following operation:
@@ -720,6 +941,11 @@ static VALUE nm_cblas_asum(VALUE self, VALUE n, VALUE x, VALUE incx) {
  * Other types are not implemented in BLAS, and while they exist in NMatrix, this method is intended only to
  * expose the ultra-optimized ATLAS versions.
  *
+ * A may also be a Yale matrix of any dtype (row-major, B not transposed), in which case m and k must be the shape of
+ * op(A), B must be k x n and C m x n, and lda, ldb and ldc are ignored: B and C may be references, and are read through
+ * their own strides. A transposed Yale matrix is read in place; its conjugate transpose is only supported for real
+ * dtypes.
+ *
  * == Arguments
  * See: http://www.netlib.org/blas/dgemm.f
  *
@@ -748,7 +974,30 @@ static VALUE nm_cblas_gemm(VALUE self,
   rubyval_to_cval(alpha, dtype, pAlpha);
   rubyval_to_cval(beta, dtype, pBeta);
 
-  ttable[dtype](blas_order_sym(order), blas_transpose_sym(trans_a), blas_transpose_sym(trans_b), FIX2INT(m), FIX2INT(n), FIX2INT(k), pAlpha, NM_STORAGE_DENSE(a)->elements, FIX2INT(lda), NM_STORAGE_DENSE(b)->elements, FIX2INT(ldb), pBeta, NM_STORAGE_DENSE(c)->elements, FIX2INT(ldc));
+  // Yale matrices have their own kernel, which reads B and C through their strides.
+  if (NM_STYPE(a) == nm::YALE_STORE) {
+    if (blas_order_sym(order) != CblasRowMajor || blas_transpose_sym(trans_b) != CblasNoTrans)
+      rb_raise(rb_eNotImpError, "gemm on a Yale matrix is only supported in row-major order, without transposing B");
+
+    const bool     transpose = yale_transpose(dtype, blas_transpose_sym(trans_a));
+    const size_t   rows      = NM_SHAPE(a, transpose ? 1 : 0),
+                   inner     = NM_SHAPE(a, transpose ? 0 : 1);
+    DENSE_STORAGE *bs        = NM_STORAGE_DENSE(b),
+                  *cs        = NM_STORAGE_DENSE(c);
+
+    if ((size_t)FIX2INT(m) != rows || (size_t)FIX2INT(k) != inner)
+      rb_raise(rb_eArgError, "m and k must be the shape of op(A) for a Yale matrix");
+    if (bs->dim != 2 || bs->shape[0] != inner || bs->shape[1] != (size_t)FIX2INT(n))
+      rb_raise(rb_eArgError, "B must be k x n");
+    if (cs->dim != 2 || cs->shape[0] != rows || cs->shape[1] != (size_t)FIX2INT(n))
+      rb_raise(rb_eArgError, "C must be m x n");
+
+    nm_yale_storage_gemm(NM_STORAGE(a), transpose, FIX2INT(n), pAlpha, dense_origin(bs, bs->elements), bs->stride[0], pBeta,
+                         dense_origin(cs, NM_DENSE_WRITABLE_ELEMENTS(c)), cs->stride[0]);
+    return c;
+  }
+
+  ttable[dtype](blas_order_sym(order), blas_transpose_sym(trans_a), blas_transpose_sym(trans_b), FIX2INT(m), FIX2INT(n), FIX2INT(k), pAlpha, NM_STORAGE_DENSE(a)->elements, FIX2INT(lda), NM_STORAGE_DENSE(b)->elements, FIX2INT(ldb), pBeta, NM_DENSE_WRITABLE_ELEMENTS(c), FIX2INT(ldc));
 
   return c;
 }
@@ -766,6 +1015,10 @@ static VALUE nm_cblas_gemm(VALUE self,
  * Other types are not implemented in BLAS, and while they exist in NMatrix, this method is intended only to
  * expose the ultra-optimized ATLAS versions.
  *
+ * A may also be a Yale matrix of any dtype, in which case m and n must be the shape of op(A) and lda is ignored; x and
+ * y must be vectors long enough for incx and incy, and may be references. A transposed Yale matrix is read in place;
+ * its conjugate transpose is only supported for real dtypes.
+ *
  * == Arguments
  * See: http://www.netlib.org/blas/dgemm.f
  *
@@ -793,10 +1046,39 @@ static VALUE nm_cblas_gemv(VALUE self,
   rubyval_to_cval(alpha, dtype, pAlpha);
   rubyval_to_cval(beta, dtype, pBeta);
 
-  return ttable[dtype](blas_transpose_sym(trans_a), FIX2INT(m), FIX2INT(n), pAlpha, NM_STORAGE_DENSE(a)->elements, FIX2INT(lda), NM_STORAGE_DENSE(x)->elements, FIX2INT(incx), pBeta, NM_STORAGE_DENSE(y)->elements, FIX2INT(incy)) ? Qtrue : Qfalse;
+  // Yale matrices have their own kernel, which reads x and y through their strides.
+  if (NM_STYPE(a) == nm::YALE_STORE) {
+    const bool     transpose = yale_transpose(dtype, blas_transpose_sym(trans_a));
+    const size_t   rows      = NM_SHAPE(a, transpose ? 1 : 0),
+                   cols      = NM_SHAPE(a, transpose ? 0 : 1);
+    DENSE_STORAGE *xs        = NM_STORAGE_DENSE(x),
+                  *ys        = NM_STORAGE_DENSE(y);
+    int            x_step, y_step;
+
+    if ((size_t)FIX2INT(m) != rows || (size_t)FIX2INT(n) != cols)
+      rb_raise(rb_eArgError, "m and n must be the shape of op(A) for a Yale matrix");
+    if (!dense_vector_fits(xs, cols, FIX2INT(incx), &x_step))
+      rb_raise(rb_eArgError, "x must be a vector with n elements, incx apart");
+    if (!dense_vector_fits(ys, rows, FIX2INT(incy), &y_step))
+      rb_raise(rb_eArgError, "y must be a vector with m elements, incy apart");
+
+    nm_yale_storage_gemv(NM_STORAGE(a), transpose, pAlpha, dense_origin(xs, xs->elements), x_step, pBeta,
+                         dense_origin(ys, NM_DENSE_WRITABLE_ELEMENTS(y)), y_step);
+    return Qtrue;
+  }
+
+  return ttable[dtype](blas_transpose_sym(trans_a), FIX2INT(m), FIX2INT(n), pAlpha, NM_STORAGE_DENSE(a)->elements, FIX2INT(lda), NM_STORAGE_DENSE(x)->elements, FIX2INT(incx), pBeta, NM_DENSE_WRITABLE_ELEMENTS(y), FIX2INT(incy)) ? Qtrue : Qfalse;
 }
 
 
+/*
+ * Call any of the cblas_xtrsm functions as directly as possible, solving op(A)*X = alpha*B or X*op(A) = alpha*B in
+ * place in B, for a triangular A.
+ *
+ * A may also be a Yale matrix of any non-integer dtype (row-major, A on the left), in which case m and lda are ignored
+ * and only the uplo triangle of A is read. Its rows are grouped into levels which can be solved in parallel (see
+ * NMatrix::BLAS.num_threads); a transposed Yale matrix is solved on one thread.
+ */
 static VALUE nm_cblas_trsm(VALUE self,
                            VALUE order,
                            VALUE side, VALUE uplo,
@@ -828,7 +1110,17 @@ static VALUE nm_cblas_trsm(VALUE self,
     void *pAlpha = ALLOCA_N(char, DTYPE_SIZES[dtype]);
     rubyval_to_cval(alpha, dtype, pAlpha);
 
-    ttable[dtype](blas_order_sym(order), blas_side_sym(side), blas_uplo_sym(uplo), blas_transpose_sym(trans_a), blas_diag_sym(diag), FIX2INT(m), FIX2INT(n), pAlpha, NM_STORAGE_DENSE(a)->elements, FIX2INT(lda), NM_STORAGE_DENSE(b)->elements, FIX2INT(ldb));
+    // Yale matrices have their own substitution kernels, which take the shape from the matrix.
+    if (NM_STYPE(a) == nm::YALE_STORE) {
+      if (blas_order_sym(order) != CblasRowMajor || blas_side_sym(side) != CblasLeft)
+        rb_raise(rb_eNotImpError, "trsm on a Yale matrix is only supported in row-major order, with A on the left");
+
+      nm_yale_storage_trsm(NM_STORAGE(a), blas_uplo_sym(uplo) == CblasUpper, yale_transpose(dtype, blas_transpose_sym(trans_a)),
+                           blas_diag_sym(diag) == CblasUnit, FIX2INT(n), pAlpha, NM_DENSE_WRITABLE_ELEMENTS(b), FIX2INT(ldb));
+      return Qtrue;
+    }
+
+    ttable[dtype](blas_order_sym(order), blas_side_sym(side), blas_uplo_sym(uplo), blas_transpose_sym(trans_a), blas_diag_sym(diag), FIX2INT(m), FIX2INT(n), pAlpha, NM_STORAGE_DENSE(a)->elements, FIX2INT(lda), NM_DENSE_WRITABLE_ELEMENTS(b), FIX2INT(ldb));
   }
 
   return Qtrue;
@@ -868,7 +1160,17 @@ static VALUE nm_cblas_trmm(VALUE self,
     void *pAlpha = ALLOCA_N(char, DTYPE_SIZES[dtype]);
     rubyval_to_cval(alpha, dtype, pAlpha);
 
-    ttable[dtype](blas_order_sym(order), blas_side_sym(side), blas_uplo_sym(uplo), blas_transpose_sym(trans_a), blas_diag_sym(diag), FIX2INT(m), FIX2INT(n), pAlpha, NM_STORAGE_DENSE(a)->elements, FIX2INT(lda), NM_STORAGE_DENSE(b)->elements, FIX2INT(ldb));
+    // Yale matrices have their own product kernel, which takes the shape from the matrix.
+    if (NM_STYPE(a) == nm::YALE_STORE) {
+      if (blas_order_sym(order) != CblasRowMajor || blas_side_sym(side) != CblasLeft)
+        rb_raise(rb_eNotImpError, "trmm on a Yale matrix is only supported in row-major order, with A on the left");
+
+      nm_yale_storage_trmm(NM_STORAGE(a), blas_uplo_sym(uplo) == CblasUpper, yale_transpose(dtype, blas_transpose_sym(trans_a)),
+                           blas_diag_sym(diag) == CblasUnit, FIX2INT(n), pAlpha, NM_DENSE_WRITABLE_ELEMENTS(b), FIX2INT(ldb));
+      return b;
+    }
+
+    ttable[dtype](blas_order_sym(order), blas_side_sym(side), blas_uplo_sym(uplo), blas_transpose_sym(trans_a), blas_diag_sym(diag), FIX2INT(m), FIX2INT(n), pAlpha, NM_STORAGE_DENSE(a)->elements, FIX2INT(lda), NM_DENSE_WRITABLE_ELEMENTS(b), FIX2INT(ldb));
   }
 
   return b;
@@ -908,7 +1210,7 @@ static VALUE nm_cblas_syrk(VALUE self,
     rubyval_to_cval(alpha, dtype, pAlpha);
     rubyval_to_cval(beta, dtype, pBeta);
 
-    ttable[dtype](blas_order_sym(order), blas_uplo_sym(uplo), blas_transpose_sym(trans), FIX2INT(n), FIX2INT(k), pAlpha, NM_STORAGE_DENSE(a)->elements, FIX2INT(lda), pBeta, NM_STORAGE_DENSE(c)->elements, FIX2INT(ldc));
+    ttable[dtype](blas_order_sym(order), blas_uplo_sym(uplo), blas_transpose_sym(trans), FIX2INT(n), FIX2INT(k), pAlpha, NM_STORAGE_DENSE(a)->elements, FIX2INT(lda), pBeta, NM_DENSE_WRITABLE_ELEMENTS(c), FIX2INT(ldc));
   }
 
   return Qtrue;
@@ -929,9 +1231,9 @@ static VALUE nm_cblas_herk(VALUE self,
   nm::dtype_t dtype = NM_DTYPE(a);
 
   if (dtype == nm::COMPLEX64) {
-    cblas_cherk(blas_order_sym(order), blas_uplo_sym(uplo), blas_transpose_sym(trans), FIX2INT(n), FIX2INT(k), NUM2DBL(alpha), NM_STORAGE_DENSE(a)->elements, FIX2INT(lda), NUM2DBL(beta), NM_STORAGE_DENSE(c)->elements, FIX2INT(ldc));
+    cblas_cherk(blas_order_sym(order), blas_uplo_sym(uplo), blas_transpose_sym(trans), FIX2INT(n), FIX2INT(k), NUM2DBL(alpha), NM_STORAGE_DENSE(a)->elements, FIX2INT(lda), NUM2DBL(beta), NM_DENSE_WRITABLE_ELEMENTS(c), FIX2INT(ldc));
   } else if (dtype == nm::COMPLEX128) {
-    cblas_zherk(blas_order_sym(order), blas_uplo_sym(uplo), blas_transpose_sym(trans), FIX2INT(n), FIX2INT(k), NUM2DBL(alpha), NM_STORAGE_DENSE(a)->elements, FIX2INT(lda), NUM2DBL(beta), NM_STORAGE_DENSE(c)->elements, FIX2INT(ldc));
+    cblas_zherk(blas_order_sym(order), blas_uplo_sym(uplo), blas_transpose_sym(trans), FIX2INT(n), FIX2INT(k), NUM2DBL(alpha), NM_STORAGE_DENSE(a)->elements, FIX2INT(lda), NUM2DBL(beta), NM_DENSE_WRITABLE_ELEMENTS(c), FIX2INT(ldc));
   } else
     rb_raise(rb_eNotImpError, "this matrix operation undefined for non-complex dtypes");
   return Qtrue;
@@ -991,8 +1293,8 @@ static VALUE nm_lapack_gesvd(VALUE self, VALUE jobu, VALUE jobvt, VALUE m, VALUE
     work_size       = NM_MAX((dtype == nm::COMPLEX64 || dtype == nm::COMPLEX128 ? 2 * min_mn + max_mn : NM_MAX(3*min_mn + max_mn, 5*min_mn)), work_size);
     void* work      = ALLOCA_N(char, DTYPE_SIZES[dtype] * work_size);
 
-    int info = gesvd_table[dtype](JOBU, JOBVT, M, N, NM_STORAGE_DENSE(a)->elements, FIX2INT(lda),
-      NM_STORAGE_DENSE(s)->elements, NM_STORAGE_DENSE(u)->elements, FIX2INT(ldu), NM_STORAGE_DENSE(vt)->elements, FIX2INT(ldvt),
+    int info = gesvd_table[dtype](JOBU, JOBVT, M, N, NM_DENSE_WRITABLE_ELEMENTS(a), FIX2INT(lda),
+      NM_DENSE_WRITABLE_ELEMENTS(s), NM_DENSE_WRITABLE_ELEMENTS(u), FIX2INT(ldu), NM_DENSE_WRITABLE_ELEMENTS(vt), FIX2INT(ldvt),
       work, work_size, rwork);
     return INT2FIX(info);
   }
@@ -1059,8 +1361,8 @@ static VALUE nm_lapack_gesdd(VALUE self, VALUE jobz, VALUE m, VALUE n, VALUE a,
     void* work  = ALLOCA_N(char, DTYPE_SIZES[dtype] * work_size);
     int* iwork  = ALLOCA_N(int, 8*min_mn);
 
-    int info = gesdd_table[dtype](JOBZ, M, N, NM_STORAGE_DENSE(a)->elements, FIX2INT(lda),
-      NM_STORAGE_DENSE(s)->elements, NM_STORAGE_DENSE(u)->elements, FIX2INT(ldu), NM_STORAGE_DENSE(vt)->elements, FIX2INT(ldvt),
+    int info = gesdd_table[dtype](JOBZ, M, N, NM_DENSE_WRITABLE_ELEMENTS(a), FIX2INT(lda),
+      NM_DENSE_WRITABLE_ELEMENTS(s), NM_DENSE_WRITABLE_ELEMENTS(u), FIX2INT(ldu), NM_DENSE_WRITABLE_ELEMENTS(vt), FIX2INT(ldvt),
       work, work_size, iwork, rwork);
     return INT2FIX(info);
   }
@@ -1106,11 +1408,11 @@ static VALUE nm_lapack_geev(VALUE self, VALUE compute_left, VALUE compute_right,
     char JOBVL = lapack_evd_job_sym(compute_left),
          JOBVR = lapack_evd_job_sym(compute_right);
 
-    void* A  = NM_STORAGE_DENSE(a)->elements;
-    void* WR = NM_STORAGE_DENSE(w)->elements;
-    void* WI = wi == Qnil ? NULL : NM_STORAGE_DENSE(wi)->elements;
-    void* VL = NM_STORAGE_DENSE(vl)->elements;
-    void* VR = NM_STORAGE_DENSE(vr)->elements;
+    void* A  = NM_DENSE_WRITABLE_ELEMENTS(a);
+    void* WR = NM_DENSE_WRITABLE_ELEMENTS(w);
+    void* WI = wi == Qnil ? NULL : NM_DENSE_WRITABLE_ELEMENTS(wi);
+    void* VL = NM_DENSE_WRITABLE_ELEMENTS(vl);
+    void* VR = NM_DENSE_WRITABLE_ELEMENTS(vr);
 
     // only need rwork for complex matrices (wi == Qnil for complex)
     int rwork_size  = dtype == nm::COMPLEX64 || dtype == nm::COMPLEX128 ? N * DTYPE_SIZES[dtype] : 0; // 2*N*floattype for complex only, otherwise 0
@@ -1163,7 +1465,7 @@ static VALUE nm_clapack_scal(VALUE self, VALUE n, VALUE scale, VALUE vector, VAL
 
   NAMED_DTYPE_TEMPLATE_TABLE(ttable, nm::math::clapack_scal, void, const int n, const void* da, void* dx, const int incx);
 
-  ttable[dtype](FIX2INT(n), da, NM_STORAGE_DENSE(vector)->elements, FIX2INT(incx));
+  ttable[dtype](FIX2INT(n), da, NM_DENSE_WRITABLE_ELEMENTS(vector), FIX2INT(incx));
 
   return vector;
 }
@@ -1198,7 +1500,7 @@ static VALUE nm_clapack_lauum(VALUE self, VALUE order, VALUE uplo, VALUE n, VALU
     rb_raise(rb_eNotImpError, "does not yet work for non-BLAS dtypes (needs herk, syrk, trmm)");
   } else {
     // Call either our version of lauum or the LAPACK version.
-    ttable[NM_DTYPE(a)](blas_order_sym(order), blas_uplo_sym(uplo), FIX2INT(n), NM_STORAGE_DENSE(a)->elements, FIX2INT(lda));
+    ttable[NM_DTYPE(a)](blas_order_sym(order), blas_uplo_sym(uplo), FIX2INT(n), NM_DENSE_WRITABLE_ELEMENTS(a), FIX2INT(lda));
   }
 
   return a;
@@ -1257,7 +1559,7 @@ static VALUE nm_clapack_getrf(VALUE self, VALUE order, VALUE m, VALUE n, VALUE a
     rb_raise(nm_eDataTypeError, "this matrix operation undefined for integer matrices");
   } else {
     // Call either our version of getrf or the LAPACK version.
-    ttable[NM_DTYPE(a)](blas_order_sym(order), M, N, NM_STORAGE_DENSE(a)->elements, FIX2INT(lda), ipiv);
+    ttable[NM_DTYPE(a)](blas_order_sym(order), M, N, NM_DENSE_WRITABLE_ELEMENTS(a), FIX2INT(lda), ipiv);
   }
 
   // Result will be stored in a. We return ipiv as an array.
@@ -1308,7 +1610,7 @@ static VALUE nm_clapack_potrf(VALUE self, VALUE order, VALUE uplo, VALUE n, VALU
     //rb_raise(nm_eDataTypeError, "this matrix operation undefined for integer matrices");
   } else {
     // Call either our version of potrf or the LAPACK version.
-    ttable[NM_DTYPE(a)](blas_order_sym(order), blas_uplo_sym(uplo), FIX2INT(n), NM_STORAGE_DENSE(a)->elements, FIX2INT(lda));
+    ttable[NM_DTYPE(a)](blas_order_sym(order), blas_uplo_sym(uplo), FIX2INT(n), NM_DENSE_WRITABLE_ELEMENTS(a), FIX2INT(lda));
   }
 
   return a;
@@ -1355,7 +1657,7 @@ static VALUE nm_clapack_getrs(VALUE self, VALUE order, VALUE trans, VALUE n, VAL
 
     // Call either our version of getrs or the LAPACK version.
     ttable[NM_DTYPE(a)](blas_order_sym(order), blas_transpose_sym(trans), FIX2INT(n), FIX2INT(nrhs), NM_STORAGE_DENSE(a)->elements, FIX2INT(lda),
-                        ipiv_, NM_STORAGE_DENSE(b)->elements, FIX2INT(ldb));
+                        ipiv_, NM_DENSE_WRITABLE_ELEMENTS(b), FIX2INT(ldb));
   }
 
   // b is both returned and modified directly in the argument list.
@@ -1391,7 +1693,7 @@ static VALUE nm_clapack_potrs(VALUE self, VALUE order, VALUE uplo, VALUE n, VALU
 
     // Call either our version of potrs or the LAPACK version.
     ttable[NM_DTYPE(a)](blas_order_sym(order), blas_uplo_sym(uplo), FIX2INT(n), FIX2INT(nrhs), NM_STORAGE_DENSE(a)->elements, FIX2INT(lda),
-                        NM_STORAGE_DENSE(b)->elements, FIX2INT(ldb));
+                        NM_DENSE_WRITABLE_ELEMENTS(b), FIX2INT(ldb));
   }
 
   // b is both returned and modified directly in the argument list.
@@ -1449,7 +1751,7 @@ static VALUE nm_clapack_getri(VALUE self, VALUE order, VALUE n, VALUE a, VALUE l
     //rb_raise(nm_eDataTypeError, "this matrix operation undefined for integer matrices");
   } else {
     // Call either our version of getri or the LAPACK version.
-    ttable[NM_DTYPE(a)](blas_order_sym(order), FIX2INT(n), NM_STORAGE_DENSE(a)->elements, FIX2INT(lda), ipiv_);
+    ttable[NM_DTYPE(a)](blas_order_sym(order), FIX2INT(n), NM_DENSE_WRITABLE_ELEMENTS(a), FIX2INT(lda), ipiv_);
   }
 
   return a;
@@ -1494,7 +1796,7 @@ static VALUE nm_clapack_potri(VALUE self, VALUE order, VALUE uplo, VALUE n, VALU
     //rb_raise(nm_eDataTypeError, "this matrix operation undefined for integer matrices");
   } else {
     // Call either our version of getri or the LAPACK version.
-    ttable[NM_DTYPE(a)](blas_order_sym(order), blas_uplo_sym(uplo), FIX2INT(n), NM_STORAGE_DENSE(a)->elements, FIX2INT(lda));
+    ttable[NM_DTYPE(a)](blas_order_sym(order), blas_uplo_sym(uplo), FIX2INT(n), NM_DENSE_WRITABLE_ELEMENTS(a), FIX2INT(lda));
   }
 
   return a;
@@ -1541,13 +1843,152 @@ static VALUE nm_clapack_laswp(VALUE self, VALUE n, VALUE a, VALUE lda, VALUE k1,
   }
 
   // Call either our version of laswp or the LAPACK version.
-  ttable[NM_DTYPE(a)](FIX2INT(n), NM_STORAGE_DENSE(a)->elements, FIX2INT(lda), FIX2INT(k1), FIX2INT(k2), ipiv_, FIX2INT(incx));
+  ttable[NM_DTYPE(a)](FIX2INT(n), NM_DENSE_WRITABLE_ELEMENTS(a), FIX2INT(lda), FIX2INT(k1), FIX2INT(k2), ipiv_, FIX2INT(incx));
 
   // a is both returned and modified directly in the argument list.
   return a;
 }
 
 
+/*
+ * call-seq:
+ *     NMatrix::BLAS.num_threads -> Integer
+ *
+ * Number of threads used by the native (non-ATLAS) matrix-matrix and matrix-vector products, which handle the integer,
+ * rational, and Ruby object dtypes. Defaults to the number of online processors. Small products always run on a single
+ * thread, as do products of Ruby objects.
+ */
+static VALUE nm_blas_num_threads(VALUE self) {
+  return SIZET2NUM(nm_math_num_threads());
+}
+
+/*
+ * call-seq:
+ *     NMatrix::BLAS.num_threads = n -> Integer
+ *
+ * Set the number of threads used by the native matrix products. 1 turns threading off.
+ */
+static VALUE nm_blas_set_num_threads(VALUE self, VALUE n) {
+  long threads = NUM2LONG(n);
+  if (threads < 1) rb_raise(rb_eArgError, "expected a positive number of threads");
+
+  nm_math_set_num_threads(threads);
+  return n;
+}
+
+
+size_t nm_math_num_threads(void) {
+  if (!math_num_threads) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    math_num_threads = cpus > 0 ? cpus : 1;
+  }
+  return math_num_threads;
+}
+
+
+void nm_math_set_num_threads(size_t n) {
+  math_num_threads = n;
+}
+
+
+/*
+ * call-seq:
+ *     NMatrix::BLAS.strassen_cutoff -> Integer
+ *
+ * Dense integer and rational products whose dimensions are all at least this large use Strassen-Winograd, which does
+ * 7/8 of the multiplications of the classical algorithm at each level of recursion, until a dimension falls below it.
+ * The results are the same either way. 0 means never. Defaults to 512.
+ */
+static VALUE nm_blas_strassen_cutoff(VALUE self) {
+  return SIZET2NUM(nm_math_strassen_cutoff());
+}
+
+/*
+ * call-seq:
+ *     NMatrix::BLAS.strassen_cutoff = n -> Integer
+ *
+ * Set the smallest dimension for which Strassen-Winograd is used. 0 turns it off.
+ */
+static VALUE nm_blas_set_strassen_cutoff(VALUE self, VALUE n) {
+  long cutoff = NUM2LONG(n);
+  if (cutoff < 0) rb_raise(rb_eArgError, "expected a non-negative cutoff");
+
+  nm_math_set_strassen_cutoff(cutoff);
+  return n;
+}
+
+
+size_t nm_math_strassen_cutoff(void) {
+  return math_strassen_cutoff;
+}
+
+
+void nm_math_set_strassen_cutoff(size_t n) {
+  math_strassen_cutoff = n;
+}
+
+
+/*
+ * One thread's share of an nm_math_parallel_for.
+ */
+struct parallel_chunk {
+  nm_parallel_func fn;
+  void*            arg;
+  int              begin, end;
+};
+
+static void* parallel_chunk_run(void* chunk_) {
+  parallel_chunk* chunk = reinterpret_cast<parallel_chunk*>(chunk_);
+  chunk->fn(chunk->arg, chunk->begin, chunk->end);
+  return NULL;
+}
+
+
+/*
+ * Split [0, n) into up to nm_math_num_threads() contiguous pieces (each a multiple of grain, except the last) and call
+ * fn on each, in parallel. The calling thread does the first piece itself. If a thread can't be started, its piece is
+ * run on the calling thread instead, so this always finishes the whole range.
+ */
+void nm_math_parallel_for(int n, int grain, nm_parallel_func fn, void* arg) {
+  size_t nthreads = nm_math_num_threads();
+  int    pieces   = (n + grain - 1) / grain;
+  if ((size_t)(pieces) < nthreads) nthreads = pieces;
+
+  if (nthreads <= 1) {
+    fn(arg, 0, n);
+    return;
+  }
+
+  int size = (pieces + nthreads - 1) / nthreads * grain;
+
+  parallel_chunk* chunks = ALLOCA_N(parallel_chunk, nthreads);
+  for (size_t t = 0; t < nthreads; ++t) {
+    chunks[t].fn    = fn;
+    chunks[t].arg   = arg;
+    chunks[t].begin = std::min(n, (int)(t) * size);
+    chunks[t].end   = std::min(n, (int)(t+1) * size);
+  }
+
+#ifdef HAVE_PTHREAD_H
+  pthread_t* threads = ALLOCA_N(pthread_t, nthreads);
+  bool*      started = ALLOCA_N(bool, nthreads);
+
+  for (size_t t = 1; t < nthreads; ++t)
+    started[t] = pthread_create(&threads[t], NULL, parallel_chunk_run, &chunks[t]) == 0;
+
+  parallel_chunk_run(&chunks[0]);
+
+  for (size_t t = 1; t < nthreads; ++t) {
+    if (started[t]) pthread_join(threads[t], NULL);
+    else            parallel_chunk_run(&chunks[t]);
+  }
+#else
+  for (size_t t = 0; t < nthreads; ++t)
+    parallel_chunk_run(&chunks[t]);
+#endif
+}
+
+
 /*
  * C accessor for calculating an exact determinant.
  */
@@ -1558,6 +1999,65 @@ void nm_math_det_exact(const int M, const void* elements, const int lda, nm::dty
 }
 
 
+/*
+ * C accessor for scaling a vector, in place, by a scalar of the same dtype.
+ */
+void nm_math_scal(const int n, const void* scalar, void* x, const int incx, nm::dtype_t dtype) {
+  NAMED_DTYPE_TEMPLATE_TABLE(ttable, nm::math::clapack_scal, void, const int, const void*, void*, const int);
+
+  ttable[dtype](n, scalar, x, incx);
+}
+
+
+/*
+ * C accessors for the batched operations on small matrices. Problem b of a batch starts b*stride elements into each
+ * array. The inverse and solve return the index of the first singular matrix in the batch, or -1 if there are none.
+ */
+void nm_math_batch_gemm(const int batch, const int M, const int N, const int K, const void* A, const size_t strideA, const int lda,
+                        const void* B, const size_t strideB, const int ldb, void* C, const size_t strideC, const int ldc, nm::dtype_t dtype)
+{
+  NAMED_DTYPE_TEMPLATE_TABLE(ttable, nm::math::batch_gemm, void, const int, const int, const int, const int, const void*, const size_t, const int,
+                             const void*, const size_t, const int, void*, const size_t, const int);
+
+  ttable[dtype](batch, M, N, K, A, strideA, lda, B, strideB, ldb, C, strideC, ldc);
+}
+
+int nm_math_batch_inverse(const int batch, const int N, const void* A, const size_t strideA, const int lda, void* C,
+                          const size_t strideC, const int ldc, nm::dtype_t dtype)
+{
+  NAMED_DTYPE_TEMPLATE_TABLE(ttable, nm::math::batch_inverse, int, const int, const int, const void*, const size_t, const int, void*,
+                             const size_t, const int);
+
+  return ttable[dtype](batch, N, A, strideA, lda, C, strideC, ldc);
+}
+
+int nm_math_batch_solve(const int batch, const int N, const int NRHS, const void* A, const size_t strideA, const int lda,
+                        const void* B, const size_t strideB, const int ldb, void* X, const size_t strideX, const int ldx, nm::dtype_t dtype)
+{
+  NAMED_DTYPE_TEMPLATE_TABLE(ttable, nm::math::batch_solve, int, const int, const int, const int, const void*, const size_t, const int,
+                             const void*, const size_t, const int, void*, const size_t, const int);
+
+  return ttable[dtype](batch, N, NRHS, A, strideA, lda, B, strideB, ldb, X, strideX, ldx);
+}
+
+int nm_math_krylov(const STORAGE* a, nm::stype_t stype, int method, int preconditioner, const void* b, void* x,
+                   double tol, int max_iter, int restart, double* history, nm::dtype_t dtype)
+{
+  static int (*ttable[nm::NUM_DTYPES])(const STORAGE*, const nm::stype_t, const int, const int, const void*, void*,
+                                        const double, const int, const int, double*) = {
+    NULL, NULL, NULL, NULL, NULL, // no iterative solves in integers
+    nm::math::krylov<float>,
+    nm::math::krylov<double>,
+    NULL, NULL, NULL, NULL, NULL, NULL
+  };
+
+  if (!ttable[dtype])
+    rb_raise(nm_eDataTypeError, "iterative solvers are only defined for float32 and float64 matrices");
+
+  return ttable[dtype](a, stype, method, preconditioner, b, x, tol, max_iter, restart, history);
+}
+
+
 /*
  * Transpose an array of elements that represent a row-major dense matrix. Does not allocate anything, only does an memcpy.
  */
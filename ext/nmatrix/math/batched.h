@@ -0,0 +1,317 @@
+/////////////////////////////////////////////////////////////////////
+// = NMatrix
+//
+// A linear algebra library for scientific computation in Ruby.
+// NMatrix is part of SciRuby.
+//
+// NMatrix was originally inspired by and derived from NArray, by
+// Masahiro Tanaka: http://narray.rubyforge.org
+//
+// == Copyright Information
+//
+// SciRuby is Copyright (c) 2010 - 2013, Ruby Science Foundation
+// NMatrix is Copyright (c) 2013, Ruby Science Foundation
+//
+// Please see LICENSE.txt for additional copyright notices.
+//
+// == Contributing
+//
+// By contributing source code to SciRuby, you agree to be bound by
+// our Contributor Agreement:
+//
+// * https://github.com/SciRuby/sciruby/wiki/Contributor-Agreement
+//
+// == batched.h
+//
+// Multiplication, inversion and linear solves for batches of small
+// matrices (the layers of a 3-dimensional dense matrix) in a single
+// call, with fixed-size versions for square matrices up to 16 x 16.
+//
+
+#ifndef BATCHED_H
+#define BATCHED_H
+
+/*
+ * Largest square size with its own unrolled kernels. Anything bigger (or, for multiplication, non-square) uses
+ * kernels whose sizes are only known at run time.
+ */
+#define NM_BATCH_MAX_FIXED 16
+
+namespace nm { namespace math {
+
+/*
+ * Kernels for one problem of a batch. Each has template size parameters which, when non-zero, replace the run-time
+ * size arguments, so that the fixed-size instantiations have constant loop bounds the compiler can fully unroll. All
+ * matrices are row-major.
+ */
+
+/*
+ * C = A * B, where A is M x K and B is K x N.
+ */
+template <int FM, int FN, int FK, typename DType>
+inline void batch_gemm_one(const int m, const int n, const int k, const DType* A, const int lda, const DType* B,
+                           const int ldb, DType* C, const int ldc)
+{
+  const int M = FM ? FM : m, N = FN ? FN : n, K = FK ? FK : k;
+
+  for (int i = 0; i < M; ++i) {
+    for (int j = 0; j < N; ++j) {
+      typename LongDType<DType>::type temp = 0;
+      for (int l = 0; l < K; ++l) {
+        temp += A[i*lda+l] * B[l*ldb+j];
+      }
+      C[i*ldc+j] = temp;
+    }
+  }
+}
+
+
+/*
+ * Invert the N x N matrix C in place, by Gauss-Jordan elimination with partial pivoting. perm must have room for N
+ * ints. Returns false if C is singular, in which case it is left partly eliminated.
+ */
+template <int FN, typename DType>
+inline bool batch_inverse_one(const int n, DType* C, const int ldc, int* perm) {
+  const int N = FN ? FN : n;
+  const DType one = 1;
+
+  for (int k = 0; k < N; ++k) {
+    // Choose the pivot with the largest magnitude in column k.
+    int p = k;
+    for (int i = k+1; i < N; ++i) {
+      if (std::abs(C[i*ldc+k]) > std::abs(C[p*ldc+k])) p = i;
+    }
+
+    if (C[p*ldc+k] == 0) return false;
+
+    perm[k] = p;
+    if (p != k) {
+      for (int j = 0; j < N; ++j) std::swap(C[k*ldc+j], C[p*ldc+j]);
+    }
+
+    DType pivinv = one / C[k*ldc+k];
+    C[k*ldc+k] = one;
+    for (int j = 0; j < N; ++j) C[k*ldc+j] *= pivinv;
+
+    for (int i = 0; i < N; ++i) {
+      if (i == k) continue;
+
+      DType factor = C[i*ldc+k];
+      C[i*ldc+k] = 0;
+      for (int j = 0; j < N; ++j) C[i*ldc+j] = C[i*ldc+j] - C[k*ldc+j] * factor;
+    }
+  }
+
+  // Swapping rows of the original is swapping columns of the inverse, in reverse order.
+  for (int k = N-1; k >= 0; --k) {
+    if (perm[k] != k) {
+      for (int i = 0; i < N; ++i) std::swap(C[i*ldc+k], C[i*ldc+perm[k]]);
+    }
+  }
+
+  return true;
+}
+
+
+/*
+ * Solve A * X = B for the N x NRHS matrix X, where A is N x N. X contains B on input. W is workspace for an N x N
+ * copy of A, which is LU-factored with partial pivoting. Returns false if A is singular.
+ */
+template <int FN, typename DType>
+inline bool batch_solve_one(const int n, const int nrhs, const DType* A, const int lda, DType* X, const int ldx, DType* W) {
+  const int N = FN ? FN : n;
+
+  for (int i = 0; i < N; ++i)
+    for (int j = 0; j < N; ++j)
+      W[i*N+j] = A[i*lda+j];
+
+  // Forward elimination, applying the same row operations to X.
+  for (int k = 0; k < N; ++k) {
+    int p = k;
+    for (int i = k+1; i < N; ++i) {
+      if (std::abs(W[i*N+k]) > std::abs(W[p*N+k])) p = i;
+    }
+
+    if (W[p*N+k] == 0) return false;
+
+    if (p != k) {
+      for (int j = k; j < N; ++j)    std::swap(W[k*N+j], W[p*N+j]);
+      for (int j = 0; j < nrhs; ++j) std::swap(X[k*ldx+j], X[p*ldx+j]);
+    }
+
+    for (int i = k+1; i < N; ++i) {
+      DType factor = W[i*N+k] / W[k*N+k];
+      for (int j = k+1; j < N; ++j)  W[i*N+j] = W[i*N+j] - W[k*N+j] * factor;
+      for (int j = 0; j < nrhs; ++j) X[i*ldx+j] = X[i*ldx+j] - X[k*ldx+j] * factor;
+    }
+  }
+
+  // Back substitution.
+  for (int k = N-1; k >= 0; --k) {
+    for (int j = 0; j < nrhs; ++j) {
+      DType temp = X[k*ldx+j];
+      for (int l = k+1; l < N; ++l) temp = temp - W[k*N+l] * X[l*ldx+j];
+      X[k*ldx+j] = temp / W[k*N+k];
+    }
+  }
+
+  return true;
+}
+
+
+/*
+ * One batched operation, split by batch index across threads with nm_math_parallel_for. Problem b of the batch starts
+ * at A + b*strideA (and likewise for B and C); within a problem, rows are lda (ldb, ldc) elements apart.
+ */
+template <typename DType>
+struct BatchTask {
+  int m, n, k;  // For solves, n x n systems with k right-hand sides.
+  const DType* A; size_t strideA; int lda;
+  const DType* B; size_t strideB; int ldb;
+  DType* C;       size_t strideC; int ldc;
+
+  int failed;   // Lowest batch index found to be singular, or -1.
+  bool nomem;   // Whether a thread couldn't allocate its workspace.
+};
+
+/*
+ * Record that problem b of a batch is singular, keeping the lowest such index when several threads find one.
+ */
+template <typename DType>
+inline void batch_task_fail(BatchTask<DType>* task, int b) {
+  int seen = __atomic_load_n(&task->failed, __ATOMIC_RELAXED);
+  while ((seen == -1 || b < seen) &&
+         !__atomic_compare_exchange_n(&task->failed, &seen, b, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+
+template <int FM, int FN, int FK, typename DType>
+inline void batch_gemm_range(BatchTask<DType>* t, int begin, int end) {
+  for (int b = begin; b < end; ++b)
+    batch_gemm_one<FM,FN,FK,DType>(t->m, t->n, t->k, t->A + b*t->strideA, t->lda, t->B + b*t->strideB, t->ldb,
+                                   t->C + b*t->strideC, t->ldc);
+}
+
+template <int FN, typename DType>
+inline void batch_inverse_range(BatchTask<DType>* t, int begin, int end) {
+  const int N = FN ? FN : t->n;
+
+  int  fixed_perm[FN ? FN : 1];
+  int* perm = FN ? fixed_perm : reinterpret_cast<int*>(std::malloc(sizeof(int) * N));
+  if (!perm) {
+    t->nomem = true;
+    return;
+  }
+
+  for (int b = begin; b < end; ++b) {
+    const DType* A = t->A + b*t->strideA;
+    DType*       C = t->C + b*t->strideC;
+
+    for (int i = 0; i < N; ++i)
+      for (int j = 0; j < N; ++j)
+        C[i*t->ldc+j] = A[i*t->lda+j];
+
+    if (!batch_inverse_one<FN,DType>(N, C, t->ldc, perm)) batch_task_fail(t, b);
+  }
+
+  if (!FN) std::free(perm);
+}
+
+template <int FN, typename DType>
+inline void batch_solve_range(BatchTask<DType>* t, int begin, int end) {
+  const int N = FN ? FN : t->n;
+
+  DType  fixed_work[FN ? FN*FN : 1];
+  DType* work = FN ? fixed_work : reinterpret_cast<DType*>(std::malloc(sizeof(DType) * N * N));
+  if (!work) {
+    t->nomem = true;
+    return;
+  }
+
+  for (int b = begin; b < end; ++b) {
+    const DType* B = t->B + b*t->strideB;
+    DType*       X = t->C + b*t->strideC;
+
+    for (int i = 0; i < N; ++i)
+      for (int j = 0; j < t->k; ++j)
+        X[i*t->ldc+j] = B[i*t->ldb+j];
+
+    if (!batch_solve_one<FN,DType>(N, t->k, t->A + b*t->strideA, t->lda, X, t->ldc, work)) batch_task_fail(t, b);
+  }
+
+  if (!FN) std::free(work);
+}
+
+
+#define NM_BATCH_FIXED_CASES(RANGE) \
+  case 2:  RANGE<2,  DType>(t, begin, end); break; \
+  case 3:  RANGE<3,  DType>(t, begin, end); break; \
+  case 4:  RANGE<4,  DType>(t, begin, end); break; \
+  case 5:  RANGE<5,  DType>(t, begin, end); break; \
+  case 6:  RANGE<6,  DType>(t, begin, end); break; \
+  case 7:  RANGE<7,  DType>(t, begin, end); break; \
+  case 8:  RANGE<8,  DType>(t, begin, end); break; \
+  case 9:  RANGE<9,  DType>(t, begin, end); break; \
+  case 10: RANGE<10, DType>(t, begin, end); break; \
+  case 11: RANGE<11, DType>(t, begin, end); break; \
+  case 12: RANGE<12, DType>(t, begin, end); break; \
+  case 13: RANGE<13, DType>(t, begin, end); break; \
+  case 14: RANGE<14, DType>(t, begin, end); break; \
+  case 15: RANGE<15, DType>(t, begin, end); break; \
+  case 16: RANGE<16, DType>(t, begin, end); break;
+
+/*
+ * nm_parallel_func entry points, which pick the kernel for the problem size.
+ */
+template <typename DType>
+void batch_gemm_task_run(void* arg, int begin, int end) {
+  BatchTask<DType>* t = reinterpret_cast<BatchTask<DType>*>(arg);
+
+  if (t->m == t->n && t->n == t->k) {
+    switch (t->n) {
+      case 2:  batch_gemm_range<2,  2,  2,  DType>(t, begin, end); return;
+      case 3:  batch_gemm_range<3,  3,  3,  DType>(t, begin, end); return;
+      case 4:  batch_gemm_range<4,  4,  4,  DType>(t, begin, end); return;
+      case 5:  batch_gemm_range<5,  5,  5,  DType>(t, begin, end); return;
+      case 6:  batch_gemm_range<6,  6,  6,  DType>(t, begin, end); return;
+      case 7:  batch_gemm_range<7,  7,  7,  DType>(t, begin, end); return;
+      case 8:  batch_gemm_range<8,  8,  8,  DType>(t, begin, end); return;
+      case 9:  batch_gemm_range<9,  9,  9,  DType>(t, begin, end); return;
+      case 10: batch_gemm_range<10, 10, 10, DType>(t, begin, end); return;
+      case 11: batch_gemm_range<11, 11, 11, DType>(t, begin, end); return;
+      case 12: batch_gemm_range<12, 12, 12, DType>(t, begin, end); return;
+      case 13: batch_gemm_range<13, 13, 13, DType>(t, begin, end); return;
+      case 14: batch_gemm_range<14, 14, 14, DType>(t, begin, end); return;
+      case 15: batch_gemm_range<15, 15, 15, DType>(t, begin, end); return;
+      case 16: batch_gemm_range<16, 16, 16, DType>(t, begin, end); return;
+    }
+  }
+
+  batch_gemm_range<0,0,0,DType>(t, begin, end);
+}
+
+template <typename DType>
+void batch_inverse_task_run(void* arg, int begin, int end) {
+  BatchTask<DType>* t = reinterpret_cast<BatchTask<DType>*>(arg);
+
+  switch (t->n) {
+    NM_BATCH_FIXED_CASES(batch_inverse_range)
+    default: batch_inverse_range<0, DType>(t, begin, end);
+  }
+}
+
+template <typename DType>
+void batch_solve_task_run(void* arg, int begin, int end) {
+  BatchTask<DType>* t = reinterpret_cast<BatchTask<DType>*>(arg);
+
+  switch (t->n) {
+    NM_BATCH_FIXED_CASES(batch_solve_range)
+    default: batch_solve_range<0, DType>(t, begin, end);
+  }
+}
+
+#undef NM_BATCH_FIXED_CASES
+
+}} // end of namespace nm::math
+
+#endif // BATCHED_H
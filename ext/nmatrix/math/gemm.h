@@ -36,10 +36,254 @@ extern "C" { // These need to be in an extern "C" block or you'll get all kinds
 
 
 namespace nm { namespace math {
+
+/*
+ * Blocking parameters for the native (non-BLAS) gemm, in the style of Goto and BLIS: a KC x NC panel of B and an
+ * MC x KC block of A are packed so that an MR x NR micro-kernel can stream through both contiguously. KC x NR of B and
+ * MC x KC of A should fit in L1 and L2 respectively for the smaller dtypes.
+ */
+template <typename DType>
+struct GemmBlocking {
+  static const int MR = 4;
+  static const int NR = 4;
+  static const int KC = 256;
+  static const int MC = 128;
+  static const int NC = 2048;
+};
+
+/*
+ * Below this many multiply-adds, packing costs more than it saves and gemm_nothrow uses the plain loops.
+ */
+#define NM_GEMM_BLOCKED_MIN_FLOPS (48*48*48)
+
+template <typename DType>
+inline bool gemm_use_blocked(const int M, const int N, const int K) {
+  return (double)(M) * N * K >= NM_GEMM_BLOCKED_MIN_FLOPS;
+}
+
+/*
+ * Ruby objects have nothing to gain from cache blocking, and keeping them only in packed heap buffers would hide them
+ * from the garbage collector.
+ */
+template <>
+inline bool gemm_use_blocked<RubyObject>(const int M, const int N, const int K) {
+  return false;
+}
+
+
+/*
+ * Pack an mc x kc block of op(A), starting at (i0, l0), into MR-row panels: Ap[panel][l][i]. Rows past mc are padded
+ * with zeros so the micro-kernel never needs a bounds check.
+ */
+template <typename DType>
+inline void gemm_pack_a(const enum CBLAS_TRANSPOSE TransA, const int mc, const int kc, const DType* A, const int lda,
+                        const int i0, const int l0, DType* Ap) {
+  const int MR = GemmBlocking<DType>::MR;
+
+  for (int ir = 0; ir < mc; ir += MR) {
+    for (int l = 0; l < kc; ++l) {
+      for (int i = 0; i < MR; ++i) {
+        if (ir + i >= mc)                 *Ap = 0;
+        else if (TransA == CblasNoTrans)  *Ap = A[(i0+ir+i) + (l0+l)*lda];
+        else                              *Ap = A[(l0+l) + (i0+ir+i)*lda];
+        ++Ap;
+      }
+    }
+  }
+}
+
+
+/*
+ * Pack a kc x nc panel of op(B), starting at (l0, j0), into NR-column slivers: Bp[sliver][l][j], zero-padded.
+ */
+template <typename DType>
+inline void gemm_pack_b(const enum CBLAS_TRANSPOSE TransB, const int kc, const int nc, const DType* B, const int ldb,
+                        const int l0, const int j0, DType* Bp) {
+  const int NR = GemmBlocking<DType>::NR;
+
+  for (int jr = 0; jr < nc; jr += NR) {
+    for (int l = 0; l < kc; ++l) {
+      for (int j = 0; j < NR; ++j) {
+        if (jr + j >= nc)                 *Bp = 0;
+        else if (TransB == CblasNoTrans)  *Bp = B[(l0+l) + (j0+jr+j)*ldb];
+        else                              *Bp = B[(j0+jr+j) + (l0+l)*ldb];
+        ++Bp;
+      }
+    }
+  }
+}
+
+
+/*
+ * MR x NR micro-kernel: C[0..mr, 0..nr] += alpha * Ap * Bp, accumulating in the long version of DType. mr and nr are
+ * the parts of the tile which actually lie inside C.
+ */
+template <typename DType>
+inline void gemm_micro_kernel(const int kc, const DType* alpha, const DType* Ap, const DType* Bp, DType* C, const int ldc,
+                              const int mr, const int nr) {
+  const int MR = GemmBlocking<DType>::MR,
+            NR = GemmBlocking<DType>::NR;
+
+  typename LongDType<DType>::type ab[GemmBlocking<DType>::MR * GemmBlocking<DType>::NR];
+
+  for (int k = 0; k < MR*NR; ++k) ab[k] = 0;
+
+  for (int l = 0; l < kc; ++l) {
+    for (int j = 0; j < NR; ++j) {
+      const DType b = Bp[j];
+      for (int i = 0; i < MR; ++i)
+        ab[i+j*MR] += Ap[i] * b;
+    }
+    Ap += MR;
+    Bp += NR;
+  }
+
+  for (int j = 0; j < nr; ++j)
+    for (int i = 0; i < mr; ++i)
+      C[i+j*ldc] += *alpha * ab[i+j*MR];
+}
+
+
+/*
+ * Multiply a packed mc x kc block of A by a packed kc x nc panel of B into C (which points at the block's first element).
+ */
+template <typename DType>
+inline void gemm_macro_kernel(const int mc, const int nc, const int kc, const DType* alpha, const DType* Ap, const DType* Bp,
+                              DType* C, const int ldc) {
+  const int MR = GemmBlocking<DType>::MR,
+            NR = GemmBlocking<DType>::NR;
+
+  for (int jr = 0; jr < nc; jr += NR) {
+    for (int ir = 0; ir < mc; ir += MR) {
+      gemm_micro_kernel<DType>(kc, alpha, Ap + ir*kc, Bp + jr*kc, C + ir + jr*ldc, ldc,
+                               std::min(MR, mc - ir), std::min(NR, nc - jr));
+    }
+  }
+}
+
+
+/*
+ * Plain column-major C += alpha*op(A)*op(B), restricted to rows [i0, i1) and columns [j0, j1) of C, for when
+ * gemm_blocked_range can't get its packing buffers.
+ */
+template <typename DType>
+inline void gemm_unblocked_range(const enum CBLAS_TRANSPOSE TransA, const enum CBLAS_TRANSPOSE TransB, const int i0, const int i1,
+                                 const int j0, const int j1, const int K, const DType* alpha, const DType* A, const int lda,
+                                 const DType* B, const int ldb, DType* C, const int ldc)
+{
+  for (int j = j0; j < j1; ++j) {
+    for (int i = i0; i < i1; ++i) {
+      typename LongDType<DType>::type temp = 0;
+
+      for (int l = 0; l < K; ++l)
+        temp += (TransA == CblasNoTrans ? A[i+l*lda] : A[l+i*lda]) * (TransB == CblasNoTrans ? B[l+j*ldb] : B[j+l*ldb]);
+
+      C[i+j*ldc] += *alpha * temp;
+    }
+  }
+}
+
+
+/*
+ * Cache-blocked column-major C += alpha*op(A)*op(B), restricted to rows [i0, i1) and columns [j0, j1) of C. Packing
+ * buffers come from malloc rather than ALLOC, so this never calls into Ruby and can run on any thread; if they can't be
+ * allocated, the range is done by gemm_unblocked_range instead.
+ */
+template <typename DType>
+inline void gemm_blocked_range(const enum CBLAS_TRANSPOSE TransA, const enum CBLAS_TRANSPOSE TransB, const int i0, const int i1,
+                               const int j0, const int j1, const int K, const DType* alpha, const DType* A, const int lda,
+                               const DType* B, const int ldb, DType* C, const int ldc)
+{
+  const int MR = GemmBlocking<DType>::MR, NR = GemmBlocking<DType>::NR,
+            MC = GemmBlocking<DType>::MC, NC = GemmBlocking<DType>::NC, KC = GemmBlocking<DType>::KC;
+
+  const int nc_max = std::min(NC, (j1 - j0 + NR - 1) / NR * NR),
+            mc_max = std::min(MC, (i1 - i0 + MR - 1) / MR * MR),
+            kc_max = std::min(KC, K);
+
+  DType* Ap = reinterpret_cast<DType*>(std::malloc(sizeof(DType) * mc_max * kc_max));
+  DType* Bp = reinterpret_cast<DType*>(std::malloc(sizeof(DType) * nc_max * kc_max));
+
+  if (!Ap || !Bp) {
+    std::free(Ap);
+    std::free(Bp);
+    gemm_unblocked_range<DType>(TransA, TransB, i0, i1, j0, j1, K, alpha, A, lda, B, ldb, C, ldc);
+    return;
+  }
+
+  for (int jc = j0; jc < j1; jc += NC) {
+    const int nc = std::min(NC, j1 - jc);
+
+    for (int pc = 0; pc < K; pc += KC) {
+      const int kc = std::min(KC, K - pc);
+      gemm_pack_b<DType>(TransB, kc, nc, B, ldb, pc, jc, Bp);
+
+      for (int ic = i0; ic < i1; ic += MC) {
+        const int mc = std::min(MC, i1 - ic);
+        gemm_pack_a<DType>(TransA, mc, kc, A, lda, ic, pc, Ap);
+
+        gemm_macro_kernel<DType>(mc, nc, kc, alpha, Ap, Bp, C + ic + jc*ldc, ldc);
+      }
+    }
+  }
+
+  std::free(Ap);
+  std::free(Bp);
+}
+
+
+/*
+ * Arguments for one thread's stripe of a parallel gemm_blocked.
+ */
+template <typename DType>
+struct GemmTask {
+  enum CBLAS_TRANSPOSE  TransA, TransB;
+  int                   M, N, K;
+  const DType*          alpha;
+  const DType*          A;
+  int                   lda;
+  const DType*          B;
+  int                   ldb;
+  DType*                C;
+  int                   ldc;
+  bool                  split_rows;  // stripes are rows of C if true, columns otherwise
+};
+
+template <typename DType>
+void gemm_task_run(void* task_, int begin, int end) {
+  GemmTask<DType>* t = reinterpret_cast<GemmTask<DType>*>(task_);
+
+  if (t->split_rows) gemm_blocked_range<DType>(t->TransA, t->TransB, begin, end, 0, t->N, t->K, t->alpha, t->A, t->lda, t->B, t->ldb, t->C, t->ldc);
+  else               gemm_blocked_range<DType>(t->TransA, t->TransB, 0, t->M, begin, end, t->K, t->alpha, t->A, t->lda, t->B, t->ldb, t->C, t->ldc);
+}
+
+
+/*
+ * Cache-blocked column-major C += alpha*op(A)*op(B). C must already have been scaled by beta.
+ *
+ * Large products are split into stripes of C (along whichever of M and N is longer), one per thread; see
+ * NMatrix::BLAS.num_threads.
+ */
+template <typename DType>
+inline void gemm_blocked(const enum CBLAS_TRANSPOSE TransA, const enum CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+                         const DType* alpha, const DType* A, const int lda, const DType* B, const int ldb, DType* C, const int ldc)
+{
+  GemmTask<DType> task = { TransA, TransB, M, N, K, alpha, A, lda, B, ldb, C, ldc, M > N };
+
+  if (parallel_threads<DType>((double)(M) * N * K) > 1) {
+    if (task.split_rows) nm_math_parallel_for(M, GemmBlocking<DType>::MR, gemm_task_run<DType>, &task);
+    else                 nm_math_parallel_for(N, GemmBlocking<DType>::NR, gemm_task_run<DType>, &task);
+  } else {
+    gemm_task_run<DType>(&task, 0, task.split_rows ? M : N);
+  }
+}
+
+
 /*
  * GEneral Matrix Multiplication: based on dgemm.f from Netlib.
  *
- * This is an extremely inefficient algorithm. Recommend using ATLAS' version instead.
+ * The loops below are only used for small products (and Ruby objects); anything larger is handed to gemm_blocked.
+ * ATLAS' version is still used for the float and complex dtypes.
  *
  * Template parameters: LT -- long version of type T. Type T is the matrix dtype.
  *
@@ -71,6 +315,22 @@ inline void gemm_nothrow(const enum CBLAS_TRANSPOSE TransA, const enum CBLAS_TRA
     return;
   }
 
+  // Large products go through the cache-blocked version.
+  if (gemm_use_blocked<DType>(M, N, K)) {
+    if (*beta == 0) {
+      for (int j = 0; j < N; ++j)
+        for (int i = 0; i < M; ++i)
+          C[i+j*ldc] = 0;
+    } else if (*beta != 1) {
+      for (int j = 0; j < N; ++j)
+        for (int i = 0; i < M; ++i)
+          C[i+j*ldc] *= *beta;
+    }
+
+    gemm_blocked<DType>(TransA, TransB, M, N, K, alpha, A, lda, B, ldb, C, ldc);
+    return;
+  }
+
   // Start the operations
   if (TransB == CblasNoTrans) {
     if (TransA == CblasNoTrans) {
@@ -225,11 +485,10 @@ inline void gemm(const enum CBLAS_ORDER Order, const enum CBLAS_TRANSPOSE TransA
    * we copy C and then subtract to preserve asymmetry.
    */
 
-  if (A == B && M == N && TransA != TransB && lda == ldb && beta == 0) {
-    rb_raise(rb_eNotImpError, "syrk and syreflect not implemented");
-    /*syrk<DType>(CblasUpper, (Order == CblasColMajor) ? TransA : TransB, N, K, alpha, A, lda, beta, C, ldc);
-    syreflect(CblasUpper, N, C, ldc);
-    */
+  if (A == B && M == N && TransA != TransB && TransA != CblasConjTrans && TransB != CblasConjTrans && lda == ldb && *beta == 0) {
+    syrk<DType>(Order, CblasUpper, TransA, N, K, alpha, A, lda, beta, C, ldc);
+    syreflect<false, DType>(Order, CblasUpper, N, C, ldc);
+    return;
   }
 
   if (Order == CblasRowMajor)    gemm_nothrow<DType>(TransB, TransA, N, M, K, alpha, B, ldb, A, lda, beta, C, ldc);
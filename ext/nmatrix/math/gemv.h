@@ -37,10 +37,51 @@ extern "C" { // These need to be in an extern "C" block or you'll get all kinds
 
 namespace nm { namespace math {
 
+/*
+ * Arguments for one thread's share of a parallel gemv.
+ */
+template <typename DType>
+struct GemvTask {
+  enum CBLAS_TRANSPOSE  Trans;
+  int                   lenX;
+  const DType*          alpha;
+  const DType*          A;
+  int                   lda;
+  const DType*          X;
+  int                   kx, incX;
+  DType*                Y;
+  int                   ky, incY;
+};
+
+/*
+ * Compute elements [begin, end) of Y += alpha*op(A)*X, each as a dot product. Doesn't call into Ruby.
+ */
+template <typename DType>
+void gemv_task_run(void* task_, int begin, int end) {
+  GemvTask<DType>* t = reinterpret_cast<GemvTask<DType>*>(task_);
+  typename LongDType<DType>::type temp;
+
+  for (int i = begin; i < end; ++i) {
+    temp = 0;
+
+    if (t->Trans == CblasNoTrans) {
+      const DType* row = t->A + i*t->lda;
+      for (int j = 0, jx = t->kx; j < t->lenX; ++j, jx += t->incX)
+        temp += row[j] * t->X[jx];
+    } else {
+      for (int j = 0, jx = t->kx; j < t->lenX; ++j, jx += t->incX)
+        temp += t->A[i + j*t->lda] * t->X[jx];
+    }
+
+    t->Y[t->ky + i*t->incY] += *(t->alpha) * temp;
+  }
+}
+
 /*
  * GEneral Matrix-Vector multiplication: based on dgemv.f from Netlib.
  *
- * This is an extremely inefficient algorithm. Recommend using ATLAS' version instead.
+ * This is an extremely inefficient algorithm. Recommend using ATLAS' version instead. Large products are at least
+ * spread across NMatrix::BLAS.num_threads threads.
  *
  * Template parameters: LT -- long version of type T. Type T is the matrix dtype.
  */
@@ -115,6 +156,13 @@ inline bool gemv(const enum CBLAS_TRANSPOSE Trans, const int M, const int N, con
 
   if (*alpha == 0) return false;
 
+  // Large products are split across threads, each computing some of the elements of Y.
+  if (parallel_threads<DType>((double)(M) * N) > 1) {
+    GemvTask<DType> task = { Trans, lenX, alpha, A, lda, X, kx, incX, Y, ky, incY };
+    nm_math_parallel_for(lenY, 64, gemv_task_run<DType>, &task);
+    return true;
+  }
+
   if (Trans == CblasNoTrans) {
 
     // Form  y := alpha*A*x + y.
@@ -152,7 +200,7 @@ inline bool gemv(const enum CBLAS_TRANSPOSE Trans, const int M, const int N, con
       for (j = 0; j < N; ++j) {
         temp = 0;
         for (i = 0; i < M; ++i) {
-          temp += A[j+i*lda]*X[j];
+          temp += A[j+i*lda]*X[i];
         }
         Y[jy] += *alpha * temp;
         jy += incY;
@@ -0,0 +1,290 @@
+/////////////////////////////////////////////////////////////////////
+// = NMatrix
+//
+// A linear algebra library for scientific computation in Ruby.
+// NMatrix is part of SciRuby.
+//
+// NMatrix was originally inspired by and derived from NArray, by
+// Masahiro Tanaka: http://narray.rubyforge.org
+//
+// == Copyright Information
+//
+// SciRuby is Copyright (c) 2010 - 2013, Ruby Science Foundation
+// NMatrix is Copyright (c) 2013, Ruby Science Foundation
+//
+// Please see LICENSE.txt for additional copyright notices.
+//
+// == Contributing
+//
+// By contributing source code to SciRuby, you agree to be bound by
+// our Contributor Agreement:
+//
+// * https://github.com/SciRuby/sciruby/wiki/Contributor-Agreement
+//
+// == krylov.h
+//
+// Preconditioned Krylov solvers for A*x = b: conjugate gradients,
+// BiCGSTAB, and restarted GMRES. The matrix and the preconditioner
+// are only seen through callbacks, so these work on any storage.
+// Every vector the solvers need is allocated before the first
+// iteration; nothing is allocated inside the loop.
+//
+
+#ifndef KRYLOV_H
+#define KRYLOV_H
+
+#include "math/nrm2.h"
+#include "math/rot.h"
+#include "math/rotg.h"
+
+extern "C" {
+  /*
+   * y = A*x, or y = M**-1 * x, for the operator or preconditioner op.
+   */
+  typedef void (*nm_krylov_apply)(const void* op, const void* x, void* y);
+}
+
+namespace nm { namespace math {
+
+/*
+ * One Krylov solve. matvec computes y = A*x for the operator a, and psolve (if not NULL) z = M**-1 * r for the
+ * preconditioner m. The solve stops once the residual norm, relative to the norm of b, is at most tol, or after
+ * max_iter iterations; restart is the number of iterations between GMRES restarts.
+ *
+ * history gets the relative residual norm before the first iteration and after each one, so it needs room for
+ * max_iter + 1 of them. For GMRES, these are the norms of the residuals of the least-squares problems, which are those
+ * of the true residuals in exact arithmetic.
+ */
+template <typename DType>
+struct KrylovSolve {
+  int             n;
+  nm_krylov_apply matvec;
+  const void*     a;
+  nm_krylov_apply psolve;
+  const void*     m;
+  const DType*    b;
+  DType*          x;
+  double          tol;
+  int             max_iter;
+  int             restart;
+  double*         history;
+};
+
+template <typename DType>
+inline DType krylov_dot(const int n, const DType* x, const DType* y) {
+  DType sum = 0;
+  for (int i = 0; i < n; ++i) sum += x[i] * y[i];
+  return sum;
+}
+
+template <typename DType>
+inline void krylov_precondition(const KrylovSolve<DType>& k, const DType* r, DType* z) {
+  if (k.psolve) k.psolve(k.m, r, z);
+  else          for (int i = 0; i < k.n; ++i) z[i] = r[i];
+}
+
+/*
+ * r = b - A*x. Returns the norm of b, or 1 if b is zero, so that residuals can always be divided by it.
+ */
+template <typename DType>
+inline double krylov_residual(const KrylovSolve<DType>& k, DType* r) {
+  k.matvec(k.a, k.x, r);
+  for (int i = 0; i < k.n; ++i) r[i] = k.b[i] - r[i];
+
+  const double bnorm = nrm2<DType,DType>(k.n, k.b, 1);
+  return bnorm > 0 ? bnorm : 1;
+}
+
+
+/*
+ * Preconditioned conjugate gradients, for symmetric positive definite A and M. Returns the number of iterations done;
+ * the solve converged if history[iterations] <= tol.
+ */
+template <typename DType>
+inline int cg(const KrylovSolve<DType>& k) {
+  const int n = k.n;
+  DType *r = ALLOC_N(DType, n), *z = ALLOC_N(DType, n), *p = ALLOC_N(DType, n), *q = ALLOC_N(DType, n);
+
+  const double bnorm = krylov_residual(k, r);
+  k.history[0] = nrm2<DType,DType>(n, r, 1) / bnorm;
+
+  krylov_precondition(k, r, z);
+  for (int i = 0; i < n; ++i) p[i] = z[i];
+  DType rz = krylov_dot(n, r, z);
+
+  int it = 0;
+  while (k.history[it] > k.tol && it < k.max_iter) {
+    k.matvec(k.a, p, q);
+
+    const DType pq = krylov_dot(n, p, q);
+    if (pq == 0) break; // breakdown: A isn't positive definite, or p is zero
+
+    const DType alpha = rz / pq;
+    for (int i = 0; i < n; ++i) {
+      k.x[i] += alpha * p[i];
+      r[i]   -= alpha * q[i];
+    }
+
+    k.history[++it] = nrm2<DType,DType>(n, r, 1) / bnorm;
+    if (k.history[it] <= k.tol) break;
+
+    krylov_precondition(k, r, z);
+    const DType rz_next = krylov_dot(n, r, z), beta = rz_next / rz;
+    rz = rz_next;
+
+    for (int i = 0; i < n; ++i) p[i] = z[i] + beta * p[i];
+  }
+
+  xfree(r); xfree(z); xfree(p); xfree(q);
+  return it;
+}
+
+
+/*
+ * BiCGSTAB with right preconditioning, for general A. Returns the number of iterations done.
+ */
+template <typename DType>
+inline int bicgstab(const KrylovSolve<DType>& k) {
+  const int n = k.n;
+  DType *r = ALLOC_N(DType, n), *rhat = ALLOC_N(DType, n), *p = ALLOC_N(DType, n), *v = ALLOC_N(DType, n),
+        *phat = ALLOC_N(DType, n), *shat = ALLOC_N(DType, n), *t = ALLOC_N(DType, n);
+
+  const double bnorm = krylov_residual(k, r);
+  k.history[0] = nrm2<DType,DType>(n, r, 1) / bnorm;
+
+  for (int i = 0; i < n; ++i) {
+    rhat[i] = r[i];
+    p[i]    = v[i] = 0;
+  }
+
+  DType rho = 1, alpha = 1, omega = 1;
+
+  int it = 0;
+  while (k.history[it] > k.tol && it < k.max_iter) {
+    const DType rho_next = krylov_dot(n, rhat, r);
+    if (rho_next == 0) break; // breakdown: r has become orthogonal to rhat
+
+    const DType beta = (rho_next / rho) * (alpha / omega);
+    rho = rho_next;
+    for (int i = 0; i < n; ++i) p[i] = r[i] + beta * (p[i] - omega * v[i]);
+
+    krylov_precondition(k, p, phat);
+    k.matvec(k.a, phat, v);
+
+    const DType rv = krylov_dot(n, rhat, v);
+    if (rv == 0) break;
+    alpha = rho / rv;
+
+    // r becomes s = r - alpha*v.
+    for (int i = 0; i < n; ++i) r[i] -= alpha * v[i];
+
+    const double snorm = nrm2<DType,DType>(n, r, 1) / bnorm;
+    if (snorm <= k.tol) {
+      for (int i = 0; i < n; ++i) k.x[i] += alpha * phat[i];
+      k.history[++it] = snorm;
+      break;
+    }
+
+    krylov_precondition(k, r, shat);
+    k.matvec(k.a, shat, t);
+
+    const DType tt = krylov_dot(n, t, t);
+    omega = tt == 0 ? DType(0) : krylov_dot(n, t, r) / tt;
+
+    for (int i = 0; i < n; ++i) {
+      k.x[i] += alpha * phat[i] + omega * shat[i];
+      r[i]   -= omega * t[i];
+    }
+
+    k.history[++it] = nrm2<DType,DType>(n, r, 1) / bnorm;
+    if (omega == 0) break; // breakdown: can't go on without dividing by omega
+  }
+
+  xfree(r); xfree(rhat); xfree(p); xfree(v); xfree(phat); xfree(shat); xfree(t);
+  return it;
+}
+
+
+/*
+ * GMRES(restart) with right preconditioning, for general A. Each cycle builds an orthonormal basis of the Krylov space
+ * by modified Gram-Schmidt, and keeps the Hessenberg matrix upper triangular with Givens rotations (rotg, rot), which
+ * also give the residual norm at every step without forming x. Returns the number of iterations done.
+ */
+template <typename DType>
+inline int gmres(const KrylovSolve<DType>& k) {
+  const int n = k.n, m = std::max(1, std::min(k.restart, k.max_iter));
+
+  DType *v  = ALLOC_N(DType, (size_t)(m + 1) * n), // the basis, one vector after another
+        *h  = ALLOC_N(DType, (size_t)(m + 1) * m), // Hessenberg matrix, column j at h + j*(m+1)
+        *cs = ALLOC_N(DType, m), *sn = ALLOC_N(DType, m), *g = ALLOC_N(DType, m + 1), *z = ALLOC_N(DType, n);
+
+  const double bnorm = krylov_residual(k, v);
+  DType beta = nrm2<DType,DType>(n, v, 1);
+  k.history[0] = beta / bnorm;
+
+  int it = 0;
+  while (k.history[it] > k.tol && it < k.max_iter && beta > 0) {
+    for (int i = 0; i < n; ++i) v[i] /= beta;
+    g[0] = beta;
+
+    int j = 0;
+    while (j < m && it < k.max_iter) {
+      DType* hj = h + (size_t)(j) * (m + 1);
+      DType* w  = v + (size_t)(j + 1) * n;
+
+      krylov_precondition(k, v + (size_t)(j) * n, z);
+      k.matvec(k.a, z, w);
+
+      for (int i = 0; i <= j; ++i) {
+        const DType* vi = v + (size_t)(i) * n;
+        hj[i] = krylov_dot(n, w, vi);
+        for (int l = 0; l < n; ++l) w[l] -= hj[i] * vi[l];
+      }
+
+      hj[j+1] = nrm2<DType,DType>(n, w, 1);
+      const bool lucky = hj[j+1] == 0; // the Krylov space is invariant, so this cycle's solution is exact
+      if (!lucky) for (int l = 0; l < n; ++l) w[l] /= hj[j+1];
+
+      for (int i = 0; i < j; ++i) rot<DType,DType>(1, hj + i, 1, hj + i + 1, 1, cs[i], sn[i]);
+      rotg<DType>(hj + j, hj + j + 1, cs + j, sn + j);
+      hj[j+1] = 0;
+
+      g[j+1] = 0;
+      rot<DType,DType>(1, g + j, 1, g + j + 1, 1, cs[j], sn[j]);
+
+      ++j;
+      k.history[++it] = std::abs(g[j]) / bnorm;
+      if (k.history[it] <= k.tol || lucky) break;
+    }
+
+    // Solve the triangular system for the coefficients of the basis, in place in g, and update x by M**-1 of the
+    // combination of the basis vectors they give (collected in the first basis vector, which isn't needed any more).
+    for (int i = j - 1; i >= 0; --i) {
+      for (int l = i + 1; l < j; ++l) g[i] -= h[(size_t)(l) * (m + 1) + i] * g[l];
+      const DType hii = h[(size_t)(i) * (m + 1) + i];
+      g[i] = hii == 0 ? DType(0) : g[i] / hii; // only if A is singular
+    }
+
+    for (int l = 0; l < n; ++l) v[l] *= g[0];
+    for (int i = 1; i < j; ++i) {
+      const DType* vi = v + (size_t)(i) * n;
+      for (int l = 0; l < n; ++l) v[l] += g[i] * vi[l];
+    }
+
+    krylov_precondition(k, v, z);
+    for (int l = 0; l < n; ++l) k.x[l] += z[l];
+
+    if (k.history[it] <= k.tol || it >= k.max_iter) break;
+
+    // Restart from the true residual.
+    krylov_residual(k, v);
+    beta = nrm2<DType,DType>(n, v, 1);
+  }
+
+  xfree(v); xfree(h); xfree(cs); xfree(sn); xfree(g); xfree(z);
+  return it;
+}
+
+}} // end of namespace nm::math
+
+#endif // KRYLOV_H
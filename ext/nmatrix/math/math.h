@@ -92,6 +92,22 @@ extern "C" { // These need to be in an extern "C" block or you'll get all kinds
  * Data
  */
 
+/*
+ * The Krylov methods and preconditioners of nm_math_krylov.
+ */
+enum nm_krylov_method_t {
+  NM_KRYLOV_CG,
+  NM_KRYLOV_BICGSTAB,
+  NM_KRYLOV_GMRES
+};
+
+enum nm_preconditioner_t {
+  NM_PRECONDITIONER_NONE,
+  NM_PRECONDITIONER_JACOBI,
+  NM_PRECONDITIONER_ILU0,
+  NM_PRECONDITIONER_IC0
+};
+
 
 extern "C" {
   /*
@@ -99,6 +115,15 @@ extern "C" {
    */
   void nm_math_det_exact(const int M, const void* elements, const int lda, nm::dtype_t dtype, void* result);
   void nm_math_transpose_generic(const size_t M, const size_t N, const void* A, const int lda, void* B, const int ldb, size_t element_size);
+  void nm_math_scal(const int n, const void* scalar, void* x, const int incx, nm::dtype_t dtype);
+  void nm_math_batch_gemm(const int batch, const int M, const int N, const int K, const void* A, const size_t strideA, const int lda,
+                          const void* B, const size_t strideB, const int ldb, void* C, const size_t strideC, const int ldc, nm::dtype_t dtype);
+  int  nm_math_batch_inverse(const int batch, const int N, const void* A, const size_t strideA, const int lda, void* C,
+                             const size_t strideC, const int ldc, nm::dtype_t dtype);
+  int  nm_math_batch_solve(const int batch, const int N, const int NRHS, const void* A, const size_t strideA, const int lda,
+                           const void* B, const size_t strideB, const int ldb, void* X, const size_t strideX, const int ldx, nm::dtype_t dtype);
+  int  nm_math_krylov(const STORAGE* a, nm::stype_t stype, int method, int preconditioner, const void* b, void* x,
+                      double tol, int max_iter, int restart, double* history, nm::dtype_t dtype);
   void nm_math_init_blas(void);
 
 }
@@ -117,56 +142,6 @@ namespace nm {
  */
 
 
-template <typename DType>
-inline void syrk(const enum CBLAS_ORDER Order, const enum CBLAS_UPLO Uplo, const enum CBLAS_TRANSPOSE Trans, const int N,
-                 const int K, const DType* alpha, const DType* A, const int lda, const DType* beta, DType* C, const int ldc) {
-  rb_raise(rb_eNotImpError, "syrk not yet implemented for non-BLAS dtypes");
-}
-
-template <typename DType>
-inline void herk(const enum CBLAS_ORDER Order, const enum CBLAS_UPLO Uplo, const enum CBLAS_TRANSPOSE Trans, const int N,
-                 const int K, const DType* alpha, const DType* A, const int lda, const DType* beta, DType* C, const int ldc) {
-  rb_raise(rb_eNotImpError, "herk not yet implemented for non-BLAS dtypes");
-}
-
-template <>
-inline void syrk(const enum CBLAS_ORDER Order, const enum CBLAS_UPLO Uplo, const enum CBLAS_TRANSPOSE Trans, const int N,
-                 const int K, const float* alpha, const float* A, const int lda, const float* beta, float* C, const int ldc) {
-  cblas_ssyrk(Order, Uplo, Trans, N, K, *alpha, A, lda, *beta, C, ldc);
-}
-
-template <>
-inline void syrk(const enum CBLAS_ORDER Order, const enum CBLAS_UPLO Uplo, const enum CBLAS_TRANSPOSE Trans, const int N,
-                 const int K, const double* alpha, const double* A, const int lda, const double* beta, double* C, const int ldc) {
-  cblas_dsyrk(Order, Uplo, Trans, N, K, *alpha, A, lda, *beta, C, ldc);
-}
-
-template <>
-inline void syrk(const enum CBLAS_ORDER Order, const enum CBLAS_UPLO Uplo, const enum CBLAS_TRANSPOSE Trans, const int N,
-                 const int K, const Complex64* alpha, const Complex64* A, const int lda, const Complex64* beta, Complex64* C, const int ldc) {
-  cblas_csyrk(Order, Uplo, Trans, N, K, alpha, A, lda, beta, C, ldc);
-}
-
-template <>
-inline void syrk(const enum CBLAS_ORDER Order, const enum CBLAS_UPLO Uplo, const enum CBLAS_TRANSPOSE Trans, const int N,
-                 const int K, const Complex128* alpha, const Complex128* A, const int lda, const Complex128* beta, Complex128* C, const int ldc) {
-  cblas_zsyrk(Order, Uplo, Trans, N, K, alpha, A, lda, beta, C, ldc);
-}
-
-
-template <>
-inline void herk(const enum CBLAS_ORDER Order, const enum CBLAS_UPLO Uplo, const enum CBLAS_TRANSPOSE Trans, const int N,
-                 const int K, const Complex64* alpha, const Complex64* A, const int lda, const Complex64* beta, Complex64* C, const int ldc) {
-  cblas_cherk(Order, Uplo, Trans, N, K, alpha->r, A, lda, beta->r, C, ldc);
-}
-
-template <>
-inline void herk(const enum CBLAS_ORDER Order, const enum CBLAS_UPLO Uplo, const enum CBLAS_TRANSPOSE Trans, const int N,
-                 const int K, const Complex128* alpha, const Complex128* A, const int lda, const Complex128* beta, Complex128* C, const int ldc) {
-  cblas_zherk(Order, Uplo, Trans, N, K, alpha->r, A, lda, beta->r, C, ldc);
-}
-
-
 template <typename DType>
 inline void trmm(const enum CBLAS_ORDER order, const enum CBLAS_SIDE side, const enum CBLAS_UPLO uplo,
                  const enum CBLAS_TRANSPOSE ta, const enum CBLAS_DIAG diag, const int m, const int n, const DType* alpha,
@@ -204,176 +179,6 @@ inline void trmm(const enum CBLAS_ORDER order, const enum CBLAS_SIDE side, const
 
 
 
-// Yale: numeric matrix multiply c=a*b
-template <typename DType, typename IType>
-inline void numbmm(const unsigned int n, const unsigned int m, const unsigned int l, const IType* ia, const IType* ja, const DType* a, const bool diaga,
-            const IType* ib, const IType* jb, const DType* b, const bool diagb, IType* ic, IType* jc, DType* c, const bool diagc) {
-  const unsigned int max_lmn = std::max(std::max(m, n), l);
-  IType next[max_lmn];
-  DType sums[max_lmn];
-
-  DType v;
-
-  IType head, length, temp, ndnz = 0;
-  IType minmn = std::min(m,n);
-  IType minlm = std::min(l,m);
-
-  for (IType idx = 0; idx < max_lmn; ++idx) { // initialize scratch arrays
-    next[idx] = std::numeric_limits<IType>::max();
-    sums[idx] = 0;
-  }
-
-  for (IType i = 0; i < n; ++i) { // walk down the rows
-    head = std::numeric_limits<IType>::max()-1; // head gets assigned as whichever column of B's row j we last visited
-    length = 0;
-
-    for (IType jj = ia[i]; jj <= ia[i+1]; ++jj) { // walk through entries in each row
-      IType j;
-
-      if (jj == ia[i+1]) { // if we're in the last entry for this row:
-        if (!diaga || i >= minmn) continue;
-        j   = i;      // if it's a new Yale matrix, and last entry, get the diagonal position (j) and entry (ajj)
-        v   = a[i];
-      } else {
-        j   = ja[jj]; // if it's not the last entry for this row, get the column (j) and entry (ajj)
-        v   = a[jj];
-      }
-
-      for (IType kk = ib[j]; kk <= ib[j+1]; ++kk) {
-
-        IType k;
-
-        if (kk == ib[j+1]) { // Get the column id for that entry
-          if (!diagb || j >= minlm) continue;
-          k  = j;
-          sums[k] += v*b[k];
-        } else {
-          k  = jb[kk];
-          sums[k] += v*b[kk];
-        }
-
-        if (next[k] == std::numeric_limits<IType>::max()) {
-          next[k] = head;
-          head    = k;
-          ++length;
-        }
-      } // end of kk loop
-    } // end of jj loop
-
-    for (IType jj = 0; jj < length; ++jj) {
-      if (sums[head] != 0) {
-        if (diagc && head == i) {
-          c[head] = sums[head];
-        } else {
-          jc[n+1+ndnz] = head;
-          c[n+1+ndnz]  = sums[head];
-          ++ndnz;
-        }
-      }
-
-      temp = head;
-      head = next[head];
-
-      next[temp] = std::numeric_limits<IType>::max();
-      sums[temp] = 0;
-    }
-
-    ic[i+1] = n+1+ndnz;
-  }
-} /* numbmm_ */
-
-
-/*
-template <typename DType, typename IType>
-inline void new_yale_matrix_multiply(const unsigned int m, const IType* ija, const DType* a, const IType* ijb, const DType* b, YALE_STORAGE* c_storage) {
-  unsigned int n = c_storage->shape[0],
-               l = c_storage->shape[1];
-
-  // Create a working vector of dimension max(m,l,n) and initial value IType::max():
-  std::vector<IType> mask(std::max(std::max(m,l),n), std::numeric_limits<IType>::max());
-
-  for (IType i = 0; i < n; ++i) { // A.rows.each_index do |i|
-
-    IType j, k;
-    size_t ndnz;
-
-    for (IType jj = ija[i]; jj <= ija[i+1]; ++jj) { // walk through column pointers for row i of A
-      j = (jj == ija[i+1]) ? i : ija[jj];   // Get the current column index (handle diagonals last)
-
-      if (j >= m) {
-        if (j == ija[jj]) rb_raise(rb_eIndexError, "ija array for left-hand matrix contains an out-of-bounds column index %u at position %u", jj, j);
-        else              break;
-      }
-
-      for (IType kk = ijb[j]; kk <= ijb[j+1]; ++kk) { // walk through column pointers for row j of B
-        if (j >= m) continue; // first of all, does B *have* a row j?
-        k = (kk == ijb[j+1]) ? j : ijb[kk];   // Get the current column index (handle diagonals last)
-
-        if (k >= l) {
-          if (k == ijb[kk]) rb_raise(rb_eIndexError, "ija array for right-hand matrix contains an out-of-bounds column index %u at position %u", kk, k);
-          else              break;
-        }
-
-        if (mask[k] == )
-      }
-
-    }
-  }
-}
-*/
-
-// Yale: Symbolic matrix multiply c=a*b
-template <typename IType>
-inline size_t symbmm(const unsigned int n, const unsigned int m, const unsigned int l, const IType* ia, const IType* ja, const bool diaga,
-            const IType* ib, const IType* jb, const bool diagb, IType* ic, const bool diagc) {
-  unsigned int max_lmn = std::max(std::max(m,n), l);
-  IType mask[max_lmn];  // INDEX in the SMMP paper.
-  IType j, k; /* Local variables */
-  size_t ndnz = n;
-
-  for (IType idx = 0; idx < max_lmn; ++idx)
-    mask[idx] = std::numeric_limits<IType>::max();
-
-  if (ic) { // Only write to ic if it's supplied; otherwise, we're just counting.
-    if (diagc)  ic[0] = n+1;
-    else        ic[0] = 0;
-  }
-
-  IType minmn = std::min(m,n);
-  IType minlm = std::min(l,m);
-
-  for (IType i = 0; i < n; ++i) { // MAIN LOOP: through rows
-
-    for (IType jj = ia[i]; jj <= ia[i+1]; ++jj) { // merge row lists, walking through columns in each row
-
-      // j <- column index given by JA[jj], or handle diagonal.
-      if (jj == ia[i+1]) { // Don't really do it the last time -- just handle diagonals in a new yale matrix.
-        if (!diaga || i >= minmn) continue;
-        j = i;
-      } else j = ja[jj];
-
-      for (IType kk = ib[j]; kk <= ib[j+1]; ++kk) { // Now walk through columns K of row J in matrix B.
-        if (kk == ib[j+1]) {
-          if (!diagb || j >= minlm) continue;
-          k = j;
-        } else k = jb[kk];
-
-        if (mask[k] != i) {
-          mask[k] = i;
-          ++ndnz;
-        }
-      }
-    }
-
-    if (diagc && mask[i] == std::numeric_limits<IType>::max()) --ndnz;
-
-    if (ic) ic[i+1] = ndnz;
-  }
-
-  return ndnz;
-} /* symbmm_ */
-
-
 // In-place quicksort (from Wikipedia) -- called by smmp_sort_columns, below. All functions are inclusive of left, right.
 namespace smmp_sort {
   const size_t THRESHOLD = 4;  // switch to insertion sort for 4 elements or fewer
@@ -473,15 +278,12 @@ namespace smmp_sort {
 
 
 /*
- * For use following symbmm and numbmm. Sorts the matrix entries in each row according to the column index.
+ * Sorts the matrix entries in each row according to the column index.
  * This utilizes quicksort, which is an in-place unstable sort (since there are no duplicate entries, we don't care
  * about stability).
  *
  * TODO: It might be worthwhile to do a test for free memory, and if available, use an unstable sort that isn't in-place.
  *
- * TODO: It's actually probably possible to write an even faster sort, since symbmm/numbmm are not producing a random
- * ordering. If someone is doing a lot of Yale matrix multiplication, it might benefit them to consider even insertion
- * sort.
  */
 template <typename DType, typename IType>
 inline void smmp_sort_columns(const size_t n, const IType* ia, IType* ja, DType* a) {
@@ -500,7 +302,7 @@ inline void smmp_sort_columns(const size_t n, const IType* ia, IType* ja, DType*
 /*
  * Transposes a generic Yale matrix (old or new). Specify new by setting diaga = true.
  *
- * Based on transp from SMMP (same as symbmm and numbmm).
+ * Based on transp from SMMP.
  *
  * This is not named in the same way as most yale_storage functions because it does not act on a YALE_STORAGE
  * object.
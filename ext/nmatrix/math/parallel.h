@@ -0,0 +1,74 @@
+/////////////////////////////////////////////////////////////////////
+// = NMatrix
+//
+// A linear algebra library for scientific computation in Ruby.
+// NMatrix is part of SciRuby.
+//
+// NMatrix was originally inspired by and derived from NArray, by
+// Masahiro Tanaka: http://narray.rubyforge.org
+//
+// == Copyright Information
+//
+// SciRuby is Copyright (c) 2010 - 2013, Ruby Science Foundation
+// NMatrix is Copyright (c) 2013, Ruby Science Foundation
+//
+// Please see LICENSE.txt for additional copyright notices.
+//
+// == Contributing
+//
+// By contributing source code to SciRuby, you agree to be bound by
+// our Contributor Agreement:
+//
+// * https://github.com/SciRuby/sciruby/wiki/Contributor-Agreement
+//
+// == parallel.h
+//
+// Splitting the native (non-BLAS) versions of GEMM and GEMV across
+// threads.
+//
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+/*
+ * Products with fewer multiply-adds than this stay on the calling thread.
+ */
+#define NM_PARALLEL_MIN_FLOPS (128*128*128)
+
+extern "C" {
+  /*
+   * Work function for nm_math_parallel_for: handle the half-open range [begin, end) of whatever arg describes. Runs
+   * without the interpreter lock, so it must not call into Ruby (that includes ALLOC and rb_raise).
+   */
+  typedef void (*nm_parallel_func)(void* arg, int begin, int end);
+
+  size_t  nm_math_num_threads(void);
+  void    nm_math_set_num_threads(size_t n);
+  void    nm_math_parallel_for(int n, int grain, nm_parallel_func fn, void* arg);
+}
+
+namespace nm { namespace math {
+
+/*
+ * Whether DType's arithmetic can run off the interpreter's thread. Ruby objects are the only dtype whose operators
+ * call back into Ruby.
+ */
+template <typename DType>
+struct ThreadSafe { static const bool value = true; };
+
+template <>
+struct ThreadSafe<RubyObject> { static const bool value = false; };
+
+/*
+ * Number of threads to use for a native operation of the given size: 1 below the threshold, otherwise the module-level
+ * setting (NMatrix::BLAS.num_threads).
+ */
+template <typename DType>
+inline size_t parallel_threads(double flops) {
+  if (!ThreadSafe<DType>::value || flops < NM_PARALLEL_MIN_FLOPS) return 1;
+  return nm_math_num_threads();
+}
+
+}} // end of namespace nm::math
+
+#endif // PARALLEL_H
@@ -29,6 +29,10 @@
 #ifndef SCAL_H
 #define SCAL_H
 
+extern "C" { // These need to be in an extern "C" block or you'll get all kinds of undefined symbol errors.
+  #include <cblas.h>
+}
+
 namespace nm { namespace math {
 
 /*  Purpose */
@@ -58,6 +62,26 @@ inline void scal(const int n, const DType da, DType* dx,	const int incx) {
   }
 } /* scal */
 
+template <>
+inline void scal(const int n, const float da, float* dx, const int incx) {
+  cblas_sscal(n, da, dx, incx);
+}
+
+template <>
+inline void scal(const int n, const double da, double* dx, const int incx) {
+  cblas_dscal(n, da, dx, incx);
+}
+
+template <>
+inline void scal(const int n, const Complex64 da, Complex64* dx, const int incx) {
+  cblas_cscal(n, &da, dx, incx);
+}
+
+template <>
+inline void scal(const int n, const Complex128 da, Complex128* dx, const int incx) {
+  cblas_zscal(n, &da, dx, incx);
+}
+
 
 /*
  * Function signature conversion for LAPACK's scal function.
@@ -0,0 +1,783 @@
+/////////////////////////////////////////////////////////////////////
+// = NMatrix
+//
+// A linear algebra library for scientific computation in Ruby.
+// NMatrix is part of SciRuby.
+//
+// NMatrix was originally inspired by and derived from NArray, by
+// Masahiro Tanaka: http://narray.rubyforge.org
+//
+// == Copyright Information
+//
+// SciRuby is Copyright (c) 2010 - 2013, Ruby Science Foundation
+// NMatrix is Copyright (c) 2013, Ruby Science Foundation
+//
+// Please see LICENSE.txt for additional copyright notices.
+//
+// == Contributing
+//
+// By contributing source code to SciRuby, you agree to be bound by
+// our Contributor Agreement:
+//
+// * https://github.com/SciRuby/sciruby/wiki/Contributor-Agreement
+//
+// == sparse_factor.h
+//
+// Sparse direct factorizations: a fill-reducing ordering, the symbolic
+// analysis for Cholesky, up-looking Cholesky, and left-looking LU with
+// partial pivoting (after Davis, "Direct Methods for Sparse Linear
+// Systems"). These work on compressed vectors with size_t indices;
+// storage/yale.cpp converts to and from them.
+//
+
+#ifndef SPARSE_FACTOR_H
+#define SPARSE_FACTOR_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace nm { namespace math {
+
+/*
+ * An n x n sparse matrix as compressed vectors: vector j's indices are idx[ptr[j]..ptr[j+1]), and its values are at the
+ * same positions in val. Whether the vectors are rows or columns is up to the caller.
+ */
+template <typename DType>
+struct CompressedMatrix {
+  size_t              n;
+  std::vector<size_t> ptr;
+  std::vector<size_t> idx;
+  std::vector<DType>  val;
+};
+
+// No index: a root of the elimination tree, or a row not yet pivoted on.
+const size_t SPARSE_NONE = (size_t)(-1);
+
+// Returned by cholesky when the matrix has an entry the symbolic analysis didn't allow for.
+const long SPARSE_PATTERN_MISMATCH = -2;
+
+// Returned by cholesky when the matrix's pattern isn't symmetric, as when only one triangle is stored.
+const long SPARSE_NOT_SYMMETRIC = -3;
+
+
+/*
+ * Transpose a compressed matrix (which also turns rows into columns). The indices of the result are sorted.
+ */
+template <typename DType>
+inline void sparse_transpose(const CompressedMatrix<DType>& a, CompressedMatrix<DType>& t) {
+  const size_t n = a.n, nz = a.ptr[n];
+
+  t.n = n;
+  t.ptr.assign(n + 1, 0);
+  t.idx.resize(nz);
+  t.val.resize(nz);
+
+  for (size_t p = 0; p < nz; ++p) ++t.ptr[a.idx[p] + 1];
+  for (size_t i = 0; i < n; ++i)  t.ptr[i+1] += t.ptr[i];
+
+  std::vector<size_t> next(t.ptr.begin(), t.ptr.end() - 1);
+  for (size_t j = 0; j < n; ++j) {
+    for (size_t p = a.ptr[j]; p < a.ptr[j+1]; ++p) {
+      const size_t q = next[a.idx[p]]++;
+      t.idx[q] = j;
+      t.val[q] = a.val[p];
+    }
+  }
+}
+
+
+/*
+ * Whether the pattern given by ptr and idx is symmetric: each entry off the diagonal has its mirror image stored too.
+ * Each vector's entries are marked, and then the transpose's vector of the same number must hit exactly those.
+ */
+inline bool symmetric_pattern(const size_t n, const std::vector<size_t>& ptr, const std::vector<size_t>& idx) {
+  std::vector<size_t> tptr(n + 1, 0);
+  for (size_t j = 0; j < n; ++j)
+    for (size_t p = ptr[j]; p < ptr[j+1]; ++p)
+      if (idx[p] != j) ++tptr[idx[p] + 1];
+  for (size_t i = 0; i < n; ++i) tptr[i+1] += tptr[i];
+
+  std::vector<size_t> tidx(tptr[n]), next(tptr.begin(), tptr.end() - 1);
+  for (size_t j = 0; j < n; ++j)
+    for (size_t p = ptr[j]; p < ptr[j+1]; ++p)
+      if (idx[p] != j) tidx[next[idx[p]]++] = j;
+
+  std::vector<size_t> mark(n, SPARSE_NONE);
+  for (size_t j = 0; j < n; ++j) {
+    size_t count = 0;
+    for (size_t p = ptr[j]; p < ptr[j+1]; ++p) {
+      if (idx[p] == j) continue;
+      mark[idx[p]] = j;
+      ++count;
+    }
+
+    if (tptr[j+1] - tptr[j] != count) return false;
+    for (size_t p = tptr[j]; p < tptr[j+1]; ++p)
+      if (mark[tidx[p]] != j) return false;
+  }
+
+  return true;
+}
+
+
+// Marks a vertex or element as absorbed into (or, for an element, ended at) element e, as -e-2, so that -1 stays free.
+inline long amd_flip(const long e) { return -e - 2; }
+
+/*
+ * Reset the marks in w when mark would pass the range they can hold: every live entry goes back to 1, and the next
+ * mark is 2. Dead entries (0) stay dead.
+ */
+inline long amd_clear(long mark, const long lemax, std::vector<long>& w, const long n) {
+  if (mark < 2 || mark + lemax < 0) {
+    for (long k = 0; k < n; ++k)
+      if (w[k] != 0) w[k] = 1;
+    mark = 2;
+  }
+  return mark;
+}
+
+/*
+ * Approximate minimum degree ordering (Amestoy, Davis and Duff) for the graph of A+A**T, where A's pattern is given by
+ * ptr and idx. Returns perm, with perm[k] the vertex eliminated k-th.
+ *
+ * The elimination graph is never formed. Instead, the quotient graph keeps each eliminated vertex as an element, the
+ * clique its neighbours would have formed, and each vertex's list holds the elements it's adjacent to followed by the
+ * vertices; an element that's a subset of a newer one is absorbed into it. Degrees are bounded from above through the
+ * elements rather than counted exactly, vertices with the same neighbours are merged into supervariables and
+ * eliminated together, and very dense vertices are left to the end. This keeps the graph within the space of A plus
+ * some elbow room, and the cost close to that of reading A.
+ */
+inline std::vector<size_t> approximate_minimum_degree(const size_t n_, const std::vector<size_t>& ptr, const std::vector<size_t>& idx) {
+  const long n = n_;
+  std::vector<size_t> perm;
+  if (!n) return perm;
+
+  // The pattern of A+A**T without the diagonal, in cp and ci, then with elbow room for the new elements.
+  std::vector<long> len(n + 1, 0);
+  for (long j = 0; j < n; ++j) {
+    for (size_t p = ptr[j]; p < ptr[j+1]; ++p) {
+      const long i = idx[p];
+      if (i == j) continue;
+      ++len[i];
+      ++len[j];
+    }
+  }
+
+  std::vector<long> cp(n + 1, 0);
+  for (long j = 0; j < n; ++j) cp[j+1] = cp[j] + len[j];
+
+  std::vector<long> ci(cp[n]), fill(cp.begin(), cp.end() - 1);
+  for (long j = 0; j < n; ++j) {
+    for (size_t p = ptr[j]; p < ptr[j+1]; ++p) {
+      const long i = idx[p];
+      if (i == j) continue;
+      ci[fill[i]++] = j;
+      ci[fill[j]++] = i;
+    }
+  }
+
+  // Merge the duplicates from entries stored in both triangles.
+  long cnz = 0;
+  std::vector<long> last(n + 1, -1);
+  for (long j = 0; j < n; ++j) {
+    const long start = cnz;
+    for (long p = cp[j]; p < cp[j+1]; ++p) {
+      const long i = ci[p];
+      if (last[i] == j) continue;
+      last[i]   = j;
+      ci[cnz++] = i;
+    }
+    cp[j]  = start;
+    len[j] = cnz - start;
+  }
+  cp[n] = cnz;
+  std::vector<long>().swap(fill);
+
+  const long nzmax = cnz + cnz / 5 + 2*n;
+  ci.resize(nzmax);
+
+  long dense = std::max(16.0, 10 * std::sqrt((double)(n)));
+  dense      = std::min(n - 2, dense);
+
+  // nv is each supervariable's size (negated while it's in the new element, 0 once merged away); elen the number of
+  // elements in a vertex's list (-1 once merged, -2 for an element); head, next and last the degree lists, and then the
+  // hash buckets (hhead); w the marks for the set differences.
+  std::vector<long> nv(n + 1, 1), next(n + 1, -1), head(n + 1, -1), elen(n + 1, 0), degree(len), w(n + 1, 1), hhead(n + 1, -1);
+  last.assign(n + 1, -1);
+
+  long mark = amd_clear(0, 0, w, n), mindeg = 0, nel = 0, lemax = 0;
+
+  // Vertex n is a dead element, which the dense vertices are absorbed into.
+  elen[n] = -2;
+  cp[n]   = -1;
+  w[n]    = 0;
+
+  for (long i = 0; i < n; ++i) {
+    const long d = degree[i];
+
+    if (d == 0) {                     // an isolated vertex is eliminated at once
+      elen[i] = -2;
+      ++nel;
+      cp[i]   = -1;
+      w[i]    = 0;
+    } else if (d > dense) {           // a dense vertex is put off to the end
+      nv[i]   = 0;
+      elen[i] = -1;
+      ++nel;
+      cp[i]   = amd_flip(n);
+      ++nv[n];
+    } else {
+      if (head[d] != -1) last[head[d]] = i;
+      next[i] = head[d];
+      head[d] = i;
+    }
+  }
+
+  while (nel < n) {
+    // Take a vertex of least approximate degree.
+    long k = -1;
+    for (; mindeg < n && (k = head[mindeg]) == -1; ++mindeg);
+    if (next[k] != -1) last[next[k]] = -1;
+    head[mindeg] = next[k];
+
+    const long elenk = elen[k];
+    long       nvk   = nv[k];
+    nel += nvk;
+
+    // Compact the lists if the new element mightn't fit after them.
+    if (elenk > 0 && cnz + mindeg >= nzmax) {
+      for (long j = 0; j < n; ++j) {
+        const long p = cp[j];
+        if (p >= 0) {
+          cp[j] = ci[p];
+          ci[p] = amd_flip(j);
+        }
+      }
+
+      long q = 0;
+      for (long p = 0; p < cnz; ) {
+        const long j = amd_flip(ci[p++]);
+        if (j >= 0) {
+          ci[q] = cp[j];
+          cp[j] = q++;
+          for (long k3 = 0; k3 < len[j] - 1; ++k3) ci[q++] = ci[p++];
+        }
+      }
+      cnz = q;
+    }
+
+    // The new element k is the union of the elements in k's list and the vertices left in it. It's built in place if k
+    // has no elements, and after the other lists otherwise.
+    long dk = 0;
+    nv[k] = -nvk;
+
+    long       p   = cp[k];
+    const long pk1 = elenk == 0 ? p : cnz;
+    long       pk2 = pk1;
+
+    for (long k1 = 1; k1 <= elenk + 1; ++k1) {
+      long e, pj, ln;
+      if (k1 > elenk) {
+        e  = k;
+        pj = p;
+        ln = len[k] - elenk;
+      } else {
+        e  = ci[p++];
+        pj = cp[e];
+        ln = len[e];
+      }
+
+      for (long k2 = 1; k2 <= ln; ++k2) {
+        const long i   = ci[pj++];
+        const long nvi = nv[i];
+        if (nvi <= 0) continue;       // already in the new element, or gone
+
+        dk       += nvi;
+        nv[i]     = -nvi;
+        ci[pk2++] = i;
+
+        if (next[i] != -1) last[next[i]] = last[i];
+        if (last[i] != -1) next[last[i]] = next[i];
+        else               head[degree[i]] = next[i];
+      }
+
+      if (e != k) {                   // e is absorbed into k
+        cp[e] = amd_flip(k);
+        w[e]  = 0;
+      }
+    }
+
+    if (elenk != 0) cnz = pk2;
+
+    degree[k] = dk;
+    cp[k]     = pk1;
+    len[k]    = pk2 - pk1;
+    elen[k]   = -2;
+
+    // |e \ k| for every element e next to a vertex of k, in w[e] - mark.
+    mark = amd_clear(mark, lemax, w, n);
+    for (long pk = pk1; pk < pk2; ++pk) {
+      const long i   = ci[pk];
+      const long eln = elen[i];
+      if (eln <= 0) continue;
+
+      const long nvi  = -nv[i];
+      const long wnvi = mark - nvi;
+
+      for (long q = cp[i]; q <= cp[i] + eln - 1; ++q) {
+        const long e = ci[q];
+        if (w[e] >= mark)   w[e] -= nvi;
+        else if (w[e] != 0) w[e]  = degree[e] + wnvi;
+      }
+    }
+
+    // The approximate degree of each vertex of k, dropping the elements k covers and hashing what's left.
+    for (long pk = pk1; pk < pk2; ++pk) {
+      const long i  = ci[pk];
+      const long p1 = cp[i], p2 = p1 + elen[i] - 1;
+      long       pn = p1, h = 0, d = 0;
+
+      for (long q = p1; q <= p2; ++q) {
+        const long e = ci[q];
+        if (w[e] == 0) continue;
+
+        const long dext = w[e] - mark;
+        if (dext > 0) {
+          d       += dext;
+          ci[pn++] = e;
+          h       += e;
+        } else {                      // aggressive absorption: e is a subset of k
+          cp[e] = amd_flip(k);
+          w[e]  = 0;
+        }
+      }
+      elen[i] = pn - p1 + 1;
+
+      const long p3 = pn, p4 = p1 + len[i];
+      for (long q = p2 + 1; q < p4; ++q) {
+        const long j   = ci[q];
+        const long nvj = nv[j];
+        if (nvj <= 0) continue;
+
+        d       += nvj;
+        ci[pn++] = j;
+        h       += j;
+      }
+
+      if (d == 0) {                   // mass elimination: i has no neighbours but k
+        cp[i] = amd_flip(k);
+        const long nvi = -nv[i];
+        dk   -= nvi;
+        nvk  += nvi;
+        nel  += nvi;
+        nv[i]   = 0;
+        elen[i] = -1;
+      } else {
+        degree[i] = std::min(degree[i], d);
+        ci[pn] = ci[p3];              // k goes at the front of i's list
+        ci[p3] = ci[p1];
+        ci[p1] = k;
+        len[i] = pn - p1 + 1;
+
+        h = (h < 0 ? -h : h) % n;
+        next[i]  = hhead[h];
+        hhead[h] = i;
+        last[i]  = h;
+      }
+    }
+
+    degree[k] = dk;
+    lemax     = std::max(lemax, dk);
+    mark      = amd_clear(mark + lemax, lemax, w, n);
+
+    // Merge the vertices of k with identical lists into supervariables, comparing only within a hash bucket.
+    for (long pk = pk1; pk < pk2; ++pk) {
+      long i = ci[pk];
+      if (nv[i] >= 0) continue;
+
+      const long h = last[i];
+      i        = hhead[h];
+      hhead[h] = -1;
+
+      for (; i != -1 && next[i] != -1; i = next[i], ++mark) {
+        const long ln = len[i], eln = elen[i];
+        for (long q = cp[i] + 1; q <= cp[i] + ln - 1; ++q) w[ci[q]] = mark;
+
+        long jlast = i;
+        for (long j = next[i]; j != -1; ) {
+          bool same = len[j] == ln && elen[j] == eln;
+          for (long q = cp[j] + 1; same && q <= cp[j] + ln - 1; ++q)
+            if (w[ci[q]] != mark) same = false;
+
+          if (same) {                 // j is absorbed into i
+            cp[j]    = amd_flip(i);
+            nv[i]   += nv[j];
+            nv[j]    = 0;
+            elen[j]  = -1;
+            j           = next[j];
+            next[jlast] = j;
+          } else {
+            jlast = j;
+            j     = next[j];
+          }
+        }
+      }
+    }
+
+    // Put the vertices still in k back in the degree lists.
+    p = pk1;
+    for (long pk = pk1; pk < pk2; ++pk) {
+      const long i   = ci[pk];
+      const long nvi = -nv[i];
+      if (nvi <= 0) continue;
+
+      nv[i] = nvi;
+      long d = degree[i] + dk - nvi;
+      d = std::min(d, n - nel - nvi);
+
+      if (head[d] != -1) last[head[d]] = i;
+      next[i] = head[d];
+      last[i] = -1;
+      head[d] = i;
+
+      mindeg    = std::min(mindeg, d);
+      degree[i] = d;
+      ci[p++]   = i;
+    }
+
+    nv[k]  = nvk;
+    len[k] = p - pk1;
+    if (len[k] == 0) {
+      cp[k] = -1;
+      w[k]  = 0;
+    }
+    if (elenk != 0) cnz = p;
+  }
+
+  // Every vertex and element now points at the element it went into, or is a root (-1). A postorder of that tree, with
+  // the vertices of each supervariable and element following one another, is the ordering.
+  for (long i = 0; i < n; ++i) cp[i] = amd_flip(cp[i]);
+  head.assign(n + 1, -1);
+
+  for (long j = n; j >= 0; --j) {
+    if (nv[j] > 0) continue;          // merged vertices go in before their representative's element
+    next[j]     = head[cp[j]];
+    head[cp[j]] = j;
+  }
+  for (long e = n; e >= 0; --e) {
+    if (nv[e] <= 0 || cp[e] == -1) continue;
+    next[e]     = head[cp[e]];
+    head[cp[e]] = e;
+  }
+
+  perm.reserve(n + 1);
+  std::vector<long>& stack = w;
+  for (long i = 0; i <= n; ++i) {
+    if (cp[i] != -1) continue;
+
+    long top = 0;
+    stack[0] = i;
+    while (top >= 0) {
+      const long v = stack[top], c = head[v];
+      if (c == -1) {
+        --top;
+        if (v != n) perm.push_back(v);
+      } else {
+        head[v]      = next[c];
+        stack[++top] = c;
+      }
+    }
+  }
+
+  return perm;
+}
+
+
+/*
+ * The elimination tree of C = P*A*P**T, for A with a symmetric pattern, by Liu's algorithm with path compression.
+ * perm[k] is the row of A which is row k of C, and pinv is its inverse. parent[k] is SPARSE_NONE for roots.
+ */
+inline std::vector<size_t> elimination_tree(const size_t n, const std::vector<size_t>& ptr, const std::vector<size_t>& idx,
+                                            const std::vector<size_t>& perm, const std::vector<size_t>& pinv) {
+  std::vector<size_t> parent(n, SPARSE_NONE), ancestor(n, SPARSE_NONE);
+
+  for (size_t k = 0; k < n; ++k) {
+    const size_t j = perm[k];
+
+    for (size_t p = ptr[j]; p < ptr[j+1]; ++p) {
+      // Climb from each entry left of the diagonal to the root of its subtree, which becomes a child of k.
+      size_t i = pinv[idx[p]];
+      while (i != SPARSE_NONE && i < k) {
+        const size_t next = ancestor[i];
+        ancestor[i] = k;
+        if (next == SPARSE_NONE) parent[i] = k;
+        i = next;
+      }
+    }
+  }
+
+  return parent;
+}
+
+
+/*
+ * The column pointers of the Cholesky factor L of C = P*A*P**T. Row k of L is the subtree of the elimination tree
+ * reached by climbing from each entry left of the diagonal in row k of C, so walking those subtrees counts every entry
+ * of L once. Each column also holds its diagonal.
+ */
+inline std::vector<size_t> cholesky_column_pointers(const size_t n, const std::vector<size_t>& ptr, const std::vector<size_t>& idx,
+                                                    const std::vector<size_t>& perm, const std::vector<size_t>& pinv,
+                                                    const std::vector<size_t>& parent) {
+  std::vector<size_t> colptr(n + 1, 0), flag(n, SPARSE_NONE);
+
+  for (size_t k = 0; k < n; ++k) {
+    const size_t j = perm[k];
+    flag[k] = k;
+
+    for (size_t p = ptr[j]; p < ptr[j+1]; ++p) {
+      for (size_t i = pinv[idx[p]]; i < k && flag[i] != k; i = parent[i]) {
+        ++colptr[i+1];
+        flag[i] = k;
+      }
+    }
+  }
+
+  for (size_t k = 0; k < n; ++k) colptr[k+1] += colptr[k] + 1;
+
+  return colptr;
+}
+
+
+/*
+ * Up-looking Cholesky, C = P*A*P**T = L*L**T: row k of L is found by a sparse triangular solve with the rows above it,
+ * whose pattern is row k's subtree of the elimination tree. A's vectors may be its rows or its columns, as it's
+ * symmetric, but both triangles must be stored. perm and pinv, parent and colptr are the symbolic analysis, from
+ * approximate_minimum_degree, elimination_tree and cholesky_column_pointers. L comes back by columns, each with its
+ * diagonal first.
+ *
+ * Returns -1 on success, the first k at which the pivot isn't positive (so A isn't positive definite),
+ * SPARSE_PATTERN_MISMATCH if A has an entry outside the pattern the analysis was made for, or SPARSE_NOT_SYMMETRIC if
+ * A's pattern isn't symmetric. A pattern smaller than the analysed one is fine.
+ */
+template <typename DType>
+inline long cholesky(const CompressedMatrix<DType>& a, const std::vector<size_t>& perm, const std::vector<size_t>& pinv,
+                     const std::vector<size_t>& parent, const std::vector<size_t>& colptr, CompressedMatrix<DType>& l) {
+  const size_t n = a.n;
+
+  // Each row of C is read only up to the diagonal, so a matrix with one triangle stored would lose the other.
+  if (!symmetric_pattern(n, a.ptr, a.idx)) return SPARSE_NOT_SYMMETRIC;
+
+  l.n   = n;
+  l.ptr = colptr;
+  l.idx.resize(colptr[n]);
+  l.val.resize(colptr[n]);
+
+  std::vector<size_t> next(colptr.begin(), colptr.end() - 1), flag(n, SPARSE_NONE), s(n);
+  std::vector<DType>  x(n, 0);
+
+  for (size_t k = 0; k < n; ++k) {
+    const size_t j = perm[k];
+    size_t     top = n;
+
+    // Scatter row k of C's lower triangle into x, and gather the pattern of row k of L onto s[top..n), in an order in
+    // which each entry comes after the ones it depends upon.
+    flag[k] = k;
+    for (size_t p = a.ptr[j]; p < a.ptr[j+1]; ++p) {
+      size_t i = pinv[a.idx[p]];
+      if (i > k) continue;
+
+      x[i] += a.val[p];
+
+      size_t len = 0;
+      while (flag[i] != k) {
+        s[len++] = i;
+        flag[i]  = k;
+        i        = parent[i];
+        if (i == SPARSE_NONE || i > k) return SPARSE_PATTERN_MISMATCH;
+      }
+      while (len > 0) s[--top] = s[--len];
+    }
+
+    DType d = x[k];
+    x[k] = 0;
+
+    for (; top < n; ++top) {
+      const size_t i   = s[top];
+      const DType  lki = x[i] / l.val[l.ptr[i]];
+      x[i] = 0;
+
+      for (size_t q = l.ptr[i] + 1; q < next[i]; ++q) x[l.idx[q]] = x[l.idx[q]] - l.val[q] * lki;
+      d = d - lki * lki;
+
+      if (next[i] == colptr[i+1]) return SPARSE_PATTERN_MISMATCH;
+      l.idx[next[i]]   = k;
+      l.val[next[i]++] = lki;
+    }
+
+    if (!(d > 0)) return k;
+
+    l.idx[next[k]]   = k;
+    l.val[next[k]++] = std::sqrt(d);
+  }
+
+  // Close up any gaps left by entries the analysis allowed for but A doesn't have.
+  size_t nz = 0;
+  for (size_t k = 0; k < n; ++k) {
+    const size_t start = l.ptr[k];
+    l.ptr[k] = nz;
+    for (size_t q = start; q < next[k]; ++q, ++nz) {
+      l.idx[nz] = l.idx[q];
+      l.val[nz] = l.val[q];
+    }
+  }
+  l.ptr[n] = nz;
+  l.idx.resize(nz);
+  l.val.resize(nz);
+
+  return -1;
+}
+
+
+/*
+ * Depth-first search from row j in the graph of the partial L of lu, where column pinv[j] of L (if j has been pivoted on)
+ * gives j's edges. Finished rows are pushed onto xi downwards from top, so xi ends up in topological order; stack and
+ * pstack are scratch of size n. Returns the new top.
+ */
+template <typename DType>
+inline size_t lu_dfs(size_t j, const CompressedMatrix<DType>& l, size_t top, size_t* xi, size_t* stack, size_t* pstack,
+                     const std::vector<size_t>& pinv, std::vector<char>& marked) {
+  size_t head = 1; // one past the top of the stack
+  stack[0] = j;
+
+  while (head > 0) {
+    j = stack[head-1];
+    const size_t jnew = pinv[j];
+
+    if (!marked[j]) {
+      marked[j]       = 1;
+      pstack[head-1]  = jnew == SPARSE_NONE ? 0 : l.ptr[jnew] + 1; // skip L's unit diagonal, which is j itself
+    }
+
+    const size_t end = jnew == SPARSE_NONE ? 0 : l.ptr[jnew+1];
+    bool done = true;
+
+    for (size_t p = pstack[head-1]; p < end; ++p) {
+      const size_t i = l.idx[p];
+      if (marked[i]) continue;
+
+      pstack[head-1] = p + 1;
+      stack[head++]  = i;
+      done = false;
+      break;
+    }
+
+    if (done) {
+      --head;
+      xi[--top] = j;
+    }
+  }
+
+  return top;
+}
+
+
+/*
+ * Left-looking LU with partial pivoting (Gilbert and Peierls), P*A*Q = L*U, for A given by columns and the column
+ * order q. Column k of L and U comes from solving with the columns of L found so far, only ever touching the entries
+ * the result can have. The pivot is the largest entry of what's left, except that the diagonal is kept whenever it's at
+ * least tol times as large; tol = 1 is plain partial pivoting.
+ *
+ * L comes back by columns with its unit diagonal first, and U by columns with its diagonal last; both in the pivoted row
+ * order, which is pinv (row i of A is row pinv[i] of L*U). l and u are reused and their capacity kept, so a matrix which
+ * is refactorized needn't grow them again. Returns -1 on success, or the first column k with no usable pivot.
+ */
+template <typename DType>
+inline long lu(const CompressedMatrix<DType>& a, const std::vector<size_t>& q, const DType tol, CompressedMatrix<DType>& l,
+               CompressedMatrix<DType>& u, std::vector<size_t>& pinv) {
+  const size_t n = a.n;
+
+  l.n = u.n = n;
+  l.ptr.assign(n + 1, 0);
+  u.ptr.assign(n + 1, 0);
+  l.idx.clear(); l.val.clear();
+  u.idx.clear(); u.val.clear();
+  pinv.assign(n, SPARSE_NONE);
+
+  std::vector<size_t> xi(n), stack(n), pstack(n);
+  std::vector<char>   marked(n, 0);
+  std::vector<DType>  x(n, 0);
+
+  for (size_t k = 0; k < n; ++k) {
+    const size_t col = q[k];
+
+    // The pattern of L\A(:,col), from the reach of A(:,col)'s rows in the graph of L.
+    size_t top = n;
+    for (size_t p = a.ptr[col]; p < a.ptr[col+1]; ++p) {
+      if (!marked[a.idx[p]]) top = lu_dfs(a.idx[p], l, top, &xi[0], &stack[0], &pstack[0], pinv, marked);
+    }
+    for (size_t p = top; p < n; ++p) {
+      marked[xi[p]] = 0;
+      x[xi[p]]      = 0;
+    }
+
+    for (size_t p = a.ptr[col]; p < a.ptr[col+1]; ++p) x[a.idx[p]] = a.val[p];
+
+    for (size_t px = top; px < n; ++px) {
+      const size_t j = xi[px], jnew = pinv[j];
+      if (jnew == SPARSE_NONE) continue;
+
+      for (size_t p = l.ptr[jnew] + 1; p < l.ptr[jnew+1]; ++p) x[l.idx[p]] = x[l.idx[p]] - l.val[p] * x[j];
+    }
+
+    // Rows already pivoted on go to U; the largest of the rest is the pivot.
+    size_t ipiv = SPARSE_NONE;
+    DType  amax = -1;
+
+    for (size_t px = top; px < n; ++px) {
+      const size_t i = xi[px];
+
+      if (pinv[i] == SPARSE_NONE) {
+        const DType t = std::abs(x[i]);
+        if (t > amax) {
+          amax = t;
+          ipiv = i;
+        }
+      } else {
+        u.idx.push_back(pinv[i]);
+        u.val.push_back(x[i]);
+      }
+    }
+
+    if (ipiv == SPARSE_NONE || !(amax > 0)) return k;
+    if (pinv[col] == SPARSE_NONE && std::abs(x[col]) >= amax * tol) ipiv = col;
+
+    const DType pivot = x[ipiv];
+    u.idx.push_back(k);
+    u.val.push_back(pivot);
+    pinv[ipiv] = k;
+
+    l.idx.push_back(ipiv);
+    l.val.push_back(1);
+    for (size_t px = top; px < n; ++px) {
+      const size_t i = xi[px];
+      if (pinv[i] != SPARSE_NONE) continue;
+
+      l.idx.push_back(i);
+      l.val.push_back(x[i] / pivot);
+      x[i] = 0;
+    }
+
+    l.ptr[k+1] = l.idx.size();
+    u.ptr[k+1] = u.idx.size();
+  }
+
+  // L's rows were numbered as in A while it was being built.
+  for (size_t p = 0; p < l.idx.size(); ++p) l.idx[p] = pinv[l.idx[p]];
+
+  return -1;
+}
+
+}} // end of namespace nm::math
+
+#endif // SPARSE_FACTOR_H
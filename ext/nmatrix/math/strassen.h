@@ -0,0 +1,249 @@
+/////////////////////////////////////////////////////////////////////
+// = NMatrix
+//
+// A linear algebra library for scientific computation in Ruby.
+// NMatrix is part of SciRuby.
+//
+// NMatrix was originally inspired by and derived from NArray, by
+// Masahiro Tanaka: http://narray.rubyforge.org
+//
+// == Copyright Information
+//
+// SciRuby is Copyright (c) 2010 - 2013, Ruby Science Foundation
+// NMatrix is Copyright (c) 2013, Ruby Science Foundation
+//
+// Please see LICENSE.txt for additional copyright notices.
+//
+// == Contributing
+//
+// By contributing source code to SciRuby, you agree to be bound by
+// our Contributor Agreement:
+//
+// * https://github.com/SciRuby/sciruby/wiki/Contributor-Agreement
+//
+// == strassen.h
+//
+// Strassen-Winograd matrix multiplication for the integer and rational
+// dtypes, which trades one of every eight multiplications for a few
+// additions at each level of recursion, bottoming out in the native
+// gemm.
+//
+
+#ifndef STRASSEN_H
+#define STRASSEN_H
+
+/*
+ * Default for NMatrix::BLAS.strassen_cutoff.
+ */
+#define NM_STRASSEN_CUTOFF 512
+
+extern "C" {
+  size_t  nm_math_strassen_cutoff(void);
+  void    nm_math_set_strassen_cutoff(size_t n);
+}
+
+namespace nm { namespace math {
+
+/*
+ * Which dtypes Strassen is used for, and the type its intermediate sums are kept in. Integers wrap around exactly as
+ * the classical product does, so they can stay as they are; rationals are widened like gemm's accumulator (see
+ * long_dtype.h) so the extra sums don't overflow where the classical product wouldn't. Floating point results would
+ * change, and Ruby objects would be hidden from the garbage collector in the temporaries.
+ */
+template <typename DType>
+struct StrassenType { typedef DType type; static const bool enabled = false; };
+
+template <> struct StrassenType<uint8_t>     { typedef uint8_t     type; static const bool enabled = true; };
+template <> struct StrassenType<int8_t>      { typedef int8_t      type; static const bool enabled = true; };
+template <> struct StrassenType<int16_t>     { typedef int16_t     type; static const bool enabled = true; };
+template <> struct StrassenType<int32_t>     { typedef int32_t     type; static const bool enabled = true; };
+template <> struct StrassenType<int64_t>     { typedef int64_t     type; static const bool enabled = true; };
+template <> struct StrassenType<Rational32>  { typedef Rational128 type; static const bool enabled = true; };
+template <> struct StrassenType<Rational64>  { typedef Rational128 type; static const bool enabled = true; };
+template <> struct StrassenType<Rational128> { typedef Rational128 type; static const bool enabled = true; };
+
+/*
+ * Element sums and differences. int32 and int64 arithmetic isn't promoted to anything wider, so it's done unsigned to
+ * get well-defined wraparound.
+ */
+template <typename DType>
+struct StrassenArith {
+  static inline DType add(const DType& x, const DType& y) { return x + y; }
+  static inline DType sub(const DType& x, const DType& y) { return x - y; }
+};
+
+template <>
+struct StrassenArith<int32_t> {
+  static inline int32_t add(int32_t x, int32_t y) { return static_cast<int32_t>(static_cast<uint32_t>(x) + static_cast<uint32_t>(y)); }
+  static inline int32_t sub(int32_t x, int32_t y) { return static_cast<int32_t>(static_cast<uint32_t>(x) - static_cast<uint32_t>(y)); }
+};
+
+template <>
+struct StrassenArith<int64_t> {
+  static inline int64_t add(int64_t x, int64_t y) { return static_cast<int64_t>(static_cast<uint64_t>(x) + static_cast<uint64_t>(y)); }
+  static inline int64_t sub(int64_t x, int64_t y) { return static_cast<int64_t>(static_cast<uint64_t>(x) - static_cast<uint64_t>(y)); }
+};
+
+
+/*
+ * Row-major Z = X + Y and Z = X - Y. Z may be X or Y.
+ */
+template <typename DType>
+inline void strassen_add(const int rows, const int cols, const DType* X, const int ldx, const DType* Y, const int ldy, DType* Z, const int ldz) {
+  for (int i = 0; i < rows; ++i)
+    for (int j = 0; j < cols; ++j)
+      Z[i*ldz+j] = StrassenArith<DType>::add(X[i*ldx+j], Y[i*ldy+j]);
+}
+
+template <typename DType>
+inline void strassen_sub(const int rows, const int cols, const DType* X, const int ldx, const DType* Y, const int ldy, DType* Z, const int ldz) {
+  for (int i = 0; i < rows; ++i)
+    for (int j = 0; j < cols; ++j)
+      Z[i*ldz+j] = StrassenArith<DType>::sub(X[i*ldx+j], Y[i*ldy+j]);
+}
+
+
+/*
+ * Row-major C = A*B + beta*C with the classical algorithm.
+ */
+template <typename DType>
+inline void strassen_leaf(const int M, const int N, const int K, const DType* A, const int lda, const DType* B, const int ldb,
+                          const DType beta, DType* C, const int ldc) {
+  const DType alpha = 1;
+  gemm_nothrow<DType>(CblasNoTrans, CblasNoTrans, N, M, K, &alpha, B, ldb, A, lda, &beta, C, ldc);
+}
+
+inline bool strassen_recurses(const int M, const int N, const int K, const size_t cutoff) {
+  const size_t smallest = std::min(M, std::min(N, K));
+  return cutoff && smallest >= std::max(cutoff, (size_t)(2));
+}
+
+/*
+ * Elements of temporary space needed by strassen_recurse for an M x K times K x N product.
+ */
+inline size_t strassen_workspace(const int M, const int N, const int K, const size_t cutoff) {
+  if (!strassen_recurses(M, N, K, cutoff)) return 0;
+
+  const int m2 = M / 2, n2 = N / 2, k2 = K / 2;
+  return (size_t)(m2) * std::max(k2, n2) + (size_t)(k2) * n2 + strassen_workspace(m2, n2, k2, cutoff);
+}
+
+
+/*
+ * Row-major C = A*B by Strassen-Winograd: seven half-size products and fifteen additions, scheduled as in Douglas et
+ * al., "GEMMW: A portable level 3 BLAS Winograd variant of Strassen's matrix-matrix multiply algorithm" (1994) so that
+ * each level only needs two temporaries beyond C itself, taken from work (see strassen_workspace). An odd row, column
+ * or inner dimension is peeled off and handled with the classical algorithm afterwards.
+ */
+template <typename DType>
+void strassen_recurse(const int M, const int N, const int K, const DType* A, const int lda, const DType* B, const int ldb,
+                      DType* C, const int ldc, const size_t cutoff, DType* work) {
+  if (!strassen_recurses(M, N, K, cutoff)) {
+    strassen_leaf<DType>(M, N, K, A, lda, B, ldb, 0, C, ldc);
+    return;
+  }
+
+  const int m2 = M / 2, n2 = N / 2, k2 = K / 2;
+
+  const DType *A11 = A,            *A12 = A + k2,
+              *A21 = A + m2*lda,   *A22 = A21 + k2,
+              *B11 = B,            *B12 = B + n2,
+              *B21 = B + k2*ldb,   *B22 = B21 + n2;
+  DType       *C11 = C,            *C12 = C + n2,
+              *C21 = C + m2*ldc,   *C22 = C21 + n2;
+
+  const int ldx = std::max(k2, n2), ldy = n2;
+  DType *X = work, *Y = X + m2*ldx, *next = Y + k2*ldy;
+
+  strassen_sub<DType>(m2, k2, A11, lda, A21, lda, X, ldx);                        // S3 = A11 - A21
+  strassen_sub<DType>(k2, n2, B22, ldb, B12, ldb, Y, ldy);                        // T3 = B22 - B12
+  strassen_recurse<DType>(m2, n2, k2, X, ldx, Y, ldy, C21, ldc, cutoff, next);    // P7 = S3*T3
+  strassen_add<DType>(m2, k2, A21, lda, A22, lda, X, ldx);                        // S1 = A21 + A22
+  strassen_sub<DType>(k2, n2, B12, ldb, B11, ldb, Y, ldy);                        // T1 = B12 - B11
+  strassen_recurse<DType>(m2, n2, k2, X, ldx, Y, ldy, C22, ldc, cutoff, next);    // P5 = S1*T1
+  strassen_sub<DType>(m2, k2, X, ldx, A11, lda, X, ldx);                          // S2 = S1 - A11
+  strassen_sub<DType>(k2, n2, B22, ldb, Y, ldy, Y, ldy);                          // T2 = B22 - T1
+  strassen_recurse<DType>(m2, n2, k2, X, ldx, Y, ldy, C12, ldc, cutoff, next);    // P6 = S2*T2
+  strassen_sub<DType>(m2, k2, A12, lda, X, ldx, X, ldx);                          // S4 = A12 - S2
+  strassen_recurse<DType>(m2, n2, k2, X, ldx, B22, ldb, C11, ldc, cutoff, next);  // P3 = S4*B22
+  strassen_recurse<DType>(m2, n2, k2, A11, lda, B11, ldb, X, ldx, cutoff, next);  // P1 = A11*B11
+  strassen_add<DType>(m2, n2, X, ldx, C12, ldc, C12, ldc);                        // U2 = P1 + P6
+  strassen_add<DType>(m2, n2, C12, ldc, C21, ldc, C21, ldc);                      // U3 = U2 + P7
+  strassen_add<DType>(m2, n2, C12, ldc, C22, ldc, C12, ldc);                      // U4 = U2 + P5
+  strassen_add<DType>(m2, n2, C21, ldc, C22, ldc, C22, ldc);                      // C22 = U3 + P5
+  strassen_add<DType>(m2, n2, C12, ldc, C11, ldc, C12, ldc);                      // C12 = U4 + P3
+  strassen_sub<DType>(k2, n2, Y, ldy, B21, ldb, Y, ldy);                          // T4 = T2 - B21
+  strassen_recurse<DType>(m2, n2, k2, A22, lda, Y, ldy, C11, ldc, cutoff, next);  // P4 = A22*T4
+  strassen_sub<DType>(m2, n2, C21, ldc, C11, ldc, C21, ldc);                      // C21 = U3 - P4
+  strassen_recurse<DType>(m2, n2, k2, A12, lda, B21, ldb, C11, ldc, cutoff, next);// P2 = A12*B21
+  strassen_add<DType>(m2, n2, X, ldx, C11, ldc, C11, ldc);                        // C11 = P1 + P2
+
+  // Peel off whatever didn't divide evenly.
+  if (K > 2*k2) strassen_leaf<DType>(2*m2, 2*n2, 1, A + 2*k2, lda, B + 2*k2*ldb, ldb, 1, C, ldc);
+  if (N > 2*n2) strassen_leaf<DType>(2*m2, 1, K, A, lda, B + 2*n2, ldb, 0, C + 2*n2, ldc);
+  if (M > 2*m2) strassen_leaf<DType>(1, N, K, A + 2*m2*lda, lda, B, ldb, 0, C + 2*m2*ldc, ldc);
+}
+
+
+/*
+ * Copy a row-major block, converting it to another dtype.
+ */
+template <typename LDType, typename RDType>
+inline void strassen_copy(const int rows, const int cols, const RDType* src, const int lds, LDType* dest, const int ldd) {
+  for (int i = 0; i < rows; ++i)
+    for (int j = 0; j < cols; ++j)
+      dest[i*ldd+j] = LDType(src[i*lds+j]);
+}
+
+/*
+ * Runs the recursion in WType, converting the operands and result if that isn't DType.
+ */
+template <typename DType, typename WType>
+struct StrassenRun {
+  static void run(const int M, const int N, const int K, const DType* A, const int lda, const DType* B, const int ldb,
+                  DType* C, const int ldc, const size_t cutoff) {
+    WType* wA   = ALLOC_N(WType, (size_t)(M)*K + (size_t)(K)*N + (size_t)(M)*N + strassen_workspace(M, N, K, cutoff));
+    WType* wB   = wA + (size_t)(M)*K;
+    WType* wC   = wB + (size_t)(K)*N;
+    WType* work = wC + (size_t)(M)*N;
+
+    strassen_copy<WType,DType>(M, K, A, lda, wA, K);
+    strassen_copy<WType,DType>(K, N, B, ldb, wB, N);
+    strassen_recurse<WType>(M, N, K, wA, K, wB, N, wC, N, cutoff, work);
+    strassen_copy<DType,WType>(M, N, wC, N, C, ldc);
+
+    xfree(wA);
+  }
+};
+
+template <typename DType>
+struct StrassenRun<DType,DType> {
+  static void run(const int M, const int N, const int K, const DType* A, const int lda, const DType* B, const int ldb,
+                  DType* C, const int ldc, const size_t cutoff) {
+    DType* work = ALLOC_N(DType, strassen_workspace(M, N, K, cutoff));
+    strassen_recurse<DType>(M, N, K, A, lda, B, ldb, C, ldc, cutoff, work);
+    xfree(work);
+  }
+};
+
+
+/*
+ * Row-major C = A*B by Strassen-Winograd, if DType is an exact dtype and the product is at least
+ * NMatrix::BLAS.strassen_cutoff in every dimension. Returns false, leaving C alone, otherwise.
+ *
+ * The result is exactly what the classical algorithm gives: integers wrap around in the same way, and rationals are
+ * exact unless an intermediate overflows Rational128.
+ */
+template <typename DType>
+inline bool strassen(const int M, const int N, const int K, const DType* A, const int lda, const DType* B, const int ldb,
+                     DType* C, const int ldc) {
+  const size_t cutoff = nm_math_strassen_cutoff();
+  if (!StrassenType<DType>::enabled || !strassen_recurses(M, N, K, cutoff)) return false;
+
+  StrassenRun<DType, typename StrassenType<DType>::type>::run(M, N, K, A, lda, B, ldb, C, ldc, cutoff);
+  return true;
+}
+
+}} // end of namespace nm::math
+
+#endif // STRASSEN_H
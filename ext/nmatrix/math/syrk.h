@@ -0,0 +1,215 @@
+/////////////////////////////////////////////////////////////////////
+// = NMatrix
+//
+// A linear algebra library for scientific computation in Ruby.
+// NMatrix is part of SciRuby.
+//
+// NMatrix was originally inspired by and derived from NArray, by
+// Masahiro Tanaka: http://narray.rubyforge.org
+//
+// == Copyright Information
+//
+// SciRuby is Copyright (c) 2010 - 2013, Ruby Science Foundation
+// NMatrix is Copyright (c) 2013, Ruby Science Foundation
+//
+// Please see LICENSE.txt for additional copyright notices.
+//
+// == Contributing
+//
+// By contributing source code to SciRuby, you agree to be bound by
+// our Contributor Agreement:
+//
+// * https://github.com/SciRuby/sciruby/wiki/Contributor-Agreement
+//
+// == syrk.h
+//
+// Header file for interface with ATLAS's CBLAS syrk and herk functions
+// and native templated versions of them, plus syreflect, which fills
+// in the triangle they leave untouched.
+//
+
+#ifndef SYRK_H
+# define SYRK_H
+
+extern "C" { // These need to be in an extern "C" block or you'll get all kinds of undefined symbol errors.
+  #include <cblas.h>
+}
+
+#include <algorithm> // std::min
+
+#include "math/long_dtype.h"
+
+
+namespace nm { namespace math {
+
+/*
+ * Width of the column blocks syrk_nothrow splits C into.
+ */
+#define NM_SYRK_BLOCK 128
+
+// Defined in gemm.h, which needs syrk for its A == B shortcut.
+template <typename DType>
+inline void gemm_nothrow(const enum CBLAS_TRANSPOSE TransA, const enum CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+                 const DType* alpha, const DType* A, const int lda, const DType* B, const int ldb, const DType* beta, DType* C, const int ldc);
+
+/*
+ * The Uplo triangle of the diagonal block [j0, j1) x [j0, j1) of a syrk, by dot products accumulated in the long
+ * version of DType.
+ */
+template <typename DType>
+inline void syrk_diagonal_block(const enum CBLAS_UPLO Uplo, const enum CBLAS_TRANSPOSE Trans, const int j0, const int j1,
+                                const int K, const DType* alpha, const DType* A, const int lda, const DType* beta, DType* C,
+                                const int ldc)
+{
+  for (int j = j0; j < j1; ++j) {
+    const int i0 = Uplo == CblasUpper ? j0    : j,
+              i1 = Uplo == CblasUpper ? j + 1 : j1;
+
+    for (int i = i0; i < i1; ++i) {
+      typename LongDType<DType>::type temp = 0;
+
+      if (Trans == CblasNoTrans) for (int l = 0; l < K; ++l) temp += A[i+l*lda] * A[j+l*lda];
+      else                       for (int l = 0; l < K; ++l) temp += A[l+i*lda] * A[l+j*lda];
+
+      if (*beta == 0) C[i+j*ldc] = *alpha*temp;
+      else            C[i+j*ldc] = *alpha*temp + *beta*C[i+j*ldc];
+    }
+  }
+}
+
+/*
+ * Native column-major syrk. Only the Uplo triangle of C is read or written:
+ *
+ *   C = alpha*A*A**T + beta*C   (Trans == CblasNoTrans, A is N x K)
+ *   C = alpha*A**T*A + beta*C   (otherwise, A is K x N)
+ *
+ * C is done NM_SYRK_BLOCK columns at a time. The part of each column block strictly inside the triangle is a plain
+ * product, which goes to gemm_nothrow (and so to the blocked, threaded kernel when it's big enough); only the small
+ * triangular blocks on the diagonal are done here. That's about half the multiplications of the equivalent gemm.
+ */
+template <typename DType>
+inline void syrk_nothrow(const enum CBLAS_UPLO Uplo, const enum CBLAS_TRANSPOSE Trans, const int N, const int K,
+                         const DType* alpha, const DType* A, const int lda, const DType* beta, DType* C, const int ldc)
+{
+  // Quick return if possible
+  if (!N || ((*alpha == 0 || !K) && *beta == 1)) return;
+
+  const enum CBLAS_TRANSPOSE TransA = Trans == CblasNoTrans ? CblasNoTrans : CblasTrans,
+                             TransB = Trans == CblasNoTrans ? CblasTrans   : CblasNoTrans;
+
+  for (int j0 = 0; j0 < N; j0 += NM_SYRK_BLOCK) {
+    const int j1 = std::min(N, j0 + NM_SYRK_BLOCK);
+
+    // Rows [r0, r1) of this column block lie strictly inside the triangle.
+    const int r0 = Uplo == CblasUpper ? 0  : j1,
+              r1 = Uplo == CblasUpper ? j0 : N;
+
+    if (r1 > r0) {
+      // Row i of op(A) starts at A + i for A*A**T, and at column i of A for A**T*A.
+      const DType* Ar = Trans == CblasNoTrans ? A + r0 : A + r0*lda;
+      const DType* Aj = Trans == CblasNoTrans ? A + j0 : A + j0*lda;
+
+      gemm_nothrow<DType>(TransA, TransB, r1 - r0, j1 - j0, K, alpha, Ar, lda, Aj, lda, beta, C + r0 + j0*ldc, ldc);
+    }
+
+    syrk_diagonal_block<DType>(Uplo, Trans, j0, j1, K, alpha, A, lda, beta, C, ldc);
+  }
+}
+
+
+/*
+ * Symmetric rank-K update, for any dtype. A row-major matrix is the transpose of the same memory read column-major,
+ * so row-major calls swap both the triangle and the transposition.
+ */
+template <typename DType>
+inline void syrk(const enum CBLAS_ORDER Order, const enum CBLAS_UPLO Uplo, const enum CBLAS_TRANSPOSE Trans, const int N,
+                 const int K, const DType* alpha, const DType* A, const int lda, const DType* beta, DType* C, const int ldc) {
+  if (Order == CblasRowMajor) {
+    syrk_nothrow<DType>(Uplo == CblasUpper ? CblasLower : CblasUpper, Trans == CblasNoTrans ? CblasTrans : CblasNoTrans,
+                        N, K, alpha, A, lda, beta, C, ldc);
+  } else {
+    syrk_nothrow<DType>(Uplo, Trans, N, K, alpha, A, lda, beta, C, ldc);
+  }
+}
+
+/*
+ * Hermitian rank-K update. Only the complex dtypes have a conjugate, and those go to BLAS, so for everything else this
+ * is just syrk.
+ */
+template <typename DType>
+inline void herk(const enum CBLAS_ORDER Order, const enum CBLAS_UPLO Uplo, const enum CBLAS_TRANSPOSE Trans, const int N,
+                 const int K, const DType* alpha, const DType* A, const int lda, const DType* beta, DType* C, const int ldc) {
+  syrk<DType>(Order, Uplo, Trans == CblasConjTrans ? CblasTrans : Trans, N, K, alpha, A, lda, beta, C, ldc);
+}
+
+template <>
+inline void syrk(const enum CBLAS_ORDER Order, const enum CBLAS_UPLO Uplo, const enum CBLAS_TRANSPOSE Trans, const int N,
+                 const int K, const float* alpha, const float* A, const int lda, const float* beta, float* C, const int ldc) {
+  cblas_ssyrk(Order, Uplo, Trans, N, K, *alpha, A, lda, *beta, C, ldc);
+}
+
+template <>
+inline void syrk(const enum CBLAS_ORDER Order, const enum CBLAS_UPLO Uplo, const enum CBLAS_TRANSPOSE Trans, const int N,
+                 const int K, const double* alpha, const double* A, const int lda, const double* beta, double* C, const int ldc) {
+  cblas_dsyrk(Order, Uplo, Trans, N, K, *alpha, A, lda, *beta, C, ldc);
+}
+
+template <>
+inline void syrk(const enum CBLAS_ORDER Order, const enum CBLAS_UPLO Uplo, const enum CBLAS_TRANSPOSE Trans, const int N,
+                 const int K, const Complex64* alpha, const Complex64* A, const int lda, const Complex64* beta, Complex64* C, const int ldc) {
+  cblas_csyrk(Order, Uplo, Trans, N, K, alpha, A, lda, beta, C, ldc);
+}
+
+template <>
+inline void syrk(const enum CBLAS_ORDER Order, const enum CBLAS_UPLO Uplo, const enum CBLAS_TRANSPOSE Trans, const int N,
+                 const int K, const Complex128* alpha, const Complex128* A, const int lda, const Complex128* beta, Complex128* C, const int ldc) {
+  cblas_zsyrk(Order, Uplo, Trans, N, K, alpha, A, lda, beta, C, ldc);
+}
+
+
+template <>
+inline void herk(const enum CBLAS_ORDER Order, const enum CBLAS_UPLO Uplo, const enum CBLAS_TRANSPOSE Trans, const int N,
+                 const int K, const Complex64* alpha, const Complex64* A, const int lda, const Complex64* beta, Complex64* C, const int ldc) {
+  cblas_cherk(Order, Uplo, Trans, N, K, alpha->r, A, lda, beta->r, C, ldc);
+}
+
+template <>
+inline void herk(const enum CBLAS_ORDER Order, const enum CBLAS_UPLO Uplo, const enum CBLAS_TRANSPOSE Trans, const int N,
+                 const int K, const Complex128* alpha, const Complex128* A, const int lda, const Complex128* beta, Complex128* C, const int ldc) {
+  cblas_zherk(Order, Uplo, Trans, N, K, alpha->r, A, lda, beta->r, C, ldc);
+}
+
+
+/*
+ * The conjugate of x if it's complex, otherwise x itself.
+ */
+template <typename DType>
+inline DType conjugate_if_complex(const DType& x) { return x; }
+
+template <>
+inline Complex64 conjugate_if_complex(const Complex64& x) { return x.conjugate(); }
+
+template <>
+inline Complex128 conjugate_if_complex(const Complex128& x) { return x.conjugate(); }
+
+
+/*
+ * Copy the Uplo triangle of an N x N matrix into the other triangle, after syrk (is_complex = false) or herk
+ * (is_complex = true, which conjugates what it copies) has computed only the one.
+ */
+template <bool is_complex, typename DType>
+inline void syreflect(const enum CBLAS_ORDER Order, const enum CBLAS_UPLO Uplo, const int N, DType* C, const int ldc) {
+  // Row-major upper is column-major lower.
+  const bool upper = (Uplo == CblasUpper) == (Order == CblasColMajor);
+
+  for (int j = 0; j < N; ++j) {
+    for (int i = 0; i < j; ++i) {
+      if (upper) C[j+i*ldc] = is_complex ? conjugate_if_complex(C[i+j*ldc]) : C[i+j*ldc];
+      else       C[i+j*ldc] = is_complex ? conjugate_if_complex(C[j+i*ldc]) : C[j+i*ldc];
+    }
+  }
+}
+
+}} // end of namespace nm::math
+
+#endif // SYRK_H
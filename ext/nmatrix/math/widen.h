@@ -0,0 +1,267 @@
+/////////////////////////////////////////////////////////////////////
+// = NMatrix
+//
+// A linear algebra library for scientific computation in Ruby.
+// NMatrix is part of SciRuby.
+//
+// NMatrix was originally inspired by and derived from NArray, by
+// Masahiro Tanaka: http://narray.rubyforge.org
+//
+// == Copyright Information
+//
+// SciRuby is Copyright (c) 2010 - 2013, Ruby Science Foundation
+// NMatrix is Copyright (c) 2013, Ruby Science Foundation
+//
+// Please see LICENSE.txt for additional copyright notices.
+//
+// == Contributing
+//
+// By contributing source code to SciRuby, you agree to be bound by
+// our Contributor Agreement:
+//
+// * https://github.com/SciRuby/sciruby/wiki/Contributor-Agreement
+//
+// == widen.h
+//
+// Integer matrix multiplication into a wider result dtype (e.g., int8
+// times int8 into int32), so that products of small integers don't
+// overflow. int8 -> int32 and int16 -> int64 have SIMD kernels on x86,
+// chosen at runtime: AVX-512 VNNI, AVX-512 or AVX2.
+//
+
+#ifndef WIDEN_H
+#define WIDEN_H
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define NM_HAVE_X86_SIMD 1
+  #include <immintrin.h>
+
+  #if !defined(__clang__) && __GNUC__ >= 8 // __builtin_cpu_supports("avx512vnni") and friends
+    #define NM_HAVE_X86_AVX512 1
+  #endif
+#endif
+
+namespace nm { namespace math {
+
+/*
+ * Packed operands are padded with zeros to a multiple of this many elements, so the SIMD kernels need no tail loops.
+ */
+#define NM_WIDEN_PAD 32
+
+/*
+ * Columns of B (rows of the packed transpose) handled together, so that they stay in cache while every row of A
+ * passes over them.
+ */
+#define NM_WIDEN_COL_BLOCK 128
+
+typedef int32_t (*nm_dot16_32_func)(const int16_t* a, const int16_t* b, int n);
+typedef int64_t (*nm_dot16_64_func)(const int16_t* a, const int16_t* b, int n);
+
+/*
+ * Dot products of padded int16 vectors. The 32-bit versions are only used on values which came from int8, where a
+ * pair of products can't overflow an int32 lane; the 64-bit versions multiply in 32 bits and accumulate in 64.
+ */
+inline int32_t dot16_32_generic(const int16_t* a, const int16_t* b, int n) {
+  int32_t sum = 0;
+  for (int i = 0; i < n; ++i) sum += (int32_t)(a[i]) * b[i];
+  return sum;
+}
+
+inline int64_t dot16_64_generic(const int16_t* a, const int16_t* b, int n) {
+  int64_t sum = 0;
+  for (int i = 0; i < n; ++i) sum += (int32_t)(a[i]) * b[i];
+  return sum;
+}
+
+#ifdef NM_HAVE_X86_SIMD
+__attribute__((target("avx2")))
+inline int32_t dot16_32_avx2(const int16_t* a, const int16_t* b, int n) {
+  __m256i acc = _mm256_setzero_si256();
+
+  for (int i = 0; i < n; i += 16) {
+    __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)),
+            vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+    acc = _mm256_add_epi32(acc, _mm256_madd_epi16(va, vb)); // pmaddwd
+  }
+
+  __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1,0,3,2)));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2,3,0,1)));
+  return _mm_cvtsi128_si32(s);
+}
+
+__attribute__((target("avx2")))
+inline int64_t dot16_64_avx2(const int16_t* a, const int16_t* b, int n) {
+  __m256i acc = _mm256_setzero_si256();
+
+  for (int i = 0; i < n; i += 8) {
+    __m256i va = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i))),
+            vb = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i))),
+            p  = _mm256_mullo_epi32(va, vb);
+    acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(p)));
+    acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(p, 1)));
+  }
+
+  int64_t lanes[4];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+#endif
+
+#ifdef NM_HAVE_X86_AVX512
+__attribute__((target("avx512f,avx512bw,avx512vnni")))
+inline int32_t dot16_32_avx512vnni(const int16_t* a, const int16_t* b, int n) {
+  __m512i acc = _mm512_setzero_si512();
+
+  for (int i = 0; i < n; i += 32) {
+    __m512i va = _mm512_loadu_si512(a + i),
+            vb = _mm512_loadu_si512(b + i);
+    acc = _mm512_dpwssd_epi32(acc, va, vb); // vpdpwssd
+  }
+
+  return _mm512_reduce_add_epi32(acc);
+}
+
+__attribute__((target("avx512f")))
+inline int64_t dot16_64_avx512(const int16_t* a, const int16_t* b, int n) {
+  __m512i acc = _mm512_setzero_si512();
+
+  for (int i = 0; i < n; i += 16) {
+    __m512i va = _mm512_cvtepi16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i))),
+            vb = _mm512_cvtepi16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i))),
+            p  = _mm512_mullo_epi32(va, vb);
+    acc = _mm512_add_epi64(acc, _mm512_cvtepi32_epi64(_mm512_castsi512_si256(p)));
+    acc = _mm512_add_epi64(acc, _mm512_cvtepi32_epi64(_mm512_extracti64x4_epi64(p, 1)));
+  }
+
+  return _mm512_reduce_add_epi64(acc);
+}
+#endif
+
+/*
+ * Pick the best kernels this CPU supports.
+ */
+inline nm_dot16_32_func dot16_32_kernel() {
+#ifdef NM_HAVE_X86_AVX512
+  if (__builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512bw")) return dot16_32_avx512vnni;
+#endif
+#ifdef NM_HAVE_X86_SIMD
+  if (__builtin_cpu_supports("avx2")) return dot16_32_avx2;
+#endif
+  return dot16_32_generic;
+}
+
+inline nm_dot16_64_func dot16_64_kernel() {
+#ifdef NM_HAVE_X86_AVX512
+  if (__builtin_cpu_supports("avx512f")) return dot16_64_avx512;
+#endif
+#ifdef NM_HAVE_X86_SIMD
+  if (__builtin_cpu_supports("avx2")) return dot16_64_avx2;
+#endif
+  return dot16_64_generic;
+}
+
+
+/*
+ * Arguments for one thread's rows of a packed widening multiply. Ap is M x Kp and Bt is N x Kp (B transposed), both
+ * int16 and zero-padded.
+ */
+template <typename WDType>
+struct WidenTask {
+  int             N, Kp;
+  const int16_t*  Ap;
+  const int16_t*  Bt;
+  WDType*         C;
+  int             ldc;
+};
+
+template <typename WDType, typename Kernel>
+void widen_task_run(void* task_, int begin, int end, Kernel dot) {
+  WidenTask<WDType>* t = reinterpret_cast<WidenTask<WDType>*>(task_);
+
+  for (int jb = 0; jb < t->N; jb += NM_WIDEN_COL_BLOCK) {
+    int je = std::min(t->N, jb + NM_WIDEN_COL_BLOCK);
+
+    for (int i = begin; i < end; ++i) {
+      const int16_t* a = t->Ap + (size_t)(i) * t->Kp;
+      for (int j = jb; j < je; ++j)
+        t->C[(size_t)(i) * t->ldc + j] = dot(a, t->Bt + (size_t)(j) * t->Kp, t->Kp);
+    }
+  }
+}
+
+inline void widen_task_run_32(void* task, int begin, int end) {
+  widen_task_run<int32_t>(task, begin, end, dot16_32_kernel());
+}
+
+inline void widen_task_run_64(void* task, int begin, int end) {
+  widen_task_run<int64_t>(task, begin, end, dot16_64_kernel());
+}
+
+
+/*
+ * Pack row-major A (M x K) and B (K x N) into zero-padded int16 rows of A and of B's transpose, and run the dot-product
+ * kernels over them.
+ */
+template <typename DType, typename WDType>
+inline void gemm_widen_packed(const int M, const int N, const int K, const DType* A, const int lda, const DType* B,
+                              const int ldb, WDType* C, const int ldc, nm_parallel_func run) {
+  const int Kp = (K + NM_WIDEN_PAD - 1) / NM_WIDEN_PAD * NM_WIDEN_PAD;
+
+  int16_t* Ap = ALLOC_N(int16_t, (size_t)(M) * Kp);
+  int16_t* Bt = ALLOC_N(int16_t, (size_t)(N) * Kp);
+
+  for (int i = 0; i < M; ++i) {
+    for (int l = 0; l < K; ++l)   Ap[(size_t)(i)*Kp + l] = A[(size_t)(i)*lda + l];
+    for (int l = K; l < Kp; ++l)  Ap[(size_t)(i)*Kp + l] = 0;
+  }
+
+  for (int j = 0; j < N; ++j) {
+    for (int l = 0; l < K; ++l)   Bt[(size_t)(j)*Kp + l] = B[(size_t)(l)*ldb + j];
+    for (int l = K; l < Kp; ++l)  Bt[(size_t)(j)*Kp + l] = 0;
+  }
+
+  WidenTask<WDType> task = { N, Kp, Ap, Bt, C, ldc };
+
+  if (parallel_threads<DType>((double)(M) * N * K) > 1) nm_math_parallel_for(M, 1, run, &task);
+  else                                                  run(&task, 0, M);
+
+  xfree(Ap);
+  xfree(Bt);
+}
+
+
+/*
+ * Row-major C = A * B, where C has a wider integer dtype than A and B, and every product and sum is computed in the
+ * wider type.
+ */
+template <typename DType, typename WDType>
+inline void gemm_widen(const int M, const int N, const int K, const DType* A, const int lda, const DType* B, const int ldb,
+                       WDType* C, const int ldc) {
+  for (int i = 0; i < M; ++i) {
+    WDType* c = C + (size_t)(i) * ldc;
+    for (int j = 0; j < N; ++j) c[j] = 0;
+
+    for (int l = 0; l < K; ++l) {
+      WDType a = A[(size_t)(i) * lda + l];
+      const DType* b = B + (size_t)(l) * ldb;
+      for (int j = 0; j < N; ++j) c[j] += a * (WDType)(b[j]);
+    }
+  }
+}
+
+template <>
+inline void gemm_widen(const int M, const int N, const int K, const int8_t* A, const int lda, const int8_t* B, const int ldb,
+                       int32_t* C, const int ldc) {
+  gemm_widen_packed<int8_t,int32_t>(M, N, K, A, lda, B, ldb, C, ldc, widen_task_run_32);
+}
+
+template <>
+inline void gemm_widen(const int M, const int N, const int K, const int16_t* A, const int lda, const int16_t* B, const int ldb,
+                       int64_t* C, const int ldc) {
+  gemm_widen_packed<int16_t,int64_t>(M, N, K, A, lda, B, ldb, C, ldc, widen_task_run_64);
+}
+
+}} // end of namespace nm::math
+
+#endif // WIDEN_H
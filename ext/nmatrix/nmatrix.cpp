@@ -48,6 +48,7 @@ extern "C" {
 
 #include "types.h"
 #include "data/data.h"
+#include "math/syrk.h" // for math.h
 #include "math/math.h"
 #include "util/io.h"
 #include "storage/storage.h"
@@ -351,7 +352,10 @@ static VALUE nm_capacity(VALUE self);
 static VALUE nm_each_with_indices(VALUE nmatrix);
 static VALUE nm_each_stored_with_indices(VALUE nmatrix);
 
-static SLICE* get_slice(size_t dim, int argc, VALUE* arg, size_t* shape);
+static void get_slice(SLICE* slice, size_t dim, int argc, VALUE* arg, size_t* shape);
+static inline bool get_scalar_coords(VALUE self, int argc, VALUE* argv, size_t* coords);
+static inline VALUE scalar_get(VALUE self, size_t* coords);
+static inline void scalar_set(VALUE self, size_t* coords, VALUE value);
 static VALUE nm_xslice(int argc, VALUE* argv, void* (*slice_func)(STORAGE*, SLICE*), void (*delete_func)(NMATRIX*), VALUE self);
 static VALUE nm_mset(int argc, VALUE* argv, VALUE self);
 static VALUE nm_mget(int argc, VALUE* argv, VALUE self);
@@ -399,19 +403,32 @@ static VALUE nm_hermitian(VALUE self);
 static VALUE nm_eqeq(VALUE left, VALUE right);
 
 static VALUE matrix_multiply_scalar(NMATRIX* left, VALUE scalar);
-static VALUE matrix_multiply(NMATRIX* left, NMATRIX* right);
-static VALUE nm_multiply(VALUE left_v, VALUE right_v);
+static VALUE matrix_multiply(NMATRIX* left, NMATRIX* right, nm::dtype_t result_dtype);
+static VALUE matrix_multiply_yale_dense(NMATRIX* left, NMATRIX* right, nm::dtype_t result_dtype);
+static VALUE matrix_multiply_masked(NMATRIX* left, NMATRIX* right, NMATRIX* mask);
+static VALUE nm_multiply(int argc, VALUE* argv, VALUE left_v);
+static VALUE nm_masked_multiply(VALUE left_v, VALUE right_v, VALUE mask_v);
+static VALUE nm_scale(VALUE self, VALUE scalar);
 static VALUE nm_det_exact(VALUE self);
+static VALUE nm_gram(VALUE self);
+static VALUE nm_outer_self(VALUE self);
+static VALUE nm_batch_dot(VALUE self, VALUE other);
+static VALUE nm_batch_invert(VALUE self);
+static VALUE nm_batch_solve(VALUE self, VALUE b);
+static VALUE nm_krylov(VALUE self, VALUE b, VALUE x, VALUE method, VALUE preconditioner, VALUE tol, VALUE max_iter, VALUE restart);
 static VALUE nm_complex_conjugate_bang(VALUE self);
 
 static nm::dtype_t	interpret_dtype(int argc, VALUE* argv, nm::stype_t stype);
-static void*		interpret_initial_value(VALUE arg, nm::dtype_t dtype);
+static void*		alloc_initial_values(size_t count, nm::dtype_t dtype, size_t dense_count);
+static void*		interpret_initial_value(VALUE arg, nm::dtype_t dtype, size_t dense_count);
 static size_t*	interpret_shape(VALUE arg, size_t* dim);
 static nm::stype_t	interpret_stype(VALUE arg);
 
 /* Singleton methods */
 static VALUE nm_itype_by_shape(VALUE self, VALUE shape_arg);
 static VALUE nm_upcast(VALUE self, VALUE t1, VALUE t2);
+static VALUE nm_get_huge_page_threshold(VALUE self);
+static VALUE nm_set_huge_page_threshold(VALUE self, VALUE bytes);
 
 
 #ifdef BENCHMARK
@@ -458,6 +475,8 @@ void Init_nmatrix() {
 	rb_define_singleton_method(cNMatrix, "itype_by_shape", (METHOD)nm_itype_by_shape, 1);
 	rb_define_singleton_method(cNMatrix, "guess_dtype", (METHOD)nm_guess_dtype, 1);
 	rb_define_singleton_method(cNMatrix, "min_dtype", (METHOD)nm_min_dtype, 1);
+	rb_define_singleton_method(cNMatrix, "huge_page_threshold", (METHOD)nm_get_huge_page_threshold, 0);
+	rb_define_singleton_method(cNMatrix, "huge_page_threshold=", (METHOD)nm_set_huge_page_threshold, 1);
 
 	//////////////////////
 	// Instance Methods //
@@ -524,11 +543,24 @@ void Init_nmatrix() {
 	// Helper Instance Methods //
 	/////////////////////////////
 	rb_define_protected_method(cNMatrix, "__yale_vector_set__", (METHOD)nm_vector_set, -1);
+	rb_define_protected_method(cNMatrix, "__yale_cholesky_analyze__", (METHOD)nm_yale_cholesky_analyze, 0);
+	rb_define_protected_method(cNMatrix, "__yale_cholesky__", (METHOD)nm_yale_cholesky, 3);
+	rb_define_protected_method(cNMatrix, "__yale_lu_analyze__", (METHOD)nm_yale_lu_analyze, 0);
+	rb_define_protected_method(cNMatrix, "__yale_lu__", (METHOD)nm_yale_lu, 2);
+	rb_define_singleton_method(cNMatrix, "__yale_factor_solve__", (METHOD)nm_yale_factor_solve, 5);
 
 	/////////////////////////
 	// Matrix Math Methods //
 	/////////////////////////
-	rb_define_method(cNMatrix, "dot",		(METHOD)nm_multiply,		1);
+	rb_define_method(cNMatrix, "dot",		(METHOD)nm_multiply,		-1);
+	rb_define_method(cNMatrix, "masked_dot", (METHOD)nm_masked_multiply, 2);
+	rb_define_method(cNMatrix, "scale", (METHOD)nm_scale, 1);
+	rb_define_method(cNMatrix, "gram", (METHOD)nm_gram, 0);
+	rb_define_method(cNMatrix, "outer_self", (METHOD)nm_outer_self, 0);
+	rb_define_method(cNMatrix, "batch_dot", (METHOD)nm_batch_dot, 1);
+	rb_define_method(cNMatrix, "batch_invert", (METHOD)nm_batch_invert, 0);
+	rb_define_method(cNMatrix, "batch_solve", (METHOD)nm_batch_solve, 1);
+	rb_define_protected_method(cNMatrix, "__krylov__", (METHOD)nm_krylov, 7);
 
 	rb_define_method(cNMatrix, "symmetric?", (METHOD)nm_symmetric, 0);
 	rb_define_method(cNMatrix, "hermitian?", (METHOD)nm_hermitian, 0);
@@ -578,25 +610,6 @@ void Init_nmatrix() {
 //////////////////
 
 
-/*
- * Slice constructor.
- */
-static SLICE* alloc_slice(size_t dim) {
-  SLICE* slice = ALLOC(SLICE);
-  slice->coords = ALLOC_N(size_t, dim);
-  slice->lengths = ALLOC_N(size_t, dim);
-  return slice;
-}
-
-
-/*
- * Slice destructor.
- */
-static void free_slice(SLICE* slice) {
-  xfree(slice->coords);
-  xfree(slice->lengths);
-  xfree(slice);
-}
 
 
 /*
@@ -730,6 +743,34 @@ static VALUE nm_upcast(VALUE self, VALUE t1, VALUE t2) {
 }
 
 
+/*
+ * call-seq:
+ *     huge_page_threshold -> Integer or nil
+ *
+ * Dense matrices whose elements take up at least this many bytes are allocated on huge pages, where the OS supports
+ * it (madvise(MADV_HUGEPAGE)). nil means huge pages are never requested.
+ */
+static VALUE nm_get_huge_page_threshold(VALUE self) {
+  size_t bytes = nm_dense_storage_huge_page_threshold();
+  return bytes ? SIZET2NUM(bytes) : Qnil;
+}
+
+/*
+ * call-seq:
+ *     huge_page_threshold = bytes -> Integer or nil
+ *
+ * Set the minimum size in bytes of a dense element buffer which should be backed by huge pages, e.g.,
+ *
+ *     NMatrix.huge_page_threshold = 64 * 1024 * 1024
+ *
+ * Use nil to turn this off (the default). Only affects matrices created afterwards.
+ */
+static VALUE nm_set_huge_page_threshold(VALUE self, VALUE bytes) {
+  nm_dense_storage_set_huge_page_threshold(bytes == Qnil ? 0 : NUM2SIZET(bytes));
+  return bytes;
+}
+
+
 /*
  * call-seq:
        default_value -> ...
@@ -880,7 +921,7 @@ static VALUE nm_complex_conjugate_bang(VALUE self) {
   if (m->stype == nm::DENSE_STORE) {
 
     size = nm_storage_count_max_elements(NM_STORAGE(self));
-    elem = NM_STORAGE_DENSE(self)->elements;
+    elem = NM_DENSE_WRITABLE_ELEMENTS(self);
 
   } else if (m->stype == nm::YALE_STORE) {
 
@@ -1013,6 +1054,13 @@ static VALUE nm_init(int argc, VALUE* argv, VALUE nm) {
   // 2-3: dtype
   nm::dtype_t dtype = interpret_dtype(argc-1-offset, argv+offset+1, stype);
 
+  // Dense matrices adopt initial values which fill them (see alloc_initial_values).
+  size_t dense_count = 0;
+  if (stype == nm::DENSE_STORE) {
+    dense_count = 1;
+    for (size_t i = 0; i < dim; ++i) dense_count *= shape[i];
+  }
+
   size_t init_cap = 0, init_val_len = 0;
   void* init_val  = NULL;
   if (!SYMBOL_P(argv[1+offset]) || TYPE(argv[1+offset]) == T_ARRAY) {
@@ -1023,7 +1071,7 @@ static VALUE nm_init(int argc, VALUE* argv, VALUE nm) {
 
     } else {
     	// 4: initial value / dtype
-      init_val = interpret_initial_value(argv[1+offset], dtype);
+      init_val = interpret_initial_value(argv[1+offset], dtype, dense_count);
 
       if (TYPE(argv[1+offset]) == T_ARRAY) 	init_val_len = RARRAY_LEN(argv[1+offset]);
       else                                  init_val_len = 1;
@@ -1039,7 +1087,7 @@ static VALUE nm_init(int argc, VALUE* argv, VALUE nm) {
     	 */
       if (dtype == nm::RUBYOBJ) {
       	// Pretend [nil] was passed for RUBYOBJ.
-      	init_val = ALLOC(VALUE);
+      	init_val = alloc_initial_values(1, dtype, dense_count);
         *(VALUE*)init_val = Qnil;
 
         init_val_len = 1;
@@ -1143,9 +1191,13 @@ static VALUE nm_init_copy(VALUE copy, VALUE original) {
 
   lhs->stype = rhs->stype;
 
-  // Copy the storage
-  CAST_TABLE(ttable);
-  lhs->storage = ttable[lhs->stype][rhs->stype](rhs->storage, rhs->storage->dtype, NULL);
+  // Copy the storage. Dense elements are shared until the first write to either matrix.
+  if (rhs->stype == nm::DENSE_STORE) {
+    lhs->storage = reinterpret_cast<STORAGE*>(nm_dense_storage_copy_on_write(reinterpret_cast<DENSE_STORAGE*>(rhs->storage)));
+  } else {
+    CAST_TABLE(ttable);
+    lhs->storage = ttable[lhs->stype][rhs->stype](rhs->storage, rhs->storage->dtype, NULL);
+  }
 
   return copy;
 }
@@ -1479,6 +1531,9 @@ static VALUE nm_is_ref(VALUE self) {
  *
  */
 static VALUE nm_mget(int argc, VALUE* argv, VALUE self) {
+  size_t coords[2];
+  if (get_scalar_coords(self, argc, argv, coords)) return scalar_get(self, coords);
+
   static void* (*ttable[nm::NUM_STYPES])(STORAGE*, SLICE*) = {
     nm_dense_storage_get,
     nm_list_storage_get,
@@ -1498,6 +1553,9 @@ static VALUE nm_mget(int argc, VALUE* argv, VALUE self) {
  *
  */
 static VALUE nm_mref(int argc, VALUE* argv, VALUE self) {
+  size_t coords[2];
+  if (get_scalar_coords(self, argc, argv, coords)) return scalar_get(self, coords);
+
   static void* (*ttable[nm::NUM_STYPES])(STORAGE*, SLICE*) = {
     nm_dense_storage_ref,
     nm_list_storage_ref,
@@ -1521,7 +1579,16 @@ static VALUE nm_mset(int argc, VALUE* argv, VALUE self) {
   if ((size_t)(argc) > NM_DIM(self)+1) {
     rb_raise(rb_eArgError, "wrong number of arguments (%d for %u)", argc, effective_dim(NM_STORAGE(self))+1);
   } else {
-    SLICE* slice = get_slice(dim, argc-1, argv, NM_STORAGE(self)->shape);
+    size_t coords[2];
+    VALUE  value = argv[argc-1];
+
+    if (TYPE(value) != T_DATA && TYPE(value) != T_ARRAY && get_scalar_coords(self, argc-1, argv, coords)) {
+      scalar_set(self, coords, value);
+      return value;
+    }
+
+    NM_ALLOCA_SLICE(slice, dim);
+    get_slice(&slice, dim, argc-1, argv, NM_STORAGE(self)->shape);
 
     static void (*ttable[nm::NUM_STYPES])(VALUE, SLICE*, VALUE) = {
       nm_dense_storage_set,
@@ -1529,9 +1596,7 @@ static VALUE nm_mset(int argc, VALUE* argv, VALUE self) {
       nm_yale_storage_set
     };
 
-    ttable[NM_STYPE(self)](self, slice, argv[argc-1]);
-
-    free_slice(slice);
+    ttable[NM_STYPE(self)](self, &slice, argv[argc-1]);
 
     return argv[argc-1];
   }
@@ -1539,14 +1604,28 @@ static VALUE nm_mset(int argc, VALUE* argv, VALUE self) {
 }
 
 /*
+ * call-seq:
+ *     dot(matrix) -> NMatrix
+ *     dot(matrix, result_dtype) -> NMatrix
+ *
  * Matrix multiply (dot product): against another matrix or a vector.
  *
  * For elementwise, use * instead.
  *
  * The two matrices must be of the same stype (for now). If dtype differs, an upcast will occur.
+ *
+ * Upcasting never widens integers, so the product of two :int8 matrices is :int8 and will usually overflow. Pass a
+ * wider result_dtype to have the products and sums computed in that dtype instead:
+ *
+ *     a.dot(b, :int32) # a and b are :int8
+ *
+ * Dense :int8 x :int8 -> :int32 and :int16 x :int16 -> :int64 products use SIMD kernels where the CPU has them.
  */
-static VALUE nm_multiply(VALUE left_v, VALUE right_v) {
+static VALUE nm_multiply(int argc, VALUE* argv, VALUE left_v) {
   NMATRIX *left, *right;
+  VALUE right_v, result_dtype_v;
+
+  rb_scan_args(argc, argv, "11", &right_v, &result_dtype_v);
 
   UnwrapNMatrix( left_v, left );
 
@@ -1563,10 +1642,15 @@ static VALUE nm_multiply(VALUE left_v, VALUE right_v) {
     if (left->storage->shape[1] != right->storage->shape[0])
       rb_raise(rb_eArgError, "incompatible dimensions");
 
-    if (left->stype != right->stype)
+    // Yale and dense matrices can be multiplied together; otherwise the stypes must match.
+    if (left->stype != right->stype &&
+        !(left->stype == nm::YALE_STORE && right->stype == nm::DENSE_STORE) && !(left->stype == nm::DENSE_STORE && right->stype == nm::YALE_STORE))
       rb_raise(rb_eNotImpError, "matrices must have same stype");
 
-    return matrix_multiply(left, right);
+    nm::dtype_t result_dtype = NIL_P(result_dtype_v) ? Upcast[left->storage->dtype][right->storage->dtype]
+                                                     : nm_dtype_from_rbsymbol(result_dtype_v);
+
+    return matrix_multiply(left, right, result_dtype);
 
   }
 
@@ -1574,6 +1658,53 @@ static VALUE nm_multiply(VALUE left_v, VALUE right_v) {
 }
 
 
+/*
+ * call-seq:
+ *     masked_dot(other, mask) -> NMatrix
+ *
+ * The product of two Yale matrices, but only at the positions where the Yale matrix mask is nonzero: the same as
+ * dot(other) with every entry outside mask's pattern dropped. Only the masked entries are ever accumulated, so this
+ * needs memory for mask rather than for the whole product, which is much denser for things like counting triangles
+ * (a.masked_dot(a, a)). The values of mask are not multiplied in.
+ */
+static VALUE nm_masked_multiply(VALUE left_v, VALUE right_v, VALUE mask_v) {
+  NMATRIX *left, *right, *mask;
+
+  CheckNMatrixType(right_v);
+  CheckNMatrixType(mask_v);
+  UnwrapNMatrix( left_v, left );
+  UnwrapNMatrix( right_v, right );
+  UnwrapNMatrix( mask_v, mask );
+
+  if (left->stype != nm::YALE_STORE || right->stype != nm::YALE_STORE || mask->stype != nm::YALE_STORE)
+    rb_raise(rb_eNotImpError, "masked products are only supported for Yale matrices");
+
+  if (left->storage->shape[1] != right->storage->shape[0])
+    rb_raise(rb_eArgError, "incompatible dimensions");
+
+  if (mask->storage->shape[0] != left->storage->shape[0] || mask->storage->shape[1] != right->storage->shape[1])
+    rb_raise(rb_eArgError, "mask must have the shape of the product");
+
+  return matrix_multiply_masked(left, right, mask);
+}
+
+
+/*
+ * call-seq:
+ *     scale(scalar) -> NMatrix
+ *
+ * Multiply every element by a number, without changing the stype. Equivalent to dot or * with a scalar.
+ */
+static VALUE nm_scale(VALUE self, VALUE scalar) {
+  if (!NM_RUBYVAL_IS_NUMERIC(scalar)) rb_raise(rb_eArgError, "expected a number");
+
+  NMATRIX* m;
+  UnwrapNMatrix(self, m);
+
+  return matrix_multiply_scalar(m, scalar);
+}
+
+
 /*
  * call-seq:
  *     dim -> Integer
@@ -1708,29 +1839,28 @@ static VALUE nm_xslice(int argc, VALUE* argv, void* (*slice_func)(STORAGE*, SLIC
   if (NM_DIM(self) < (size_t)(argc)) {
     rb_raise(rb_eArgError, "wrong number of arguments (%d for %u)", argc, effective_dim(s));
   } else {
-    SLICE* slice = get_slice(NM_DIM(self), argc, argv, s->shape);
+    NM_ALLOCA_SLICE(slice, NM_DIM(self));
+    get_slice(&slice, NM_DIM(self), argc, argv, s->shape);
 
-    if (slice->single) {
+    if (slice.single) {
       static void* (*ttable[nm::NUM_STYPES])(STORAGE*, SLICE*) = {
         nm_dense_storage_ref,
         nm_list_storage_ref,
         nm_yale_storage_ref
       };
 
-      if (NM_DTYPE(self) == nm::RUBYOBJ)  result = *reinterpret_cast<VALUE*>( ttable[NM_STYPE(self)](s, slice) );
-      else                                result = rubyobj_from_cval( ttable[NM_STYPE(self)](s, slice), NM_DTYPE(self) ).rval;
+      if (NM_DTYPE(self) == nm::RUBYOBJ)  result = *reinterpret_cast<VALUE*>( ttable[NM_STYPE(self)](s, &slice) );
+      else                                result = rubyobj_from_cval( ttable[NM_STYPE(self)](s, &slice), NM_DTYPE(self) ).rval;
 
     } else {
       STYPE_MARK_TABLE(mark_table);
 
       NMATRIX* mat  = ALLOC(NMATRIX);
       mat->stype    = NM_STYPE(self);
-      mat->storage  = (STORAGE*)((*slice_func)( s, slice ));
+      mat->storage  = (STORAGE*)((*slice_func)( s, &slice ));
 
       result        = Data_Wrap_Struct(CLASS_OF(self), mark_table[mat->stype], delete_func, mat);
     }
-
-    free_slice(slice);
   }
 
   return result;
@@ -1750,6 +1880,10 @@ static VALUE elementwise_op(nm::ewop_t op, VALUE left_val, VALUE right_val) {
 	UnwrapNMatrix(left_val, left);
 
   if (TYPE(right_val) != T_DATA || (RDATA(right_val)->dfree != (RUBY_DATA_FUNC)nm_delete && RDATA(right_val)->dfree != (RUBY_DATA_FUNC)nm_delete_ref)) {
+    // Multiplication by a number is done natively.
+    if (op == nm::EW_MUL && NM_RUBYVAL_IS_NUMERIC(right_val))
+      return matrix_multiply_scalar(left, right_val);
+
     // This is a matrix-scalar element-wise operation.
     std::string sym;
     switch(left->stype) {
@@ -1883,9 +2017,9 @@ nm::dtype_t nm_dtype_min_rational(VALUE vv) {
   rubyval_to_cval(vv, nm::RATIONAL128, v);
 
   int64_t i = std::max(std::abs(v->n), v->d);
-  if (i <= SHRT_MAX) return nm::INT16;
-  else if (i <= INT_MAX) return nm::INT32;
-  else return nm::INT64;
+  if (i <= SHRT_MAX) return nm::RATIONAL32;
+  else if (i <= INT_MAX) return nm::RATIONAL64;
+  else return nm::RATIONAL128;
 }
 
 /*
@@ -1998,14 +2132,86 @@ nm::dtype_t nm_dtype_guess(VALUE v) {
 
 
 /*
- * Allocate and return a SLICE object, which will contain the appropriate coordinate and length information for
- * accessing some part of a matrix.
+ * Fast path for element access: if self is a 1- or 2-dimensional dense or Yale matrix and every argument is a Fixnum
+ * within bounds, fill in coords and return true. Otherwise return false, and the caller should go through get_slice
+ * (which also produces the appropriate errors).
  */
-static SLICE* get_slice(size_t dim, int argc, VALUE* arg, size_t* shape) {
+static inline bool get_scalar_coords(VALUE self, int argc, VALUE* argv, size_t* coords) {
+  STORAGE* s = NM_STORAGE(self);
+
+  if (NM_STYPE(self) == nm::LIST_STORE || s->dim > 2 || (size_t)(argc) != s->dim) return false;
+
+  for (size_t i = 0; i < s->dim; ++i) {
+    if (!FIXNUM_P(argv[i])) return false;
+
+    long c = FIX2LONG(argv[i]);
+    if (c < 0 || (size_t)(c) >= s->shape[i]) return false;
+
+    coords[i] = c;
+  }
+
+  return true;
+}
+
+
+/*
+ * Read a single element located by get_scalar_coords, without allocating a slice.
+ */
+static inline VALUE scalar_get(VALUE self, size_t* coords) {
+  void* elem;
+
+  if (NM_STYPE(self) == nm::DENSE_STORE) {
+    DENSE_STORAGE* s = NM_STORAGE_DENSE(self);
+    size_t pos = 0;
+    for (size_t i = 0; i < s->dim; ++i)
+      pos += (coords[i] + s->offset[i]) * s->stride[i];
+
+    elem = reinterpret_cast<char*>(s->elements) + pos * DTYPE_SIZES[s->dtype];
+
+  } else {
+    size_t lengths[2] = {1, 1};
+    SLICE  slice      = {coords, lengths, true};
+
+    elem = nm_yale_storage_ref(NM_STORAGE(self), &slice);
+  }
+
+  if (NM_DTYPE(self) == nm::RUBYOBJ)  return *reinterpret_cast<VALUE*>(elem);
+  else                                return rubyobj_from_cval(elem, NM_DTYPE(self)).rval;
+}
+
+
+/*
+ * Write a single (non-matrix) value to an element located by get_scalar_coords. Dense matrices are written in place;
+ * Yale matrices convert the value on the stack.
+ */
+static inline void scalar_set(VALUE self, size_t* coords, VALUE value) {
+  if (NM_STYPE(self) == nm::DENSE_STORE) {
+    DENSE_STORAGE* s = NM_STORAGE_DENSE(self);
+    nm_dense_storage_unshare(s);
+
+    size_t pos = 0;
+    for (size_t i = 0; i < s->dim; ++i)
+      pos += (coords[i] + s->offset[i]) * s->stride[i];
+
+    rubyval_to_cval(value, s->dtype, reinterpret_cast<char*>(s->elements) + pos * DTYPE_SIZES[s->dtype]);
+
+  } else {
+    size_t lengths[2] = {1, 1};
+    SLICE  slice      = {coords, lengths, true};
+
+    nm_yale_storage_set(self, &slice, value);
+  }
+}
+
+
+/*
+ * Fill in a SLICE object (usually declared with NM_ALLOCA_SLICE) with the appropriate coordinate and length
+ * information for accessing some part of a matrix.
+ */
+static void get_slice(SLICE* slice, size_t dim, int argc, VALUE* arg, size_t* shape) {
   VALUE beg, end;
   int excl;
 
-  SLICE* slice = alloc_slice(dim);
   slice->single = true;
 
   // r is the shape position; t is the slice position. They may differ when we're dealing with a
@@ -2050,8 +2256,6 @@ static SLICE* get_slice(size_t dim, int argc, VALUE* arg, size_t* shape) {
     if (slice->coords[r] > shape[r] || slice->coords[r] + slice->lengths[r] > shape[r])
       rb_raise(rb_eRangeError, "slice is larger than matrix in dimension %u (slice component %u)", r, t);
   }
-
-  return slice;
 }
 
 #ifdef BENCHMARK
@@ -2105,16 +2309,27 @@ static nm::dtype_t interpret_dtype(int argc, VALUE* argv, nm::stype_t stype) {
 }
 
 /*
- * Convert an Ruby value or an array of Ruby values into initial C values.
+ * A buffer for count initial values of a new matrix. nm_dense_storage_create adopts one that holds all dense_count
+ * elements of a dense matrix (dense_count is 0 for other stypes), so that comes from the dense allocator; anything
+ * shorter is copied and freed with xfree.
+ */
+static void* alloc_initial_values(size_t count, nm::dtype_t dtype, size_t dense_count) {
+  if (count > 0 && count == dense_count) return nm_dense_storage_alloc_elements(DTYPE_SIZES[dtype] * count);
+  return ALLOC_N(char, DTYPE_SIZES[dtype] * count);
+}
+
+/*
+ * Convert an Ruby value or an array of Ruby values into initial C values, for a matrix with dense_count elements if
+ * it's dense.
  */
-static void* interpret_initial_value(VALUE arg, nm::dtype_t dtype) {
+static void* interpret_initial_value(VALUE arg, nm::dtype_t dtype, size_t dense_count) {
   unsigned int index;
   void* init_val;
 
   if (TYPE(arg) == T_ARRAY) {
   	// Array
 
-    init_val = ALLOC_N(int8_t, DTYPE_SIZES[dtype] * RARRAY_LEN(arg));
+    init_val = alloc_initial_values(RARRAY_LEN(arg), dtype, dense_count);
     for (index = 0; index < RARRAY_LEN(arg); ++index) {
     	rubyval_to_cval(RARRAY_PTR(arg)[index], dtype, (char*)init_val + (index * DTYPE_SIZES[dtype]));
     }
@@ -2122,7 +2337,8 @@ static void* interpret_initial_value(VALUE arg, nm::dtype_t dtype) {
   } else {
   	// Single value
 
-    init_val = rubyobj_to_cval(arg, dtype);
+    init_val = alloc_initial_values(1, dtype, dense_count);
+    rubyval_to_cval(arg, dtype, init_val);
   }
 
   return init_val;
@@ -2178,17 +2394,20 @@ static nm::stype_t interpret_stype(VALUE arg) {
 // Math Helpers //
 //////////////////
 
+/*
+ * Get storage of the given dtype for an operand, copying only if necessary. Dense references are returned as they are,
+ * since the dense math reads them in place (using the source's stride as the leading dimension).
+ */
 STORAGE* matrix_storage_cast_alloc(NMATRIX* matrix, nm::dtype_t new_dtype) {
-  if (matrix->storage->dtype == new_dtype && !is_ref(matrix))
+  if (matrix->storage->dtype == new_dtype && (!is_ref(matrix) || matrix->stype == nm::DENSE_STORE))
     return matrix->storage;
 
   CAST_TABLE(cast_copy_storage);
   return cast_copy_storage[matrix->stype][matrix->stype](matrix->storage, new_dtype, NULL);
 }
 
-STORAGE_PAIR binary_storage_cast_alloc(NMATRIX* left_matrix, NMATRIX* right_matrix) {
+STORAGE_PAIR binary_storage_cast_alloc(NMATRIX* left_matrix, NMATRIX* right_matrix, nm::dtype_t new_dtype) {
   STORAGE_PAIR casted;
-  nm::dtype_t new_dtype = Upcast[left_matrix->storage->dtype][right_matrix->storage->dtype];
 
   casted.left  = matrix_storage_cast_alloc(left_matrix, new_dtype);
   casted.right = matrix_storage_cast_alloc(right_matrix, new_dtype);
@@ -2196,54 +2415,204 @@ STORAGE_PAIR binary_storage_cast_alloc(NMATRIX* left_matrix, NMATRIX* right_matr
   return casted;
 }
 
+/*
+ * Multiply every element of a matrix by a scalar, giving a new matrix of the same stype. The result's dtype is the
+ * upcast of the matrix's and the smallest which holds the scalar, as for the element-wise operations. Only stored
+ * values are touched, so for Yale this is O(nnz) and leaves the structure as it is.
+ */
 static VALUE matrix_multiply_scalar(NMATRIX* left, VALUE scalar) {
-  rb_raise(rb_eNotImpError, "matrix-scalar multiplication not implemented yet");
-  return Qnil;
+  STYPE_MARK_TABLE(mark_table);
+  CAST_TABLE(cast_copy_storage);
+
+  static void (*storage_scale[nm::NUM_STYPES])(STORAGE*, const void*) = {
+    nm_dense_storage_scale,
+    nm_list_storage_scale,
+    nm_yale_storage_scale
+  };
+
+  nm::dtype_t dtype = Upcast[left->storage->dtype][nm_dtype_min(scalar)];
+
+  void* s = ALLOCA_N(char, DTYPE_SIZES[dtype]);
+  rubyval_to_cval(scalar, dtype, s);
+
+  // Wrap the copy before scaling it, so that the garbage collector can see any Ruby objects it ends up holding.
+  NMATRIX* result = nm_create(left->stype, cast_copy_storage[left->stype][left->stype](left->storage, dtype, NULL));
+  VALUE result_v  = Data_Wrap_Struct(cNMatrix, mark_table[left->stype], nm_delete, result);
+
+  storage_scale[left->stype](result->storage, s);
+
+  return result_v;
 }
 
-static VALUE matrix_multiply(NMATRIX* left, NMATRIX* right) {
+static VALUE matrix_multiply(NMATRIX* left, NMATRIX* right, nm::dtype_t result_dtype) {
   ///TODO: multiplication for non-dense and/or non-decimal matrices
+  STYPE_MARK_TABLE(mark_table);
 
-  // Make sure both of our matrices are of the correct type.
-  STORAGE_PAIR casted = binary_storage_cast_alloc(left, right);
+  // Sparse-dense and sparse matrix-vector products skip the symbolic passes of the general sparse product.
+  if ((left->stype == nm::YALE_STORE && (right->stype == nm::DENSE_STORE || right->storage->shape[1] == 1)) ||
+      (left->stype == nm::DENSE_STORE && right->stype == nm::YALE_STORE))
+    return matrix_multiply_yale_dense(left, right, result_dtype);
 
   size_t*  resulting_shape   = ALLOC_N(size_t, 2);
   resulting_shape[0] = left->storage->shape[0];
   resulting_shape[1] = right->storage->shape[1];
 
-  // Sometimes we only need to use matrix-vector multiplication (e.g., GEMM versus GEMV). Find out.
-  bool vector = false;
-  if (resulting_shape[1] == 1) vector = true;
-
-  static STORAGE* (*storage_matrix_multiply[nm::NUM_STYPES])(const STORAGE_PAIR&, size_t*, bool) = {
-    nm_dense_storage_matrix_multiply,
-    nm_list_storage_matrix_multiply,
-    nm_yale_storage_matrix_multiply
-  };
+  // Integer products into a wider integer dtype have their own kernels.
+  if (left->stype == nm::DENSE_STORE && result_dtype != Upcast[left->storage->dtype][right->storage->dtype]) {
+    STORAGE_PAIR operands = { left->storage, right->storage };
+    STORAGE* widened = nm_dense_storage_matrix_multiply_widened(operands, resulting_shape, result_dtype);
+    if (widened)
+      return Data_Wrap_Struct(cNMatrix, mark_table[nm::DENSE_STORE], nm_delete, nm_create(nm::DENSE_STORE, widened));
+  }
 
-  STORAGE* resulting_storage = storage_matrix_multiply[left->stype](casted, resulting_shape, vector);
-  NMATRIX* result = nm_create(left->stype, resulting_storage);
+  // Otherwise, compute in a dtype which can represent both the operands and the requested result.
+  nm::dtype_t compute_dtype = Upcast[ Upcast[left->storage->dtype][right->storage->dtype] ][result_dtype];
 
-  // Free any casted-storage we created for the multiplication.
-  // TODO: Can we make the Ruby GC take care of this stuff now that we're using it?
-  // If we did that, we night not have to re-create these every time, right? Or wrong? Need to do
-  // more research.
   static void (*free_storage[nm::NUM_STYPES])(STORAGE*) = {
     nm_dense_storage_delete,
     nm_list_storage_delete,
     nm_yale_storage_delete
   };
 
-  if (left->storage != casted.left)   free_storage[result->stype](casted.left);
-  if (right->storage != casted.right) free_storage[result->stype](casted.right);
+  STORAGE* resulting_storage = NULL;
 
+  // Dense operands of differing dtypes are converted a panel at a time during the multiplication, not up front.
+  if (left->stype == nm::DENSE_STORE &&
+      (left->storage->dtype != compute_dtype || right->storage->dtype != compute_dtype)) {
+    STORAGE_PAIR operands = { left->storage, right->storage };
+    resulting_storage = nm_dense_storage_matrix_multiply_mixed(operands, resulting_shape, compute_dtype);
+  }
 
-  STYPE_MARK_TABLE(mark_table);
+  if (!resulting_storage) {
+    // Make sure both of our matrices are of the correct type.
+    STORAGE_PAIR casted = binary_storage_cast_alloc(left, right, compute_dtype);
+
+    // Sometimes we only need to use matrix-vector multiplication (e.g., GEMM versus GEMV). Find out.
+    bool vector = false;
+    if (resulting_shape[1] == 1) vector = true;
+
+    static STORAGE* (*storage_matrix_multiply[nm::NUM_STYPES])(const STORAGE_PAIR&, size_t*, bool) = {
+      nm_dense_storage_matrix_multiply,
+      nm_list_storage_matrix_multiply,
+      nm_yale_storage_matrix_multiply
+    };
+
+    resulting_storage = storage_matrix_multiply[left->stype](casted, resulting_shape, vector);
+
+    // Free any casted-storage we created for the multiplication.
+    // TODO: Can we make the Ruby GC take care of this stuff now that we're using it?
+    // If we did that, we night not have to re-create these every time, right? Or wrong? Need to do
+    // more research.
+    if (left->storage != casted.left)   free_storage[left->stype](casted.left);
+    if (right->storage != casted.right) free_storage[left->stype](casted.right);
+  }
+
+  NMATRIX* result = nm_create(left->stype, resulting_storage);
+
+  // Narrow the result, if a narrower dtype was requested than the operands need.
+  if (resulting_storage && resulting_storage->dtype != result_dtype) {
+    CAST_TABLE(cast_copy_storage);
+    result->storage = cast_copy_storage[result->stype][result->stype](resulting_storage, result_dtype, NULL);
+    free_storage[result->stype](resulting_storage);
+  }
 
   if (result) return Data_Wrap_Struct(cNMatrix, mark_table[result->stype], nm_delete, result);
   return Qnil; // Only if we try to multiply list matrices should we return Qnil.
 }
 
+/*
+ * Multiply a Yale matrix by a dense matrix or a vector, or a dense matrix by a Yale matrix, with the sparse-dense
+ * kernels, which write a dense result. That's what's returned unless both operands are Yale (a Yale matrix times a Yale
+ * vector), in which case the result is Yale too.
+ */
+static VALUE matrix_multiply_yale_dense(NMATRIX* left, NMATRIX* right, nm::dtype_t result_dtype) {
+  STYPE_MARK_TABLE(mark_table);
+  CAST_TABLE(cast_copy_storage);
+
+  nm::dtype_t dtype = Upcast[ Upcast[left->storage->dtype][right->storage->dtype] ][result_dtype];
+
+  // The Yale operand is the left one if it can be; the other is made dense.
+  const bool sparse_left = left->stype == nm::YALE_STORE;
+  NMATRIX *sparse = sparse_left ? left : right,
+          *other  = sparse_left ? right : left;
+
+  // The kernels check this too, but by then the casts below would leak.
+  if (!nm_yale_storage_default_value_is_zero(sparse->storage))
+    rb_raise(rb_eNotImpError, "matrix default value must be some form of zero (not false or nil) for multiplication");
+
+  STORAGE* s = sparse->storage->dtype == dtype ? sparse->storage
+                                               : cast_copy_storage[nm::YALE_STORE][nm::YALE_STORE](sparse->storage, dtype, NULL);
+
+  DENSE_STORAGE* d;
+  if (other->stype == nm::DENSE_STORE && other->storage->dtype == dtype)
+    d = reinterpret_cast<DENSE_STORAGE*>(other->storage);
+  else
+    d = reinterpret_cast<DENSE_STORAGE*>(cast_copy_storage[nm::DENSE_STORE][other->stype](other->storage, dtype, NULL));
+
+  size_t* shape = ALLOC_N(size_t, 2);
+  shape[0] = left->storage->shape[0];
+  shape[1] = right->storage->shape[1];
+  DENSE_STORAGE* c = nm_dense_storage_create(dtype, shape, 2, NULL, 0);
+
+  size_t origin[2] = {0, 0};
+  const void* d_elements = reinterpret_cast<char*>(d->elements) + nm_dense_storage_pos(d, origin) * DTYPE_SIZES[dtype];
+
+  void *alpha = ALLOCA_N(char, DTYPE_SIZES[dtype]),
+       *beta  = ALLOCA_N(char, DTYPE_SIZES[dtype]);
+  rubyval_to_cval(INT2FIX(1), dtype, alpha);
+  rubyval_to_cval(INT2FIX(0), dtype, beta);
+
+  if (!sparse_left)
+    nm_yale_storage_dense_gemm(d_elements, c->shape[0], d->stride[0], s, alpha, beta, c->elements, c->shape[1]);
+  else if (c->shape[1] == 1)
+    nm_yale_storage_gemv(s, false, alpha, d_elements, d->stride[0], beta, c->elements, 1);
+  else
+    nm_yale_storage_gemm(s, false, c->shape[1], alpha, d_elements, d->stride[0], beta, c->elements, c->shape[1]);
+
+  if (s != sparse->storage)                  nm_yale_storage_delete(s);
+  if (d != (DENSE_STORAGE*)(other->storage)) nm_dense_storage_delete(reinterpret_cast<STORAGE*>(d));
+
+  nm::stype_t result_stype = left->stype == right->stype ? nm::YALE_STORE : nm::DENSE_STORE;
+
+  STORAGE* result = reinterpret_cast<STORAGE*>(c);
+  if (result_stype != nm::DENSE_STORE || dtype != result_dtype) {
+    result = cast_copy_storage[result_stype][nm::DENSE_STORE](result, result_dtype, NULL);
+    nm_dense_storage_delete(reinterpret_cast<STORAGE*>(c));
+  }
+
+  return Data_Wrap_Struct(cNMatrix, mark_table[result_stype], nm_delete, nm_create(result_stype, result));
+}
+
+/*
+ * The Yale product left*right masked by mask, computed in the upcast of left's and right's dtypes. mask keeps its own
+ * dtype. See nm_masked_multiply.
+ */
+static VALUE matrix_multiply_masked(NMATRIX* left, NMATRIX* right, NMATRIX* mask) {
+  STYPE_MARK_TABLE(mark_table);
+
+  if (!nm_yale_storage_default_value_is_zero(left->storage) || !nm_yale_storage_default_value_is_zero(right->storage) ||
+      !nm_yale_storage_default_value_is_zero(mask->storage))
+    rb_raise(rb_eNotImpError, "matrix default value must be some form of zero (not false or nil) for multiplication");
+
+  nm::dtype_t dtype = Upcast[left->storage->dtype][right->storage->dtype];
+
+  size_t* resulting_shape = ALLOC_N(size_t, 2);
+  resulting_shape[0] = left->storage->shape[0];
+  resulting_shape[1] = right->storage->shape[1];
+
+  // The mask is only read for where it's nonzero, in its own dtype, so it's copied only if it's a reference.
+  STORAGE_PAIR casted = binary_storage_cast_alloc(left, right, dtype);
+  STORAGE*     m      = matrix_storage_cast_alloc(mask, mask->storage->dtype);
+
+  STORAGE* result = nm_yale_storage_masked_matrix_multiply(casted, m, resulting_shape);
+
+  if (left->storage != casted.left)   nm_yale_storage_delete(casted.left);
+  if (right->storage != casted.right) nm_yale_storage_delete(casted.right);
+  if (mask->storage != m)             nm_yale_storage_delete(m);
+
+  return Data_Wrap_Struct(cNMatrix, mark_table[nm::YALE_STORE], nm_delete, nm_create(nm::YALE_STORE, result));
+}
+
 /*
  * Calculate the exact determinant of a dense matrix.
  *
@@ -2263,6 +2632,251 @@ static VALUE nm_det_exact(VALUE self) {
   return rubyobj_from_cval(result, NM_DTYPE(self)).rval;
 }
 
+/*
+ * Shared by #gram and #outer_self.
+ */
+static VALUE gram(VALUE self, bool outer) {
+  if (NM_STYPE(self) != nm::DENSE_STORE) rb_raise(nm_eStorageTypeError, "Gram matrices are only available for dense matrices");
+  if (NM_DIM(self) != 2) rb_raise(rb_eArgError, "Gram matrices require a 2-dimensional matrix");
+
+  STORAGE* result = nm_dense_storage_gram(NM_STORAGE(self), outer);
+  return Data_Wrap_Struct(cNMatrix, nm_dense_storage_mark, nm_delete, nm_create(nm::DENSE_STORE, result));
+}
+
+/*
+ * call-seq:
+ *     gram -> NMatrix
+ *
+ * The Gram matrix of this matrix's columns, A**T * A (A**H * A for complex dtypes). Only half of the symmetric
+ * product is computed.
+ */
+static VALUE nm_gram(VALUE self) {
+  return gram(self, false);
+}
+
+/*
+ * call-seq:
+ *     outer_self -> NMatrix
+ *
+ * The product of this matrix with its own transpose, A * A**T (A * A**H for complex dtypes). Only half of the
+ * symmetric product is computed.
+ */
+static VALUE nm_outer_self(VALUE self) {
+  return gram(self, true);
+}
+
+/*
+ * Check that a matrix is a batch: a 3-dimensional dense matrix, with one problem per layer.
+ */
+static void check_batch(VALUE matrix) {
+  if (NM_STYPE(matrix) != nm::DENSE_STORE) rb_raise(nm_eStorageTypeError, "batched operations require dense matrices");
+  if (NM_DIM(matrix) != 3) rb_raise(rb_eArgError, "batched operations require 3-dimensional matrices of shape [batch, rows, columns]");
+}
+
+/*
+ * First element of a batch, along with the distances (in elements) between its layers and between rows within a layer.
+ * Works for references too, since the last dimension of a dense matrix is always contiguous.
+ */
+static void* batch_elements(const STORAGE* s, size_t* layer_stride, int* row_stride) {
+  const DENSE_STORAGE* dense = reinterpret_cast<const DENSE_STORAGE*>(s);
+  size_t origin[3] = {0, 0, 0};
+
+  *layer_stride = dense->stride[0];
+  *row_stride   = dense->stride[1];
+
+  return reinterpret_cast<char*>(dense->elements) + nm_dense_storage_pos(dense, origin) * DTYPE_SIZES[dense->dtype];
+}
+
+/*
+ * A new dense batch of shape [batch, rows, cols], already wrapped so the garbage collector can see it. It's zeroed
+ * first, so the collector never marks garbage in an :object batch that hasn't been filled in yet.
+ */
+static VALUE batch_result(nm::dtype_t dtype, size_t batch, size_t rows, size_t cols) {
+  size_t* shape = ALLOC_N(size_t, 3);
+  shape[0] = batch;
+  shape[1] = rows;
+  shape[2] = cols;
+
+  DENSE_STORAGE* result = nm_dense_storage_create(dtype, shape, 3, NULL, 0);
+  std::memset(result->elements, 0, batch * rows * cols * DTYPE_SIZES[dtype]);
+
+  return Data_Wrap_Struct(cNMatrix, nm_dense_storage_mark, nm_delete, nm_create(nm::DENSE_STORE, result));
+}
+
+/*
+ * call-seq:
+ *     batch_dot(other) -> NMatrix
+ *
+ * Multiply each layer of this [batch, m, k] matrix by the corresponding layer of a [batch, k, n] matrix, giving a
+ * [batch, m, n] matrix, in a single call. Square layers up to 16 x 16 use kernels specialized for their size.
+ */
+static VALUE nm_batch_dot(VALUE self, VALUE other) {
+  check_batch(self);
+  check_batch(other);
+
+  if (NM_SHAPE(self,0) != NM_SHAPE(other,0)) rb_raise(rb_eArgError, "batch sizes differ");
+  if (NM_SHAPE(self,2) != NM_SHAPE(other,1)) rb_raise(rb_eArgError, "incompatible dimensions");
+
+  nm::dtype_t dtype   = Upcast[NM_DTYPE(self)][NM_DTYPE(other)];
+  STORAGE_PAIR casted = binary_storage_cast_alloc(NM_STRUCT(self), NM_STRUCT(other), dtype);
+
+  const size_t batch = NM_SHAPE(self,0), M = NM_SHAPE(self,1), N = NM_SHAPE(other,2), K = NM_SHAPE(self,2);
+  VALUE result = batch_result(dtype, batch, M, N);
+
+  size_t stride_a, stride_b;
+  int    lda, ldb;
+  void*  a = batch_elements(casted.left, &stride_a, &lda);
+  void*  b = batch_elements(casted.right, &stride_b, &ldb);
+
+  nm_math_batch_gemm(batch, M, N, K, a, stride_a, lda, b, stride_b, ldb, NM_STORAGE_DENSE(result)->elements, M*N, N, dtype);
+
+  if (casted.left != NM_STORAGE(self))   nm_dense_storage_delete(casted.left);
+  if (casted.right != NM_STORAGE(other)) nm_dense_storage_delete(casted.right);
+
+  return result;
+}
+
+/*
+ * call-seq:
+ *     batch_invert -> NMatrix
+ *
+ * Invert each square layer of this [batch, n, n] matrix, in a single call. Raises ZeroDivisionError if any of them is
+ * singular.
+ */
+static VALUE nm_batch_invert(VALUE self) {
+  check_batch(self);
+
+  if (NM_SHAPE(self,1) != NM_SHAPE(self,2)) rb_raise(rb_eArgError, "batched inversion requires square layers");
+  if (NM_DTYPE(self) <= nm::INT64) rb_raise(nm_eDataTypeError, "batched inversion is undefined for integer matrices");
+
+  const size_t batch = NM_SHAPE(self,0), N = NM_SHAPE(self,1);
+  VALUE result = batch_result(NM_DTYPE(self), batch, N, N);
+
+  size_t stride_a;
+  int    lda;
+  void*  a = batch_elements(NM_STORAGE(self), &stride_a, &lda);
+
+  int singular = nm_math_batch_inverse(batch, N, a, stride_a, lda, NM_STORAGE_DENSE(result)->elements, N*N, N, NM_DTYPE(self));
+  if (singular >= 0) rb_raise(rb_eZeroDivError, "matrix %d of the batch is singular", singular);
+
+  return result;
+}
+
+/*
+ * call-seq:
+ *     batch_solve(b) -> NMatrix
+ *
+ * Solve A * X = B for each square layer A of this [batch, n, n] matrix and the corresponding layer B of a
+ * [batch, n, nrhs] matrix, in a single call, by LU decomposition with partial pivoting. Raises ZeroDivisionError if
+ * any A is singular.
+ */
+static VALUE nm_batch_solve(VALUE self, VALUE b) {
+  check_batch(self);
+  check_batch(b);
+
+  if (NM_SHAPE(self,1) != NM_SHAPE(self,2)) rb_raise(rb_eArgError, "batched solves require square layers");
+  if (NM_SHAPE(self,0) != NM_SHAPE(b,0))    rb_raise(rb_eArgError, "batch sizes differ");
+  if (NM_SHAPE(self,1) != NM_SHAPE(b,1))    rb_raise(rb_eArgError, "incompatible dimensions");
+
+  nm::dtype_t dtype = Upcast[NM_DTYPE(self)][NM_DTYPE(b)];
+  if (dtype <= nm::INT64) rb_raise(nm_eDataTypeError, "batched solves are undefined for integer matrices");
+
+  STORAGE_PAIR casted = binary_storage_cast_alloc(NM_STRUCT(self), NM_STRUCT(b), dtype);
+
+  const size_t batch = NM_SHAPE(self,0), N = NM_SHAPE(self,1), NRHS = NM_SHAPE(b,2);
+  VALUE result = batch_result(dtype, batch, N, NRHS);
+
+  size_t stride_a, stride_b;
+  int    lda, ldb;
+  void*  a  = batch_elements(casted.left, &stride_a, &lda);
+  void*  bb = batch_elements(casted.right, &stride_b, &ldb);
+
+  int singular = nm_math_batch_solve(batch, N, NRHS, a, stride_a, lda, bb, stride_b, ldb,
+                                     NM_STORAGE_DENSE(result)->elements, N*NRHS, NRHS, dtype);
+
+  if (casted.left != NM_STORAGE(self)) nm_dense_storage_delete(casted.left);
+  if (casted.right != NM_STORAGE(b))   nm_dense_storage_delete(casted.right);
+
+  if (singular >= 0) rb_raise(rb_eZeroDivError, "matrix %d of the batch is singular", singular);
+
+  return result;
+}
+
+static nm_krylov_method_t krylov_method_sym(VALUE method) {
+  if (rb_to_id(method) == rb_intern("cg"))       return NM_KRYLOV_CG;
+  if (rb_to_id(method) == rb_intern("bicgstab")) return NM_KRYLOV_BICGSTAB;
+  if (rb_to_id(method) == rb_intern("gmres"))    return NM_KRYLOV_GMRES;
+
+  rb_raise(rb_eArgError, "unrecognized iterative method: expected :cg, :bicgstab or :gmres");
+  return NM_KRYLOV_CG;
+}
+
+static nm_preconditioner_t preconditioner_sym(VALUE preconditioner) {
+  if (preconditioner == Qnil || preconditioner == Qfalse)   return NM_PRECONDITIONER_NONE;
+  if (rb_to_id(preconditioner) == rb_intern("jacobi"))      return NM_PRECONDITIONER_JACOBI;
+  if (rb_to_id(preconditioner) == rb_intern("ilu0"))        return NM_PRECONDITIONER_ILU0;
+  if (rb_to_id(preconditioner) == rb_intern("ic0"))         return NM_PRECONDITIONER_IC0;
+
+  rb_raise(rb_eArgError, "unrecognized preconditioner: expected nil, :jacobi, :ilu0 or :ic0");
+  return NM_PRECONDITIONER_NONE;
+}
+
+/*
+ * call-seq:
+ *     __krylov__(b, x, method, preconditioner, tol, max_iter, restart) -> Array
+ *
+ * Solve self * x = b iteratively, overwriting x, which holds the initial guess. self is a square dense or Yale matrix
+ * (not a reference), and b and x are dense column vectors of its dtype, float32 or float64. Returns the residual
+ * history: the norm of b - self*x relative to that of b, before the first iteration and after each one.
+ */
+static VALUE nm_krylov(VALUE self, VALUE b, VALUE x, VALUE method, VALUE preconditioner, VALUE tol, VALUE max_iter, VALUE restart) {
+  const nm::stype_t stype = NM_STYPE(self);
+
+  if (stype != nm::DENSE_STORE && stype != nm::YALE_STORE)
+    rb_raise(nm_eStorageTypeError, "iterative solvers require dense or Yale matrices");
+  if (NM_DIM(self) != 2 || NM_SHAPE0(self) != NM_SHAPE1(self))
+    rb_raise(rb_eArgError, "iterative solvers require a square matrix");
+  if (NM_SRC(self) != NM_STORAGE(self))
+    rb_raise(rb_eNotImpError, "iterative solvers are not supported on references");
+  if (stype == nm::YALE_STORE && rb_funcall(nm_yale_default_value(self), rb_intern("=="), 1, INT2FIX(0)) != Qtrue)
+    rb_raise(rb_eNotImpError, "matrix default value must be some form of zero (not false or nil) for iterative solves");
+
+  const size_t n = NM_SHAPE0(self);
+  VALUE vectors[2] = { b, x };
+  for (int v = 0; v < 2; ++v) {
+    if (NM_STYPE(vectors[v]) != nm::DENSE_STORE || NM_SRC(vectors[v]) != NM_STORAGE(vectors[v]))
+      rb_raise(nm_eStorageTypeError, "iterative solvers require b and x to be dense, and not references");
+    if (NM_DIM(vectors[v]) != 2 || NM_SHAPE0(vectors[v]) != n || NM_SHAPE1(vectors[v]) != 1)
+      rb_raise(rb_eArgError, "iterative solvers require b and x to be [%lu,1] column vectors", (unsigned long)(n));
+    if (NM_DTYPE(vectors[v]) != NM_DTYPE(self))
+      rb_raise(nm_eDataTypeError, "iterative solvers require b and x to have the matrix's dtype");
+  }
+
+  const nm_krylov_method_t  m = krylov_method_sym(method);
+  const nm_preconditioner_t p = preconditioner_sym(preconditioner);
+  const int max_it = NUM2INT(max_iter), restart_it = NUM2INT(restart);
+  if (max_it < 0)     rb_raise(rb_eArgError, "max_iter must not be negative");
+  if (restart_it < 1) rb_raise(rb_eArgError, "restart must be positive");
+
+  // The history is kept in a matrix so the garbage collector frees it if setting up the preconditioner raises.
+  size_t* shape = ALLOC_N(size_t, 2);
+  shape[0] = max_it + 1;
+  shape[1] = 1;
+
+  DENSE_STORAGE* history = nm_dense_storage_create(nm::FLOAT64, shape, 2, NULL, 0);
+  VALUE history_v = Data_Wrap_Struct(cNMatrix, nm_dense_storage_mark, nm_delete, nm_create(nm::DENSE_STORE, history));
+  double* h = reinterpret_cast<double*>(history->elements);
+
+  const int iterations = nm_math_krylov(NM_STORAGE(self), stype, m, p, NM_STORAGE_DENSE(b)->elements,
+                                        NM_STORAGE_DENSE(x)->elements, NUM2DBL(tol), max_it, restart_it, h, NM_DTYPE(self));
+
+  VALUE result = rb_ary_new2(iterations + 1);
+  for (int i = 0; i <= iterations; ++i) rb_ary_push(result, rb_float_new(h[i]));
+
+  RB_GC_GUARD(history_v);
+  return result;
+}
+
 /////////////////
 // Exposed API //
 /////////////////
@@ -2296,12 +2910,16 @@ VALUE rb_nmatrix_dense_create(nm::dtype_t dtype, size_t* shape, size_t dim, void
     memcpy(shape_copy, shape, sizeof(size_t)*nm_dim);
   }
 
-  // Copy elements
-  void* elements_copy = ALLOC_N(char, DTYPE_SIZES[dtype]*length);
-  memcpy(elements_copy, elements, DTYPE_SIZES[dtype]*length);
-
   // allocate and create the matrix and its storage
-  nm = nm_create(nm::DENSE_STORE, nm_dense_storage_create(dtype, shape_copy, dim, elements_copy, length));
+  DENSE_STORAGE* s = nm_dense_storage_create(dtype, shape_copy, dim, NULL, 0);
+
+  // Copy elements (repeating them if there aren't enough)
+  size_t count = nm_storage_count_max_elements(s);
+  for (size_t i = 0; i < count && length > 0; i += length) {
+    memcpy((char*)(s->elements) + i*DTYPE_SIZES[dtype], elements, DTYPE_SIZES[dtype] * std::min(length, count - i));
+  }
+
+  nm = nm_create(nm::DENSE_STORE, s);
 
   // tell Ruby about the matrix and its storage, particularly how to garbage collect it.
   return Data_Wrap_Struct(cNMatrix, nm_dense_storage_mark, nm_dense_storage_delete, nm);
@@ -2389,24 +3007,24 @@ VALUE rb_nmatrix_dense_from_array(VALUE obj)
 	else
 		rb_raise(rb_eArgError, "Unexpected Values in Arrays (type)");
 	
-	// alloc
-	void* elements = ALLOC_N(char, DTYPE_SIZES[dtype]*length);
-	
-	// copy
-	int idx = 0;
-	rb_nmatrix_dense_from_array_helper(obj, 0, dim, shape, dtype, &idx, elements);	
-	
 	// allocate and create the matrix and its storage
 	NMATRIX* nm;
+	size_t nm_dim = dim;
 	
 	// Do not allow a dim of 1. Treat it as a column or row matrix.
-	if (dim == 1) 
+	if (nm_dim == 1) 
 	{
-		dim = 2;
+		nm_dim = 2;
 		shape[1] = 1;
 	}
 	
-	nm = nm_create(nm::DENSE_STORE, nm_dense_storage_create(nm::dtype_t(dtype), shape, dim, elements, length));
+	DENSE_STORAGE* s = nm_dense_storage_create(nm::dtype_t(dtype), shape, nm_dim, NULL, 0);
+	
+	// copy straight into the new elements
+	int idx = 0;
+	rb_nmatrix_dense_from_array_helper(obj, 0, dim, shape, dtype, &idx, s->elements);	
+	
+	nm = nm_create(nm::DENSE_STORE, s);
 
 	// tell Ruby about the matrix and its storage, particularly how to garbage collect it.
 	return Data_Wrap_Struct(cNMatrix, nm_dense_storage_mark, nm_dense_storage_delete, nm);
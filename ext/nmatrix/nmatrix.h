@@ -249,6 +249,7 @@ NM_DEF_STORAGE_STRUCT;
 NM_DEF_STORAGE_CHILD_STRUCT_PRE(DENSE_STORAGE); // struct DENSE_STORAGE : STORAGE {
 	size_t*	stride;
 	void*		elements;
+	int*		shared_count; // number of storages sharing elements copy-on-write; NULL if not shared
 NM_DEF_STORAGE_STRUCT_POST(DENSE_STORAGE);     // };
 
 /* Yale Storage */
@@ -276,6 +277,7 @@ NM_DEF_STORAGE_CHILD_STRUCT_PRE(LIST_STORAGE); // struct LIST_STORAGE : STORAGE
 	// List storage specific elements.
 	void* default_val;
 	NM_DECL_STRUCT(LIST*, rows); // LIST* rows;
+	void* row_arrays; // flat copy of the rows kept for matrix products; NULL until one is made, and after any write
 NM_DEF_STORAGE_STRUCT_POST(LIST_STORAGE);      // };
 
 
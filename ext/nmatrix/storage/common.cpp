@@ -29,6 +29,8 @@
  * Standard Includes
  */
 
+#include <algorithm> // std::max
+
 /*
  * Project Includes
  */
@@ -43,6 +45,13 @@
  * Global Variables
  */
 
+/*
+ * Recently freed reference headers, one free list per dimension. Ruby's global lock serializes every caller, so
+ * these don't need to be guarded.
+ */
+static STORAGE* ref_pool[NM_MAX_RANK+1];
+static size_t   ref_pool_size[NM_MAX_RANK+1];
+
 /*
  * Forward Declarations
  */
@@ -51,6 +60,14 @@
  * Functions
  */
 
+/*
+ * Size of the largest storage struct, rounded up so the offset and shape arrays which follow it are aligned.
+ */
+static inline size_t ref_header_size() {
+  size_t size = std::max(sizeof(DENSE_STORAGE), std::max(sizeof(LIST_STORAGE), sizeof(YALE_STORAGE)));
+  return (size + sizeof(size_t) - 1) / sizeof(size_t) * sizeof(size_t);
+}
+
 extern "C" {
   /*
    * Calculate the number of elements in the dense storage structure, based on
@@ -74,4 +91,65 @@ extern "C" {
     return LONG2NUM(len);
   }
 
+  /*
+   * Make sure the right-hand side of a slice assignment has the same shape as the slice (dim is that of the left-hand
+   * side). Dimensions of length 1 are ignored, so a row vector may be assigned to a row of a matrix, and so on.
+   */
+  void nm_storage_check_slice_set_shape(const STORAGE* right, const SLICE* slice, size_t dim) {
+    size_t i = 0, j = 0;
+
+    while (true) {
+      while (i < dim && slice->lengths[i] == 1) ++i;
+      while (j < right->dim && right->shape[j] == 1) ++j;
+
+      if (i == dim || j == right->dim) break;
+      if (slice->lengths[i] != right->shape[j]) break;
+
+      ++i; ++j;
+    }
+
+    if (i != dim || j != right->dim)
+      rb_raise(rb_eArgError, "shape of right-hand side does not match that of the slice being assigned");
+  }
+
+  /*
+   * Allocate the header of a reference (a slice which shares its source's data), with room for its offset and shape
+   * arrays in the same block. The block is large enough for any stype; cast it to the appropriate storage struct.
+   * dim, offset, and shape are set; all other fields are up to the caller.
+   *
+   * Free it with nm_storage_free_ref, not xfree.
+   */
+  STORAGE* nm_storage_alloc_ref(size_t dim) {
+    STORAGE* s;
+
+    if (dim <= NM_MAX_RANK && ref_pool[dim]) {
+      s             = ref_pool[dim];
+      ref_pool[dim] = s->src;
+      --ref_pool_size[dim];
+    } else {
+      s = reinterpret_cast<STORAGE*>(ALLOC_N(char, ref_header_size() + 2 * dim * sizeof(size_t)));
+    }
+
+    s->dim    = dim;
+    s->offset = reinterpret_cast<size_t*>(reinterpret_cast<char*>(s) + ref_header_size());
+    s->shape  = s->offset + dim;
+
+    return s;
+  }
+
+  /*
+   * Return a reference header to the pool (or to the heap, if the pool is full). Does not touch the source.
+   */
+  void nm_storage_free_ref(STORAGE* s) {
+    size_t dim = s->dim;
+
+    if (dim <= NM_MAX_RANK && ref_pool_size[dim] < NM_REF_POOL_SIZE) {
+      s->src        = ref_pool[dim]; // src links the free list
+      ref_pool[dim] = s;
+      ++ref_pool_size[dim];
+    } else {
+      xfree(s);
+    }
+  }
+
 } // end of extern "C" block
@@ -62,6 +62,20 @@ struct SLICE {
   bool  	single; // true if all lengths equal to 1 (represents single matrix element)
 };
 
+/*
+ * Declare a SLICE whose coordinate and length arrays live on the stack, so that reading an element or taking a
+ * reference doesn't touch the heap. Only valid for the life of the enclosing function.
+ */
+#define NM_ALLOCA_SLICE(name, dim)              \
+  SLICE name;                                   \
+  name.coords  = ALLOCA_N(size_t, (dim));       \
+  name.lengths = ALLOCA_N(size_t, (dim));
+
+/*
+ * Number of freed reference headers kept around for reuse, per dimension.
+ */
+#define NM_REF_POOL_SIZE 64
+
 /*
  * Data
  */
@@ -72,6 +86,9 @@ struct SLICE {
 
   size_t nm_storage_count_max_elements(const STORAGE* storage);
   VALUE nm_enumerator_length(VALUE nmatrix);
+  void nm_storage_check_slice_set_shape(const STORAGE* right, const SLICE* slice, size_t dim);
+  STORAGE* nm_storage_alloc_ref(size_t dim);
+  void nm_storage_free_ref(STORAGE* s);
 
 } // end of extern "C" block
 
@@ -30,27 +30,47 @@
  */
 
 #include <ruby.h>
+#include <cstdlib>
+#include <type_traits>
+
+#ifdef HAVE_MADVISE
+#include <sys/mman.h>
+#endif
 
 /*
  * Project Includes
  */
 // #include "types.h"
 #include "data/data.h"
+#include "math/syrk.h"
 #include "math/long_dtype.h"
+#include "math/parallel.h"
 #include "math/gemm.h"
+#include "math/strassen.h"
+#include "math/widen.h"
 #include "math/gemv.h"
 #include "math/math.h"
 #include "common.h"
+#include "storage.h"
 #include "dense.h"
 
 /*
  * Macros
  */
 
+#define NM_DENSE_HUGE_PAGE_SIZE  (2 * 1024 * 1024)
+
+// Columns of the left operand (rows of the right) converted at a time by a mixed-dtype multiplication.
+#define NM_MIXED_MULTIPLY_PANEL  256
+
 /*
  * Global Variables
  */
 
+static nm_dense_alloc_func  dense_alloc_func           = NULL; // NULL means use default_alloc_elements
+static nm_dense_free_func   dense_free_func            = NULL;
+static size_t               dense_huge_page_threshold  = 0;    // 0 means never use huge pages
+
 /*
  * Forward Declarations
  */
@@ -69,6 +89,15 @@ namespace nm { namespace dense_storage {
   template <typename DType>
   static DENSE_STORAGE* matrix_multiply(const STORAGE_PAIR& casted_storage, size_t* resulting_shape, bool vector);
 
+  template <typename DType>
+  static bool matrix_multiply_widened(const DENSE_STORAGE* left, const DENSE_STORAGE* right, DENSE_STORAGE* result);
+
+  template <typename DType>
+  static void matrix_multiply_mixed(const DENSE_STORAGE* left, const DENSE_STORAGE* right, DENSE_STORAGE* result);
+
+  template <typename DType>
+  static void gram(const DENSE_STORAGE* matrix, DENSE_STORAGE* result, bool outer);
+
   template <typename DType>
   bool is_hermitian(const DENSE_STORAGE* mat, int lda);
 
@@ -99,6 +128,43 @@ namespace nm { namespace dense_storage {
 
   }
 
+  /*
+   * Copy a contiguous run of elements, converting each one.
+   */
+  template <typename LDType, typename RDType>
+  static inline void slice_set_run(LDType* dest, RDType* src, size_t length, std::false_type) {
+    for (size_t p = 0; p < length; ++p) dest[p] = src[p];
+  }
+
+  /*
+   * Copy a contiguous run of elements of a trivially copyable dtype, which needs no conversion.
+   */
+  template <typename DType>
+  static inline void slice_set_run(DType* dest, DType* src, size_t length, std::true_type) {
+    memcpy(dest, src, length * sizeof(DType));
+  }
+
+  /*
+   * Recursive block assignment for N-dimensional matrices. dest and src already point at the first element of the
+   * block; each has its own strides (src may be packed). Contiguous runs are copied with memcpy when both sides have
+   * the same dtype and it's trivially copyable; Ruby objects and conversions go element by element.
+   */
+  template <typename LDType, typename RDType>
+  static void slice_set(void* dest_, const size_t* dest_stride, const void* src_, const size_t* src_stride, const size_t* lengths, size_t dim, size_t n) {
+    typedef std::integral_constant<bool, std::is_same<LDType,RDType>::value && std::is_trivially_copyable<LDType>::value> raw_copy;
+
+    LDType*       dest = reinterpret_cast<LDType*>(dest_);
+    RDType*       src  = reinterpret_cast<RDType*>(const_cast<void*>(src_));
+
+    if (dim - n > 1) {
+      for (size_t i = 0; i < lengths[n]; ++i) {
+        slice_set<LDType,RDType>(dest + dest_stride[n]*i, dest_stride, src + src_stride[n]*i, src_stride, lengths, dim, n + 1);
+      }
+    } else {
+      slice_set_run(dest, src, lengths[n], raw_copy());
+    }
+  }
+
 }} // end of namespace nm::dense_storage
 
 
@@ -116,6 +182,115 @@ static void slice_copy(DENSE_STORAGE *dest, const DENSE_STORAGE *src, size_t* le
 ///////////////
 
 
+/*
+ * Allocate an uninitialized buffer of at least the given size, aligned to the given (power of two) boundary. Like
+ * ALLOC_N, runs the garbage collector and tries again before raising NoMemoryError, and tells the garbage collector
+ * about the memory, so that big matrices still count towards its next run.
+ */
+static void* aligned_alloc_or_raise(size_t alignment, size_t bytes) {
+  if (bytes == 0) bytes = alignment;
+
+#ifdef HAVE_POSIX_MEMALIGN
+  void* ptr = NULL;
+
+  if (posix_memalign(&ptr, alignment, bytes)) {
+    rb_gc();
+    if (posix_memalign(&ptr, alignment, bytes)) rb_memerror();
+  }
+
+#ifdef HAVE_RB_GC_ADJUST_MEMORY_USAGE
+  rb_gc_adjust_memory_usage((ssize_t)(bytes));
+#endif
+
+  return ptr;
+
+#else
+  // Over-allocate, and keep the pointer we got from Ruby just before the aligned buffer.
+  char* raw   = ALLOC_N(char, bytes + alignment + sizeof(void*));
+  char* ptr   = (char*)(((uintptr_t)(raw + sizeof(void*)) + alignment - 1) & ~(uintptr_t)(alignment - 1));
+  reinterpret_cast<void**>(ptr)[-1] = raw;
+
+  return ptr;
+#endif
+}
+
+
+/*
+ * Default allocator for dense elements: NM_DENSE_ALIGNMENT-byte alignment, or huge-page alignment (with
+ * madvise(MADV_HUGEPAGE)) for buffers at or above the huge page threshold.
+ */
+static void* default_alloc_elements(size_t bytes) {
+#if defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+  if (dense_huge_page_threshold && bytes >= dense_huge_page_threshold) {
+    void* ptr = aligned_alloc_or_raise(NM_DENSE_HUGE_PAGE_SIZE, bytes);
+    madvise(ptr, bytes & ~(size_t)(NM_DENSE_HUGE_PAGE_SIZE - 1), MADV_HUGEPAGE); // only a hint, so ignore failure
+    return ptr;
+  }
+#endif
+
+  return aligned_alloc_or_raise(NM_DENSE_ALIGNMENT, bytes);
+}
+
+
+static void default_free_elements(void* ptr, size_t bytes) {
+#ifdef HAVE_POSIX_MEMALIGN
+  free(ptr);
+
+#ifdef HAVE_RB_GC_ADJUST_MEMORY_USAGE
+  rb_gc_adjust_memory_usage(-(ssize_t)(bytes ? bytes : NM_DENSE_ALIGNMENT));
+#endif
+#else
+  xfree(reinterpret_cast<void**>(ptr)[-1]);
+#endif
+}
+
+
+/*
+ * Allocate an uninitialized elements buffer for dense storage. All dense elements must come from here, since they'll
+ * be freed with nm_dense_storage_free_elements.
+ */
+void* nm_dense_storage_alloc_elements(size_t bytes) {
+  return dense_alloc_func ? dense_alloc_func(bytes) : default_alloc_elements(bytes);
+}
+
+
+/*
+ * Free an elements buffer from nm_dense_storage_alloc_elements. bytes must be the size it was allocated with.
+ */
+void nm_dense_storage_free_elements(void* elements, size_t bytes) {
+  if (dense_free_func) dense_free_func(elements);
+  else                 default_free_elements(elements, bytes);
+}
+
+
+/*
+ * Replace the allocator used for dense elements (e.g., with a NUMA-aware or pooled one). Pass NULL for both to restore
+ * the default. This must be done before any dense matrices exist, since their elements would otherwise be freed by the
+ * wrong function.
+ */
+void nm_dense_storage_set_allocator(nm_dense_alloc_func alloc_func, nm_dense_free_func free_func) {
+  if ((alloc_func == NULL) != (free_func == NULL))
+    rb_raise(rb_eArgError, "dense allocator needs both an alloc and a free function");
+
+  dense_alloc_func = alloc_func;
+  dense_free_func  = free_func;
+}
+
+
+/*
+ * Dense element buffers of at least this many bytes are allocated on huge-page boundaries and marked with
+ * madvise(MADV_HUGEPAGE), where supported. 0 (the default) disables this.
+ */
+void nm_dense_storage_set_huge_page_threshold(size_t bytes) {
+  dense_huge_page_threshold = bytes;
+}
+
+
+size_t nm_dense_storage_huge_page_threshold(void) {
+  return dense_huge_page_threshold;
+}
+
+
 /*
  * This creates a dummy with all the properties of dense storage, but no actual elements allocation.
  *
@@ -137,6 +312,7 @@ static DENSE_STORAGE* nm_dense_storage_create_dummy(nm::dtype_t dtype, size_t* s
   s->src        = s;
 
 	s->elements   = NULL;
+  s->shared_count = NULL;
 
   return s;
 }
@@ -144,37 +320,39 @@ static DENSE_STORAGE* nm_dense_storage_create_dummy(nm::dtype_t dtype, size_t* s
 
 /*
  * Note that elements and elements_length are for initial value(s) passed in.
- * If they are the correct length, they will be used directly. If not, they
- * will be concatenated over and over again into a new elements array. If
- * elements is NULL, the new elements array will not be initialized.
+ *
+ * If there are exactly as many as the matrix has elements, the buffer is adopted as the matrix's elements, so it must
+ * have come from nm_dense_storage_alloc_elements. Otherwise it's from ALLOC_N: its values are concatenated over and
+ * over again into a new (aligned) elements array, and then it's freed. If elements is NULL, the new elements array will
+ * not be initialized -- fill in s->elements directly to avoid an extra copy.
  */
 DENSE_STORAGE* nm_dense_storage_create(nm::dtype_t dtype, size_t* shape, size_t dim, void* elements, size_t elements_length) {
 
   DENSE_STORAGE* s = nm_dense_storage_create_dummy(dtype, shape, dim);
   size_t count  = nm_storage_count_max_elements(s);
 
-  if (elements_length == count) {
-  	s->elements = elements;
-
-  } else {
-    s->elements = ALLOC_N(char, DTYPE_SIZES[dtype]*count);
+  if (elements && elements_length == count && count > 0) {
+    s->elements = elements;
+    return s;
+  }
 
-    size_t copy_length = elements_length;
+  s->elements = nm_dense_storage_alloc_elements(DTYPE_SIZES[dtype]*count);
 
-    if (elements_length > 0) {
-      // Repeat elements over and over again until the end of the matrix.
-      for (size_t i = 0; i < count; i += elements_length) {
+  size_t copy_length = elements_length;
 
-        if (i + elements_length > count) {
-        	copy_length = count - i;
-        }
+  if (elements_length > 0) {
+    // Repeat elements over and over again until the end of the matrix.
+    for (size_t i = 0; i < count; i += elements_length) {
 
-        memcpy((char*)(s->elements)+i*DTYPE_SIZES[dtype], (char*)(elements)+(i % elements_length)*DTYPE_SIZES[dtype], copy_length*DTYPE_SIZES[dtype]);
+      if (i + elements_length > count) {
+        copy_length = count - i;
       }
 
-      // Get rid of the init_val.
-      xfree(elements);
+      memcpy((char*)(s->elements)+i*DTYPE_SIZES[dtype], (char*)(elements)+(i % elements_length)*DTYPE_SIZES[dtype], copy_length*DTYPE_SIZES[dtype]);
     }
+
+    // Get rid of the init_val.
+    xfree(elements);
   }
 
   return s;
@@ -189,11 +367,20 @@ void nm_dense_storage_delete(STORAGE* s) {
   if (s) {
     DENSE_STORAGE* storage = (DENSE_STORAGE*)s;
     if(storage->count-- == 1) {
+      const size_t bytes = DTYPE_SIZES[storage->dtype] * nm_storage_count_max_elements(storage);
+
       xfree(storage->shape);
       xfree(storage->offset);
       xfree(storage->stride);
-      if (storage->elements != NULL) // happens with dummy objects
-        xfree(storage->elements);
+
+      if (storage->shared_count && --(*storage->shared_count) > 0) {
+        // Some copy-on-write duplicate still owns the elements.
+      } else {
+        if (storage->shared_count) xfree(storage->shared_count);
+        if (storage->elements != NULL) // happens with dummy objects
+          nm_dense_storage_free_elements(storage->elements, bytes);
+      }
+
       xfree(storage);
     }
   }
@@ -207,9 +394,7 @@ void nm_dense_storage_delete_ref(STORAGE* s) {
   if (s) {
     DENSE_STORAGE* storage = (DENSE_STORAGE*)s;
     nm_dense_storage_delete( reinterpret_cast<STORAGE*>(storage->src) );
-    xfree(storage->shape);
-    xfree(storage->offset);
-    xfree(storage);
+    nm_storage_free_ref(s);
   }
 }
 
@@ -444,19 +629,20 @@ void* nm_dense_storage_ref(STORAGE* storage, SLICE* slice) {
     return (char*)(s->elements) + nm_dense_storage_pos(s, slice->coords) * DTYPE_SIZES[s->dtype];
 
   else {
-    DENSE_STORAGE* ns = ALLOC( DENSE_STORAGE );
-    ns->dim        = s->dim;
+    DENSE_STORAGE* ns = reinterpret_cast<DENSE_STORAGE*>(nm_storage_alloc_ref(s->dim));
     ns->dtype      = s->dtype;
-    ns->offset     = ALLOC_N(size_t, ns->dim);
-    ns->shape      = ALLOC_N(size_t, ns->dim);
 
     for (size_t i = 0; i < ns->dim; ++i) {
       ns->offset[i] = slice->coords[i] + s->offset[i];
       ns->shape[i]  = slice->lengths[i];
     }
 
+    // A reference may be written through, so it can't point at a copy-on-write buffer.
+    nm_dense_storage_unshare(reinterpret_cast<DENSE_STORAGE*>(s->src));
+
     ns->stride     = s->stride;
     ns->elements   = s->elements;
+    ns->shared_count = NULL;
 
     s->src->count++;
     ns->src = s->src;
@@ -482,26 +668,76 @@ static void slice_set_single(DENSE_STORAGE* dest, void* src, size_t* lengths, si
 }
 
 
+/*
+ * Copy the contents of another matrix (of any stype and dtype) into a slice of a dense matrix. The shapes must already
+ * have been checked.
+ *
+ * If right is a dense matrix with the same layout as the slice and doesn't share elements with dest, it's read in
+ * place. Otherwise it's first copied into a packed dense buffer, which also makes the assignment safe when right is a
+ * reference into dest itself.
+ */
+static void slice_set_matrix(DENSE_STORAGE* dest, SLICE* slice, STORAGE* right, nm::stype_t right_stype) {
+  NAMED_LR_DTYPE_TEMPLATE_TABLE(slice_set_table, nm::dense_storage::slice_set, void, void*, const size_t*, const void*, const size_t*, const size_t*, size_t, size_t)
+
+  DENSE_STORAGE* src = reinterpret_cast<DENSE_STORAGE*>(right);
+  size_t* src_stride = ALLOCA_N(size_t, dest->dim);
+  size_t  psrc       = 0;
+
+  bool in_place = right_stype == nm::DENSE_STORE && right->dim == dest->dim && src->elements != dest->elements
+               && !memcmp(right->shape, slice->lengths, sizeof(size_t) * dest->dim);
+
+  if (in_place) {
+    size_t* zero = ALLOCA_N(size_t, dest->dim);
+    memset(zero, 0, sizeof(size_t) * dest->dim);
+
+    memcpy(src_stride, src->stride, sizeof(size_t) * dest->dim);
+    psrc = nm_dense_storage_pos(src, zero);
+
+  } else {
+    if (right_stype == nm::DENSE_STORE) {
+      src = nm_dense_storage_copy(src);
+    } else {
+      CAST_TABLE(cast_table);
+      src = reinterpret_cast<DENSE_STORAGE*>(cast_table[nm::DENSE_STORE][right_stype](right, dest->dtype, NULL));
+    }
+
+    // src is packed in the shape of the slice
+    for (size_t i = dest->dim; i-- > 0;)
+      src_stride[i] = (i == dest->dim - 1) ? 1 : src_stride[i+1] * slice->lengths[i+1];
+  }
+
+  slice_set_table[dest->dtype][src->dtype]((char*)(dest->elements) + nm_dense_storage_pos(dest, slice->coords) * DTYPE_SIZES[dest->dtype],
+                                           dest->stride,
+                                           (char*)(src->elements) + psrc * DTYPE_SIZES[src->dtype],
+                                           src_stride,
+                                           slice->lengths, dest->dim, 0);
+
+  if (!in_place) nm_dense_storage_delete(src);
+}
+
+
 /*
  * Set a value or values in a dense matrix. Requires that right be either a single value or an NMatrix (ref or real).
  */
 void nm_dense_storage_set(VALUE left, SLICE* slice, VALUE right) {
   DENSE_STORAGE* s = NM_STORAGE_DENSE(left);
+  nm_dense_storage_unshare(s);
 
   if (TYPE(right) == T_DATA) {
     if (RDATA(right)->dfree == (RUBY_DATA_FUNC)nm_delete || RDATA(right)->dfree == (RUBY_DATA_FUNC)nm_delete_ref) {
-      rb_raise(rb_eNotImpError, "this type of slicing not yet supported");
+      nm_storage_check_slice_set_shape(NM_STORAGE(right), slice, s->dim);
+      slice_set_matrix(s, slice, NM_STORAGE(right), NM_STYPE(right));
     } else {
       rb_raise(rb_eTypeError, "unrecognized type for slice assignment");
     }
   } else {
-    void* val = rubyobj_to_cval(right, s->dtype);
-    if (slice->single)
-      memcpy((char*)(s->elements) + nm_dense_storage_pos(s, slice->coords) * DTYPE_SIZES[s->dtype], val, DTYPE_SIZES[s->dtype]);
-    else
+    if (slice->single) {
+      rubyval_to_cval(right, s->dtype, (char*)(s->elements) + nm_dense_storage_pos(s, slice->coords) * DTYPE_SIZES[s->dtype]);
+    } else {
+      void* val = ALLOCA_N(char, DTYPE_SIZES[s->dtype]);
+      rubyval_to_cval(right, s->dtype, val);
       slice_set_single(s, val, slice->lengths, nm_dense_storage_pos(s, slice->coords), 0);
-
-    xfree(val);
+    }
   }
 
 }
@@ -568,6 +804,84 @@ STORAGE* nm_dense_storage_matrix_multiply(const STORAGE_PAIR& casted_storage, si
   return ttable[casted_storage.left->dtype](casted_storage, resulting_shape, vector);
 }
 
+/*
+ * Multiply every element of a dense matrix, in place, by a scalar of its dtype. The matrix must not be a reference.
+ */
+void nm_dense_storage_scale(STORAGE* s, const void* scalar) {
+  nm_math_scal(nm_storage_count_max_elements(s), scalar, nm_dense_storage_writable_elements(reinterpret_cast<DENSE_STORAGE*>(s)), 1, s->dtype);
+}
+
+/*
+ * Multiply two dense matrices of different dtypes, converting only a panel of each operand to result_dtype at a time.
+ * Returns NULL (and leaves resulting_shape alone) if this isn't possible, in which case the operands should be cast in
+ * full; otherwise the result takes ownership of resulting_shape.
+ */
+STORAGE* nm_dense_storage_matrix_multiply_mixed(const STORAGE_PAIR& operands, size_t* resulting_shape, nm::dtype_t result_dtype) {
+  DTYPE_TEMPLATE_TABLE(nm::dense_storage::matrix_multiply_mixed, void, const DENSE_STORAGE*, const DENSE_STORAGE*, DENSE_STORAGE*);
+
+  const DENSE_STORAGE* left  = reinterpret_cast<const DENSE_STORAGE*>(operands.left);
+  const DENSE_STORAGE* right = reinterpret_cast<const DENSE_STORAGE*>(operands.right);
+
+  // Converted Ruby objects would only be referenced from the unmarked panel buffers.
+  if (result_dtype == nm::RUBYOBJ) return NULL;
+
+  // Rationals can't be converted from floating point or complex.
+  for (size_t i = 0; i < 2; ++i) {
+    nm::dtype_t from = i ? right->dtype : left->dtype;
+    if (from != result_dtype && result_dtype >= nm::RATIONAL32 && from >= nm::FLOAT32 && from <= nm::COMPLEX128) return NULL;
+  }
+
+  DENSE_STORAGE* result = nm_dense_storage_create(result_dtype, resulting_shape, 2, NULL, 0);
+  ttable[result_dtype](left, right, result);
+
+  return result;
+}
+
+
+/*
+ * The Gram matrix of a 2-dimensional dense matrix's columns (outer = false) or rows (outer = true), computing only
+ * half of the symmetric (or Hermitian) result. The matrix may be a reference.
+ */
+STORAGE* nm_dense_storage_gram(const STORAGE* matrix, bool outer) {
+  DTYPE_TEMPLATE_TABLE(nm::dense_storage::gram, void, const DENSE_STORAGE*, DENSE_STORAGE*, bool);
+
+  size_t* shape = ALLOC_N(size_t, 2);
+  shape[0] = shape[1] = matrix->shape[outer ? 0 : 1];
+
+  DENSE_STORAGE* result = nm_dense_storage_create(matrix->dtype, shape, 2, NULL, 0);
+  ttable[matrix->dtype](reinterpret_cast<const DENSE_STORAGE*>(matrix), result, outer);
+
+  return result;
+}
+
+
+/*
+ * Multiply two dense integer matrices of the same dtype into a wider integer dtype (e.g., int8 x int8 -> int32), with
+ * no overflow in the intermediate products. Returns NULL (and leaves resulting_shape alone) if the dtypes aren't
+ * suitable; otherwise the result takes ownership of resulting_shape.
+ */
+STORAGE* nm_dense_storage_matrix_multiply_widened(const STORAGE_PAIR& operands, size_t* resulting_shape, nm::dtype_t result_dtype) {
+  static bool (*ttable[nm::NUM_DTYPES])(const DENSE_STORAGE*, const DENSE_STORAGE*, DENSE_STORAGE*) = {
+    nm::dense_storage::matrix_multiply_widened<uint8_t>,
+    nm::dense_storage::matrix_multiply_widened<int8_t>,
+    nm::dense_storage::matrix_multiply_widened<int16_t>,
+    nm::dense_storage::matrix_multiply_widened<int32_t>,
+    NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL
+  };
+
+  DENSE_STORAGE* left  = reinterpret_cast<DENSE_STORAGE*>(operands.left);
+  DENSE_STORAGE* right = reinterpret_cast<DENSE_STORAGE*>(operands.right);
+
+  if (left->dtype != right->dtype || !ttable[left->dtype]) return NULL;
+  if (result_dtype != nm::INT16 && result_dtype != nm::INT32 && result_dtype != nm::INT64) return NULL;
+  if (DTYPE_SIZES[result_dtype] <= DTYPE_SIZES[left->dtype]) return NULL;
+
+  DENSE_STORAGE* result = nm_dense_storage_create(result_dtype, resulting_shape, 2, NULL, 0);
+  ttable[left->dtype](left, right, result);
+
+  return result;
+}
+
 /////////////
 // Utility //
 /////////////
@@ -677,6 +991,66 @@ DENSE_STORAGE* nm_dense_storage_copy(const DENSE_STORAGE* rhs) {
 }
 
 
+/*
+ * Copy dense storage lazily: the new storage shares rhs's elements until one of the two is written to (see
+ * nm_dense_storage_unshare). References, and matrices which currently have references into them, are copied
+ * immediately, since writes through a reference must remain visible in its source.
+ */
+DENSE_STORAGE* nm_dense_storage_copy_on_write(DENSE_STORAGE* rhs) {
+  if (rhs->src != rhs || rhs->count > 1 || !rhs->elements)
+    return nm_dense_storage_copy(rhs);
+
+  size_t *shape  = ALLOC_N(size_t, rhs->dim);
+  memcpy(shape, rhs->shape, sizeof(size_t) * rhs->dim);
+
+  DENSE_STORAGE* lhs = nm_dense_storage_create_dummy(rhs->dtype, shape, rhs->dim);
+
+  if (!rhs->shared_count) {
+    rhs->shared_count  = ALLOC(int);
+    *(rhs->shared_count) = 1;
+  }
+
+  ++(*rhs->shared_count);
+  lhs->shared_count = rhs->shared_count;
+  lhs->elements     = rhs->elements;
+
+  return lhs;
+}
+
+
+/*
+ * Give a storage (or the source of a reference) its own copy of any elements it is sharing copy-on-write. Must be
+ * called before anything modifies the elements of a dense matrix in place.
+ */
+void nm_dense_storage_unshare(DENSE_STORAGE* s) {
+  s = reinterpret_cast<DENSE_STORAGE*>(s->src);
+
+  if (!s->shared_count) return;
+
+  if (*(s->shared_count) > 1) {
+    size_t bytes = DTYPE_SIZES[s->dtype] * nm_storage_count_max_elements(s);
+    void* elements = nm_dense_storage_alloc_elements(bytes);
+    memcpy(elements, s->elements, bytes);
+
+    --(*s->shared_count);
+    s->elements = elements;
+  } else {
+    xfree(s->shared_count);
+  }
+
+  s->shared_count = NULL;
+}
+
+
+/*
+ * Get the elements of a dense matrix for writing, unsharing them first if necessary.
+ */
+void* nm_dense_storage_writable_elements(DENSE_STORAGE* s) {
+  nm_dense_storage_unshare(s);
+  return s->elements;
+}
+
+
 /*
  * Transpose dense storage into a new dense storage object. Basically a copy constructor.
  *
@@ -846,7 +1220,121 @@ bool is_symmetric(const DENSE_STORAGE* mat, int lda) {
 
 
 /*
- * DType-templated matrix-matrix multiplication for dense storage.
+ * First element of a 2-dimensional dense matrix, which may be a reference. Its rows are stride[0] elements apart, so
+ * that serves as the leading dimension when passing it to BLAS.
+ */
+static inline size_t first_element_pos(const DENSE_STORAGE* s) {
+  return s->offset[0] * s->stride[0] + s->offset[1] * s->stride[1];
+}
+
+template <typename DType>
+static inline DType* first_element(const DENSE_STORAGE* s) {
+  return reinterpret_cast<DType*>(s->elements) + first_element_pos(s);
+}
+
+
+/*
+ * Copy a rows x cols block of a row-major matrix of RDType, whose rows are src_ld elements apart, into a packed
+ * row-major block of LDType.
+ */
+template <typename LDType, typename RDType>
+static void convert_block(void* dest_, const void* src_, size_t rows, size_t cols, size_t src_ld) {
+  LDType* dest = reinterpret_cast<LDType*>(dest_);
+  RDType* src  = reinterpret_cast<RDType*>(const_cast<void*>(src_));
+
+  for (size_t r = 0; r < rows; ++r)
+    for (size_t c = 0; c < cols; ++c)
+      dest[r*cols + c] = src[r*src_ld + c];
+}
+
+
+/*
+ * Matrix-matrix multiplication where one or both operands have a dtype other than the result's. Rather than casting
+ * whole operands, take NM_MIXED_MULTIPLY_PANEL columns of the left (and the matching rows of the right) at a time,
+ * convert just those, and accumulate their product into the result with gemm. Operands which already have the result
+ * dtype are read in place.
+ */
+template <typename DType>
+static void matrix_multiply_mixed(const DENSE_STORAGE* left, const DENSE_STORAGE* right, DENSE_STORAGE* result) {
+  NAMED_LR_DTYPE_TEMPLATE_TABLE(convert_table, nm::dense_storage::convert_block, void, void*, const void*, size_t, size_t, size_t);
+
+  const int M = left->shape[0], K = left->shape[1], N = right->shape[1];
+  const int kc_max = std::min(NM_MIXED_MULTIPLY_PANEL, K);
+
+  // With no panels at all, the product is zero.
+  if (K == 0) {
+    DType* c = reinterpret_cast<DType*>(result->elements);
+    for (size_t i = 0; i < (size_t)(M) * N; ++i) c[i] = 0;
+    return;
+  }
+
+  const bool convert_left  = left->dtype  != result->dtype,
+             convert_right = right->dtype != result->dtype;
+
+  DType* Ap = convert_left  ? ALLOC_N(DType, (size_t)(M) * kc_max) : NULL;
+  DType* Bp = convert_right ? ALLOC_N(DType, (size_t)(kc_max) * N) : NULL;
+
+  const char* a0 = reinterpret_cast<const char*>(left->elements)  + first_element_pos(left)  * DTYPE_SIZES[left->dtype];
+  const char* b0 = reinterpret_cast<const char*>(right->elements) + first_element_pos(right) * DTYPE_SIZES[right->dtype];
+
+  DType alpha = 1, beta;
+
+  for (int pc = 0; pc < K; pc += NM_MIXED_MULTIPLY_PANEL) {
+    const int kc = std::min(NM_MIXED_MULTIPLY_PANEL, K - pc);
+
+    const DType *A, *B;
+    int lda, ldb;
+
+    if (convert_left) {
+      convert_table[result->dtype][left->dtype](Ap, a0 + pc * DTYPE_SIZES[left->dtype], M, kc, left->stride[0]);
+      A   = Ap;
+      lda = kc;
+    } else {
+      A   = reinterpret_cast<const DType*>(a0) + pc;
+      lda = left->stride[0];
+    }
+
+    if (convert_right) {
+      convert_table[result->dtype][right->dtype](Bp, b0 + pc * right->stride[0] * DTYPE_SIZES[right->dtype], kc, N, right->stride[0]);
+      B   = Bp;
+      ldb = N;
+    } else {
+      B   = reinterpret_cast<const DType*>(b0) + pc * right->stride[0];
+      ldb = right->stride[0];
+    }
+
+    beta = pc == 0 ? 0 : 1;
+    nm::math::gemm<DType>(CblasRowMajor, CblasNoTrans, CblasNoTrans, M, N, kc, &alpha, A, lda, B, ldb, &beta,
+                          reinterpret_cast<DType*>(result->elements), N);
+  }
+
+  if (Ap) xfree(Ap);
+  if (Bp) xfree(Bp);
+}
+
+
+/*
+ * The Gram matrix A**H*A of a matrix's columns, or with outer set, the matrix A*A**H of its rows. (For non-complex
+ * dtypes, the conjugate transpose is the transpose.) herk computes the upper triangle, which is then reflected into
+ * the lower.
+ */
+template <typename DType>
+static void gram(const DENSE_STORAGE* matrix, DENSE_STORAGE* result, bool outer) {
+  const int N = result->shape[0],
+            K = outer ? matrix->shape[1] : matrix->shape[0];
+
+  DType alpha = 1, beta = 0;
+
+  nm::math::herk<DType>(CblasRowMajor, CblasUpper, outer ? CblasNoTrans : CblasConjTrans, N, K, &alpha,
+                        first_element<DType>(matrix), matrix->stride[0], &beta, reinterpret_cast<DType*>(result->elements), N);
+  nm::math::syreflect<true, DType>(CblasRowMajor, CblasUpper, N, reinterpret_cast<DType*>(result->elements), N);
+}
+
+
+/*
+ * DType-templated matrix-matrix multiplication for dense storage. Either operand may be a reference, in which case it's
+ * read in place using its source's row stride. Large integer and rational products use Strassen-Winograd (see
+ * strassen.h).
  */
 template <typename DType>
 static DENSE_STORAGE* matrix_multiply(const STORAGE_PAIR& casted_storage, size_t* resulting_shape, bool vector) {
@@ -863,15 +1351,50 @@ static DENSE_STORAGE* matrix_multiply(const STORAGE_PAIR& casted_storage, size_t
   *pBeta = 0;
   // Do the multiplication
   if (vector) nm::math::gemv<DType>(CblasNoTrans, left->shape[0], left->shape[1], pAlpha,
-                                    reinterpret_cast<DType*>(left->elements), left->shape[1],
-                                    reinterpret_cast<DType*>(right->elements), 1, pBeta,
+                                    first_element<DType>(left), left->stride[0],
+                                    first_element<DType>(right), right->stride[0], pBeta,
                                     reinterpret_cast<DType*>(result->elements), 1);
-  else        nm::math::gemm<DType>(CblasRowMajor, CblasNoTrans, CblasNoTrans, left->shape[0], right->shape[1], left->shape[1],
-                                    pAlpha, reinterpret_cast<DType*>(left->elements), left->shape[1],
-                                    reinterpret_cast<DType*>(right->elements), right->shape[1], pBeta,
+  else if (!nm::math::strassen<DType>(left->shape[0], right->shape[1], left->shape[1],
+                                      first_element<DType>(left), left->stride[0],
+                                      first_element<DType>(right), right->stride[0],
+                                      reinterpret_cast<DType*>(result->elements), result->shape[1]))
+              nm::math::gemm<DType>(CblasRowMajor, CblasNoTrans, CblasNoTrans, left->shape[0], right->shape[1], left->shape[1],
+                                    pAlpha, first_element<DType>(left), left->stride[0],
+                                    first_element<DType>(right), right->stride[0], pBeta,
                                     reinterpret_cast<DType*>(result->elements), result->shape[1]);
 
   return result;
 }
 
+
+/*
+ * Integer matrix-matrix multiplication for dense storage, into a result with a wider integer dtype. Returns false if
+ * the result dtype isn't wider than DType.
+ */
+template <typename DType>
+static bool matrix_multiply_widened(const DENSE_STORAGE* left, const DENSE_STORAGE* right, DENSE_STORAGE* result) {
+  const int M = left->shape[0], K = left->shape[1], N = right->shape[1];
+
+  const int lda = left->stride[0], ldb = right->stride[0];
+
+  const DType* A = first_element<DType>(left);
+  const DType* B = first_element<DType>(right);
+
+  if (DTYPE_SIZES[result->dtype] <= sizeof(DType)) return false;
+
+  switch (result->dtype) {
+  case nm::INT16:
+    nm::math::gemm_widen<DType,int16_t>(M, N, K, A, lda, B, ldb, reinterpret_cast<int16_t*>(result->elements), N);
+    return true;
+  case nm::INT32:
+    nm::math::gemm_widen<DType,int32_t>(M, N, K, A, lda, B, ldb, reinterpret_cast<int32_t*>(result->elements), N);
+    return true;
+  case nm::INT64:
+    nm::math::gemm_widen<DType,int64_t>(M, N, K, A, lda, B, ldb, reinterpret_cast<int64_t*>(result->elements), N);
+    return true;
+  default:
+    return false;
+  }
+}
+
 }} // end of namespace nm::dense_storage
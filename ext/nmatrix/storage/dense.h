@@ -51,10 +51,19 @@
  * Macros
  */
 
+// Elements of a dense NMatrix VALUE which are about to be modified in place.
+#define NM_DENSE_WRITABLE_ELEMENTS(val)   (nm_dense_storage_writable_elements(NM_STORAGE_DENSE(val)))
+
+// Alignment (in bytes) of dense elements allocated by the default allocator; one cache line.
+#define NM_DENSE_ALIGNMENT  64
+
 /*
  * Types
  */
 
+typedef void* (*nm_dense_alloc_func)(size_t bytes);
+typedef void  (*nm_dense_free_func)(void* elements);
+
 /*
  * Data
  */
@@ -74,6 +83,12 @@ void						nm_dense_storage_delete(STORAGE* s);
 void						nm_dense_storage_delete_ref(STORAGE* s);
 void						nm_dense_storage_mark(void*);
 
+void*           nm_dense_storage_alloc_elements(size_t bytes);
+void            nm_dense_storage_free_elements(void* elements, size_t bytes);
+void            nm_dense_storage_set_allocator(nm_dense_alloc_func alloc_func, nm_dense_free_func free_func);
+void            nm_dense_storage_set_huge_page_threshold(size_t bytes);
+size_t          nm_dense_storage_huge_page_threshold(void);
+
 ///////////////
 // Accessors //
 ///////////////
@@ -100,6 +115,10 @@ bool nm_dense_storage_is_hermitian(const DENSE_STORAGE* mat, int lda);
 //////////
 
 STORAGE* nm_dense_storage_matrix_multiply(const STORAGE_PAIR& casted_storage, size_t* resulting_shape, bool vector);
+STORAGE* nm_dense_storage_matrix_multiply_widened(const STORAGE_PAIR& operands, size_t* resulting_shape, nm::dtype_t result_dtype);
+STORAGE* nm_dense_storage_matrix_multiply_mixed(const STORAGE_PAIR& operands, size_t* resulting_shape, nm::dtype_t result_dtype);
+STORAGE* nm_dense_storage_gram(const STORAGE* matrix, bool outer);
+void     nm_dense_storage_scale(STORAGE* s, const void* scalar);
 
 /////////////
 // Utility //
@@ -113,6 +132,9 @@ void nm_dense_storage_coords(const DENSE_STORAGE* s, const size_t slice_pos, siz
 /////////////////////////
 
 DENSE_STORAGE*  nm_dense_storage_copy(const DENSE_STORAGE* rhs);
+DENSE_STORAGE*  nm_dense_storage_copy_on_write(DENSE_STORAGE* rhs);
+void            nm_dense_storage_unshare(DENSE_STORAGE* s);
+void*           nm_dense_storage_writable_elements(DENSE_STORAGE* s);
 STORAGE*        nm_dense_storage_copy_transposed(const STORAGE* rhs_base);
 STORAGE*        nm_dense_storage_cast_copy(const STORAGE* rhs, nm::dtype_t new_dtype, void*);
 
@@ -34,6 +34,7 @@
 #include <algorithm> // std::min
 #include <iostream>
 #include <vector>
+#include <limits>
 
 /*
  * Project Includes
@@ -44,8 +45,10 @@
 #include "data/data.h"
 
 #include "common.h"
+#include "storage.h"
 #include "list.h"
 
+#include "math/syrk.h" // for math.h
 #include "math/math.h"
 #include "util/sl_list.h"
 
@@ -53,6 +56,24 @@
  * Macros
  */
 
+// The right operand of a product is copied to flat arrays when the left has this many times as many entries as the
+// right has non-empty rows.
+#define NM_LIST_ROW_ARRAYS_REUSE 4
+
+/*
+ * Types
+ */
+
+/*
+ * The rows of a 2-dimensional list matrix laid out as flat arrays, for operands whose rows are walked many times over.
+ * a holds values of the matrix's dtype. Kept in row_arrays of the storage it was made from until that's written to.
+ */
+struct ROW_ARRAYS {
+  size_t* ia;
+  size_t* ja;
+  void*   a;
+};
+
 /*
  * Global Variables
  */
@@ -131,6 +152,15 @@ static LIST_STORAGE* cast_copy(const LIST_STORAGE* rhs, dtype_t new_dtype);
 template <typename LDType, typename RDType>
 static bool eqeq_r(RecurseData& left, RecurseData& right, const LIST* l, const LIST* r, size_t rec);
 
+template <typename DType>
+static void scale(LIST_STORAGE* s, const void* scalar);
+
+template <typename DType>
+static void scale_r(LIST* l, const DType& scalar, size_t rec);
+
+template <typename DType>
+static LIST_STORAGE* matrix_multiply(const STORAGE_PAIR& casted_storage, size_t* resulting_shape);
+
 template <typename SDType, typename TDType>
 static bool eqeq_empty_r(RecurseData& s, const LIST* l, size_t rec, const TDType* t_init);
 
@@ -279,12 +309,30 @@ LIST_STORAGE* nm_list_storage_create(dtype_t dtype, size_t* shape, size_t dim, v
 
   s->rows  = list::create();
   s->default_val = init_val;
+  s->row_arrays = NULL;
   s->count = 1;
   s->src = s;
 
   return s;
 }
 
+/*
+ * Drop the flat copy of a list matrix's rows kept for products (see matrix_multiply). Must be called whenever its
+ * entries change; s may be a reference, in which case its source's copy is dropped.
+ */
+static void nm_list_storage_drop_row_arrays(LIST_STORAGE* s) {
+  s = reinterpret_cast<LIST_STORAGE*>(s->src);
+  if (!s->row_arrays) return;
+
+  ROW_ARRAYS* r = reinterpret_cast<ROW_ARRAYS*>(s->row_arrays);
+  xfree(r->ia);
+  xfree(r->ja);
+  xfree(r->a);
+  xfree(r);
+
+  s->row_arrays = NULL;
+}
+
 /*
  * Documentation goes here.
  */
@@ -292,6 +340,7 @@ void nm_list_storage_delete(STORAGE* s) {
   if (s) {
     LIST_STORAGE* storage = (LIST_STORAGE*)s;
     if (storage->count-- == 1) {
+      nm_list_storage_drop_row_arrays(storage);
       list::del( storage->rows, storage->dim - 1 );
 
       xfree(storage->shape);
@@ -310,9 +359,7 @@ void nm_list_storage_delete_ref(STORAGE* s) {
     LIST_STORAGE* storage = (LIST_STORAGE*)s;
 
     nm_list_storage_delete( reinterpret_cast<STORAGE*>(storage->src ) );
-    xfree(storage->shape);
-    xfree(storage->offset);
-    xfree(s);
+    nm_storage_free_ref(s);
   }
 }
 
@@ -615,12 +662,9 @@ void* nm_list_storage_ref(STORAGE* storage, SLICE* slice) {
     return (n ? n->val : s->default_val);
   } 
   else {
-    ns              = ALLOC( LIST_STORAGE );
-    
-    ns->dim         = s->dim;
+    ns              = reinterpret_cast<LIST_STORAGE*>(nm_storage_alloc_ref(s->dim));
+
     ns->dtype       = s->dtype;
-    ns->offset      = ALLOC_N(size_t, ns->dim);
-    ns->shape       = ALLOC_N(size_t, ns->dim);
 
     for (size_t i = 0; i < ns->dim; ++i) {
       ns->offset[i] = slice->coords[i] + s->offset[i];
@@ -629,6 +673,7 @@ void* nm_list_storage_ref(STORAGE* storage, SLICE* slice) {
 
     ns->rows        = s->rows;
     ns->default_val = s->default_val;
+    ns->row_arrays  = NULL;
     
     s->src->count++;
     ns->src         = s->src;
@@ -677,22 +722,105 @@ static void slice_set_single(LIST_STORAGE* dest, LIST* l, void* val, size_t* coo
 }
 
 
+/*
+ * Recursive function, moves the nodes of src (whose keys are relative to the slice) into l, which must not contain any
+ * entries within the slice. Value nodes are relinked rather than copied; src is left empty.
+ */
+static void slice_splice(LIST_STORAGE* dest, LIST* l, LIST* src, size_t* coords, size_t n) {
+  NODE* prev = NULL;
+  NODE* curr = src->first;
+  src->first = NULL;
+
+  while (curr) {
+    NODE*  next = curr->next;
+    size_t key  = curr->key + dest->offset[n] + coords[n];
+
+    prev = prev ? list::find_preceding_from_node(prev, key) : list::find_preceding_from_list(l, key);
+    NODE* at = prev ? prev->next : l->first;
+
+    if (dest->dim - n > 1) {
+      LIST* sub = reinterpret_cast<LIST*>(curr->val);
+
+      if (sub->first) {
+        if (!at || at->key != key) // need a new row
+          at = prev ? list::insert_after(prev, key, list::create()) : list::insert(l, false, key, list::create());
+
+        slice_splice(dest, reinterpret_cast<LIST*>(at->val), sub, coords, n + 1);
+        prev = at;
+      }
+
+      list::del(sub, 0);
+      xfree(curr);
+
+    } else {
+      curr->key  = key;
+      curr->next = at;
+
+      if (prev) prev->next = curr;
+      else      l->first   = curr;
+
+      prev = curr;
+    }
+
+    curr = next;
+  }
+}
+
+
+/*
+ * Convert the right-hand side of a slice assignment into list storage of dest's dtype and default value, in the shape
+ * of the slice. This is always a copy, so right may safely refer to dest.
+ */
+static LIST_STORAGE* slice_set_source(const LIST_STORAGE* dest, SLICE* slice, STORAGE* right, nm::stype_t right_stype) {
+  if (right_stype == nm::LIST_STORE && right->dim == dest->dim && !memcmp(right->shape, slice->lengths, sizeof(size_t) * dest->dim)) {
+    LIST_STORAGE* tmp = reinterpret_cast<LIST_STORAGE*>(nm_list_storage_cast_copy(right, dest->dtype, NULL));
+    if (!std::memcmp(tmp->default_val, dest->default_val, DTYPE_SIZES[dest->dtype])) return tmp;
+
+    nm_list_storage_delete(tmp); // different default value -- need to fill in the gaps.
+  }
+
+  // Go through a packed dense copy, reshaped to match the slice.
+  CAST_TABLE(cast_table);
+  DENSE_STORAGE* packed = reinterpret_cast<DENSE_STORAGE*>(cast_table[nm::DENSE_STORE][right_stype](right, dest->dtype, NULL));
+
+  size_t* shape = ALLOC_N(size_t, dest->dim);
+  memcpy(shape, slice->lengths, sizeof(size_t) * dest->dim);
+
+  DENSE_STORAGE* reshaped = nm_dense_storage_create(dest->dtype, shape, dest->dim, NULL, 0);
+  std::swap(reshaped->elements, packed->elements);
+  nm_dense_storage_delete(packed);
+
+  LIST_STORAGE* tmp = reinterpret_cast<LIST_STORAGE*>(nm_list_storage_from_dense(reshaped, dest->dtype, dest->default_val));
+  nm_dense_storage_delete(reshaped);
+
+  return tmp;
+}
+
+
 /*
  * Set a value or values in a list matrix.
  */
 void nm_list_storage_set(VALUE left, SLICE* slice, VALUE right) {
   LIST_STORAGE* s = NM_STORAGE_LIST(left);
+  nm_list_storage_drop_row_arrays(s);
 
   if (TYPE(right) == T_DATA) {
     if (RDATA(right)->dfree == (RUBY_DATA_FUNC)nm_delete || RDATA(right)->dfree == (RUBY_DATA_FUNC)nm_delete_ref) {
-      rb_raise(rb_eNotImpError, "this type of slicing not yet supported");
+      nm_storage_check_slice_set_shape(NM_STORAGE(right), slice, s->dim);
+
+      LIST_STORAGE* tmp = slice_set_source(s, slice, NM_STORAGE(right), NM_STYPE(right));
+
+      list::remove_recursive(s->rows, slice->coords, s->offset, slice->lengths, 0, s->dim);
+      slice_splice(s, s->rows, tmp->rows, slice->coords, 0);
+
+      nm_list_storage_delete(tmp);
     } else {
       rb_raise(rb_eTypeError, "unrecognized type for slice assignment");
     }
   } else {
     void* val = rubyobj_to_cval(right, s->dtype);
 
-    bool remove = !std::memcmp(val, s->default_val, s->dtype);
+    bool remove = !std::memcmp(val, s->default_val, DTYPE_SIZES[s->dtype]);
 
     if (remove) {
       xfree(val);
@@ -721,6 +849,8 @@ NODE* nm_list_storage_insert(STORAGE* storage, SLICE* slice, void* val) {
   NODE*  n;
   LIST*  l = s->rows;
 
+  nm_list_storage_drop_row_arrays(s);
+
   // drill down into the structure
   for (r = s->dim; r > 1; --r) {
     n = list::insert(l, false, s->offset[s->dim - r] + slice->coords[s->dim - r], list::create());
@@ -739,6 +869,7 @@ void nm_list_storage_remove(STORAGE* storage, SLICE* slice) {
   // This returns a boolean, which will indicate whether s->rows is empty.
   // We can safely ignore it, since we never want to delete s->rows until
   // it's time to destroy the LIST_STORAGE object.
+  nm_list_storage_drop_row_arrays(s);
   list::remove_recursive(s->rows, slice->coords, s->offset, slice->lengths, 0, s->dim);
 }
 
@@ -767,12 +898,21 @@ bool nm_list_storage_eqeq(const STORAGE* left, const STORAGE* right) {
  * List storage matrix multiplication.
  */
 STORAGE* nm_list_storage_matrix_multiply(const STORAGE_PAIR& casted_storage, size_t* resulting_shape, bool vector) {
-  free(resulting_shape);
-  rb_raise(rb_eNotImpError, "multiplication not implemented for list-of-list matrices");
-  return NULL;
-  //DTYPE_TEMPLATE_TABLE(dense_storage::matrix_multiply, NMATRIX*, STORAGE_PAIR, size_t*, bool);
+  DTYPE_TEMPLATE_TABLE(nm::list_storage::matrix_multiply, LIST_STORAGE*, const STORAGE_PAIR& casted_storage, size_t* resulting_shape);
 
-  //return ttable[reinterpret_cast<DENSE_STORAGE*>(casted_storage.left)->dtype](casted_storage, resulting_shape, vector);
+  return reinterpret_cast<STORAGE*>(ttable[casted_storage.left->dtype](casted_storage, resulting_shape));
+}
+
+
+/*
+ * Multiply a list matrix's stored values and default value, in place, by a scalar of its dtype. The matrix must not be
+ * a reference.
+ */
+void nm_list_storage_scale(STORAGE* s, const void* scalar) {
+  DTYPE_TEMPLATE_TABLE(nm::list_storage::scale, void, LIST_STORAGE*, const void*);
+
+  nm_list_storage_drop_row_arrays(reinterpret_cast<LIST_STORAGE*>(s));
+  ttable[s->dtype](reinterpret_cast<LIST_STORAGE*>(s), scalar);
 }
 
 
@@ -926,6 +1066,163 @@ static LIST_STORAGE* cast_copy(const LIST_STORAGE* rhs, dtype_t new_dtype) {
 }
 
 
+/*
+ * Recursive helper for scale: rec is the number of list levels below l.
+ */
+template <typename DType>
+static void scale_r(LIST* l, const DType& scalar, size_t rec) {
+  for (NODE* curr = l->first; curr; curr = curr->next) {
+    if (rec) scale_r<DType>(reinterpret_cast<LIST*>(curr->val), scalar, rec-1);
+    else     *reinterpret_cast<DType*>(curr->val) = *reinterpret_cast<DType*>(curr->val) * scalar;
+  }
+}
+
+/*
+ * Templated version of nm_list_storage_scale.
+ */
+template <typename DType>
+static void scale(LIST_STORAGE* s, const void* scalar_) {
+  const DType& scalar = *reinterpret_cast<const DType*>(scalar_);
+
+  *reinterpret_cast<DType*>(s->default_val) = *reinterpret_cast<DType*>(s->default_val) * scalar;
+  scale_r<DType>(s->rows, scalar, s->dim - 1);
+}
+
+
+/*
+ * Copy the rows of s, which must not be a reference, to flat arrays.
+ */
+template <typename DType>
+static ROW_ARRAYS* row_arrays(const LIST_STORAGE* s) {
+  const size_t rows  = s->shape[0],
+               count = nm_list_storage_count_elements(s);
+
+  ROW_ARRAYS* r = ALLOC(ROW_ARRAYS);
+  r->ia = ALLOC_N(size_t, rows + 1);
+  r->ja = ALLOC_N(size_t, count);
+
+  DType* a = ALLOC_N(DType, count);
+  r->a     = a;
+
+  size_t p = 0;
+  NODE*  row = s->rows->first;
+
+  for (size_t i = 0; i < rows; ++i) {
+    r->ia[i] = p;
+    if (!row || row->key != i) continue;
+
+    for (NODE* curr = reinterpret_cast<LIST*>(row->val)->first; curr; curr = curr->next, ++p) {
+      r->ja[p] = curr->key;
+      a[p]     = *reinterpret_cast<DType*>(curr->val);
+    }
+
+    row = row->next;
+  }
+
+  r->ia[rows] = p;
+  return r;
+}
+
+
+/*
+ * Templated version of nm_list_storage_matrix_multiply. Each row of the product is added up in a dense accumulator
+ * from the rows of the right operand that the left row's entries pick out, then written out as a list in column
+ * order, leaving out zeros.
+ *
+ * Finding a row of a list matrix means walking its row list, so the right operand's rows are indexed once up front.
+ * If they are also going to be walked many times each -- the left operand has several times as many entries as the
+ * right has non-empty rows -- the right operand is copied to flat arrays instead, which are much quicker to read than
+ * linked nodes. That copy is kept with the right operand, so later products with it (until it's written to) use it
+ * without copying again.
+ */
+template <typename DType>
+static LIST_STORAGE* matrix_multiply(const STORAGE_PAIR& casted_storage, size_t* resulting_shape) {
+  const LIST_STORAGE *left  = reinterpret_cast<const LIST_STORAGE*>(casted_storage.left),
+                     *right = reinterpret_cast<const LIST_STORAGE*>(casted_storage.right);
+
+  if (!(*reinterpret_cast<DType*>(left->default_val) == 0) || !(*reinterpret_cast<DType*>(right->default_val) == 0)) {
+    xfree(resulting_shape);
+    rb_raise(rb_eNotImpError, "matrix default value must be some form of zero (not false or nil) for multiplication");
+  }
+
+  const size_t inner = right->shape[0],
+               cols  = resulting_shape[1];
+
+  const LIST** r_rows = ALLOC_N(const LIST*, inner);
+  size_t nonempty     = 0;
+
+  for (size_t j = 0; j < inner; ++j) r_rows[j] = NULL;
+  for (NODE* row = right->rows->first; row; row = row->next, ++nonempty)
+    r_rows[row->key] = reinterpret_cast<const LIST*>(row->val);
+
+  // The flat copy is a cache, not part of right's value, so it's kept even though right is const.
+  const ROW_ARRAYS* r = right->row_arrays ? reinterpret_cast<const ROW_ARRAYS*>(right->row_arrays) : NULL;
+  if (!r && right->src == right && nm_list_storage_count_elements(left) > NM_LIST_ROW_ARRAYS_REUSE * nonempty) {
+    ROW_ARRAYS* made = row_arrays<DType>(right);
+    const_cast<LIST_STORAGE*>(right)->row_arrays = made;
+    r = made;
+  }
+
+  const DType* ra = r ? reinterpret_cast<const DType*>(r->a) : NULL;
+
+  DType*  sums    = ALLOC_N(DType, cols);
+  size_t* marks   = ALLOC_N(size_t, cols);
+  size_t* touched = ALLOC_N(size_t, cols);
+  for (size_t k = 0; k < cols; ++k) marks[k] = std::numeric_limits<size_t>::max();
+
+  DType* init = ALLOC(DType);
+  *init       = 0;
+
+  LIST_STORAGE* result = nm_list_storage_create(left->dtype, resulting_shape, 2, init);
+  NODE* last_row = NULL;
+
+  for (NODE* lrow = left->rows->first; lrow; lrow = lrow->next) {
+    const size_t i = lrow->key;
+    size_t len     = 0;
+
+    for (NODE* l = reinterpret_cast<LIST*>(lrow->val)->first; l; l = l->next) {
+      const DType& v = *reinterpret_cast<DType*>(l->val);
+      if (v == 0) continue;
+
+      if (r) {
+        for (size_t p = r->ia[l->key]; p < r->ia[l->key + 1]; ++p) {
+          const size_t k = r->ja[p];
+          if (marks[k] != i) { marks[k] = i; sums[k] = v * ra[p]; touched[len++] = k; }
+          else               sums[k] += v * ra[p];
+        }
+
+      } else if (r_rows[l->key]) {
+        for (NODE* rn = r_rows[l->key]->first; rn; rn = rn->next) {
+          const size_t k = rn->key;
+          if (marks[k] != i) { marks[k] = i; sums[k] = v * *reinterpret_cast<DType*>(rn->val); touched[len++] = k; }
+          else               sums[k] += v * *reinterpret_cast<DType*>(rn->val);
+        }
+      }
+    }
+
+    if (!len) continue;
+    std::sort(touched, touched + len);
+
+    LIST* row  = list::create();
+    NODE* last = NULL;
+
+    for (size_t p = 0; p < len; ++p) {
+      if (sums[touched[p]] != 0) last = list::insert_helper(row, last, touched[p], sums[touched[p]]);
+    }
+
+    if (row->first) last_row = list::insert_helper(result->rows, last_row, i, row);
+    else            list::del(row, 0);
+  }
+
+  xfree(sums);
+  xfree(marks);
+  xfree(touched);
+  xfree(r_rows);
+
+  return result;
+}
+
+
 /*
  * Recursive helper function for eqeq. Note that we use SDType and TDType instead of L and R because this function
  * is a re-labeling. That is, it can be called in order L,R or order R,L; and we don't want to get confused. So we
@@ -96,6 +96,7 @@ extern "C" {
   //////////
 
   STORAGE* nm_list_storage_matrix_multiply(const STORAGE_PAIR& casted_storage, size_t* resulting_shape, bool vector);
+  void     nm_list_storage_scale(STORAGE* s, const void* scalar);
 
 
   /////////////
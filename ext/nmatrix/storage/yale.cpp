@@ -47,6 +47,7 @@
 #include <typeinfo>
 #include <tuple>
 #include <queue>
+#include <vector>
 
 #define RB_P(OBJ) \
 	rb_funcall(rb_stderr, rb_intern("print"), 1, rb_funcall(OBJ, rb_intern("object_id"), 0)); \
@@ -58,9 +59,13 @@
 
 // #include "types.h"
 #include "data/data.h"
+#include "math/syrk.h" // for math.h
+#include "math/parallel.h"
 #include "math/math.h"
+#include "math/sparse_factor.h"
 
 #include "common.h"
+#include "storage.h"
 #include "yale.h"
 
 #include "nmatrix.h"
@@ -75,6 +80,17 @@
 #define NM_MIN(a,b) (((a)<(b))?(a):(b))
 #endif
 
+/*
+ * The dense operand of a sparse-dense product is worked through in pieces of about this many bytes (column blocks of
+ * the right-hand side of sparse times dense, row blocks of the left-hand side of dense times sparse), so that it stays
+ * in cache while the sparse structure is read once per piece. Pieces are never narrower than NM_YALE_SPMM_MIN_BLOCK.
+ */
+#define NM_YALE_SPMM_BLOCK_BYTES (256 * 1024)
+#define NM_YALE_SPMM_MIN_BLOCK   16
+
+// Levels of a parallel triangular solve with fewer rows than this are solved on the calling thread.
+#define NM_YALE_TRSM_MIN_LEVEL 256
+
 #ifndef NM_MAX_ITYPE
 #define NM_MAX_ITYPE(a,b) ((static_cast<int8_t>(a) > static_cast<int8_t>(b)) ? static_cast<nm::itype_t>(a) : static_cast<nm::itype_t>(b))
 #define NM_MIN_ITYPE(a,b) ((static_cast<int8_t>(a) < static_cast<int8_t>(b)) ? static_cast<nm::itype_t>(a) : static_cast<nm::itype_t>(b))
@@ -89,9 +105,11 @@ extern "C" {
   static YALE_STORAGE*	alloc(nm::dtype_t dtype, size_t* shape, size_t dim, nm::itype_t min_itype);
 
   static size_t yale_count_slice_copy_ndnz(const YALE_STORAGE* s, size_t*, size_t*);
+  static void   yale_gather_rows(const YALE_STORAGE* r, nm::dtype_t dtype, size_t* ptr, size_t** cols, void** vals, void* default_val);
 
   static void* default_value_ptr(const YALE_STORAGE* s);
   static VALUE default_value(const YALE_STORAGE* s);
+  static bool default_value_is_numeric_zero(const YALE_STORAGE* s);
   static VALUE obj_at(YALE_STORAGE* s, size_t k);
 
   /* Ruby-accessible functions */
@@ -146,9 +164,6 @@ static char           vector_insert(YALE_STORAGE* s, size_t pos, size_t* j, void
 template <typename DType, typename IType>
 static char           vector_insert_resize(YALE_STORAGE* s, size_t current_size, size_t pos, size_t* j, size_t n, bool struct_only);
 
-template <typename DType, typename IType>
-static std::tuple<long,bool,std::queue<std::tuple<IType,IType,int> > > count_slice_set_ndnz_change(YALE_STORAGE* s, size_t* coords, size_t* lengths, DType* v, size_t v_size);
-
 template <typename IType>
 static inline IType* IJA(const YALE_STORAGE* s) {
   return reinterpret_cast<IType*>(reinterpret_cast<YALE_STORAGE*>(s->src)->ija);
@@ -410,6 +425,61 @@ static void slice_copy(YALE_STORAGE* ns, const YALE_STORAGE* s, size_t* offset,
 }
 
 
+/*
+ * The entries of r (which may be a reference) other than its default value, cast to LDType, as compressed rows: row i
+ * holds cols[ptr[i]..ptr[i+1]), relative to r and sorted, with its diagonal entry in its place among the others. ptr
+ * has r->shape[0] + 1 elements; cols and vals are allocated here, and default_val is set to r's default value.
+ */
+template <typename LDType, typename RDType, typename IType>
+static void gather_rows(const YALE_STORAGE* r, size_t* ptr, size_t** cols_, void** vals_, void* default_val) {
+  const YALE_STORAGE* src = reinterpret_cast<const YALE_STORAGE*>(r->src);
+  const IType* ija = reinterpret_cast<const IType*>(src->ija);
+  RDType*      a   = reinterpret_cast<RDType*>(src->a);
+  RDType       RZERO(a[src->shape[0]]);
+
+  const size_t rows = r->shape[0], row_offset = r->offset[0], col_offset = r->offset[1], width = r->shape[1];
+
+  size_t capacity = 0;
+  for (size_t i = row_offset; i < row_offset + rows; ++i) capacity += 1 + ija[i+1] - ija[i];
+
+  size_t* cols = ALLOC_N(size_t, capacity);
+  LDType* vals = ALLOC_N(LDType, capacity);
+  size_t  q    = 0;
+
+  ptr[0] = 0;
+  for (size_t i = 0; i < rows; ++i) {
+    const size_t si = i + row_offset, d = si - col_offset; // column indices left of r wrap around past its right edge
+    bool         diagonal = d < width && a[si] != RZERO;
+
+    for (IType p = ija[si]; p < ija[si+1]; ++p) {
+      const size_t j = ija[p] - col_offset;
+      if (j >= width || a[p] == RZERO) continue;
+
+      if (diagonal && d < j) {
+        cols[q]  = d;
+        vals[q++] = a[si];
+        diagonal = false;
+      }
+
+      cols[q]   = j;
+      vals[q++] = a[p];
+    }
+
+    if (diagonal) {
+      cols[q]   = d;
+      vals[q++] = a[si];
+    }
+
+    ptr[i+1] = q;
+  }
+
+  LDType default_cast(RZERO);
+  *reinterpret_cast<LDType*>(default_val) = default_cast;
+  *cols_ = cols;
+  *vals_ = reinterpret_cast<void*>(vals);
+}
+
+
 /*
  * Get a single element of a yale storage object
  */
@@ -446,11 +516,7 @@ static void* get_single(YALE_STORAGE* storage, SLICE* slice) {
 template <typename DType,typename IType>
 void* ref(YALE_STORAGE* s, SLICE* slice) {
 
-  YALE_STORAGE* ns = ALLOC( YALE_STORAGE );
-
-  ns->dim     = s->dim;
-  ns->offset  = ALLOC_N(size_t, ns->dim);
-  ns->shape   = ALLOC_N(size_t, ns->dim);
+  YALE_STORAGE* ns = reinterpret_cast<YALE_STORAGE*>(nm_storage_alloc_ref(s->dim));
 
   for (size_t i = 0; i < ns->dim; ++i) {
     ns->offset[i]   = slice->coords[i] + s->offset[i];
@@ -474,264 +540,176 @@ void* ref(YALE_STORAGE* s, SLICE* slice) {
 }
 
 /*
- * Copy a vector into a temporary location, changing certain entries.
- *
- * Note that s must not be a reference. Call this on s->src
- */
-template <typename DType, typename IType>
-static void modify_partial_row(YALE_STORAGE* s, IType si, IType pos, IType end, int n, size_t j_off, size_t j_len, DType* v, size_t v_size, size_t& k) {
-  int new_len   = end - pos + n;
-  IType* tmp_ja = ALLOCA_N(IType, new_len);
-  DType* tmp_a  = ALLOCA_N(DType, new_len);
-
-  IType* s_ija  = reinterpret_cast<IType*>(s->ija);
-  DType* s_a    = reinterpret_cast<DType*>(s->a);
-
-  DType ZERO(*reinterpret_cast<DType*>(default_value_ptr(s)));
-
-  IType m = 0, p = pos;
-  for (IType j = 0; j < j_len; ++j, ++k) {
-    IType sj   = j + j_off;
-    IType x_sj = s_ija[p];
-
-    if (sj == si) {              // set diagonal in the real A
-      s_a[si] = v[k % v_size];
-    } else if (sj < x_sj) {
-      if (v[k % v_size] != ZERO) { // add non-zero
-        tmp_ja[m] = sj;
-        tmp_a[m]  = v[k % v_size];
-        ++m;
-      }
-    } else { // sj == x_sj
-      if (v[k % v_size] != ZERO) {
-        tmp_ja[m] = sj;
-        tmp_a[m]  = v[k % v_size];
-        ++m;
-      }
-      ++p;
-      x_sj = p < end ? s_ija[p] : (IType)(s->shape[1]);
-    }
-  }
-
-  // Now write into the original A and IJA.
-  for (IType m = 0; m < new_len; ++m) {
-    s_a[pos + m]   = tmp_a[m];
-    s_ija[pos + m] = tmp_ja[m];
-  }
-
-  // Update IA array
-  increment_ia_after<IType>(s, s->shape[0], si, s_ija[pos+1] - s_ija[pos] + n);
-}
-
-
-/*
- * Return as a pair:
- *    - The total ndnz change of some slice-set operation;
- *    - Whether the vector should be resized regardless (which may simply be because the total size of partial copies
- *      that would have to be done to accomplish the slice-set conventionally exceeds the copy size for simply rewriting
- *      the vectors; and by conventionally, I mean moving parts of A[x...] and IJA[x...] as we add new rows).
+ * Attempt to set multiple cells in a YALE_STORAGE object.
  *
  * By default, v is a single element of type DType. We iterate through it repeatedly, using v[k] as the element to which
- * we want to set the current element of s. Each time we reach the end of v, we go back to the beginning.
+ * we want to set the current element of s. Each time we reach the end of v, we go back to the beginning. When v holds
+ * a whole row-major block (e.g., from another matrix), v_size is simply the size of the slice.
  *
- * FIXME: There is one obvious potential improvement here: that changes within a row do not necessarily need a copy/resize if
- * FIXME: they are balanced out by changes in a different row, especially one which is located very nearby. But this is
- * FIXME: an edge case, and very complicated to implement, so I have elected not to address it.
+ * If v_ptr is given, v is sparse instead, as from gather_rows: row i of the slice holds v[v_ptr[i]..v_ptr[i+1]) at
+ * columns v_cols of the slice, and is s's default value everywhere else.
  *
- * FIXME: I just came up with another improvement. The first part of the IA vector has to be rewritten following the
- * FIXME: first row i whose size gets changed. This should be taken into account.
+ * All of the affected rows are spliced at once: the new non-diagonal entries for the block of rows are built up in a
+ * temporary buffer, the remainder of IJA and A is shifted (or copied into larger vectors) exactly once, and then the
+ * buffer is written into place.
  */
 template <typename DType, typename IType>
-static std::tuple<long,bool,std::queue<std::tuple<IType,IType,int> > > count_slice_set_ndnz_change(YALE_STORAGE* s, size_t* coords, size_t* lengths, DType* v, size_t v_size) {
-  long change = 0;
-  std::queue<std::tuple<IType,IType,int> > row_plan_q;
-  unsigned long partial_copies = 0;
-  bool resize = false;
+static void set_multiple_cells(YALE_STORAGE* storage, size_t* coords, size_t* lengths, DType* v, size_t v_size,
+                               const size_t* v_ptr = NULL, const size_t* v_cols = NULL) {
+  YALE_STORAGE* s = reinterpret_cast<YALE_STORAGE*>(storage->src);
 
-  IType* ija  = IJA<IType>(s);
-  DType* a    = A<DType>(s);
+  IType* ija = reinterpret_cast<IType*>(s->ija);
+  DType* a   = reinterpret_cast<DType*>(s->a);
 
   DType ZERO(*reinterpret_cast<DType*>(default_value_ptr(s)));
-  IType last_ija = get_size<IType>(s);
 
-  size_t k = 0; // index in v (actually, use k % v_size for simplicity, so we don't have to keep resetting to 0)
+  size_t size      = ija[s->shape[0]],
+         first_row = storage->offset[0] + coords[0],
+         first_col = storage->offset[1] + coords[1],
+         last_col  = first_col + lengths[1]; // one past the end
+
+  size_t block_start = ija[first_row],
+         block_end   = ija[first_row + lengths[0]];
+
+  // The new block can be at most the old block plus the non-diagonal nonzeros being written.
+  size_t inserted = 0, k = 0;
+  if (v_ptr) {
+    inserted = v_ptr[lengths[0]];
+  } else {
+    for (size_t i = 0; i < lengths[0]; ++i)
+      for (size_t sj = first_col; sj < last_col; ++sj, ++k)
+        if (sj != first_row + i && v[k % v_size] != ZERO) ++inserted;
+  }
+
+  size_t  tmp_capacity = block_end - block_start + inserted;
+  IType*  tmp_ja       = ALLOC_N(IType, tmp_capacity);
+  DType*  tmp_a        = ALLOC_N(DType, tmp_capacity);
+  IType*  new_ia       = ALLOC_N(IType, lengths[0]); // end of each new row, relative to block_start
 
-  for (IType i = 0; i < lengths[0]; ++i) {
-    IType si = coords[0] + s->offset[0] + i;
+  size_t m = 0;
+  k = 0;
 
-    IType row_start      = ija[si];
-    IType past_row_end   = ija[si+1];
-    int   row_change     = 0;
+  for (size_t i = 0; i < lengths[0]; ++i) {
+    size_t si = first_row + i;
+    size_t p  = ija[si], p_end = ija[si+1];
 
-    if (row_start == ija[si+1]) { // empty row
+    // Keep entries to the left of the slice.
+    for (; p < p_end && ija[p] < first_col; ++p, ++m) {
+      tmp_ja[m] = ija[p];
+      tmp_a[m]  = a[p];
+    }
 
-      for (IType j = 0; j < lengths[1]; ++j, ++k) {
-        IType sj = coords[1] + s->offset[1] + i;
+    // Replace entries within the slice.
+    if (v_ptr) {
+      if (si >= first_col && si < last_col) a[si] = ZERO;
 
-        if (sj == si) continue; // don't need to count diagonals
+      for (size_t q = v_ptr[i]; q < v_ptr[i+1]; ++q) {
+        const size_t sj = first_col + v_cols[q];
 
-        // If the thing we want to add is non-zero, we need to update.
-        if (v[k % v_size] != ZERO) row_change++;
+        if (sj == si) { // diagonal lives in the real A
+          a[si] = v[q];
+        } else {
+          tmp_ja[m] = sj;
+          tmp_a[m]  = v[q];
+          ++m;
+        }
       }
 
-    } else { // non-empty row.
-      IType p      = binary_search_left_boundary<IType>(s, row_start, past_row_end-1, s->offset[1]);
-      row_start    = p;
-      IType x_sj   = p < past_row_end ? ija[p] : (IType)(s->shape[1]); // next existent sj if it exists (otherwise, use one past end)
-
-      for (IType j = 0; j < lengths[1]; ++j, ++k) {
-        IType sj      = j + s->offset[1] + coords[1];
-
-        if (sj != si) { // don't need to count diagonals
-          if (sj < x_sj) { // anything we find in this condition is an add
-            if (v[k % v_size] != ZERO) row_change++;
-          } else if (sj == x_sj) { // could be a change (don't count it) or a remove (count it)
-            if (v[k % v_size] == ZERO) row_change--;
-            ++p;  // need to step to the next x_sj
-            x_sj   = p < past_row_end ? ija[p] : (IType)(s->shape[1]); // next existent sj if it exists (otherwise, use one past end)
-          }
+    } else {
+      for (size_t sj = first_col; sj < last_col; ++sj, ++k) {
+        const DType& val = v[k % v_size];
+
+        if (sj == si) { // diagonal lives in the real A
+          a[si] = val;
+        } else if (val != ZERO) {
+          tmp_ja[m] = sj;
+          tmp_a[m]  = val;
+          ++m;
         }
       }
-      past_row_end  = p;
     }
 
-    // We need to copy from the next row (s->ija[si+1]) to the end (last_ija) as well as changing the row entries.
-    if (row_change != 0) {
-      partial_copies += last_ija - ija[si+1] + row_change;
-      change += row_change;
+    // Skip old entries within the slice and keep those to the right of it.
+    while (p < p_end && ija[p] < last_col) ++p;
 
-      // There's no reason to do it conventionally if partial_copies is more than the max_size
-      if (partial_copies >= last_ija) resize = true;
+    for (; p < p_end; ++p, ++m) {
+      tmp_ja[m] = ija[p];
+      tmp_a[m]  = a[p];
     }
 
-    row_plan_q.push(std::make_tuple(row_start, past_row_end, row_change));
+    new_ia[i] = m;
   }
 
-  return make_tuple(change, resize, row_plan_q);
-}
-
-
-
-/*
- * Attempt to set multiple cells in a YALE_STORAGE object.
- */
-template <typename DType, typename IType>
-static void set_multiple_cells(YALE_STORAGE* s, size_t* coords, size_t* lengths, DType* v, size_t v_size) {
-  typedef std::tuple<IType,IType,int>               RowPlan;
-  typedef std::queue<std::tuple<IType,IType,int> >  PlanQ;
-  typedef std::tuple<bool,long,PlanQ>               Plan;
-
-  IType size                = get_size<IType>(s);
-  // First count the number of entries that we expect will be added or removed and determine if a resize would be
-  // more efficient.
-  long delta_size;
-  bool copy;
-  PlanQ row_plans;
-  Plan plan = count_slice_set_ndnz_change<DType, IType>(s, coords, lengths, v, v_size);
-  std::tie(delta_size, copy, row_plans) = plan;
-
-  std::cerr << "copy = " << int(copy) << ", delta_size = " << int(delta_size) << ", row_plans size = " << row_plans.size() << std::endl;
+  long   delta    = (long)(m) - (long)(block_end - block_start);
+  size_t new_size = size + delta;
 
-
-  IType* ija = IJA<IType>(s);
-  DType* a   = A<DType>(s);
-
-  // We don't *have* to shrink, but we might as well.
-  if (!copy && delta_size < 0 && size + delta_size < s->capacity / GROWTH_CONSTANT)
-    copy = true;
-
-  std::cerr << "copy = " << int(copy) << std::endl;
-
-  if (!copy) {
-    size_t k  = 0;
-    long accum = 0; // counts the accumulated error in row_start (the first element of row_plan_q's pair) as we modify.
-    IType si   = s->offset[0] + coords[0]; // use as row counter
-
-    while (!row_plans.empty()) { // for each row
-      IType pos, end;
-      int n;
-      std::tie(pos, end, n) = row_plans.front(); row_plans.pop();
-      pos += accum; end += accum;
-
-      std::cerr << "row " << int(si) << "\tpos=" << int(pos) << "\tend=" << int(end) << "\tn=" << n << std::endl;
-
-      if (n > 0) { // size increase: copy later rows first, then modify contents of this row.
-        for (IType m = 0; m < size - end; ++m) { // copy/resize
-          ija[size+n-1-m] = ija[size-1-m];
-          a[size+n-1-m]   = a[size-1-m];
-        }
-
-        modify_partial_row<DType,IType>((YALE_STORAGE*)(s->src), si, pos, end, n, s->offset[1] + coords[1], lengths[1], v, v_size, k);
-      } else if (n < 0) { // size decrease: modify contents of row, then copy later rows
-        modify_partial_row<DType,IType>((YALE_STORAGE*)(s->src), si, pos, end, n, s->offset[1] + coords[1], lengths[1], v, v_size, k);
-
-        for (IType m = 0; m < size - end; ++m) {
-          ija[size+n-1-m] = ija[size-1-m];
-          a[size+n-1-m]   = a[size-1-m];
-        }
-      } else if (n == 0) { // just overwrite the row, no copy needed
-        // FIXME: This can be done in-place.
-        modify_partial_row<DType,IType>((YALE_STORAGE*)(s->src), si, pos, end, n, s->offset[1] + coords[1], lengths[1], v, v_size, k);
-      }
-
-      accum     += n;
-      ++si;
-    }
-  } else {  // allowed to make a copy.
-    size_t new_capacity = NM_MAX(s->capacity * GROWTH_CONSTANT, s->capacity + delta_size);
+  if (new_size > s->capacity) {
+    size_t new_capacity = NM_MAX(s->capacity * GROWTH_CONSTANT, new_size);
     size_t max_capacity = max_size(s);
-    if (new_capacity > max_capacity) {
-      new_capacity = max_capacity;
+    if (new_capacity > max_capacity) new_capacity = max_capacity;
 
-      if (s->capacity + delta_size > max_capacity)
-        rb_raise(rb_eNoMemError, "insertion size exceeded maximum yale matrix size");
+    if (new_size > new_capacity) {
+      xfree(tmp_ja);
+      xfree(tmp_a);
+      xfree(new_ia);
+      rb_raise(rb_eNoMemError, "insertion size exceeded maximum yale matrix size");
     }
 
-    // Allocate new vectors. (ija and a local variables have the old ones)
-    reinterpret_cast<YALE_STORAGE*>(s->src)->ija = ALLOC_N(IType, new_capacity);
-    reinterpret_cast<YALE_STORAGE*>(s->src)->a   = ALLOC_N(DType, new_capacity);
+    IType* new_ija = ALLOC_N(IType, new_capacity);
+    DType* new_a   = ALLOC_N(DType, new_capacity);
 
-    size_t k  = 0;
-    long accum = 0; // counts the accumulated error in row_start (the first element of row_plan_q's pair) as we modify.
-    IType si   = s->offset[0] + coords[0]; // use as row counter
-    IType last_end = 0;
-    int n = 0;
-    IType pos, end;
+    // Everything before the block (IA, the diagonal, and earlier rows) stays put, as does the tail, shifted by delta.
+    for (size_t q = 0; q < block_start; ++q) {
+      new_ija[q] = ija[q];
+      new_a[q]   = a[q];
+    }
 
-    while (!row_plans.empty()) { // for each row
-      std::tie(pos, end, n) = row_plans.front(); row_plans.pop();
-      pos += accum;
-      end += accum;
+    for (size_t q = block_end; q < size; ++q) {
+      new_ija[q + delta] = ija[q];
+      new_a[q + delta]   = a[q];
+    }
 
-      accum += n;
+    xfree(ija);
+    xfree(a);
 
-      // Copy all values prior to the insertion site to the new IJA and new A.
-      for (size_t m = 0; m < pos; ++m) {
-        IJA_SET(s, m, ija[m]);
-        A_SET(  s, m, a[m]);
-      }
+    s->ija      = reinterpret_cast<void*>(new_ija);
+    s->a        = reinterpret_cast<void*>(new_a);
+    s->capacity = new_capacity;
 
-      // Fill in between pos and end
-      modify_partial_row<DType,IType>((YALE_STORAGE*)(s->src), si, pos, end, n, s->offset[1] + coords[1], lengths[1], v, v_size, k);
+    ija = new_ija;
+    a   = new_a;
 
-      last_end = end;
+  } else if (delta > 0) {
+    for (size_t q = size; q-- > block_end; ) {
+      ija[q + delta] = ija[q];
+      a[q + delta]   = a[q];
     }
 
-    // Copy values subsequent to insertion site
-    for (size_t m = last_end; m < size; ++m) {
-      IJA_SET(s, m+n, ija[m]);
-      A_SET(  s, m+n, a[m]);
+  } else if (delta < 0) {
+    for (size_t q = block_end; q < size; ++q) {
+      ija[q + delta] = ija[q];
+      a[q + delta]   = a[q];
     }
+  }
 
-    reinterpret_cast<YALE_STORAGE*>(s->src)->capacity = new_capacity;
-
-    // Delete
-    xfree(ija);
-    xfree(a);
+  // Write the new block into place.
+  for (size_t q = 0; q < m; ++q) {
+    ija[block_start + q] = tmp_ja[q];
+    a[block_start + q]   = tmp_a[q];
   }
 
-  reinterpret_cast<YALE_STORAGE*>(s->src)->ndnz += delta_size;
+  // Update IA for the block and for all subsequent rows.
+  for (size_t i = 0; i < lengths[0]; ++i)
+    ija[first_row + i + 1] = block_start + new_ia[i];
+
+  for (size_t si = first_row + lengths[0] + 1; si <= s->shape[0]; ++si)
+    ija[si] += delta;
 
+  s->ndnz += delta;
+
+  xfree(tmp_ja);
+  xfree(tmp_a);
+  xfree(new_ia);
 }
 
 
@@ -793,17 +771,55 @@ template <typename DType, typename IType>
 void set(VALUE left, SLICE* slice, VALUE right) {
   YALE_STORAGE* storage = NM_STORAGE_YALE(left);
 
-  // TODO: Easily modified to accept pass dense storage elements in instead of v (below). Won't work with slices.
   if (TYPE(right) == T_DATA) {
     if (RDATA(right)->dfree == (RUBY_DATA_FUNC)nm_delete || RDATA(right)->dfree == (RUBY_DATA_FUNC)nm_delete_ref) {
-      rb_raise(rb_eNotImpError, "this type of slicing not yet supported");
+      nm_storage_check_slice_set_shape(NM_STORAGE(right), slice, storage->dim);
+
+      // A Yale right-hand side with the same default is spliced in from its nonzeros. They're gathered first, so it
+      // doesn't matter whether right refers to the same storage as left.
+      if (NM_STYPE(right) == nm::YALE_STORE && !slice->single
+          && NM_SHAPE0(right) == slice->lengths[0] && NM_SHAPE1(right) == slice->lengths[1]) {
+        const DType ZERO(*reinterpret_cast<DType*>(default_value_ptr(storage)));
+
+        size_t* ptr = ALLOC_N(size_t, slice->lengths[0] + 1);
+        size_t* cols;
+        void*   vals;
+        DType   right_default;
+        yale_gather_rows(NM_STORAGE_YALE(right), storage->dtype, ptr, &cols, &vals, &right_default);
+
+        bool same_default = right_default == ZERO;
+        if (same_default)
+          set_multiple_cells<DType,IType>(storage, slice->coords, slice->lengths, reinterpret_cast<DType*>(vals), 0, ptr, cols);
+
+        xfree(ptr);
+        xfree(cols);
+        xfree(vals);
+
+        if (same_default) return;
+      }
+
+      // Take a dense copy of the right-hand side in our dtype. Since it's a copy, it doesn't matter whether right
+      // refers to the same storage as left.
+      CAST_TABLE(cast_table);
+      DENSE_STORAGE* tmp = reinterpret_cast<DENSE_STORAGE*>(cast_table[nm::DENSE_STORE][NM_STYPE(right)](NM_STORAGE(right), storage->dtype, NULL));
+      DType* v = reinterpret_cast<DType*>(tmp->elements);
+
+      if (slice->single || (slice->lengths[0] == 1 && slice->lengths[1] == 1)) {
+        set_single_cell<DType,IType>(storage, slice->coords, *v);
+      } else {
+        set_multiple_cells<DType,IType>(storage, slice->coords, slice->lengths, v, nm_storage_count_max_elements(tmp));
+      }
+
+      nm_dense_storage_delete(tmp);
+
     } else {
       rb_raise(rb_eTypeError, "unrecognized type for slice assignment");
     }
 
   } else {
 
-    DType* v;
+    DType  scalar;
+    DType* v      = &scalar; // scalars are converted on the stack
     size_t v_size = 1;
     if (TYPE(right) == T_ARRAY) {  // Allow the user to pass in an array
       v_size = RARRAY_LEN(right);
@@ -812,7 +828,7 @@ void set(VALUE left, SLICE* slice, VALUE right) {
         rubyval_to_cval(rb_ary_entry(right, m), storage->dtype, &(v[m]));
       }
     } else {
-      v = reinterpret_cast<DType*>(rubyobj_to_cval(right, storage->dtype));
+      rubyval_to_cval(right, storage->dtype, &scalar);
     }
 
     if (slice->single || (slice->lengths[0] == 1 && slice->lengths[1] == 1)) { // set a single cell
@@ -821,7 +837,7 @@ void set(VALUE left, SLICE* slice, VALUE right) {
       set_multiple_cells<DType,IType>(storage, slice->coords, slice->lengths, v, v_size);
     }
 
-    xfree(v);
+    if (v != &scalar) xfree(v);
   }
 }
 
@@ -1241,154 +1257,1663 @@ static IType insert_search(YALE_STORAGE* s, IType left, IType right, IType key,
   } else if (mid_j > key) {
   	return insert_search<IType>(s, left, mid-1, key, found);
 
-  } else {
-  	return insert_search<IType>(s, mid+1, right, key, found);
+  } else {
+  	return insert_search<IType>(s, mid+1, right, key, found);
+  }
+}
+
+/////////////////////////
+// Copying and Casting //
+/////////////////////////
+
+/*
+ * Templated copy constructor for changing dtypes.
+ */
+template <typename LDType, typename RDType, typename IType>
+YALE_STORAGE* cast_copy(const YALE_STORAGE* rhs, dtype_t new_dtype) {
+
+  YALE_STORAGE* lhs;
+
+  if (rhs->src != rhs) { // copy the reference
+    // Copy shape for yale construction
+    size_t* shape           = ALLOC_N(size_t, 2);
+    shape[0]                = rhs->shape[0];
+    shape[1]                = rhs->shape[1];
+    size_t ndnz             = src_ndnz(rhs);
+    if (shape[0] != rhs->src->shape[0] || shape[1] != rhs->src->shape[1])
+      ndnz                  = count_slice_copy_ndnz<RDType,IType>(rhs, rhs->offset, rhs->shape); // expensive, avoid if possible
+    size_t request_capacity = shape[0] + ndnz + 1;
+    // FIXME: Should we use a different itype? Or same?
+    lhs                     = nm_yale_storage_create(new_dtype, shape, 2, request_capacity, rhs->itype);
+
+    // This check probably isn't necessary.
+    if (lhs->capacity < request_capacity)
+      rb_raise(nm_eStorageTypeError, "conversion failed; capacity of %ld requested, max allowable is %ld", request_capacity, lhs->capacity);
+
+    slice_copy<LDType, RDType, IType>(lhs, rhs, rhs->offset, rhs->shape, new_dtype);
+  } else { // regular copy
+
+    // Allocate a new structure
+    size_t size = get_size<IType>(rhs);
+    lhs = copy_alloc_struct<IType>(rhs, new_dtype, rhs->capacity, size);
+
+    LDType* la = reinterpret_cast<LDType*>(lhs->a);
+    RDType* ra = A<RDType>(rhs);
+
+    for (size_t index = 0; index < size; ++index) {
+      la[index] = ra[index];
+    }
+  }
+
+  return lhs;
+}
+
+/*
+ * Template access for getting the size of Yale storage.
+ */
+template <typename IType>
+static inline size_t get_size(const YALE_STORAGE* storage) {
+  return static_cast<size_t>(reinterpret_cast<IType*>(storage->ija)[ storage->shape[0] ]);
+}
+
+
+/*
+ * Allocate for a copy or copy-cast operation, and copy the IJA portion of the
+ * matrix (the structure).
+ */
+template <typename IType>
+static YALE_STORAGE* copy_alloc_struct(const YALE_STORAGE* rhs, const dtype_t new_dtype, const size_t new_capacity, const size_t new_size) {
+  YALE_STORAGE* lhs = ALLOC( YALE_STORAGE );
+  lhs->dim          = rhs->dim;
+  lhs->shape        = ALLOC_N( size_t, lhs->dim );
+  lhs->offset       = ALLOC_N( size_t, lhs->dim );
+  memcpy(lhs->shape, rhs->shape, lhs->dim * sizeof(size_t));
+  //memcpy(lhs->offset, rhs->offset, lhs->dim * sizeof(size_t));
+  lhs->offset[0]    = 0;
+  lhs->offset[1]    = 0;
+
+  lhs->itype        = rhs->itype;
+  lhs->capacity     = new_capacity;
+  lhs->dtype        = new_dtype;
+  lhs->ndnz         = rhs->ndnz;
+
+  lhs->ija          = ALLOC_N( IType, lhs->capacity );
+  lhs->a            = ALLOC_N( char, DTYPE_SIZES[new_dtype] * lhs->capacity );
+  lhs->src          = lhs;
+  lhs->count        = 1;
+
+  // Now copy the contents -- but only within the boundaries set by the size. Leave
+  // the rest uninitialized.
+  if (!rhs->offset[0] && !rhs->offset[1]) {
+    for (size_t i = 0; i < get_size<IType>(rhs); ++i)
+      reinterpret_cast<IType*>(lhs->ija)[i] = reinterpret_cast<IType*>(rhs->ija)[i]; // copy indices
+  } else {
+    rb_raise(rb_eNotImpError, "cannot copy struct due to different offsets");
+  }
+  return lhs;
+}
+
+/*
+ * Arguments for the Gustavson product C = L*R of two Yale matrices with the same itype. Row i of C is scattered into a
+ * dense accumulator over C's columns, and its columns written to the scratch slot [upper[i], upper[i+1]), which is
+ * big enough for every product that could land in the row. Each chunk of rows has its own accumulator (sums and marks,
+ * cols entries each), so the threads share nothing but the read-only operands. For a masked product, ijm is the mask's
+ * structure and nzm says which of its stored entries are nonzero, and each slot only has room for the mask's row.
+ */
+template <typename DType, typename IType>
+struct SpGEMMTask {
+  const IType*  ijl;
+  const DType*  al;
+  const IType*  ijr;
+  const DType*  ar;
+  const IType*  ijm;
+  const char*   nzm;
+  size_t        rows, inner, cols;
+  const size_t* bounds;
+  const size_t* upper;
+  IType*        ja;
+  DType*        a;
+  DType*        diag;
+  size_t*       counts;
+  DType*        sums;
+  IType*        marks;
+};
+
+/*
+ * Compute rows [i0, i1) of L*R into the scratch slots. Zero sums are dropped, as they would be by set. The touched
+ * columns are sorted as they're written out, by std::sort when there are few of them and otherwise by a pass over the
+ * marks, so C comes out with its columns in order.
+ */
+template <typename DType, typename IType>
+static void spgemm_rows(const SpGEMMTask<DType,IType>& t, const size_t i0, const size_t i1, DType* sums, IType* marks) {
+  const size_t l_diag = std::min(t.rows, t.inner),
+               r_diag = std::min(t.inner, t.cols);
+
+  for (size_t i = i0; i < i1; ++i) {
+    IType* ja  = t.ja + t.upper[i];
+    DType* a   = t.a  + t.upper[i];
+    size_t len = 0;
+
+    for (IType p = t.ijl[i]; p <= t.ijl[i+1]; ++p) {
+      size_t j;
+      DType  v;
+
+      if (p == t.ijl[i+1]) { // the diagonal, last
+        if (i >= l_diag) continue;
+        j = i;
+        v = t.al[i];
+      } else {
+        j = t.ijl[p];
+        v = t.al[p];
+      }
+
+      if (v == 0) continue;
+
+      for (IType q = t.ijr[j]; q <= t.ijr[j+1]; ++q) {
+        size_t k;
+        DType  w;
+
+        if (q == t.ijr[j+1]) {
+          if (j >= r_diag) continue;
+          k = j;
+          w = t.ar[j];
+        } else {
+          k = t.ijr[q];
+          w = t.ar[q];
+        }
+
+        if (marks[k] != (IType)(i)) {
+          marks[k] = i;
+          sums[k]  = v * w;
+          ja[len++] = k;
+        } else {
+          sums[k] += v * w;
+        }
+      }
+    }
+
+    // A row touching a good part of the columns is quicker to collect in order than to sort.
+    if (len * 16 > t.cols) {
+      len = 0;
+      for (size_t k = 0; k < t.cols; ++k)
+        if (marks[k] == (IType)(i)) ja[len++] = k;
+    } else {
+      std::sort(ja, ja + len);
+    }
+
+    size_t count = 0;
+    for (size_t p = 0; p < len; ++p) {
+      const size_t k = ja[p];
+
+      if (k == i)                t.diag[i] = sums[k];
+      else if (sums[k] != 0) {
+        ja[count]  = k;
+        a[count++] = sums[k];
+      }
+    }
+
+    t.counts[i] = count;
+  }
+}
+
+template <typename DType, typename IType>
+static void spgemm_task_run(void* task_, int begin, int end) {
+  SpGEMMTask<DType,IType>* t = reinterpret_cast<SpGEMMTask<DType,IType>*>(task_);
+
+  for (int c = begin; c < end; ++c) {
+    DType* sums  = t->sums  + c * t->cols;
+    IType* marks = t->marks + c * t->cols;
+    for (size_t k = 0; k < t->cols; ++k) marks[k] = std::numeric_limits<IType>::max();
+
+    spgemm_rows<DType,IType>(*t, t->bounds[c], t->bounds[c+1], sums, marks);
+  }
+}
+
+/*
+ * Compute rows [i0, i1) of L*R masked by M into the scratch slots. Only the columns at which row i of M is nonzero are
+ * marked, and products landing anywhere else are skipped, so a row never needs more room than M's. The row is written
+ * out in M's column order, which is already sorted.
+ */
+template <typename DType, typename IType>
+static void spgemm_masked_rows(const SpGEMMTask<DType,IType>& t, const size_t i0, const size_t i1, DType* sums, IType* marks) {
+  const size_t l_diag = std::min(t.rows, t.inner),
+               r_diag = std::min(t.inner, t.cols);
+
+  for (size_t i = i0; i < i1; ++i) {
+    IType* ja      = t.ja + t.upper[i];
+    DType* a       = t.a  + t.upper[i];
+    bool   allowed = false;
+
+    if (i < t.cols && t.nzm[i]) {
+      marks[i] = i;
+      sums[i]  = 0;
+      allowed  = true;
+    }
+
+    for (IType p = t.ijm[i]; p < t.ijm[i+1]; ++p) {
+      if (!t.nzm[p]) continue;
+      marks[t.ijm[p]] = i;
+      sums[t.ijm[p]]  = 0;
+      allowed         = true;
+    }
+
+    t.counts[i] = 0;
+    if (!allowed) continue;
+
+    for (IType p = t.ijl[i]; p <= t.ijl[i+1]; ++p) {
+      size_t j;
+      DType  v;
+
+      if (p == t.ijl[i+1]) {
+        if (i >= l_diag) continue;
+        j = i;
+        v = t.al[i];
+      } else {
+        j = t.ijl[p];
+        v = t.al[p];
+      }
+
+      if (v == 0) continue;
+
+      if (j < r_diag && marks[j] == (IType)(i)) sums[j] += v * t.ar[j];
+
+      for (IType q = t.ijr[j]; q < t.ijr[j+1]; ++q) {
+        if (marks[t.ijr[q]] == (IType)(i)) sums[t.ijr[q]] += v * t.ar[q];
+      }
+    }
+
+    if (i < t.cols && marks[i] == (IType)(i)) t.diag[i] = sums[i];
+
+    size_t count = 0;
+    for (IType p = t.ijm[i]; p < t.ijm[i+1]; ++p) {
+      const size_t k = t.ijm[p];
+
+      if (t.nzm[p] && sums[k] != 0) {
+        ja[count]  = k;
+        a[count++] = sums[k];
+      }
+    }
+
+    t.counts[i] = count;
+  }
+}
+
+template <typename DType, typename IType>
+static void spgemm_masked_task_run(void* task_, int begin, int end) {
+  SpGEMMTask<DType,IType>* t = reinterpret_cast<SpGEMMTask<DType,IType>*>(task_);
+
+  for (int c = begin; c < end; ++c) {
+    DType* sums  = t->sums  + c * t->cols;
+    IType* marks = t->marks + c * t->cols;
+    for (size_t k = 0; k < t->cols; ++k) marks[k] = std::numeric_limits<IType>::max();
+
+    spgemm_masked_rows<DType,IType>(*t, t->bounds[c], t->bounds[c+1], sums, marks);
+  }
+}
+
+/*
+ * Move the rows of C from their scratch slots to their places in result, once IA has been filled in.
+ */
+template <typename DType, typename IType>
+static void spgemm_compact(const SpGEMMTask<DType,IType>& t, const size_t i0, const size_t i1, YALE_STORAGE* result) {
+  IType* ija = reinterpret_cast<IType*>(result->ija);
+  DType* a   = reinterpret_cast<DType*>(result->a);
+
+  for (size_t i = i0; i < i1; ++i) {
+    if (i < t.cols) a[i] = t.diag[i];
+
+    for (size_t p = 0; p < t.counts[i]; ++p) {
+      ija[ija[i] + p] = t.ja[t.upper[i] + p];
+      a[ija[i] + p]   = t.a[t.upper[i] + p];
+    }
+  }
+}
+
+template <typename DType, typename IType>
+struct SpGEMMCompactTask {
+  const SpGEMMTask<DType,IType>* t;
+  YALE_STORAGE*                  result;
+};
+
+template <typename DType, typename IType>
+static void spgemm_compact_run(void* task_, int begin, int end) {
+  SpGEMMCompactTask<DType,IType>* ct = reinterpret_cast<SpGEMMCompactTask<DType,IType>*>(task_);
+
+  for (int c = begin; c < end; ++c)
+    spgemm_compact<DType,IType>(*ct->t, ct->t->bounds[c], ct->t->bounds[c+1], ct->result);
+}
+
+/*
+ * The IJA array of s as an IType array: s's own if it already has that itype, otherwise a copy to be freed with xfree.
+ */
+template <typename IType>
+static IType* ija_as_itype(YALE_STORAGE* s, nm::itype_t itype) {
+  if (s->itype == itype) return reinterpret_cast<IType*>(s->ija);
+
+  size_t length = nm_yale_storage_get_size(s);
+  IType* ija    = ALLOC_N(IType, length);
+  copy_recast_itype_vector(reinterpret_cast<void*>(s->ija), s->itype, reinterpret_cast<void*>(ija), itype, length);
+
+  return ija;
+}
+
+/*
+ * The number of products landing in row i of L*R: the length of each row of R that row i of L draws on.
+ */
+template <typename DType, typename IType>
+static size_t spgemm_row_products(const SpGEMMTask<DType,IType>& t, const size_t i) {
+  const size_t l_diag = std::min(t.rows, t.inner),
+               r_diag = std::min(t.inner, t.cols);
+  size_t products = 0;
+
+  for (IType p = t.ijl[i]; p <= t.ijl[i+1]; ++p) {
+    if (p == t.ijl[i+1] && i >= l_diag) continue;
+    const size_t j = p == t.ijl[i+1] ? i : t.ijl[p];
+    products += t.ijr[j+1] - t.ijr[j] + (j < r_diag ? 1 : 0);
+  }
+
+  return products;
+}
+
+/*
+ * Run a Gustavson product whose scratch slots have been laid out in t.upper, and compact it into a new matrix of
+ * exactly the right capacity. The rows are split between threads so that each has about the same number of products to
+ * add up (see NMatrix::BLAS.num_threads); products is that number for each row, and is freed here.
+ */
+template <typename DType, typename IType>
+static YALE_STORAGE* spgemm(SpGEMMTask<DType,IType>& t, size_t* products, nm_parallel_func run, nm::dtype_t dtype,
+                            size_t* resulting_shape, nm::itype_t result_itype) {
+  size_t total = 0;
+  for (size_t i = 0; i < t.rows; ++i) { // now the number of products before row i
+    const size_t row = products[i];
+    products[i]      = total;
+    total           += row;
+  }
+
+  const size_t nchunks = std::max<size_t>(1, std::min(nm::math::parallel_threads<DType>((double)(total)), t.rows));
+  size_t* bounds = ALLOCA_N(size_t, nchunks + 1);
+
+  bounds[0]       = 0;
+  bounds[nchunks] = t.rows;
+  for (size_t c = 1; c < nchunks; ++c) // first row starting at or past an even share of the products
+    bounds[c] = std::max(bounds[c-1], (size_t)(std::lower_bound(products, products + t.rows, total * c / nchunks) - products));
+
+  xfree(products);
+
+  const size_t scratch = t.upper[t.rows];
+
+  t.bounds = bounds;
+  t.ja     = ALLOC_N(IType, scratch);
+  t.a      = ALLOC_N(DType, scratch);
+  t.diag   = ALLOC_N(DType, t.rows);
+  t.counts = ALLOC_N(size_t, t.rows);
+  t.sums   = ALLOC_N(DType, nchunks * t.cols);
+  t.marks  = ALLOC_N(IType, nchunks * t.cols);
+
+  for (size_t i = 0; i < t.rows; ++i) t.diag[i] = 0;
+
+  if (nchunks > 1) nm_math_parallel_for(nchunks, 1, run, &t);
+  else             run(&t, 0, 1);
+
+  xfree(t.sums);
+  xfree(t.marks);
+
+  // Now that the size of each row is known, lay out the result and move the rows into it.
+  size_t ndnz = 0;
+  for (size_t i = 0; i < t.rows; ++i) ndnz += t.counts[i];
+
+  YALE_STORAGE* result = nm_yale_storage_create(dtype, resulting_shape, 2, t.rows + 1 + ndnz, result_itype);
+  init<DType,IType>(result, NULL);
+
+  IType* ija = reinterpret_cast<IType*>(result->ija);
+  for (size_t i = 0; i < t.rows; ++i) ija[i+1] = ija[i] + t.counts[i];
+
+  SpGEMMCompactTask<DType,IType> compact = { &t, result };
+  if (nchunks > 1) nm_math_parallel_for(nchunks, 1, spgemm_compact_run<DType,IType>, &compact);
+  else             spgemm_compact_run<DType,IType>(&compact, 0, 1);
+
+  xfree(t.ja);
+  xfree(t.a);
+  xfree(t.diag);
+  xfree(t.counts);
+
+  return result;
+}
+
+/*
+ * Yale times Yale, by Gustavson's algorithm. The only pass over the structure before the product is a cheap bound on
+ * each row's size, from the number of products landing in it; the product is then computed once, into slots of that
+ * size, and compacted.
+ */
+template <typename DType, typename IType>
+static STORAGE* matrix_multiply(const STORAGE_PAIR& casted_storage, size_t* resulting_shape, bool vector, nm::itype_t result_itype) {
+  YALE_STORAGE *left  = (YALE_STORAGE*)(casted_storage.left),
+               *right = (YALE_STORAGE*)(casted_storage.right);
+
+  // We can safely get dtype from the casted matrices; post-condition of binary_storage_cast_alloc is that dtype is the
+  // same for left and right.
+  SpGEMMTask<DType,IType> t;
+  t.ijl   = ija_as_itype<IType>(left, result_itype);
+  t.al    = reinterpret_cast<const DType*>(left->a);
+  t.ijr   = ija_as_itype<IType>(right, result_itype);
+  t.ar    = reinterpret_cast<const DType*>(right->a);
+  t.ijm   = NULL;
+  t.nzm   = NULL;
+  t.rows  = resulting_shape[0];
+  t.inner = left->shape[1];
+  t.cols  = resulting_shape[1];
+
+  // Each row's slot has room for every product landing in it, or every column, whichever is fewer.
+  size_t* upper    = ALLOC_N(size_t, t.rows + 1);
+  size_t* products = ALLOC_N(size_t, t.rows);
+
+  upper[0] = 0;
+  for (size_t i = 0; i < t.rows; ++i) {
+    products[i] = spgemm_row_products<DType,IType>(t, i);
+    upper[i+1]  = upper[i] + std::min(products[i], t.cols);
+  }
+  t.upper = upper;
+
+  YALE_STORAGE* result = spgemm<DType,IType>(t, products, spgemm_task_run<DType,IType>, left->dtype, resulting_shape, result_itype);
+
+  xfree(upper);
+  if (t.ijl != reinterpret_cast<IType*>(left->ija))  xfree(const_cast<IType*>(t.ijl));
+  if (t.ijr != reinterpret_cast<IType*>(right->ija)) xfree(const_cast<IType*>(t.ijr));
+
+  return reinterpret_cast<STORAGE*>(result);
+}
+
+/*
+ * Flag which of s's stored entries, diagonal included, are nonzero, comparing in s's own dtype so that a mask of any
+ * dtype can be used without casting it (and truncating 0.5 to 0). nonzero needs one entry per slot of A.
+ */
+template <typename DType>
+static void stored_nonzero(const YALE_STORAGE* s, char* nonzero) {
+  const DType* a    = reinterpret_cast<const DType*>(s->a);
+  const size_t size = nm_yale_storage_get_size(s);
+
+  for (size_t p = 0; p < size; ++p) nonzero[p] = a[p] != 0;
+}
+
+/*
+ * L*R masked by M, taken as a pattern: the result holds the entries of L*R at which M is nonzero, and nothing else. Each
+ * row's slot only needs room for the mask's row, so the scratch space is bounded by the size of M rather than of L*R.
+ */
+template <typename DType, typename IType>
+static STORAGE* masked_matrix_multiply(const STORAGE_PAIR& casted_storage, const STORAGE* mask_storage, const char* mask_nonzero, size_t* resulting_shape, nm::itype_t result_itype) {
+  YALE_STORAGE *left  = (YALE_STORAGE*)(casted_storage.left),
+               *right = (YALE_STORAGE*)(casted_storage.right),
+               *mask  = (YALE_STORAGE*)(mask_storage);
+
+  SpGEMMTask<DType,IType> t;
+  t.ijl   = ija_as_itype<IType>(left, result_itype);
+  t.al    = reinterpret_cast<const DType*>(left->a);
+  t.ijr   = ija_as_itype<IType>(right, result_itype);
+  t.ar    = reinterpret_cast<const DType*>(right->a);
+  t.ijm   = ija_as_itype<IType>(mask, result_itype);
+  t.nzm   = mask_nonzero;
+  t.rows  = resulting_shape[0];
+  t.inner = left->shape[1];
+  t.cols  = resulting_shape[1];
+
+  size_t* upper    = ALLOC_N(size_t, t.rows + 1);
+  size_t* products = ALLOC_N(size_t, t.rows);
+
+  upper[0] = 0;
+  for (size_t i = 0; i < t.rows; ++i) {
+    products[i] = spgemm_row_products<DType,IType>(t, i);
+    upper[i+1]  = upper[i] + t.ijm[i+1] - t.ijm[i];
+  }
+  t.upper = upper;
+
+  YALE_STORAGE* result = spgemm<DType,IType>(t, products, spgemm_masked_task_run<DType,IType>, left->dtype, resulting_shape, result_itype);
+
+  xfree(upper);
+  if (t.ijl != reinterpret_cast<IType*>(left->ija))  xfree(const_cast<IType*>(t.ijl));
+  if (t.ijr != reinterpret_cast<IType*>(right->ija)) xfree(const_cast<IType*>(t.ijr));
+  if (t.ijm != reinterpret_cast<IType*>(mask->ija))  xfree(const_cast<IType*>(t.ijm));
+
+  return reinterpret_cast<STORAGE*>(result);
+}
+
+
+/*
+ * Split the rows of s into nchunks contiguous pieces with about the same number of stored entries each, counting the
+ * diagonal as one per row, so that a few dense rows don't leave most threads idle. Each boundary is a binary search over
+ * IA, which is the running total of the off-diagonal entries. bounds gets nchunks + 1 row numbers.
+ */
+template <typename IType>
+static void balanced_row_chunks(const YALE_STORAGE* s, const size_t nchunks, size_t* bounds) {
+  const IType* ija  = reinterpret_cast<const IType*>(reinterpret_cast<const YALE_STORAGE*>(s->src)->ija) + s->offset[0];
+  const size_t rows = s->shape[0],
+               total = ija[rows] - ija[0] + rows;
+
+  bounds[0]       = 0;
+  bounds[nchunks] = rows;
+
+  for (size_t c = 1; c < nchunks; ++c) {
+    const size_t target = total * c / nchunks;
+    size_t lo = bounds[c-1], hi = rows;
+
+    while (lo < hi) { // first row whose entries before it reach the target
+      const size_t mid = (lo + hi) / 2;
+      if (ija[mid] - ija[0] + mid < target) lo = mid + 1;
+      else                                  hi = mid;
+    }
+
+    bounds[c] = lo;
+  }
+}
+
+
+/*
+ * Sparse matrix-vector product for rows [i0, i1) of s: y[i] = alpha*(s*x)[i] + beta*y[i], from the diagonal entry and
+ * the row's range of IJA. y isn't read when beta is zero. References are read in place from their source, skipping
+ * entries outside their columns.
+ */
+template <typename DType, typename IType>
+static void gemv_rows(const YALE_STORAGE* s, const size_t i0, const size_t i1, const DType* alpha, const DType* x, const int incx,
+                      const DType* beta, DType* y, const int incy) {
+  const YALE_STORAGE* src = reinterpret_cast<const YALE_STORAGE*>(s->src);
+  const IType* ija = reinterpret_cast<const IType*>(src->ija);
+  const DType* a   = reinterpret_cast<const DType*>(src->a);
+
+  const size_t row_offset = s->offset[0], col_offset = s->offset[1], cols = s->shape[1];
+
+  for (size_t i = i0; i < i1; ++i) {
+    const size_t r = i + row_offset;
+    DType sum = 0;
+
+    // Column indices are unsigned, so anything left of the reference wraps around to past its right edge.
+    if (r - col_offset < cols) sum += a[r] * x[(r - col_offset) * incx];
+
+    for (IType p = ija[r]; p < ija[r+1]; ++p) {
+      const size_t j = ija[p] - col_offset;
+      if (j < cols) sum += a[p] * x[j * incx];
+    }
+
+    if (*beta == 0) y[i * incy] = *alpha * sum;
+    else            y[i * incy] = *alpha * sum + *beta * y[i * incy];
+  }
+}
+
+/*
+ * Width of the pieces a dense operand is split into (see NM_YALE_SPMM_BLOCK_BYTES), when the other dimension of each
+ * piece is length.
+ */
+template <typename DType>
+static inline size_t spmm_block(const size_t length, const size_t limit) {
+  const size_t fit = NM_YALE_SPMM_BLOCK_BYTES / (sizeof(DType) * std::max(length, (size_t)(1)));
+  return std::min(limit, std::max(fit, (size_t)(NM_YALE_SPMM_MIN_BLOCK)));
+}
+
+
+/*
+ * Sparse times dense for rows [i0, i1) of s: C[i,:] = alpha*(s*B)[i,:] + beta*C[i,:], with B and C row-major with n
+ * columns. Each stored entry of the row adds a multiple of a row of B. B is taken a block of columns at a time, small
+ * enough to stay in cache across all the rows.
+ */
+template <typename DType, typename IType>
+static void gemm_rows(const YALE_STORAGE* s, const size_t i0, const size_t i1, const int n, const DType* alpha,
+                      const DType* B, const int ldb, const DType* beta, DType* C, const int ldc) {
+  const YALE_STORAGE* src = reinterpret_cast<const YALE_STORAGE*>(s->src);
+  const IType* ija = reinterpret_cast<const IType*>(src->ija);
+  const DType* a   = reinterpret_cast<const DType*>(src->a);
+
+  const size_t row_offset = s->offset[0], col_offset = s->offset[1], cols = s->shape[1];
+  const int    width      = spmm_block<DType>(cols, n);
+
+  for (int j0 = 0; j0 < n; j0 += width) {
+    const int j1 = std::min(n, j0 + width);
+
+    for (size_t i = i0; i < i1; ++i) {
+      const size_t r = i + row_offset;
+      DType* c = C + i*ldc;
+
+      if (*beta == 0)      for (int j = j0; j < j1; ++j) c[j] = 0;
+      else if (*beta != 1) for (int j = j0; j < j1; ++j) c[j] *= *beta;
+
+      if (r - col_offset < cols && a[r] != 0) {
+        const DType  v = *alpha * a[r];
+        const DType* b = B + (r - col_offset)*ldb;
+        for (int j = j0; j < j1; ++j) c[j] += v * b[j];
+      }
+
+      for (IType p = ija[r]; p < ija[r+1]; ++p) {
+        const size_t k = ija[p] - col_offset;
+        if (k >= cols) continue;
+
+        const DType  v = *alpha * a[p];
+        const DType* b = B + k*ldb;
+        for (int j = j0; j < j1; ++j) c[j] += v * b[j];
+      }
+    }
+  }
+}
+
+/*
+ * Dense times sparse for rows [i0, i1) of A: C[i,:] = alpha*(A*s)[i,:] + beta*C[i,:], with A and C row-major. The rows
+ * are taken a block at a time, small enough for the block of C to stay in cache, and each row of s is read once per
+ * block and scattered into every row of C in it.
+ */
+template <typename DType, typename IType>
+static void dense_gemm_rows(const DType* A, const int lda, const YALE_STORAGE* s, const size_t i0, const size_t i1,
+                            const DType* alpha, const DType* beta, DType* C, const int ldc) {
+  const YALE_STORAGE* src = reinterpret_cast<const YALE_STORAGE*>(s->src);
+  const IType* ija = reinterpret_cast<const IType*>(src->ija);
+  const DType* a   = reinterpret_cast<const DType*>(src->a);
+
+  const size_t row_offset = s->offset[0], col_offset = s->offset[1], inner = s->shape[0], cols = s->shape[1];
+  const size_t height     = spmm_block<DType>(cols, i1 - i0);
+
+  for (size_t i = i0; i < i1; ++i) {
+    DType* c = C + i*ldc;
+    if (*beta == 0)      for (size_t j = 0; j < cols; ++j) c[j] = 0;
+    else if (*beta != 1) for (size_t j = 0; j < cols; ++j) c[j] *= *beta;
+  }
+
+  for (size_t ib = i0; ib < i1; ib += height) {
+    const size_t ie = std::min(i1, ib + height);
+
+    for (size_t l = 0; l < inner; ++l) {
+      const size_t r = l + row_offset, diag = r - col_offset;
+
+      for (size_t i = ib; i < ie; ++i) {
+        if (A[i*lda + l] == 0) continue;
+
+        const DType v = *alpha * A[i*lda + l];
+        DType* c = C + i*ldc;
+
+        if (diag < cols) c[diag] += v * a[r];
+
+        for (IType p = ija[r]; p < ija[r+1]; ++p) {
+          const size_t j = ija[p] - col_offset;
+          if (j < cols) c[j] += v * a[p];
+        }
+      }
+    }
+  }
+}
+
+
+/*
+ * Transposed sparse matrix-vector product for rows [i0, i1) of s, scattered into y: y[j] += alpha*s[i,j]*x[i] for each
+ * stored entry. s**T is never formed; its columns are just the rows of s.
+ */
+template <typename DType, typename IType>
+static void gemv_transposed_rows(const YALE_STORAGE* s, const size_t i0, const size_t i1, const DType* alpha, const DType* x,
+                                 const int incx, DType* y, const int incy) {
+  const YALE_STORAGE* src = reinterpret_cast<const YALE_STORAGE*>(s->src);
+  const IType* ija = reinterpret_cast<const IType*>(src->ija);
+  const DType* a   = reinterpret_cast<const DType*>(src->a);
+
+  const size_t row_offset = s->offset[0], col_offset = s->offset[1], cols = s->shape[1];
+
+  for (size_t i = i0; i < i1; ++i) {
+    if (x[i * incx] == 0) continue;
+
+    const size_t r = i + row_offset;
+    const DType  v = *alpha * x[i * incx];
+
+    if (r - col_offset < cols) y[(r - col_offset) * incy] += a[r] * v;
+
+    for (IType p = ija[r]; p < ija[r+1]; ++p) {
+      const size_t j = ija[p] - col_offset;
+      if (j < cols) y[j * incy] += a[p] * v;
+    }
+  }
+}
+
+/*
+ * Transposed sparse times dense for columns [j0, j1) of B and C: C = alpha*s**T*B + beta*C, where C has a row for each
+ * column of s. Each stored entry s[i,k] adds a multiple of row i of B to row k of C. The columns are taken a block at a
+ * time, so that block of C stays in cache while all of s is read.
+ */
+template <typename DType, typename IType>
+static void gemm_transposed_columns(const YALE_STORAGE* s, const int j0, const int j1, const DType* alpha, const DType* B,
+                                    const int ldb, const DType* beta, DType* C, const int ldc) {
+  const YALE_STORAGE* src = reinterpret_cast<const YALE_STORAGE*>(s->src);
+  const IType* ija = reinterpret_cast<const IType*>(src->ija);
+  const DType* a   = reinterpret_cast<const DType*>(src->a);
+
+  const size_t row_offset = s->offset[0], col_offset = s->offset[1], rows = s->shape[0], cols = s->shape[1];
+  const int    width      = spmm_block<DType>(cols, j1 - j0);
+
+  for (size_t k = 0; k < cols; ++k) {
+    DType* c = C + k*ldc;
+    if (*beta == 0)      for (int j = j0; j < j1; ++j) c[j] = 0;
+    else if (*beta != 1) for (int j = j0; j < j1; ++j) c[j] *= *beta;
+  }
+
+  for (int jb = j0; jb < j1; jb += width) {
+    const int je = std::min(j1, jb + width);
+
+    for (size_t i = 0; i < rows; ++i) {
+      const size_t r = i + row_offset;
+      const DType* b = B + i*ldb;
+
+      if (r - col_offset < cols && a[r] != 0) {
+        const DType v = *alpha * a[r];
+        DType*      c = C + (r - col_offset)*ldc;
+        for (int j = jb; j < je; ++j) c[j] += v * b[j];
+      }
+
+      for (IType p = ija[r]; p < ija[r+1]; ++p) {
+        const size_t k = ija[p] - col_offset;
+        if (k >= cols) continue;
+
+        const DType v = *alpha * a[p];
+        DType*      c = C + k*ldc;
+        for (int j = jb; j < je; ++j) c[j] += v * b[j];
+      }
+    }
+  }
+}
+
+
+/*
+ * Arguments for a parallel sparse product: the row chunks from balanced_row_chunks (sparse times dense only), the dense
+ * operand D, and the result C. A thread only writes its own rows of C, so the result doesn't depend on the number of
+ * threads. The transposed SpMV scatters each chunk into its own accumulator in acc instead, and adds those up afterwards
+ * in chunk order.
+ */
+template <typename DType>
+struct SparseProductTask {
+  const YALE_STORAGE* s;
+  const size_t*       bounds;
+  int                 n;
+  const DType*        alpha;
+  const DType*        D;
+  int                 ldd;
+  const DType*        beta;
+  DType*              C;
+  int                 ldc;
+  DType*              acc;
+  size_t              nchunks;
+};
+
+template <typename DType, typename IType>
+static void gemv_task_run(void* task_, int begin, int end) {
+  SparseProductTask<DType>* t = reinterpret_cast<SparseProductTask<DType>*>(task_);
+  for (int c = begin; c < end; ++c)
+    gemv_rows<DType,IType>(t->s, t->bounds[c], t->bounds[c+1], t->alpha, t->D, t->ldd, t->beta, t->C, t->ldc);
+}
+
+template <typename DType, typename IType>
+static void gemm_task_run(void* task_, int begin, int end) {
+  SparseProductTask<DType>* t = reinterpret_cast<SparseProductTask<DType>*>(task_);
+  for (int c = begin; c < end; ++c)
+    gemm_rows<DType,IType>(t->s, t->bounds[c], t->bounds[c+1], t->n, t->alpha, t->D, t->ldd, t->beta, t->C, t->ldc);
+}
+
+template <typename DType, typename IType>
+static void dense_gemm_task_run(void* task_, int begin, int end) {
+  SparseProductTask<DType>* t = reinterpret_cast<SparseProductTask<DType>*>(task_);
+  dense_gemm_rows<DType,IType>(t->D, t->ldd, t->s, begin, end, t->alpha, t->beta, t->C, t->ldc);
+}
+
+template <typename DType, typename IType>
+static void gemv_transposed_task_run(void* task_, int begin, int end) {
+  SparseProductTask<DType>* t = reinterpret_cast<SparseProductTask<DType>*>(task_);
+
+  for (int c = begin; c < end; ++c) {
+    DType* acc = t->acc + c * t->s->shape[1];
+    for (size_t j = 0; j < t->s->shape[1]; ++j) acc[j] = 0;
+
+    gemv_transposed_rows<DType,IType>(t->s, t->bounds[c], t->bounds[c+1], t->alpha, t->D, t->ldd, acc, 1);
+  }
+}
+
+template <typename DType>
+static void gemv_transposed_reduce_run(void* task_, int begin, int end) {
+  SparseProductTask<DType>* t = reinterpret_cast<SparseProductTask<DType>*>(task_);
+  const size_t cols = t->s->shape[1];
+
+  for (int j = begin; j < end; ++j) {
+    DType sum = t->acc[j];
+    for (size_t c = 1; c < t->nchunks; ++c) sum += t->acc[c*cols + j];
+
+    if (*t->beta == 0) t->C[j * t->ldc] = sum;
+    else               t->C[j * t->ldc] = sum + *t->beta * t->C[j * t->ldc];
+  }
+}
+
+template <typename DType, typename IType>
+static void gemm_transposed_task_run(void* task_, int begin, int end) {
+  SparseProductTask<DType>* t = reinterpret_cast<SparseProductTask<DType>*>(task_);
+  gemm_transposed_columns<DType,IType>(t->s, begin, end, t->alpha, t->D, t->ldd, t->beta, t->C, t->ldc);
+}
+
+/*
+ * Run fn over all the rows of s, on as many threads as NMatrix::BLAS.num_threads allows for this much work, with the
+ * rows split by stored entries.
+ */
+template <typename DType, typename IType>
+static void sparse_product_run(SparseProductTask<DType>& task, nm_parallel_func fn) {
+  const YALE_STORAGE* s = task.s;
+  const size_t rows     = s->shape[0];
+  const IType* ija      = reinterpret_cast<const IType*>(reinterpret_cast<const YALE_STORAGE*>(s->src)->ija) + s->offset[0];
+
+  const size_t threads  = nm::math::parallel_threads<DType>((double)(ija[rows] - ija[0] + rows) * task.n);
+  const size_t nchunks  = std::min(threads, rows);
+
+  if (nchunks <= 1) {
+    size_t bounds[2] = { 0, rows };
+    task.bounds = bounds;
+    fn(&task, 0, 1);
+    return;
+  }
+
+  size_t* bounds = ALLOCA_N(size_t, nchunks + 1);
+  balanced_row_chunks<IType>(s, nchunks, bounds);
+  task.bounds = bounds;
+
+  nm_math_parallel_for(nchunks, 1, fn, &task);
+}
+
+/*
+ * y = alpha*s**T*x + beta*y. On one thread, the rows of s are scattered straight into y. On several, each chunk of rows
+ * is scattered into its own accumulator, and the accumulators are then added up a range of y at a time.
+ */
+template <typename DType, typename IType>
+static void gemv_transposed(SparseProductTask<DType>& task) {
+  const YALE_STORAGE* s = task.s;
+  const size_t rows     = s->shape[0],
+               cols     = s->shape[1];
+  const IType* ija      = reinterpret_cast<const IType*>(reinterpret_cast<const YALE_STORAGE*>(s->src)->ija) + s->offset[0];
+
+  const size_t threads  = nm::math::parallel_threads<DType>((double)(ija[rows] - ija[0] + rows));
+  const size_t nchunks  = std::min(threads, rows);
+
+  if (nchunks <= 1) {
+    for (size_t j = 0; j < cols; ++j) {
+      if (*task.beta == 0)      task.C[j * task.ldc] = 0;
+      else if (*task.beta != 1) task.C[j * task.ldc] *= *task.beta;
+    }
+
+    gemv_transposed_rows<DType,IType>(s, 0, rows, task.alpha, task.D, task.ldd, task.C, task.ldc);
+    return;
+  }
+
+  size_t* bounds = ALLOCA_N(size_t, nchunks + 1);
+  balanced_row_chunks<IType>(s, nchunks, bounds);
+
+  task.bounds  = bounds;
+  task.acc     = ALLOC_N(DType, nchunks * cols);
+  task.nchunks = nchunks;
+
+  nm_math_parallel_for(nchunks, 1, gemv_transposed_task_run<DType,IType>, &task);
+  nm_math_parallel_for(cols, 64, gemv_transposed_reduce_run<DType>, &task);
+
+  xfree(task.acc);
+}
+
+template <typename DType, typename IType>
+static void gemv(const YALE_STORAGE* s, const bool transpose, const void* alpha, const void* x, const int incx, const void* beta, void* y, const int incy) {
+  SparseProductTask<DType> task = { s, NULL, 1, reinterpret_cast<const DType*>(alpha), reinterpret_cast<const DType*>(x), incx,
+                                    reinterpret_cast<const DType*>(beta), reinterpret_cast<DType*>(y), incy, NULL, 0 };
+
+  if (transpose) gemv_transposed<DType,IType>(task);
+  else           sparse_product_run<DType,IType>(task, gemv_task_run<DType,IType>);
+}
+
+/*
+ * y = s*x, for the iterative solvers.
+ */
+template <typename DType, typename IType>
+static void spmv(const YALE_STORAGE* s, const void* x, void* y) {
+  const DType one = 1, zero = 0;
+  gemv<DType,IType>(s, false, &one, x, 1, &zero, y, 1);
+}
+
+/*
+ * The transposed product splits the columns of B between threads rather than the rows of s, since every row of s can
+ * add to any row of C.
+ */
+template <typename DType, typename IType>
+static void gemm(const YALE_STORAGE* s, const bool transpose, const int n, const void* alpha, const void* b, const int ldb, const void* beta, void* c, const int ldc) {
+  SparseProductTask<DType> task = { s, NULL, n, reinterpret_cast<const DType*>(alpha), reinterpret_cast<const DType*>(b), ldb,
+                                    reinterpret_cast<const DType*>(beta), reinterpret_cast<DType*>(c), ldc, NULL, 0 };
+
+  if (!transpose) {
+    sparse_product_run<DType,IType>(task, gemm_task_run<DType,IType>);
+    return;
+  }
+
+  const IType* ija   = reinterpret_cast<const IType*>(reinterpret_cast<const YALE_STORAGE*>(s->src)->ija) + s->offset[0];
+  const double flops = (double)(n) * (ija[s->shape[0]] - ija[0] + s->shape[0]);
+
+  if (nm::math::parallel_threads<DType>(flops) > 1)
+    nm_math_parallel_for(n, NM_YALE_SPMM_MIN_BLOCK, gemm_transposed_task_run<DType,IType>, &task);
+  else
+    gemm_transposed_task_run<DType,IType>(&task, 0, n);
+}
+
+/*
+ * Dense times sparse has the same amount of work in every row of the dense operand, so its rows are split evenly.
+ */
+template <typename DType, typename IType>
+static void dense_gemm(const void* a, const int m, const int lda, const YALE_STORAGE* s, const void* alpha, const void* beta, void* c, const int ldc) {
+  SparseProductTask<DType> task = { s, NULL, (int)(s->shape[1]), reinterpret_cast<const DType*>(alpha), reinterpret_cast<const DType*>(a), lda,
+                                    reinterpret_cast<const DType*>(beta), reinterpret_cast<DType*>(c), ldc, NULL, 0 };
+
+  const IType* ija = reinterpret_cast<const IType*>(reinterpret_cast<const YALE_STORAGE*>(s->src)->ija) + s->offset[0];
+  const double flops = (double)(m) * (ija[s->shape[0]] - ija[0] + s->shape[0]);
+
+  if (nm::math::parallel_threads<DType>(flops) > 1)
+    nm_math_parallel_for(m, spmm_block<DType>(s->shape[1], m), dense_gemm_task_run<DType,IType>, &task);
+  else
+    dense_gemm_task_run<DType,IType>(&task, 0, m);
+}
+
+
+/*
+ * Arguments for a triangular solve over the rows in rows[0, count). Only the entries of s on the upper or lower side of
+ * the diagonal are read, so s may hold both triangles (as an incomplete factorization does).
+ */
+template <typename DType>
+struct TriangularSolveTask {
+  const YALE_STORAGE* s;
+  bool                upper, unit;
+  const size_t*       rows;
+  int                 n;
+  DType*              b;
+  int                 ldb;
+};
+
+/*
+ * Substitute for each row i in t.rows, in order: row i of B becomes (B[i,:] - sum of T[i,j]*B[j,:]) / T[i,i], where j
+ * runs over the stored entries on t's side of the diagonal, which must already have been solved.
+ */
+template <typename DType, typename IType>
+static void trsm_rows(const TriangularSolveTask<DType>& t, const size_t begin, const size_t end) {
+  const IType* ija = reinterpret_cast<const IType*>(t.s->ija);
+  const DType* a   = reinterpret_cast<const DType*>(t.s->a);
+
+  for (size_t r = begin; r < end; ++r) {
+    const size_t i = t.rows ? t.rows[r] : (t.upper ? t.s->shape[0] - 1 - r : r);
+    DType* bi = t.b + i*t.ldb;
+
+    for (IType p = ija[i]; p < ija[i+1]; ++p) {
+      const size_t j = ija[p];
+      if ((t.upper ? j < i : j > i) || a[p] == 0) continue;
+
+      const DType* bj = t.b + j*t.ldb;
+      for (int c = 0; c < t.n; ++c) bi[c] = bi[c] - a[p] * bj[c];
+    }
+
+    if (!t.unit)
+      for (int c = 0; c < t.n; ++c) bi[c] = bi[c] / a[i];
+  }
+}
+
+template <typename DType, typename IType>
+static void trsm_task_run(void* task_, int begin, int end) {
+  trsm_rows<DType,IType>(*reinterpret_cast<TriangularSolveTask<DType>*>(task_), begin, end);
+}
+
+/*
+ * Solve T**T*X = B by columns: once row i of X is known, its multiples are taken off the rows it's used in. Every row of
+ * T can touch any row of B, so this is always done on one thread.
+ */
+template <typename DType, typename IType>
+static void trsm_transposed(const TriangularSolveTask<DType>& t) {
+  const IType* ija  = reinterpret_cast<const IType*>(t.s->ija);
+  const DType* a    = reinterpret_cast<const DType*>(t.s->a);
+  const size_t rows = t.s->shape[0];
+
+  for (size_t r = 0; r < rows; ++r) {
+    const size_t i  = t.upper ? r : rows - 1 - r;
+    DType*       bi = t.b + i*t.ldb;
+
+    if (!t.unit)
+      for (int c = 0; c < t.n; ++c) bi[c] = bi[c] / a[i];
+
+    for (IType p = ija[i]; p < ija[i+1]; ++p) {
+      const size_t j = ija[p];
+      if ((t.upper ? j < i : j > i) || a[p] == 0) continue;
+
+      DType* bj = t.b + j*t.ldb;
+      for (int c = 0; c < t.n; ++c) bj[c] = bj[c] - a[p] * bi[c];
+    }
+  }
+}
+
+/*
+ * Group the rows of a triangular solve into levels: a row's level is one more than the highest level of the rows it
+ * depends on, so the rows of a level can all be solved at once, after the levels before it. order gets the rows level by
+ * level, and level_ptr[l] the position in order where level l starts. Returns the number of levels.
+ */
+template <typename IType>
+static size_t triangular_levels(const YALE_STORAGE* s, const bool upper, size_t* order, size_t* level_ptr) {
+  const IType* ija  = reinterpret_cast<const IType*>(s->ija);
+  const size_t rows = s->shape[0];
+  size_t* level     = ALLOC_N(size_t, rows);
+  size_t  levels    = 0;
+
+  for (size_t r = 0; r < rows; ++r) {
+    const size_t i = upper ? rows - 1 - r : r;
+    size_t l = 0;
+
+    for (IType p = ija[i]; p < ija[i+1]; ++p) {
+      const size_t j = ija[p];
+      if ((upper ? j > i : j < i) && level[j] + 1 > l) l = level[j] + 1;
+    }
+
+    level[i] = l;
+    if (l + 1 > levels) levels = l + 1;
+  }
+
+  // Counting sort of the rows by level.
+  for (size_t l = 0; l <= levels; ++l) level_ptr[l] = 0;
+  for (size_t i = 0; i < rows; ++i)    ++level_ptr[level[i] + 1];
+  for (size_t l = 0; l < levels; ++l)  level_ptr[l+1] += level_ptr[l];
+
+  size_t* next = ALLOC_N(size_t, levels);
+  for (size_t l = 0; l < levels; ++l) next[l] = level_ptr[l];
+  for (size_t i = 0; i < rows; ++i)   order[next[level[i]]++] = i;
+
+  xfree(next);
+  xfree(level);
+
+  return levels;
+}
+
+/*
+ * Run the substitution of t level by level, with the levels from triangular_levels. The rows of each level that is wide
+ * enough are split between threads.
+ */
+template <typename DType, typename IType>
+static void trsm_levels(const TriangularSolveTask<DType>& t, const size_t* order, const size_t* level_ptr, const size_t levels) {
+  for (size_t l = 0; l < levels; ++l) {
+    const size_t width = level_ptr[l+1] - level_ptr[l];
+
+    TriangularSolveTask<DType> level_task = t;
+    level_task.rows = order + level_ptr[l];
+
+    if (width >= NM_YALE_TRSM_MIN_LEVEL) nm_math_parallel_for(width, NM_YALE_TRSM_MIN_LEVEL / 4, trsm_task_run<DType,IType>, &level_task);
+    else                                 trsm_rows<DType,IType>(level_task, 0, width);
+  }
+}
+
+/*
+ * Solve T*X = alpha*B (or T**T*X = alpha*B), in place in B, which is row-major with n columns. When there are threads to
+ * spare (see NMatrix::BLAS.num_threads), the rows are grouped into levels by triangular_levels, and the rows of each
+ * level that is wide enough are split between threads. Returns -1, or the first row with a zero on the diagonal if
+ * unit is false, in which case B is left alone.
+ */
+template <typename DType, typename IType>
+static long trsm(const YALE_STORAGE* s, const bool upper, const bool transpose, const bool unit, const int n,
+                 const void* alpha_, void* b_, const int ldb) {
+  const DType& alpha = *reinterpret_cast<const DType*>(alpha_);
+  DType*       b     = reinterpret_cast<DType*>(b_);
+  const size_t rows  = s->shape[0];
+  const IType* ija   = reinterpret_cast<const IType*>(s->ija);
+  const DType* a     = reinterpret_cast<const DType*>(s->a);
+
+  if (!unit)
+    for (size_t i = 0; i < rows; ++i)
+      if (a[i] == 0) return i;
+
+  if (alpha != 1)
+    for (size_t i = 0; i < rows; ++i)
+      for (int c = 0; c < n; ++c) b[i*ldb + c] = alpha * b[i*ldb + c];
+
+  TriangularSolveTask<DType> task = { s, upper, unit, NULL, n, b, ldb };
+
+  if (transpose) {
+    trsm_transposed<DType,IType>(task);
+    return -1;
+  }
+
+  const double flops = (double)(n) * (ija[rows] - ija[0] + rows);
+  if (nm::math::parallel_threads<DType>(flops) <= 1) {
+    trsm_rows<DType,IType>(task, 0, rows);
+    return -1;
+  }
+
+  size_t* order     = ALLOC_N(size_t, rows);
+  size_t* level_ptr = ALLOC_N(size_t, rows + 1);
+  const size_t levels = triangular_levels<IType>(s, upper, order, level_ptr);
+
+  trsm_levels<DType,IType>(task, order, level_ptr, levels);
+
+  xfree(order);
+  xfree(level_ptr);
+
+  return -1;
+}
+
+
+/*
+ * s's pattern as compressed rows with size_t indices, each row's diagonal first (whether or not it's zero).
+ */
+template <typename IType>
+static void structure(const YALE_STORAGE* s, std::vector<size_t>& ptr, std::vector<size_t>& idx) {
+  const size_t n   = s->shape[0];
+  const IType* ija = reinterpret_cast<const IType*>(s->ija);
+
+  ptr.resize(n + 1);
+  idx.resize(ija[n] - 1); // the diagonal, plus everything after the default value
+
+  ptr[0] = 0;
+  for (size_t i = 0, q = 0; i < n; ++i) {
+    idx[q++] = i;
+    for (size_t p = ija[i]; p < ija[i+1]; ++p) idx[q++] = ija[p];
+    ptr[i+1] = q;
+  }
+}
+
+/*
+ * Copy a size_t IJA into s, which must have room for it.
+ */
+template <typename IType>
+static void set_ija(YALE_STORAGE* s, const std::vector<size_t>& ija) {
+  IType* sija = reinterpret_cast<IType*>(s->ija);
+  for (size_t p = 0; p < ija.size(); ++p) sija[p] = ija[p];
+}
+
+/*
+ * s as compressed rows, in the layout given by structure.
+ */
+template <typename DType>
+static void compressed_rows(const YALE_STORAGE* s, nm::math::CompressedMatrix<DType>& m) {
+  NAMED_ITYPE_TEMPLATE_TABLE(ttable, structure, void, const YALE_STORAGE*, std::vector<size_t>&, std::vector<size_t>&);
+
+  const size_t n   = s->shape[0];
+  const DType* a   = reinterpret_cast<const DType*>(s->a);
+
+  m.n = n;
+  ttable[s->itype](s, m.ptr, m.idx);
+  m.val.resize(m.idx.size());
+
+  for (size_t i = 0, p = n + 1; i < n; ++i) {
+    m.val[m.ptr[i]] = a[i];
+    for (size_t q = m.ptr[i] + 1; q < m.ptr[i+1]; ++q) m.val[q] = a[p++];
+  }
+}
+
+/*
+ * A new Yale matrix from compressed columns, leaving out zeros off the diagonal.
+ */
+template <typename DType>
+static YALE_STORAGE* from_compressed_columns(const nm::math::CompressedMatrix<DType>& c, nm::dtype_t dtype) {
+  NAMED_ITYPE_TEMPLATE_TABLE(ttable, set_ija, void, YALE_STORAGE*, const std::vector<size_t>&);
+
+  nm::math::CompressedMatrix<DType> r;
+  nm::math::sparse_transpose(c, r); // by rows, with the columns in order
+
+  const size_t n = r.n;
+  size_t    ndnz = 0;
+  for (size_t i = 0; i < n; ++i)
+    for (size_t q = r.ptr[i]; q < r.ptr[i+1]; ++q)
+      if (r.idx[q] != i && r.val[q] != 0) ++ndnz;
+
+  size_t* shape = ALLOC_N(size_t, 2);
+  shape[0] = shape[1] = n;
+
+  YALE_STORAGE* s = nm_yale_storage_create(dtype, shape, 2, n + 1 + ndnz, nm_yale_storage_itype_by_shape(shape));
+  DType*        a = reinterpret_cast<DType*>(s->a);
+  std::vector<size_t> ija(n + 1 + ndnz);
+
+  size_t p = n + 1;
+  for (size_t i = 0; i < n; ++i) {
+    ija[i] = p;
+    a[i]   = 0;
+
+    for (size_t q = r.ptr[i]; q < r.ptr[i+1]; ++q) {
+      if (r.idx[q] == i) {
+        a[i]   = r.val[q];
+      } else if (r.val[q] != 0) {
+        ija[p] = r.idx[q];
+        a[p++] = r.val[q];
+      }
+    }
+  }
+  ija[n] = p;
+  a[n]   = 0;
+
+  ttable[s->itype](s, ija);
+  s->ndnz = ndnz;
+
+  return s;
+}
+
+/*
+ * Wrap a new Yale matrix in an NMatrix of the same class as self.
+ */
+static VALUE new_yale_matrix(VALUE self, YALE_STORAGE* s) {
+  NMATRIX* m = nm_create(nm::YALE_STORE, reinterpret_cast<STORAGE*>(s));
+  return Data_Wrap_Struct(CLASS_OF(self), nm_yale_storage_mark, nm_delete, m);
+}
+
+static VALUE indices_to_array(const std::vector<size_t>& v) {
+  VALUE ary = rb_ary_new2(v.size());
+  for (size_t i = 0; i < v.size(); ++i)
+    rb_ary_push(ary, v[i] == nm::math::SPARSE_NONE ? Qnil : SIZET2NUM(v[i]));
+  return ary;
+}
+
+/*
+ * Read an Array of len indices below limit, or nils (which become SPARSE_NONE). Nothing is raised, since the caller's
+ * vectors would leak; returns NULL, or what's wrong with ary for the caller to raise once they're gone.
+ */
+static const char* indices_from_array(VALUE ary, size_t len, size_t limit, std::vector<size_t>& v) {
+  if (TYPE(ary) != T_ARRAY)             return "symbolic analysis must be made of Arrays";
+  if ((size_t)(RARRAY_LEN(ary)) != len) return "symbolic analysis is for a matrix of another size";
+
+  v.resize(len);
+  for (size_t i = 0; i < len; ++i) {
+    VALUE x = rb_ary_entry(ary, i);
+    if (x == Qnil) {
+      v[i] = nm::math::SPARSE_NONE;
+    } else {
+      if (!FIXNUM_P(x)) return "symbolic analysis has an index out of range";
+      long l = FIX2LONG(x);
+      if (l < 0 || (size_t)(l) >= limit) return "symbolic analysis has an index out of range";
+      v[i] = l;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * Check that s can be factorized: a square matrix (not a slice) with a zero default value.
+ */
+static void check_factorizable(const YALE_STORAGE* s) {
+  if (s->src != s)
+    rb_raise(rb_eNotImpError, "sparse factorizations are not supported on Yale slices");
+  if (s->shape[0] != s->shape[1])
+    rb_raise(rb_eArgError, "sparse factorizations require a square matrix");
+  if (!default_value_is_numeric_zero(s))
+    rb_raise(rb_eNotImpError, "matrix default value must be some form of zero (not false or nil) for factorization");
+}
+
+/*
+ * Read the permutation perm from an Array, and its inverse. Like indices_from_array, returns NULL or what's wrong.
+ */
+static const char* permutation_from_array(VALUE ary, size_t n, std::vector<size_t>& perm, std::vector<size_t>& pinv) {
+  const char* error = indices_from_array(ary, n, n, perm);
+  if (error) return error;
+
+  pinv.assign(n, nm::math::SPARSE_NONE);
+  for (size_t k = 0; k < n; ++k) {
+    if (perm[k] == nm::math::SPARSE_NONE || pinv[perm[k]] != nm::math::SPARSE_NONE)
+      return "symbolic analysis has an invalid permutation";
+    pinv[perm[k]] = k;
+  }
+
+  return NULL;
+}
+
+/*
+ * Check a Cholesky analysis's elimination tree and column pointers, which the factorization trusts to stay within L.
+ * Returns NULL or what's wrong.
+ */
+static const char* check_cholesky_analysis(const size_t n, const std::vector<size_t>& parent, const std::vector<size_t>& colptr) {
+  for (size_t k = 0; k < n; ++k) {
+    if (parent[k] != nm::math::SPARSE_NONE && parent[k] <= k)
+      return "symbolic analysis has an invalid elimination tree";
+    if (colptr[k+1] <= colptr[k] || colptr[k+1] - colptr[k] > n - k)
+      return "symbolic analysis has invalid column pointers";
+  }
+  if (n && colptr[0] != 0) return "symbolic analysis has invalid column pointers";
+
+  return NULL;
+}
+
+/*
+ * Numeric Cholesky factorization of s, given its symbolic analysis from nm_yale_cholesky_analyze. Returns L.
+ */
+template <typename DType>
+static VALUE cholesky(VALUE self, VALUE perm_, VALUE parent_, VALUE colptr_) {
+  const YALE_STORAGE* s = NM_STORAGE_YALE(self);
+  const size_t        n = s->shape[0];
+
+  const char*   error  = NULL;
+  long          result = -1;
+  YALE_STORAGE* factor = NULL;
+
+  { // Anything wrong is raised once the vectors are out of scope, so that they don't leak.
+    std::vector<size_t> perm, pinv, parent, colptr;
+
+    error = permutation_from_array(perm_, n, perm, pinv);
+    if (!error) error = indices_from_array(parent_, n, n, parent);
+    if (!error) error = indices_from_array(colptr_, n + 1, (size_t)(-1), colptr);
+    if (!error) error = check_cholesky_analysis(n, parent, colptr);
+
+    if (!error) {
+      nm::math::CompressedMatrix<DType> a, l;
+      compressed_rows<DType>(s, a);
+
+      result = nm::math::cholesky<DType>(a, perm, pinv, parent, colptr, l);
+      if (result == -1) factor = from_compressed_columns<DType>(l, s->dtype);
+    }
+  }
+
+  if (error)
+    rb_raise(rb_eArgError, "%s", error);
+  else if (result == nm::math::SPARSE_NOT_SYMMETRIC)
+    rb_raise(rb_eArgError, "sparse Cholesky requires a matrix with a symmetric pattern, with both triangles stored");
+  else if (result == nm::math::SPARSE_PATTERN_MISMATCH)
+    rb_raise(rb_eArgError, "matrix has entries outside the pattern of its symbolic analysis");
+  else if (result >= 0)
+    rb_raise(rb_eArgError, "matrix is not positive definite (pivot %ld)", result);
+
+  return new_yale_matrix(self, factor);
+}
+
+/*
+ * Numeric LU factorization of s with the column order from nm_yale_lu_analyze. Returns [L, U, p].
+ */
+template <typename DType>
+static VALUE lu(VALUE self, VALUE q_, VALUE tol_) {
+  const YALE_STORAGE* s   = NM_STORAGE_YALE(self);
+  const size_t        n   = s->shape[0];
+  const DType         tol = NUM2DBL(tol_);
+
+  const char*   error    = NULL;
+  long          singular = -1;
+  YALE_STORAGE *l_factor = NULL, *u_factor = NULL;
+  VALUE         p        = Qnil;
+
+  { // As for cholesky, nothing is raised while the vectors are alive.
+    std::vector<size_t> q, qinv;
+    error = permutation_from_array(q_, n, q, qinv);
+
+    if (!error) {
+      nm::math::CompressedMatrix<DType> rows, a, l, u;
+      std::vector<size_t> pinv;
+
+      compressed_rows<DType>(s, rows);
+      nm::math::sparse_transpose(rows, a);
+      std::vector<DType>().swap(rows.val);
+
+      singular = nm::math::lu<DType>(a, q, tol, l, u, pinv);
+
+      if (singular == -1) {
+        std::vector<size_t> order(n);
+        for (size_t i = 0; i < n; ++i) order[pinv[i]] = i;
+
+        l_factor = from_compressed_columns<DType>(l, s->dtype);
+        u_factor = from_compressed_columns<DType>(u, s->dtype);
+        p        = indices_to_array(order);
+      }
+    }
+  }
+
+  if (error)         rb_raise(rb_eArgError, "%s", error);
+  if (singular >= 0) rb_raise(rb_eZeroDivError, "matrix is singular: no pivot for column %ld", singular);
+
+  VALUE result = rb_ary_new2(3);
+  rb_ary_push(result, new_yale_matrix(self, l_factor));
+  rb_ary_push(result, new_yale_matrix(self, u_factor));
+  rb_ary_push(result, p);
+
+  return result;
+}
+
+/*
+ * X = Q*(L*U)**-1*P*B for a sparse factorization: row k of P*B is row p[k] of B, and row q[k] of X is row k of what the
+ * triangular solves give. U is L**T if u is NULL, and L has a unit diagonal otherwise. B is a dense matrix of L's dtype
+ * with n rows, not a reference, and X a new one of the same shape. As for cholesky, nothing is raised while the vectors
+ * are alive.
+ */
+template <typename DType>
+static VALUE factor_solve(const YALE_STORAGE* l, const YALE_STORAGE* u, const DENSE_STORAGE* b, VALUE p_, VALUE q_) {
+  NAMED_LI_DTYPE_TEMPLATE_TABLE(ttable, trsm, long, const YALE_STORAGE*, const bool, const bool, const bool, const int, const void*, void*, const int);
+
+  const size_t n = l->shape[0], cols = b->shape[1];
+  const DType  one = 1;
+
+  size_t* shape = ALLOC_N(size_t, 2);
+  shape[0] = n;
+  shape[1] = cols;
+  DENSE_STORAGE* x = nm_dense_storage_create(l->dtype, shape, 2, NULL, 0);
+  VALUE result = Data_Wrap_Struct(cNMatrix, nm_dense_storage_mark, nm_delete, nm_create(nm::DENSE_STORE, reinterpret_cast<STORAGE*>(x)));
+
+  const char* error    = NULL;
+  long        singular = -1;
+
+  {
+    std::vector<size_t> p, pinv, q, qinv;
+    error = permutation_from_array(p_, n, p, pinv);
+    if (!error) error = permutation_from_array(q_, n, q, qinv);
+
+    if (!error) {
+      const DType* be = reinterpret_cast<const DType*>(b->elements);
+      DType*       xe = reinterpret_cast<DType*>(x->elements);
+      std::vector<DType> y(n * cols);
+
+      for (size_t k = 0; k < n; ++k)
+        for (size_t c = 0; c < cols; ++c) y[k*cols + c] = be[p[k]*cols + c];
+
+      singular = ttable[l->dtype][l->itype](l, false, false, u != NULL, cols, &one, y.data(), cols);
+      if (singular == -1) {
+        if (u) singular = ttable[u->dtype][u->itype](u, true, false, false, cols, &one, y.data(), cols);
+        else   singular = ttable[l->dtype][l->itype](l, false, true, false, cols, &one, y.data(), cols);
+      }
+
+      if (singular == -1)
+        for (size_t k = 0; k < n; ++k)
+          for (size_t c = 0; c < cols; ++c) xe[q[k]*cols + c] = y[k*cols + c];
+    }
   }
-}
 
-/////////////////////////
-// Copying and Casting //
-/////////////////////////
+  if (error)         rb_raise(rb_eArgError, "%s", error);
+  if (singular >= 0) rb_raise(rb_eZeroDivError, "factor is singular: zero on the diagonal in row %ld", singular);
+
+  return result;
+}
 
 /*
- * Templated copy constructor for changing dtypes.
+ * B = alpha*T*B (or alpha*T**T*B), in place in B, which is row-major with n columns. Each row of T*B only needs the rows
+ * of B on T's side of its own, so the rows are taken from the far end of the triangle; T**T*B is scattered instead, each
+ * row of B adding its multiples to the rows it's used in before it's scaled by its diagonal. This is done on one thread.
  */
-template <typename LDType, typename RDType, typename IType>
-YALE_STORAGE* cast_copy(const YALE_STORAGE* rhs, dtype_t new_dtype) {
+template <typename DType, typename IType>
+static void trmm(const YALE_STORAGE* s, const bool upper, const bool transpose, const bool unit, const int n,
+                 const void* alpha_, void* b_, const int ldb) {
+  const DType& alpha = *reinterpret_cast<const DType*>(alpha_);
+  DType*       b     = reinterpret_cast<DType*>(b_);
+  const size_t rows  = s->shape[0];
+  const IType* ija   = reinterpret_cast<const IType*>(s->ija);
+  const DType* a     = reinterpret_cast<const DType*>(s->a);
+
+  for (size_t r = 0; r < rows; ++r) {
+    const size_t i  = upper == transpose ? rows - 1 - r : r;
+    DType*       bi = b + i*ldb;
+
+    if (!transpose && !unit)
+      for (int c = 0; c < n; ++c) bi[c] = a[i] * bi[c];
+
+    for (IType p = ija[i]; p < ija[i+1]; ++p) {
+      const size_t j = ija[p];
+      if ((upper ? j < i : j > i) || a[p] == 0) continue;
+
+      DType* bj = b + j*ldb;
+      if (transpose) for (int c = 0; c < n; ++c) bj[c] = bj[c] + a[p] * bi[c];
+      else           for (int c = 0; c < n; ++c) bi[c] = bi[c] + a[p] * bj[c];
+    }
 
-  YALE_STORAGE* lhs;
+    if (transpose && !unit)
+      for (int c = 0; c < n; ++c) bi[c] = a[i] * bi[c];
+  }
 
-  if (rhs->src != rhs) { // copy the reference
-    // Copy shape for yale construction
-    size_t* shape           = ALLOC_N(size_t, 2);
-    shape[0]                = rhs->shape[0];
-    shape[1]                = rhs->shape[1];
-    size_t ndnz             = src_ndnz(rhs);
-    if (shape[0] != rhs->src->shape[0] || shape[1] != rhs->src->shape[1])
-      ndnz                  = count_slice_copy_ndnz<RDType,IType>(rhs, rhs->offset, rhs->shape); // expensive, avoid if possible
-    size_t request_capacity = shape[0] + ndnz + 1;
-    // FIXME: Should we use a different itype? Or same?
-    lhs                     = nm_yale_storage_create(new_dtype, shape, 2, request_capacity, rhs->itype);
+  if (alpha != 1)
+    for (size_t i = 0; i < rows; ++i)
+      for (int c = 0; c < n; ++c) b[i*ldb + c] = alpha * b[i*ldb + c];
+}
 
-    // This check probably isn't necessary.
-    if (lhs->capacity < request_capacity)
-      rb_raise(nm_eStorageTypeError, "conversion failed; capacity of %ld requested, max allowable is %ld", request_capacity, lhs->capacity);
+/*
+ * An incomplete factorization with the pattern of the matrix it came from, ILU(0) or IC(0), for preconditioning the
+ * iterative solvers. f holds L below the diagonal and U on and above it; for ILU(0), L has a unit diagonal, and for
+ * IC(0), U is L**T and they share the diagonal. If the solves are big enough to be worth splitting between threads, their
+ * levels (see triangular_levels) are found once, here, so that applying the factorization allocates nothing.
+ */
+struct IncompleteFactor {
+  YALE_STORAGE* f;
+  bool          unit_lower;
+  size_t*       order[2];     // lower, then upper
+  size_t*       level_ptr[2];
+  size_t        levels[2];
+};
 
-    slice_copy<LDType, RDType, IType>(lhs, rhs, rhs->offset, rhs->shape, new_dtype);
-  } else { // regular copy
+/*
+ * ILU(0) in place, row by row (the IKJ variant): fill-in outside the pattern is dropped. pos is scratch of s->shape[0]
+ * SPARSE_NONEs, and is left that way. Returns -1, or the first row with a zero pivot.
+ */
+template <typename DType, typename IType>
+static long ilu0(YALE_STORAGE* s, std::vector<size_t>& pos) {
+  const size_t n   = s->shape[0];
+  const IType* ija = reinterpret_cast<const IType*>(s->ija);
+  DType*       a   = reinterpret_cast<DType*>(s->a);
 
-    // Allocate a new structure
-    size_t size = get_size<IType>(rhs);
-    lhs = copy_alloc_struct<IType>(rhs, new_dtype, rhs->capacity, size);
+  for (size_t i = 0; i < n; ++i) {
+    for (IType p = ija[i]; p < ija[i+1]; ++p) pos[ija[p]] = p;
 
-    LDType* la = reinterpret_cast<LDType*>(lhs->a);
-    RDType* ra = A<RDType>(rhs);
+    for (IType p = ija[i]; p < ija[i+1] && ija[p] < i; ++p) {
+      const size_t k = ija[p];
+      if (a[k] == 0) return k;
 
-    for (size_t index = 0; index < size; ++index) {
-      la[index] = ra[index];
+      a[p] = a[p] / a[k];
+
+      for (IType q = ija[k]; q < ija[k+1]; ++q) {
+        const size_t j = ija[q];
+        if (j <= k) continue;
+
+        if (j == i)                                  a[i]      = a[i] - a[p] * a[q];
+        else if (pos[j] != nm::math::SPARSE_NONE)    a[pos[j]] = a[pos[j]] - a[p] * a[q];
+      }
     }
+
+    for (IType p = ija[i]; p < ija[i+1]; ++p) pos[ija[p]] = nm::math::SPARSE_NONE;
   }
 
-  return lhs;
+  for (size_t i = 0; i < n; ++i)
+    if (a[i] == 0) return i;
+
+  return -1;
 }
 
 /*
- * Template access for getting the size of Yale storage.
+ * IC(0) in place, for a symmetric matrix with both triangles stored: L is computed row by row in the lower triangle,
+ * then copied into the upper one as L**T. pos is as for ilu0. Returns -1, the first row whose pivot isn't positive, or
+ * SPARSE_PATTERN_MISMATCH if the pattern isn't symmetric.
  */
-template <typename IType>
-static inline size_t get_size(const YALE_STORAGE* storage) {
-  return static_cast<size_t>(reinterpret_cast<IType*>(storage->ija)[ storage->shape[0] ]);
-}
+template <typename DType, typename IType>
+static long ic0(YALE_STORAGE* s, std::vector<size_t>& pos) {
+  const size_t n   = s->shape[0];
+  const IType* ija = reinterpret_cast<const IType*>(s->ija);
+  DType*       a   = reinterpret_cast<DType*>(s->a);
 
+  for (size_t i = 0; i < n; ++i) {
+    for (IType p = ija[i]; p < ija[i+1]; ++p) pos[ija[p]] = p;
 
-/*
- * Allocate for a copy or copy-cast operation, and copy the IJA portion of the
- * matrix (the structure).
- */
-template <typename IType>
-static YALE_STORAGE* copy_alloc_struct(const YALE_STORAGE* rhs, const dtype_t new_dtype, const size_t new_capacity, const size_t new_size) {
-  YALE_STORAGE* lhs = ALLOC( YALE_STORAGE );
-  lhs->dim          = rhs->dim;
-  lhs->shape        = ALLOC_N( size_t, lhs->dim );
-  lhs->offset       = ALLOC_N( size_t, lhs->dim );
-  memcpy(lhs->shape, rhs->shape, lhs->dim * sizeof(size_t));
-  //memcpy(lhs->offset, rhs->offset, lhs->dim * sizeof(size_t));
-  lhs->offset[0]    = 0;
-  lhs->offset[1]    = 0;
+    DType d = a[i];
+    for (IType p = ija[i]; p < ija[i+1] && ija[p] < i; ++p) {
+      const size_t k = ija[p];
+      DType    sum = a[p];
 
-  lhs->itype        = rhs->itype;
-  lhs->capacity     = new_capacity;
-  lhs->dtype        = new_dtype;
-  lhs->ndnz         = rhs->ndnz;
+      // Less the entries of rows i and k of L left of column k which are both in the pattern.
+      for (IType q = ija[k]; q < ija[k+1] && ija[q] < k; ++q)
+        if (pos[ija[q]] != nm::math::SPARSE_NONE) sum = sum - a[pos[ija[q]]] * a[q];
 
-  lhs->ija          = ALLOC_N( IType, lhs->capacity );
-  lhs->a            = ALLOC_N( char, DTYPE_SIZES[new_dtype] * lhs->capacity );
-  lhs->src          = lhs;
-  lhs->count        = 1;
+      a[p] = sum / a[k];
+      d    = d - a[p] * a[p];
+    }
 
-  // Now copy the contents -- but only within the boundaries set by the size. Leave
-  // the rest uninitialized.
-  if (!rhs->offset[0] && !rhs->offset[1]) {
-    for (size_t i = 0; i < get_size<IType>(rhs); ++i)
-      reinterpret_cast<IType*>(lhs->ija)[i] = reinterpret_cast<IType*>(rhs->ija)[i]; // copy indices
-  } else {
-    rb_raise(rb_eNotImpError, "cannot copy struct due to different offsets");
+    for (IType p = ija[i]; p < ija[i+1]; ++p) pos[ija[p]] = nm::math::SPARSE_NONE;
+
+    if (!(d > 0)) return i;
+    a[i] = std::sqrt(d);
   }
-  return lhs;
+
+  // Row i of L is column i of L**T. Going through the rows in order, each row k of the upper triangle is filled from the
+  // left, so pos can hold the next entry of each.
+  for (size_t k = 0; k < n; ++k) {
+    IType p = ija[k];
+    while (p < ija[k+1] && ija[p] < k) ++p;
+    pos[k] = p;
+  }
+
+  for (size_t i = 0; i < n; ++i) {
+    for (IType p = ija[i]; p < ija[i+1] && ija[p] < i; ++p) {
+      const size_t k = ija[p];
+      if (pos[k] == ija[k+1] || ija[pos[k]] != i) return nm::math::SPARSE_PATTERN_MISMATCH;
+      a[pos[k]++] = a[p];
+    }
+  }
+
+  for (size_t k = 0; k < n; ++k)
+    if (pos[k] != ija[k+1]) return nm::math::SPARSE_PATTERN_MISMATCH;
+
+  return -1;
 }
 
+/*
+ * Factorize s incompletely (see IncompleteFactor), by IC(0) if cholesky and ILU(0) otherwise.
+ */
 template <typename DType, typename IType>
-static STORAGE* matrix_multiply(const STORAGE_PAIR& casted_storage, size_t* resulting_shape, bool vector, nm::itype_t result_itype) {
-  YALE_STORAGE *left  = (YALE_STORAGE*)(casted_storage.left),
-               *right = (YALE_STORAGE*)(casted_storage.right);
-
-  // We can safely get dtype from the casted matrices; post-condition of binary_storage_cast_alloc is that dtype is the
-  // same for left and right.
-  // int8_t dtype = left->dtype;
+static void* incomplete_factor(const YALE_STORAGE* s, const bool cholesky) {
+  const size_t n = s->shape[0];
 
-  // Massage the IType arrays into the correct form.
+  YALE_STORAGE* f = reinterpret_cast<YALE_STORAGE*>(nm_yale_storage_cast_copy(s, s->dtype, NULL));
+  long result;
 
-  IType* ijl;
-  if (left->itype == result_itype) ijl = reinterpret_cast<IType*>(left->ija);
-  else {  // make a temporary copy of the IJA vector for L with the correct itype
-    size_t length = nm_yale_storage_get_size(left);
-    ijl = ALLOCA_N(IType, length);
-    copy_recast_itype_vector(reinterpret_cast<void*>(left->ija), left->itype, reinterpret_cast<void*>(ijl), result_itype, length);
+  { // pos must be gone before anything is raised, or it would leak.
+    std::vector<size_t> pos(n, nm::math::SPARSE_NONE);
+    result = cholesky ? ic0<DType,IType>(f, pos) : ilu0<DType,IType>(f, pos);
   }
 
-  IType* ijr;
-  if (right->itype == result_itype) ijr = reinterpret_cast<IType*>(right->ija);
-  else {  // make a temporary copy of the IJA vector for R with the correct itype
-    size_t length = nm_yale_storage_get_size(right);
-    ijr = ALLOCA_N(IType, length);
-    copy_recast_itype_vector(reinterpret_cast<void*>(right->ija), right->itype, reinterpret_cast<void*>(ijr), result_itype, length);
+  if (result != -1) {
+    nm_yale_storage_delete(f);
+    if (result == nm::math::SPARSE_PATTERN_MISMATCH)
+      rb_raise(rb_eArgError, "IC(0) requires a matrix with a symmetric pattern");
+    else if (cholesky)
+      rb_raise(rb_eArgError, "IC(0) broke down: pivot %ld is not positive", result);
+    else
+      rb_raise(rb_eZeroDivError, "ILU(0) broke down: zero pivot in row %ld", result);
   }
 
-  // First, count the ndnz of the result.
-  // TODO: This basically requires running symbmm twice to get the exact ndnz size. That's frustrating. Are there simple
-  // cases where we can avoid running it?
-  size_t result_ndnz = nm::math::symbmm<IType>(resulting_shape[0], left->shape[1], resulting_shape[1], ijl, ijl, true, ijr, ijr, true, NULL, true);
+  IncompleteFactor* factor = ALLOC(IncompleteFactor);
+  factor->f          = f;
+  factor->unit_lower = !cholesky;
 
-  // Create result storage.
-  YALE_STORAGE* result = nm_yale_storage_create(left->dtype, resulting_shape, 2, result_ndnz, result_itype);
-  init<DType,IType>(result, NULL);
-  IType* ija = reinterpret_cast<IType*>(result->ija);
+  const IType* ija   = reinterpret_cast<const IType*>(f->ija);
+  const double flops = (double)(ija[n] - ija[0] + n);
 
-  // Symbolic multiplication step (build the structure)
-  nm::math::symbmm<IType>(resulting_shape[0], left->shape[1], resulting_shape[1], ijl, ijl, true, ijr, ijr, true, ija, true);
+  for (int t = 0; t < 2; ++t) {
+    factor->order[t] = factor->level_ptr[t] = NULL;
+    factor->levels[t] = 0;
 
-  // Numeric multiplication step (fill in the elements)
+    if (nm::math::parallel_threads<DType>(flops) > 1) {
+      factor->order[t]     = ALLOC_N(size_t, n);
+      factor->level_ptr[t] = ALLOC_N(size_t, n + 1);
+      factor->levels[t]    = triangular_levels<IType>(f, t == 1, factor->order[t], factor->level_ptr[t]);
+    }
+  }
+
+  return factor;
+}
 
-  nm::math::numbmm<DType,IType>(result->shape[0], left->shape[1], result->shape[1],
-                                ijl, ijl, reinterpret_cast<DType*>(left->a), true,
-                                ijr, ijr, reinterpret_cast<DType*>(right->a), true,
-                                ija, ija, reinterpret_cast<DType*>(result->a), true);
+/*
+ * z = (L*U)**-1 * r for an IncompleteFactor.
+ */
+template <typename DType, typename IType>
+static void incomplete_solve(const IncompleteFactor* factor, const void* r, void* z_) {
+  const size_t n = factor->f->shape[0];
+  DType*       z = reinterpret_cast<DType*>(z_);
 
+  for (size_t i = 0; i < n; ++i) z[i] = reinterpret_cast<const DType*>(r)[i];
 
-  // Sort the columns
-  nm::math::smmp_sort_columns<DType,IType>(result->shape[0], ija, ija, reinterpret_cast<DType*>(result->a));
+  for (int t = 0; t < 2; ++t) {
+    TriangularSolveTask<DType> task = { factor->f, t == 1, t == 0 && factor->unit_lower, NULL, 1, z, 1 };
 
-  return reinterpret_cast<STORAGE*>(result);
+    if (factor->order[t]) trsm_levels<DType,IType>(task, factor->order[t], factor->level_ptr[t], factor->levels[t]);
+    else                  trsm_rows<DType,IType>(task, 0, n);
+  }
 }
 
 
@@ -1901,6 +3426,16 @@ static size_t yale_count_slice_copy_ndnz(const YALE_STORAGE* s, size_t* offset,
 }
 
 
+/*
+ * C accessor for yale_storage::gather_rows, casting the entries of r to dtype.
+ */
+static void yale_gather_rows(const YALE_STORAGE* r, nm::dtype_t dtype, size_t* ptr, size_t** cols, void** vals, void* default_val) {
+  NAMED_LRI_DTYPE_TEMPLATE_TABLE(ttable, nm::yale_storage::gather_rows, void, const YALE_STORAGE*, size_t*, size_t**, void**, void*)
+
+  ttable[dtype][r->dtype][r->itype](r, ptr, cols, vals, default_val);
+}
+
+
 /*
  * C accessor for yale_storage::get, which returns a slice of YALE_STORAGE object by copy
  *
@@ -2042,6 +3577,14 @@ static bool default_value_is_numeric_zero(const YALE_STORAGE* s) {
   return rb_funcall(default_value(s), rb_intern("=="), 1, INT2FIX(0)) == Qtrue;
 }
 
+/*
+ * C accessor for default_value_is_numeric_zero, so that callers can check before allocating anything they'd leak
+ * when the kernels raise.
+ */
+bool nm_yale_storage_default_value_is_zero(const STORAGE* s) {
+  return default_value_is_numeric_zero(reinterpret_cast<const YALE_STORAGE*>(s));
+}
+
 
 /*
  * C accessor for allocating a yale storage object for cast-copying. Copies the IJA vector, does not copy the A vector.
@@ -2077,6 +3620,162 @@ STORAGE* nm_yale_storage_copy_transposed(const STORAGE* rhs_base) {
   return (STORAGE*)lhs;
 }
 
+/*
+ * Multiply a Yale matrix's stored values, in place, by a scalar of its dtype. Only the A vector changes; the structure
+ * (IJA) stays as it is, even where a product is zero. The matrix must not be a reference.
+ */
+void nm_yale_storage_scale(STORAGE* s, const void* scalar) {
+  YALE_STORAGE* y = reinterpret_cast<YALE_STORAGE*>(s);
+  nm_math_scal(nm_yale_storage_get_size(y), scalar, y->a, 1, y->dtype);
+}
+
+/*
+ * C accessor for y = alpha*s*x + beta*y, or y = alpha*s**T*x + beta*y if transpose, where x and y are dense vectors of
+ * s's dtype with strides incx and incy. This goes straight through each row of s, without the symbolic passes of the
+ * general product or forming the transpose, on several threads if s is large enough (see NMatrix::BLAS.num_threads).
+ * s may be a reference.
+ */
+void nm_yale_storage_gemv(const STORAGE* s, const bool transpose, const void* alpha, const void* x, const int incx, const void* beta, void* y, const int incy) {
+  NAMED_LI_DTYPE_TEMPLATE_TABLE(ttable, nm::yale_storage::gemv, void, const YALE_STORAGE*, const bool, const void*, const void*, const int, const void*, void*, const int);
+
+  const YALE_STORAGE* m = reinterpret_cast<const YALE_STORAGE*>(s);
+
+  if (!default_value_is_numeric_zero(m))
+    rb_raise(rb_eNotImpError, "matrix default value must be some form of zero (not false or nil) for multiplication");
+
+  ttable[m->dtype][m->itype](m, transpose, alpha, x, incx, beta, y, incy);
+}
+
+/*
+ * C accessor for C = alpha*s*B + beta*C, or C = alpha*s**T*B + beta*C if transpose, where B and C are row-major dense
+ * matrices of s's dtype with n columns and leading dimensions ldb and ldc. s may be a reference.
+ */
+void nm_yale_storage_gemm(const STORAGE* s, const bool transpose, const int n, const void* alpha, const void* b, const int ldb, const void* beta, void* c, const int ldc) {
+  NAMED_LI_DTYPE_TEMPLATE_TABLE(ttable, nm::yale_storage::gemm, void, const YALE_STORAGE*, const bool, const int, const void*, const void*, const int, const void*, void*, const int);
+
+  const YALE_STORAGE* m = reinterpret_cast<const YALE_STORAGE*>(s);
+
+  if (!default_value_is_numeric_zero(m))
+    rb_raise(rb_eNotImpError, "matrix default value must be some form of zero (not false or nil) for multiplication");
+
+  ttable[m->dtype][m->itype](m, transpose, n, alpha, b, ldb, beta, c, ldc);
+}
+
+/*
+ * C accessor for C = alpha*A*s + beta*C, where A is a row-major dense m x s->shape[0] matrix of s's dtype with leading
+ * dimension lda, and C is row-major with leading dimension ldc. s may be a reference.
+ */
+void nm_yale_storage_dense_gemm(const void* a, const int m, const int lda, const STORAGE* s, const void* alpha, const void* beta, void* c, const int ldc) {
+  NAMED_LI_DTYPE_TEMPLATE_TABLE(ttable, nm::yale_storage::dense_gemm, void, const void*, const int, const int, const YALE_STORAGE*, const void*, const void*, void*, const int);
+
+  const YALE_STORAGE* y = reinterpret_cast<const YALE_STORAGE*>(s);
+
+  if (!default_value_is_numeric_zero(y))
+    rb_raise(rb_eNotImpError, "matrix default value must be some form of zero (not false or nil) for multiplication");
+
+  ttable[y->dtype][y->itype](a, m, lda, y, alpha, beta, c, ldc);
+}
+
+/*
+ * C accessor for solving T*X = alpha*B, or T**T*X = alpha*B if transpose, in place in B: a row-major dense matrix of s's
+ * dtype with n columns and leading dimension ldb. T is the upper or lower triangle of s, with its diagonal if unit is
+ * false and ones on it otherwise; entries on the other side of the diagonal are ignored. s must not be a reference.
+ */
+void nm_yale_storage_trsm(const STORAGE* s, const bool upper, const bool transpose, const bool unit, const int n, const void* alpha, void* b, const int ldb) {
+  NAMED_LI_DTYPE_TEMPLATE_TABLE(ttable, nm::yale_storage::trsm, long, const YALE_STORAGE*, const bool, const bool, const bool, const int, const void*, void*, const int);
+
+  const YALE_STORAGE* y = reinterpret_cast<const YALE_STORAGE*>(s);
+
+  if (y->src != y)
+    rb_raise(rb_eNotImpError, "triangular solves are not supported on Yale slices");
+  if (y->shape[0] != y->shape[1])
+    rb_raise(rb_eArgError, "triangular solve requires a square matrix");
+
+  long singular = ttable[y->dtype][y->itype](y, upper, transpose, unit, n, alpha, b, ldb);
+  if (singular >= 0) rb_raise(rb_eZeroDivError, "matrix is singular: zero on the diagonal in row %ld", singular);
+}
+
+/*
+ * C accessor for B = alpha*T*B, or alpha*T**T*B if transpose, with B and T as for nm_yale_storage_trsm. s must not be
+ * a reference.
+ */
+void nm_yale_storage_trmm(const STORAGE* s, const bool upper, const bool transpose, const bool unit, const int n, const void* alpha, void* b, const int ldb) {
+  NAMED_LI_DTYPE_TEMPLATE_TABLE(ttable, nm::yale_storage::trmm, void, const YALE_STORAGE*, const bool, const bool, const bool, const int, const void*, void*, const int);
+
+  const YALE_STORAGE* y = reinterpret_cast<const YALE_STORAGE*>(s);
+
+  if (y->src != y)
+    rb_raise(rb_eNotImpError, "triangular products are not supported on Yale slices");
+  if (y->shape[0] != y->shape[1])
+    rb_raise(rb_eArgError, "triangular product requires a square matrix");
+
+  ttable[y->dtype][y->itype](y, upper, transpose, unit, n, alpha, b, ldb);
+}
+
+/*
+ * C accessor for y = s*x, where x and y are dense vectors of s's dtype. Used as the operator of the Krylov solvers, so it
+ * skips the checks; s must not be a reference.
+ */
+void nm_yale_storage_spmv(const void* s, const void* x, void* y) {
+  NAMED_LI_DTYPE_TEMPLATE_TABLE(ttable, nm::yale_storage::spmv, void, const YALE_STORAGE*, const void*, void*);
+
+  const YALE_STORAGE* ys = reinterpret_cast<const YALE_STORAGE*>(s);
+  ttable[ys->dtype][ys->itype](ys, x, y);
+}
+
+/*
+ * C accessor for the ILU(0) factorization of s, or IC(0) if cholesky, for preconditioning. s must be a square float32
+ * or float64 matrix with a zero default, and not a reference. Raises if the factorization breaks down. The result goes
+ * to nm_yale_storage_incomplete_solve, and is freed by nm_yale_storage_incomplete_factor_delete.
+ */
+void* nm_yale_storage_incomplete_factor(const STORAGE* s, const bool cholesky) {
+  static void* (*ttable[nm::NUM_DTYPES][nm::NUM_ITYPES])(const YALE_STORAGE*, const bool) = {
+    {NULL, NULL, NULL, NULL}, {NULL, NULL, NULL, NULL}, {NULL, NULL, NULL, NULL}, {NULL, NULL, NULL, NULL},
+    {NULL, NULL, NULL, NULL},
+    {nm::yale_storage::incomplete_factor<float,uint8_t>,  nm::yale_storage::incomplete_factor<float,uint16_t>,
+     nm::yale_storage::incomplete_factor<float,uint32_t>, nm::yale_storage::incomplete_factor<float,uint64_t>},
+    {nm::yale_storage::incomplete_factor<double,uint8_t>,  nm::yale_storage::incomplete_factor<double,uint16_t>,
+     nm::yale_storage::incomplete_factor<double,uint32_t>, nm::yale_storage::incomplete_factor<double,uint64_t>},
+    {NULL, NULL, NULL, NULL}, {NULL, NULL, NULL, NULL}, {NULL, NULL, NULL, NULL}, {NULL, NULL, NULL, NULL},
+    {NULL, NULL, NULL, NULL}, {NULL, NULL, NULL, NULL}
+  };
+
+  const YALE_STORAGE* y = reinterpret_cast<const YALE_STORAGE*>(s);
+
+  if (y->src != y)
+    rb_raise(rb_eNotImpError, "incomplete factorizations are not supported on Yale slices");
+  if (y->shape[0] != y->shape[1])
+    rb_raise(rb_eArgError, "incomplete factorization requires a square matrix");
+  if (!default_value_is_numeric_zero(y))
+    rb_raise(rb_eNotImpError, "matrix default value must be some form of zero (not false or nil) for factorization");
+  if (!ttable[y->dtype][y->itype])
+    rb_raise(nm_eDataTypeError, "incomplete factorizations are only defined for float32 and float64 matrices");
+
+  return ttable[y->dtype][y->itype](y, cholesky);
+}
+
+/*
+ * C accessor for z = (L*U)**-1 * r, with a factorization from nm_yale_storage_incomplete_factor.
+ */
+void nm_yale_storage_incomplete_solve(const void* factor, const void* r, void* z) {
+  NAMED_LI_DTYPE_TEMPLATE_TABLE(ttable, nm::yale_storage::incomplete_solve, void, const nm::yale_storage::IncompleteFactor*, const void*, void*);
+
+  const nm::yale_storage::IncompleteFactor* f = reinterpret_cast<const nm::yale_storage::IncompleteFactor*>(factor);
+  ttable[f->f->dtype][f->f->itype](f, r, z);
+}
+
+void nm_yale_storage_incomplete_factor_delete(void* factor) {
+  nm::yale_storage::IncompleteFactor* f = reinterpret_cast<nm::yale_storage::IncompleteFactor*>(factor);
+
+  for (int t = 0; t < 2; ++t) {
+    if (f->order[t])     xfree(f->order[t]);
+    if (f->level_ptr[t]) xfree(f->level_ptr[t]);
+  }
+
+  nm_yale_storage_delete(f->f);
+  xfree(f);
+}
+
 /*
  * C accessor for multiplying two YALE_STORAGE matrices, which have already been casted to the same dtype.
  *
@@ -2102,6 +3801,36 @@ STORAGE* nm_yale_storage_matrix_multiply(const STORAGE_PAIR& casted_storage, siz
   return ttable[left->dtype][itype](casted_storage, resulting_shape, vector, itype);
 }
 
+/*
+ * C accessor for the product L*R masked by mask, a Yale matrix of the result's shape and any dtype: only the positions
+ * at which mask is nonzero are computed. L and R have the same dtype. None of the three may be a reference.
+ */
+STORAGE* nm_yale_storage_masked_matrix_multiply(const STORAGE_PAIR& casted_storage, const STORAGE* mask, size_t* resulting_shape) {
+  NAMED_LI_DTYPE_TEMPLATE_TABLE(ttable, nm::yale_storage::masked_matrix_multiply, STORAGE*, const STORAGE_PAIR& casted_storage, const STORAGE* mask, const char* mask_nonzero, size_t* resulting_shape, nm::itype_t resulting_itype);
+  NAMED_DTYPE_TEMPLATE_TABLE(nonzero_table, nm::yale_storage::stored_nonzero, void, const YALE_STORAGE*, char*);
+
+  YALE_STORAGE* left  = reinterpret_cast<YALE_STORAGE*>(casted_storage.left);
+  YALE_STORAGE* right = reinterpret_cast<YALE_STORAGE*>(casted_storage.right);
+  const YALE_STORAGE* m = reinterpret_cast<const YALE_STORAGE*>(mask);
+
+  if (!default_value_is_numeric_zero(left) || !default_value_is_numeric_zero(right) || !default_value_is_numeric_zero(m)) {
+    rb_raise(rb_eNotImpError, "matrix default value must be some form of zero (not false or nil) for multiplication");
+    return NULL;
+  }
+
+  nm::itype_t itype = nm_yale_storage_itype_by_shape(resulting_shape),
+              max_itype = NM_MAX_ITYPE(NM_MAX_ITYPE(left->itype, right->itype), m->itype);
+  if (static_cast<int8_t>(itype) < static_cast<int8_t>(max_itype)) itype = max_itype;
+
+  char* nonzero = ALLOC_N(char, nm_yale_storage_get_size(m));
+  nonzero_table[m->dtype](m, nonzero);
+
+  STORAGE* result = ttable[left->dtype][itype](casted_storage, mask, nonzero, resulting_shape, itype);
+
+  xfree(nonzero);
+  return result;
+}
+
 
 ///////////////
 // Lifecycle //
@@ -2169,9 +3898,7 @@ void nm_yale_storage_delete_ref(STORAGE* s) {
   if (s) {
     YALE_STORAGE* storage = (YALE_STORAGE*)s;
     nm_yale_storage_delete( reinterpret_cast<STORAGE*>(storage->src) );
-    xfree(storage->shape);
-    xfree(storage->offset);
-    xfree(s);
+    nm_storage_free_ref(s);
   }
 }
 
@@ -2620,4 +4347,157 @@ VALUE nm_yale_map_stored(VALUE self) {
   return ttable[NM_ITYPE(self)](self);
 }
 
+
+/*
+ * call-seq:
+ *     __yale_cholesky_analyze__ -> [perm, parent, colptr]
+ *
+ * Symbolic analysis for the sparse Cholesky factorization P*A*P**T = L*L**T of a symmetric Yale matrix with both
+ * triangles stored: an approximate minimum degree ordering perm (row k of P*A*P**T is row perm[k] of A), the
+ * elimination tree (the parent of each column of L, or nil for roots), and L's column pointers. It depends only on the
+ * pattern of the matrix, which must be symmetric.
+ */
+VALUE nm_yale_cholesky_analyze(VALUE self) {
+  NAMED_ITYPE_TEMPLATE_TABLE(ttable, nm::yale_storage::structure, void, const YALE_STORAGE*, std::vector<size_t>&, std::vector<size_t>&);
+
+  const YALE_STORAGE* s = NM_STORAGE_YALE(self);
+  nm::yale_storage::check_factorizable(s);
+
+  const size_t n = s->shape[0];
+  VALUE result   = Qnil;
+
+  { // The vectors must be gone before the error is raised.
+    std::vector<size_t> ptr, idx;
+    ttable[s->itype](s, ptr, idx);
+
+    if (nm::math::symmetric_pattern(n, ptr, idx)) {
+      std::vector<size_t> perm = nm::math::approximate_minimum_degree(n, ptr, idx), pinv(n);
+      for (size_t k = 0; k < n; ++k) pinv[perm[k]] = k;
+
+      std::vector<size_t> parent = nm::math::elimination_tree(n, ptr, idx, perm, pinv),
+                          colptr = nm::math::cholesky_column_pointers(n, ptr, idx, perm, pinv, parent);
+
+      result = rb_ary_new2(3);
+      rb_ary_push(result, nm::yale_storage::indices_to_array(perm));
+      rb_ary_push(result, nm::yale_storage::indices_to_array(parent));
+      rb_ary_push(result, nm::yale_storage::indices_to_array(colptr));
+    }
+  }
+
+  if (result == Qnil)
+    rb_raise(rb_eArgError, "sparse Cholesky requires a matrix with a symmetric pattern, with both triangles stored");
+
+  return result;
+}
+
+/*
+ * call-seq:
+ *     __yale_cholesky__(perm, parent, colptr) -> NMatrix
+ *
+ * Numeric sparse Cholesky factorization, given the symbolic analysis from __yale_cholesky_analyze__ of this matrix or
+ * any other with the same pattern. Returns L, lower triangular, as a Yale matrix.
+ */
+VALUE nm_yale_cholesky(VALUE self, VALUE perm, VALUE parent, VALUE colptr) {
+  static VALUE (*ttable[nm::NUM_DTYPES])(VALUE, VALUE, VALUE, VALUE) = {
+    NULL, NULL, NULL, NULL, NULL, // no square roots of integers
+    nm::yale_storage::cholesky<float>,
+    nm::yale_storage::cholesky<double>,
+    NULL, NULL, NULL, NULL, NULL, NULL
+  };
+
+  const YALE_STORAGE* s = NM_STORAGE_YALE(self);
+  nm::yale_storage::check_factorizable(s);
+
+  if (!ttable[s->dtype])
+    rb_raise(nm_eDataTypeError, "sparse factorizations are only defined for float32 and float64 matrices");
+
+  return ttable[s->dtype](self, perm, parent, colptr);
+}
+
+/*
+ * call-seq:
+ *     __yale_lu_analyze__ -> q
+ *
+ * Symbolic analysis for the sparse LU factorization P*A*Q = L*U of a Yale matrix: an approximate minimum degree
+ * ordering of the pattern of A+A**T, which becomes the column order q (column k of A*Q is column q[k] of A). The row
+ * order P isn't known until the pivots are chosen.
+ */
+VALUE nm_yale_lu_analyze(VALUE self) {
+  NAMED_ITYPE_TEMPLATE_TABLE(ttable, nm::yale_storage::structure, void, const YALE_STORAGE*, std::vector<size_t>&, std::vector<size_t>&);
+
+  const YALE_STORAGE* s = NM_STORAGE_YALE(self);
+  nm::yale_storage::check_factorizable(s);
+
+  std::vector<size_t> ptr, idx;
+  ttable[s->itype](s, ptr, idx);
+
+  return nm::yale_storage::indices_to_array(nm::math::approximate_minimum_degree(s->shape[0], ptr, idx));
+}
+
+/*
+ * call-seq:
+ *     __yale_lu__(q, tol) -> [L, U, p]
+ *
+ * Numeric sparse LU factorization with partial pivoting, P*A*Q = L*U, given the column order from __yale_lu_analyze__.
+ * The pivot in each column is the largest entry, except that the diagonal is kept if it's at least tol times as large.
+ * L (with a unit diagonal) and U come back as Yale matrices, and p is the row order: row k of P*A is row p[k] of A.
+ */
+VALUE nm_yale_lu(VALUE self, VALUE q, VALUE tol) {
+  static VALUE (*ttable[nm::NUM_DTYPES])(VALUE, VALUE, VALUE) = {
+    NULL, NULL, NULL, NULL, NULL, // integers not allowed due to division
+    nm::yale_storage::lu<float>,
+    nm::yale_storage::lu<double>,
+    NULL, NULL, NULL, NULL, NULL, NULL
+  };
+
+  const YALE_STORAGE* s = NM_STORAGE_YALE(self);
+  nm::yale_storage::check_factorizable(s);
+
+  if (!ttable[s->dtype])
+    rb_raise(nm_eDataTypeError, "sparse factorizations are only defined for float32 and float64 matrices");
+
+  return ttable[s->dtype](self, q, tol);
+}
+
+/*
+ * call-seq:
+ *     NMatrix.__yale_factor_solve__(l, u, b, p, q) -> NMatrix
+ *
+ * Solve A*X = B with a sparse factorization P*A*Q = L*U, or P*A*P**T = L*L**T if u is nil, in which case q is p's
+ * order too. L (unit lower triangular, unless u is nil) and U are Yale matrices from __yale_lu__ or __yale_cholesky__,
+ * and B is a dense matrix of their dtype; row k of P*B is row p[k] of B, and column k of A*Q is column q[k] of A. The
+ * rows are permuted as the solves are done, and X comes back as a new dense matrix.
+ */
+VALUE nm_yale_factor_solve(VALUE klass, VALUE l, VALUE u, VALUE b, VALUE p, VALUE q) {
+  static VALUE (*ttable[nm::NUM_DTYPES])(const YALE_STORAGE*, const YALE_STORAGE*, const DENSE_STORAGE*, VALUE, VALUE) = {
+    NULL, NULL, NULL, NULL, NULL, // integers not allowed due to division
+    nm::yale_storage::factor_solve<float>,
+    nm::yale_storage::factor_solve<double>,
+    NULL, NULL, NULL, NULL, NULL, NULL
+  };
+
+  CheckNMatrixType(l);
+  CheckNMatrixType(b);
+  if (u != Qnil) CheckNMatrixType(u);
+
+  if (NM_STYPE(l) != nm::YALE_STORE || (u != Qnil && NM_STYPE(u) != nm::YALE_STORE) || NM_STYPE(b) != nm::DENSE_STORE)
+    rb_raise(nm_eStorageTypeError, "expected Yale factors and a dense right-hand side");
+
+  const YALE_STORAGE*  ls = NM_STORAGE_YALE(l);
+  const YALE_STORAGE*  us = u == Qnil ? NULL : NM_STORAGE_YALE(u);
+  const DENSE_STORAGE* bs = NM_STORAGE_DENSE(b);
+
+  if (ls->src != ls || (us && us->src != us) || bs->src != reinterpret_cast<const STORAGE*>(bs))
+    rb_raise(rb_eNotImpError, "sparse solves are not supported on slices");
+  if (ls->shape[0] != ls->shape[1] || (us && (us->shape[0] != ls->shape[0] || us->shape[1] != ls->shape[0])) ||
+      bs->dim != 2 || bs->shape[0] != ls->shape[0])
+    rb_raise(rb_eArgError, "incompatible dimensions");
+  if ((us && us->dtype != ls->dtype) || bs->dtype != ls->dtype)
+    rb_raise(nm_eDataTypeError, "factors and right-hand side must have the same dtype");
+  if (!ttable[ls->dtype])
+    rb_raise(nm_eDataTypeError, "sparse factorizations are only defined for float32 and float64 matrices");
+
+  return ttable[ls->dtype](ls, us, bs, p, q);
+}
+
 } // end of extern "C" block
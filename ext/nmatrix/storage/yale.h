@@ -114,12 +114,24 @@ extern "C" {
   ///////////
 
   bool nm_yale_storage_eqeq(const STORAGE* left, const STORAGE* right);
+  bool nm_yale_storage_default_value_is_zero(const STORAGE* s);
 
   //////////
   // Math //
   //////////
 
   STORAGE* nm_yale_storage_matrix_multiply(const STORAGE_PAIR& casted_storage, size_t* resulting_shape, bool vector);
+  STORAGE* nm_yale_storage_masked_matrix_multiply(const STORAGE_PAIR& casted_storage, const STORAGE* mask, size_t* resulting_shape);
+  void     nm_yale_storage_gemv(const STORAGE* s, const bool transpose, const void* alpha, const void* x, const int incx, const void* beta, void* y, const int incy);
+  void     nm_yale_storage_gemm(const STORAGE* s, const bool transpose, const int n, const void* alpha, const void* b, const int ldb, const void* beta, void* c, const int ldc);
+  void     nm_yale_storage_dense_gemm(const void* a, const int m, const int lda, const STORAGE* s, const void* alpha, const void* beta, void* c, const int ldc);
+  void     nm_yale_storage_trsm(const STORAGE* s, const bool upper, const bool transpose, const bool unit, const int n, const void* alpha, void* b, const int ldb);
+  void     nm_yale_storage_trmm(const STORAGE* s, const bool upper, const bool transpose, const bool unit, const int n, const void* alpha, void* b, const int ldb);
+  void     nm_yale_storage_spmv(const void* s, const void* x, void* y);
+  void*    nm_yale_storage_incomplete_factor(const STORAGE* s, const bool cholesky);
+  void     nm_yale_storage_incomplete_solve(const void* factor, const void* r, void* z);
+  void     nm_yale_storage_incomplete_factor_delete(void* factor);
+  void     nm_yale_storage_scale(STORAGE* s, const void* scalar);
 
   /////////////
   // Utility //
@@ -173,6 +185,12 @@ extern "C" {
 
   VALUE nm_vector_set(int argc, VALUE* argv, VALUE self);
 
+  VALUE nm_yale_cholesky_analyze(VALUE self);
+  VALUE nm_yale_cholesky(VALUE self, VALUE perm, VALUE parent, VALUE colptr);
+  VALUE nm_yale_lu_analyze(VALUE self);
+  VALUE nm_yale_lu(VALUE self, VALUE q, VALUE tol);
+  VALUE nm_yale_factor_solve(VALUE klass, VALUE l, VALUE u, VALUE b, VALUE p, VALUE q);
+
 
 } // end of extern "C" block
 
@@ -305,7 +305,6 @@ bool node_is_within_slice(NODE* n, size_t coord, size_t len) {
  * FIXME: we can remove directly instead of calling remove() and doing the search over again.
  */
 bool remove_recursive(LIST* list, const size_t* coords, const size_t* offsets, const size_t* lengths, size_t r, const size_t& dim) {
-  std::cerr << "remove_recursive: " << r << std::endl;
   // find the current coordinates in the list
   NODE* prev    = find_preceding_from_list(list, coords[r] + offsets[r]);
   NODE* n;
@@ -319,7 +318,6 @@ bool remove_recursive(LIST* list, const size_t* coords, const size_t* offsets, c
       bool remove_parent = remove_recursive(reinterpret_cast<LIST*>(n->val), coords, offsets, lengths, r+1, dim);
 
       if (remove_parent) { // now empty -- so remove the sub-list
-        std::cerr << r << ": removing parent list at " << n->key << std::endl;
         xfree(remove_by_node(list, prev, n));
 
         if (prev) n  = prev->next && node_is_within_slice(prev->next, coords[r] + offsets[r], lengths[r]) ? prev->next : NULL;
@@ -338,7 +336,6 @@ bool remove_recursive(LIST* list, const size_t* coords, const size_t* offsets, c
   } else { // nodes here are not lists, but actual values
 
     while (n) {
-      std::cerr << r << ": removing node at " << n->key << std::endl;
       xfree(remove_by_node(list, prev, n));
 
       if (prev) n  = prev->next && node_is_within_slice(prev->next, coords[r] + offsets[r], lengths[r]) ? prev->next : NULL;
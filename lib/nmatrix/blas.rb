@@ -39,8 +39,13 @@ module NMatrix::BLAS
     #   C = (alpha * A * B) + (beta * C)
     # where +alpha+ and +beta+ are scalar values.
     #
+    # A may be a Yale matrix, whose rows are split between threads by their
+    # number of stored entries (see num_threads). A transposed Yale matrix is
+    # read in place, with the columns of B split between threads instead.
+    # B must then be k x n and C m x n, and either may be a slice.
+    #
     # * *Arguments* :
-    #   - +a+ -> Matrix A.
+    #   - +a+ -> Matrix A (dense or Yale).
     #   - +b+ -> Matrix B.
     #   - +c+ -> Matrix C.
     #   - +alpha+ -> A scalar value that multiplies A * B.
@@ -61,9 +66,10 @@ module NMatrix::BLAS
     #   - +ArgumentError+ -> The dtype of the matrices must be equal.
     #
     def gemm(a, b, c = nil, alpha = 1.0, beta = 0.0, transpose_a = false, transpose_b = false, m = nil, n = nil, k = nil, lda = nil, ldb = nil, ldc = nil)
-      raise(ArgumentError, 'Expected dense NMatrices as first two arguments.') unless a.is_a?(NMatrix) and b.is_a?(NMatrix) and a.stype == :dense and b.stype == :dense
+      raise(ArgumentError, 'Expected a dense or Yale NMatrix and a dense NMatrix as first two arguments.') unless a.is_a?(NMatrix) and b.is_a?(NMatrix) and (a.stype == :dense or a.stype == :yale) and b.stype == :dense
       raise(ArgumentError, 'Expected nil or dense NMatrix as third argument.') unless c.nil? or (c.is_a?(NMatrix) and c.stype == :dense)
       raise(ArgumentError, 'NMatrix dtype mismatch.')													 unless a.dtype == b.dtype and (c ? a.dtype == c.dtype : true)
+      raise(ArgumentError, 'B cannot be transposed when A is a Yale matrix.') if a.stype == :yale and transpose_b
 
       # First, set m, n, and k, which depend on whether we're taking the
       # transpose of a and b.
@@ -88,6 +94,11 @@ module NMatrix::BLAS
         c		= NMatrix.new([m, n], a.dtype)
       end
 
+      if a.stype == :yale
+        raise(ArgumentError, 'Expected B to be k x n.') unless b.shape == [k, n]
+        raise(ArgumentError, 'Expected C to be m x n.') unless c.shape == [m, n]
+      end
+
       # I think these are independent of whether or not a transpose occurs.
       lda ||= a.shape[1]
       ldb ||= b.shape[1]
@@ -115,8 +126,13 @@ module NMatrix::BLAS
     #   y = (alpha * A * x) + (beta * y)
     # where +alpha+ and +beta+ are scalar values.
     #
+    # A may be a Yale matrix, which is multiplied in place without the general
+    # sparse product, transposed or not; pass +y+ to reuse an output vector
+    # between calls. +x+ and +y+ may then be slices, but must be vectors with
+    # as many elements as op(A) has columns and rows.
+    #
     # * *Arguments* :
-    #   - +a+ -> Matrix A.
+    #   - +a+ -> Matrix A (dense or Yale).
     #   - +x+ -> Vector x.
     #   - +y+ -> Vector y.
     #   - +alpha+ -> A scalar value that multiplies A * x.
@@ -133,7 +149,7 @@ module NMatrix::BLAS
     #   - ++ ->
     #
     def gemv(a, x, y = nil, alpha = 1.0, beta = 0.0, transpose_a = false, m = nil, n = nil, lda = nil, incx = nil, incy = nil)
-      raise(ArgumentError, 'Expected dense NMatrices as first two arguments.') unless a.is_a?(NMatrix) and x.is_a?(NMatrix) and a.stype == :dense and x.stype == :dense
+      raise(ArgumentError, 'Expected a dense or Yale NMatrix and a dense NMatrix as first two arguments.') unless a.is_a?(NMatrix) and x.is_a?(NMatrix) and (a.stype == :dense or a.stype == :yale) and x.stype == :dense
       raise(ArgumentError, 'Expected nil or dense NMatrix as third argument.') unless y.nil? or (y.is_a?(NMatrix) and y.stype == :dense)
       raise(ArgumentError, 'NMatrix dtype mismatch.')													 unless a.dtype == x.dtype and (y ? a.dtype == y.dtype : true)
 
@@ -150,13 +166,58 @@ module NMatrix::BLAS
         beta  = Complex(0.0, 0.0) if beta  == 0.0
       end
 
-      y ||= NMatrix.new([m, n], a.dtype)
+      y ||= a.stype == :yale ? NMatrix.new([m, 1], 0, a.dtype) : NMatrix.new([m, n], a.dtype)
+
+      if a.stype == :yale
+        raise(ArgumentError, 'Expected x to be a vector with n elements, incx apart.') unless x.shape.include?(1) and (n - 1) * incx < x.size
+        raise(ArgumentError, 'Expected y to be a vector with m elements, incy apart.') unless y.shape.include?(1) and (m - 1) * incy < y.size
+      end
 
       ::NMatrix::BLAS.cblas_gemv(transpose_a, m, n, alpha, a, lda, x, incx, beta, y, incy)
 
       return y
     end
 
+    #
+    # call-seq:
+    #     trsm(a, b) -> NMatrix
+    #     trsm(a, b, uplo, transpose_a, diag, alpha) -> NMatrix
+    #
+    # Solves the triangular system
+    #   op(A) * X = alpha * B
+    # in place, overwriting B (which may have several columns) with X.
+    #
+    # A may be a Yale matrix, in which case only its +uplo+ triangle is read,
+    # so an incomplete factorization holding both triangles can be used as it
+    # is. Rows which don't depend on each other are solved in parallel (see
+    # num_threads).
+    #
+    # * *Arguments* :
+    #   - +a+ -> Matrix A (dense or Yale), square.
+    #   - +b+ -> Matrix B, dense, with as many rows as A.
+    #   - +uplo+ -> :lower or :upper.
+    #   - +transpose_a+ -> false or :transpose.
+    #   - +diag+ -> :nonunit, or :unit to take the diagonal of A as ones.
+    #   - +alpha+ -> A scalar value that multiplies B.
+    # * *Returns* :
+    #   - B, holding X.
+    # * *Raises* :
+    #   - +ArgumentError+ -> +a+ and +b+ must be dense or Yale, and dense.
+    #   - +ZeroDivisionError+ -> A Yale +a+ has a zero on its diagonal.
+    #
+    def trsm(a, b, uplo = :lower, transpose_a = false, diag = :nonunit, alpha = 1.0)
+      raise(ArgumentError, 'Expected a dense or Yale NMatrix and a dense NMatrix as first two arguments.') unless a.is_a?(NMatrix) and b.is_a?(NMatrix) and (a.stype == :dense or a.stype == :yale) and b.stype == :dense
+      raise(ArgumentError, 'NMatrix dtype mismatch.') unless a.dtype == b.dtype
+      raise(ArgumentError, 'Expected a square A with as many rows as B.') unless a.shape[0] == a.shape[1] and a.shape[0] == b.shape[0]
+
+      # NM_COMPLEX64 and NM_COMPLEX128 both require complex alpha.
+      alpha = Complex(1.0, 0.0) if (a.dtype == :complex64 or a.dtype == :complex128) and alpha == 1.0
+
+      ::NMatrix::BLAS.cblas_trsm(:row, :left, uplo, transpose_a, diag, b.shape[0], b.shape[1], alpha, a, a.shape[1], b, b.shape[1])
+
+      return b
+    end
+
     #
     # call-seq:
     #     rot(x, y, c, s) -> [NVector, NVector]
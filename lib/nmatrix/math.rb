@@ -75,21 +75,28 @@ class NMatrix
   #   - +StorageTypeError+ -> ATLAS functions only work on dense matrices.
   #
   def getrf!
-    raise(StorageTypeError, "ATLAS functions only work on dense matrices") unless self.stype == :dense
+    raise(StorageTypeError, "ATLAS functions only work on dense matrices (use factorize_lu on Yale matrices)") unless self.stype == :dense
     NMatrix::LAPACK::clapack_getrf(:row, self.shape[0], self.shape[1], self, self.shape[1])
   end
 
   #
   # call-seq:
   #     factorize_lu -> ...
+  #     factorize_lu(analysis = nil) -> NMatrix::SparseLU
   #
   # LU factorization of a matrix.
   #
+  # A Yale matrix is factorized without densifying it, as P*A*Q = L*U, by left-looking LU with partial pivoting; see
+  # NMatrix::SparseLU. +analysis+ is the result of analyze_lu, on this matrix or any other with the same pattern; if it's
+  # not given, the matrix is analysed first.
+  #
   # FIXME: For some reason, getrf seems to require that the matrix be transposed first -- and then you have to transpose the
   # FIXME: result again. Ideally, this would be an in-place factorize instead, and would be called nm_factorize_lu_bang.
   #
-  def factorize_lu
-    raise(NotImplementedError, "only implemented for dense storage") unless self.stype == :dense
+  def factorize_lu(analysis = nil)
+    return __sparse_lu__(analysis) if self.stype == :yale
+
+    raise(NotImplementedError, "only implemented for dense and Yale storage") unless self.stype == :dense
     raise(NotImplementedError, "matrix is not 2-dimensional") unless self.dimensions == 2
 
     t = self.transpose
@@ -97,6 +104,94 @@ class NMatrix
     t.transpose
   end
 
+  #
+  # call-seq:
+  #     analyze_lu -> NMatrix::SparseAnalysis
+  #
+  # Symbolic analysis for factorize_lu of a square Yale matrix: an approximate minimum degree ordering of the pattern
+  # of A+A**T, used as the column order to keep down fill-in. It depends only on where the nonzeros are, so it can be
+  # reused for any matrix with the same pattern.
+  #
+  def analyze_lu
+    __sparse_factorizable__
+    NMatrix::SparseAnalysis.new(:lu, self.shape, __yale_lu_analyze__)
+  end
+
+  #
+  # call-seq:
+  #     analyze_cholesky -> NMatrix::SparseAnalysis
+  #
+  # Symbolic analysis for factorize_cholesky of a symmetric Yale matrix (with both triangles stored): an approximate
+  # minimum degree ordering, the elimination tree, and the number of entries in each column of the factor. It depends
+  # only on where the nonzeros are, so it can be reused for any matrix with the same pattern -- e.g., a stiffness matrix
+  # reassembled with new coefficients. Raises ArgumentError if the pattern isn't symmetric.
+  #
+  def analyze_cholesky
+    __sparse_factorizable__
+    NMatrix::SparseAnalysis.new(:cholesky, self.shape, *__yale_cholesky_analyze__)
+  end
+
+  #
+  # call-seq:
+  #     factorize_cholesky(analysis = nil) -> NMatrix::SparseCholesky
+  #
+  # Sparse Cholesky factorization P*A*P**T = L*L**T of a symmetric positive definite Yale matrix, computed one row of L at
+  # a time. +analysis+ is the result of analyze_cholesky, on this matrix or any other with the same pattern; if it's not
+  # given, the matrix is analysed first.
+  #
+  # Only float32 and float64 matrices can be factorized.
+  #
+  # * *Raises* :
+  #   - +ArgumentError+ -> The matrix isn't positive definite, or has entries the analysis doesn't allow for.
+  #
+  def factorize_cholesky(analysis = nil)
+    analysis ||= analyze_cholesky
+    __check_sparse_analysis__(analysis, :cholesky)
+    NMatrix::SparseCholesky.new(__yale_cholesky__(analysis.order, analysis.parent, analysis.colptr), analysis)
+  end
+
+  #
+  # call-seq:
+  #     solve_iterative(b, opts = {}) -> [x, residuals]
+  #
+  # Solve A*x = b for a square dense or Yale matrix A and a column vector b by a preconditioned Krylov method, without
+  # factorizing A. Returns x and the residual history: the norm of b - A*x relative to that of b, before the first
+  # iteration and after each one. The solve converged if the last of them is at most +tol+.
+  #
+  # All the work vectors are allocated before the first iteration, so memory use doesn't grow with the number of
+  # iterations beyond the history itself.
+  #
+  # Only float32 and float64 matrices can be solved.
+  #
+  # * *Arguments* :
+  #   - +b+ -> The right-hand side, an [n,1] matrix.
+  #   - +opts+ -> Options:
+  #     - +:method+ -> +:cg+ (conjugate gradients, for symmetric positive definite A; the default), +:bicgstab+, or
+  #       +:gmres+ (restarted GMRES).
+  #     - +:preconditioner+ -> +nil+ (the default), +:jacobi+, or, for Yale matrices, +:ilu0+ or +:ic0+ (incomplete LU or
+  #       Cholesky, with A's own pattern; IC(0) needs a symmetric matrix with both triangles stored).
+  #     - +:tol+ -> Relative residual norm to stop at. Defaults to 1e-8.
+  #     - +:max_iter+ -> Most iterations to do. Defaults to n.
+  #     - +:restart+ -> Iterations between GMRES restarts. Defaults to 30.
+  #     - +:x0+ -> Initial guess. Defaults to zero.
+  # * *Raises* :
+  #   - +ArgumentError+ -> IC(0) broke down, or the matrix's pattern isn't symmetric.
+  #   - +ZeroDivisionError+ -> ILU(0) met a zero pivot, or Jacobi a zero on the diagonal.
+  #
+  def solve_iterative(b, opts = {})
+    opts = {method: :cg, preconditioner: nil, tol: 1e-8, max_iter: nil, restart: 30, x0: nil}.merge(opts)
+
+    raise(ArgumentError, "iterative solvers require a square matrix") unless self.dim == 2 and self.shape[0] == self.shape[1]
+    n = self.shape[0]
+
+    a = self.is_ref? ? self.cast(self.stype, self.dtype) : self
+    x = opts[:x0] ? opts[:x0].cast(:dense, self.dtype) : NMatrix.new([n,1], 0, self.dtype)
+
+    residuals = a.__krylov__(b.cast(:dense, self.dtype), x, opts[:method], opts[:preconditioner], opts[:tol].to_f,
+                             opts[:max_iter] || n, opts[:restart])
+    [x, residuals]
+  end
+
   def alloc_svd_result
     [
       NMatrix.new(:dense, self.shape[0], self.dtype),
@@ -412,7 +507,226 @@ class NMatrix
   alias :permute_columns  :laswp
   alias :permute_columns! :laswp!
 
+  # Dtypes for which BLAS.gemm can write into a recycled intermediate in multi_dot.
+  MULTI_DOT_REUSABLE_DTYPES = [:float32, :float64, :complex64, :complex128]
+
+  class << self
+    #
+    # call-seq:
+    #     multi_dot(matrices) -> NMatrix
+    #
+    # Multiply a chain of matrices A*B*...*Z in the order which needs the fewest
+    # operations (see multi_dot_order). This can be far cheaper than going left to
+    # right: with A and B 1000x1000 and x 1000x1, A.dot(B).dot(x) takes 10^9
+    # multiplications, but A.dot(B.dot(x)) only 2*10^6.
+    #
+    # Dense intermediate products are recycled as the output of later products of
+    # the same shape and dtype once they're no longer needed.
+    #
+    # * *Arguments* :
+    #   - +matrices+ -> An Array of matrices, each with as many rows as the one before it has columns.
+    # * *Returns* :
+    #   - The product of the matrices.
+    # * *Raises* :
+    #   - +ArgumentError+ -> The chain is empty or the shapes are incompatible.
+    #
+    def multi_dot(matrices)
+      order = multi_dot_order(matrices)
+      __multi_dot__(matrices, order, Hash.new { |h,k| h[k] = [] })
+    end
+
+    #
+    # call-seq:
+    #     multi_dot_order(matrices) -> Integer or Array
+    #
+    # Find the cheapest parenthesisation of a matrix chain by dynamic programming,
+    # counting multiplications and, to break ties, the elements stored in the
+    # intermediate products. A Yale operand costs in proportion to its density.
+    # Yale times dense (or dense times Yale) gives a dense result. Yale times Yale
+    # gives a Yale result, whose density is estimated assuming the nonzeros are
+    # spread uniformly. Any other product is done densely.
+    #
+    # The result is nested pairs of indices into +matrices+, e.g. [0, [1, 2]] for
+    # A*(B*C), or just 0 when there's only one matrix.
+    #
+    # * *Arguments* :
+    #   - +matrices+ -> An Array of matrices, each with as many rows as the one before it has columns.
+    # * *Raises* :
+    #   - +ArgumentError+ -> The chain is empty or the shapes are incompatible.
+    #
+    def multi_dot_order(matrices)
+      raise(ArgumentError, "expected a non-empty array of matrices") unless matrices.is_a?(Array) and !matrices.empty?
+      matrices.each do |m|
+        raise(ArgumentError, "expected two-dimensional matrices") unless m.is_a?(NMatrix) and m.dim == 2
+      end
+      matrices.each_cons(2) do |l,r|
+        raise(ArgumentError, "incompatible dimensions #{l.shape.inspect} and #{r.shape.inspect}") unless l.shape[1] == r.shape[0]
+      end
+
+      n       = matrices.size
+      cost    = Array.new(n) { Array.new(n) } # [multiplications, intermediate elements] for each subchain
+      split   = Array.new(n) { Array.new(n) }
+      density = Array.new(n) { Array.new(n) }
+      sparse  = Array.new(n) { Array.new(n) }
+
+      matrices.each_with_index do |m,i|
+        cost[i][i]    = [0, 0]
+        sparse[i][i]  = m.stype == :yale
+        density[i][i] = sparse[i][i] ? __yale_density__(m) : 1.0
+      end
+
+      (1...n).each do |len|
+        (0...n-len).each do |i|
+          j    = i + len
+          rows = matrices[i].shape[0]
+          cols = matrices[j].shape[1]
+
+          (i...j).each do |s|
+            inner = matrices[s].shape[1]
+            both  = sparse[i][s] && sparse[s+1][j]
+            mults = rows * inner * cols * density[i][s] * density[s+1][j]
+
+            if both
+              d     = 1.0 - (1.0 - density[i][s] * density[s+1][j])**inner
+              elems = 2 * rows * cols * d + rows  # a and ja, plus ia
+            else
+              d     = 1.0
+              elems = rows * cols
+            end
+
+            c = [cost[i][s][0] + cost[s+1][j][0] + mults, cost[i][s][1] + cost[s+1][j][1] + elems]
+
+            if cost[i][j].nil? or (c <=> cost[i][j]) < 0
+              cost[i][j], split[i][j], density[i][j], sparse[i][j] = c, s, d, both
+            end
+          end
+        end
+      end
+
+      __multi_dot_order__(split, 0, n-1)
+    end
+
+  protected
+
+    def __multi_dot_order__(split, i, j)
+      return i if i == j
+      [__multi_dot_order__(split, i, split[i][j]), __multi_dot_order__(split, split[i][j]+1, j)]
+    end
+
+    def __yale_density__(m)
+      size = m.shape[0] * m.shape[1]
+      return 1.0 if size == 0
+      m.extend(NMatrix::YaleFunctions) unless m.is_a?(NMatrix::YaleFunctions)
+      [m.yale_size.to_f / size, 1.0].min
+    end
+
+    # Evaluate one node of the order from multi_dot_order. +pool+ holds the dense
+    # intermediates which have already been consumed, by shape and dtype.
+    def __multi_dot__(matrices, order, pool)
+      return matrices[order] if order.is_a?(Integer)
+
+      l = __multi_dot__(matrices, order[0], pool)
+      r = __multi_dot__(matrices, order[1], pool)
+
+      product =
+        if l.stype == :yale or r.stype == :yale
+          l = l.cast(:dense, l.dtype) if l.stype == :list
+          r = r.cast(:dense, r.dtype) if r.stype == :list
+          l.dot(r)
+        else
+          l = l.cast(:dense, l.dtype) unless l.stype == :dense
+          r = r.cast(:dense, r.dtype) unless r.stype == :dense
+
+          buffer = pool[[[l.shape[0], r.shape[1]], l.dtype]].pop if l.dtype == r.dtype and
+            MULTI_DOT_REUSABLE_DTYPES.include?(l.dtype) and !l.is_ref? and !r.is_ref?
+          buffer ? NMatrix::BLAS.gemm(l, r, buffer) : l.dot(r)
+        end
+
+      # Only now are the operands dead, so they can't be handed back as their own product's output.
+      [[order[0], l], [order[1], r]].each do |o, m|
+        pool[[m.shape, m.dtype]] << m if o.is_a?(Array) and m.stype == :dense
+      end
+
+      product
+    end
+  end
+
+  #
+  # The symbolic analysis of a sparse matrix, from analyze_cholesky or analyze_lu, which can be passed to any number of
+  # factorizations of matrices with the same pattern. +order+ is the fill-reducing ordering: the symmetric permutation
+  # for Cholesky, and the column order for LU. A Cholesky analysis also has the elimination tree (+parent+) and the
+  # column pointers of the factor (+colptr+).
+  #
+  SparseAnalysis = Struct.new(:type, :shape, :order, :parent, :colptr)
+
+  #
+  # A sparse Cholesky factorization P*A*P**T = L*L**T, from factorize_cholesky. +l+ is a lower triangular Yale matrix,
+  # and row k of P*A*P**T is row analysis.order[k] of A.
+  #
+  class SparseCholesky
+    attr_reader :l, :analysis
+
+    def initialize(l, analysis)
+      @l, @analysis = l, analysis
+    end
+
+    #
+    # call-seq:
+    #     solve(b) -> NMatrix
+    #
+    # Solve A*X = B by two sparse triangular solves, for a dense B with as many rows as A.
+    #
+    def solve(b)
+      NMatrix.__yale_factor_solve__(@l, nil, b.cast(:dense, @l.dtype), @analysis.order, @analysis.order)
+    end
+  end
+
+  #
+  # A sparse LU factorization P*A*Q = L*U, from factorize_lu. +l+ (with a unit diagonal) and +u+ are triangular Yale
+  # matrices; row k of P*A is row p[k] of A, and column k of A*Q is column q[k] of A.
+  #
+  class SparseLU
+    attr_reader :l, :u, :p, :analysis
+
+    def initialize(l, u, p, analysis)
+      @l, @u, @p, @analysis = l, u, p, analysis
+    end
+
+    def q
+      @analysis.order
+    end
+
+    #
+    # call-seq:
+    #     solve(b) -> NMatrix
+    #
+    # Solve A*X = B by two sparse triangular solves, for a dense B with as many rows as A.
+    #
+    def solve(b)
+      NMatrix.__yale_factor_solve__(@l, @u, b.cast(:dense, @l.dtype), @p, q)
+    end
+  end
+
 protected
+
+  def __sparse_factorizable__
+    raise(NotImplementedError, "sparse factorizations are only implemented for Yale storage") unless self.stype == :yale
+    raise(ArgumentError, "sparse factorizations require a square matrix") unless self.dim == 2 and self.shape[0] == self.shape[1]
+  end
+
+  def __check_sparse_analysis__(analysis, type)
+    __sparse_factorizable__
+    raise(ArgumentError, "expected a #{type} analysis") unless analysis.is_a?(NMatrix::SparseAnalysis) and analysis.type == type
+    raise(ArgumentError, "analysis is for a matrix of shape #{analysis.shape.inspect}") unless analysis.shape == self.shape
+  end
+
+  def __sparse_lu__(analysis)
+    analysis ||= analyze_lu
+    __check_sparse_analysis__(analysis, :lu)
+    l, u, p = __yale_lu__(analysis.order, 1.0)
+    NMatrix::SparseLU.new(l, u, p, analysis)
+  end
+
   # Define the element-wise operations for lists. Note that the __list_map_merged_stored__ iterator returns a Ruby Object
   # matrix, which we then cast back to the appropriate type. If you don't want that, you can redefine these functions in
   # your own code.
@@ -173,4 +173,43 @@ describe NMatrix::BLAS do
 
     end
   end
+
+  it "gives the same native matrix product whatever the number of threads" do
+    threads = NMatrix::BLAS.num_threads
+    threads.should be >= 1
+
+    a = NMatrix.new([150,140], (0...150*140).map { |i| i % 7 - 3 }, :int32)
+    b = NMatrix.new([140,130], (0...140*130).map { |i| i % 5 - 2 }, :int32)
+
+    begin
+      NMatrix::BLAS.num_threads = 1
+      serial = a.dot(b)
+      NMatrix::BLAS.num_threads = 4
+      a.dot(b).should == serial
+    ensure
+      NMatrix::BLAS.num_threads = threads
+    end
+
+    expect { NMatrix::BLAS.num_threads = 0 }.to raise_error(ArgumentError)
+  end
+
+  it "gives the same integer and rational products with and without Strassen" do
+    cutoff = NMatrix::BLAS.strassen_cutoff
+
+    [:int32, :int64, :rational64].each do |dtype|
+      a = NMatrix.new([37,41], (0...37*41).map { |i| i % 11 - 5 }, dtype)
+      b = NMatrix.new([41,35], (0...41*35).map { |i| i % 13 - 6 }, dtype)
+
+      begin
+        NMatrix::BLAS.strassen_cutoff = 0
+        classical = a.dot(b)
+        NMatrix::BLAS.strassen_cutoff = 4
+        a.dot(b).should == classical
+      ensure
+        NMatrix::BLAS.strassen_cutoff = cutoff
+      end
+    end
+
+    expect { NMatrix::BLAS.strassen_cutoff = -1 }.to raise_error(ArgumentError)
+  end
 end
\ No newline at end of file
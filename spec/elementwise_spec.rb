@@ -57,6 +57,18 @@ describe NMatrix do
       y[0,0].should == 3
     end
 
+    it "should scale natively without changing the structure" do
+      x = @n.dot(2)
+      x.stype.should == :yale
+      x.extend NMatrix::YaleFunctions
+      x.yale_size.should == @n.yale_size
+      x[0,1].should == 60
+      x[2,2].should == 0
+
+      @n.scale(0.5).dtype.should == :float64
+      @n.scale(0.5)[1,1].should == 20.0
+    end
+
     it "should refuse to perform a dot operation on a yale with non-zero default" do
       r = NMatrix.new(:yale, 3, :int64)
       y = r + 3
@@ -135,6 +147,13 @@ describe NMatrix do
       y[0,0].should == 4
     end
 
+    it "should scale natively" do
+      x = @n.dot(-2)
+      x.stype.should == :list
+      x[0,0].should == -104
+      x[0,1].should == 0
+    end
+
     it "should perform element-wise addition" do
       r = NMatrix.new(:list, 2, 0, :int64)
       r[0,0] = 52
@@ -218,6 +237,15 @@ describe NMatrix do
         (@n+1).should == NMatrix.new(:dense, 2, [2,3,4,5], :int64)
       end
 
+      it "multiplies natively with dot, scale and *" do
+        @n.dot(3).should == NMatrix.new(:dense, 2, [3,6,9,12], :int64)
+        (@n * 3).should == NMatrix.new(:dense, 2, [3,6,9,12], :int64)
+        h = @n.scale(Rational(1,2))
+        h[0,0].should == Rational(1,2)
+        h[1,1].should == 2
+        @n[0..1,1].scale(2.0).should == NMatrix.new(:dense, [2,1], [4.0,8.0], :float64)
+      end
+
       #it "works for complex64" do
       #  n = @n.cast(:dtype => :complex64)
       #  (n + 10.0).to_a.should == [Complex(11.0), Complex(12.0), Complex(13.0), Complex(14.0)]
@@ -152,4 +152,156 @@ describe "math" do
       end
     end
   end
+
+  [:int32, :int64, :rational64].each do |dtype|
+    it "dense handles large #{dtype} matrix multiplication" do
+      a = (0...70).map { |i| (0...65).map { |j| (i*3 + j*7) % 11 - 5 } }
+      b = (0...65).map { |i| (0...50).map { |j| (i*5 + j) % 13 - 6 } }
+
+      n = NMatrix.new([70,65], a.flatten, dtype)
+      m = NMatrix.new([65,50], b.flatten, dtype)
+      r = n.dot m
+
+      [[0,0], [69,49], [31,17], [64,0]].each do |i,j|
+        r[i,j].should == (0...65).inject(0) { |sum,k| sum + a[i][k]*b[k][j] }
+      end
+    end
+  end
+
+  [[:int8, :int32], [:int16, :int64], [:int8, :int64]].each do |dtype, result_dtype|
+    it "dense multiplies #{dtype} matrices into a wider #{result_dtype} result" do
+      big = dtype == :int8 ? 127 : 32767
+      n = NMatrix.new([3,40], (0...120).map { |i| i.even? ? big : -big }, dtype)
+      m = NMatrix.new([40,2], (0...80).map { |i| i % 3 == 0 ? -big : big }, dtype)
+
+      r = n.dot(m, result_dtype)
+      r.dtype.should == result_dtype
+
+      expected = (0...40).inject(0) { |sum,k| sum + n[0,k] * m[k,1] }
+      r[0,1].should == expected
+      r[2,1].should == expected
+    end
+  end
+
+  [[:float32, :float64], [:int32, :rational64], [:int8, :float64]].each do |left_dtype, right_dtype|
+    it "dense multiplies mixed #{left_dtype} and #{right_dtype} matrices spanning several panels" do
+      a = (0...6).map { |i| (0...300).map { |j| (i + j*3) % 7 - 3 } }
+      b = (0...300).map { |i| (0...4).map { |j| (i*2 + j) % 5 - 2 } }
+
+      n = NMatrix.new([6,300], a.flatten, left_dtype)
+      m = NMatrix.new([300,4], b.flatten, right_dtype)
+      r = n.dot m
+
+      r.dtype.should == NMatrix.upcast(left_dtype, right_dtype)
+      [[0,0], [5,3], [2,1]].each do |i,j|
+        r[i,j].should == (0...300).inject(0) { |sum,k| sum + a[i][k]*b[k][j] }
+      end
+    end
+  end
+
+  [:int32, :int64, :rational64, :float64, :object].each do |dtype|
+    it "dense computes the #{dtype} Gram matrix and outer product of a matrix with itself" do
+      a = [[1, 2, 3], [4, 5, 6], [7, 8, -9], [0, 1, 2]]
+      n = NMatrix.new([4,3], a.flatten, dtype)
+
+      g = n.gram
+      g.shape.should == [3,3]
+      g.dtype.should == dtype
+      3.times { |i| 3.times { |j| g[i,j].should == (0...4).inject(0) { |sum,k| sum + a[k][i]*a[k][j] } } }
+
+      o = n.outer_self
+      o.shape.should == [4,4]
+      4.times { |i| 4.times { |j| o[i,j].should == (0...3).inject(0) { |sum,k| sum + a[i][k]*a[j][k] } } }
+    end
+  end
+
+  it "dense computes the Hermitian Gram matrix of a complex matrix" do
+    n = NMatrix.new([2,2], [Complex(1,1), Complex(0,2), Complex(3,0), Complex(1,-1)], :complex128)
+    g = n.gram
+
+    g[0,0].should == Complex(11,0)
+    g[0,1].should == Complex(5,-1)
+    g[1,0].should == Complex(5,1)
+  end
+
+  context "batched operations" do
+    before :each do
+      @a = NMatrix.new([2,3,3], [2,1,0, 1,3,1, 0,1,4,  0,2,1, 1,0,0, 3,1,5], :float64)
+    end
+
+    it "multiplies each layer of a batch by the matching layer of another" do
+      b = NMatrix.new([2,3,2], (0...12).to_a, :int32)
+      r = @a.batch_dot(b)
+
+      r.shape.should == [2,3,2]
+      2.times do |l|
+        3.times { |i| 2.times { |j| r[l,i,j].should == (0...3).inject(0) { |sum,k| sum + @a[l,i,k] * b[l,k,j] } } }
+      end
+    end
+
+    it "inverts each layer of a batch" do
+      r = @a.batch_dot(@a.batch_invert)
+      2.times { |l| 3.times { |i| 3.times { |j| r[l,i,j].should be_within(1e-12).of(i == j ? 1 : 0) } } }
+    end
+
+    it "solves a linear system for each layer of a batch" do
+      b = NMatrix.new([2,3,1], [1,2,3, 4,5,6], :float64)
+      x = @a.batch_solve(b)
+
+      r = @a.batch_dot(x)
+      2.times { |l| 3.times { |i| r[l,i,0].should be_within(1e-12).of(b[l,i,0]) } }
+    end
+
+    it "raises when a layer of a batch is singular" do
+      s = NMatrix.new([2,2,2], [1,0,0,1, 1,2,2,4], :rational64)
+      expect { s.batch_invert }.to raise_error(ZeroDivisionError)
+    end
+  end
+
+  context "list dot" do
+    it "multiplies list matrices, giving a list matrix" do
+      a = NMatrix.new([3,4], [1,0,2,0, 0,0,0,0, 0,-3,0,4], :int64)
+      b = NMatrix.new([4,2], [0,1, 2,0, 0,0, 5,-1], :int64)
+
+      r = a.cast(:list, :int64).dot(b.cast(:list, :int64))
+      r.stype.should == :list
+      r.cast(:dense, :int64).should == a.dot(b)
+    end
+
+    it "multiplies by a list matrix whose rows are each used many times" do
+      a = NMatrix.new([6,3], (1..18).to_a, :float64)
+      b = NMatrix.new([3,5], [1,0,0,2,0, 0,0,3,0,0, 0,4,0,0,5], :float64)
+
+      a.cast(:list, :float64).dot(b.cast(:list, :float64)).cast(:dense, :float64).should == a.dot(b)
+    end
+  end
+
+  context "multi_dot" do
+    it "multiplies a chain in the cheapest order" do
+      a = NMatrix.new([10,100], (0...1000).to_a, :float64)
+      b = NMatrix.new([100,5], (0...500).to_a, :float64)
+      c = NMatrix.new([5,50], (0...250).to_a, :float64)
+
+      NMatrix.multi_dot_order([a,b,c]).should == [[0,1],2]
+      NMatrix.multi_dot([a,b,c]).should == a.dot(b).dot(c)
+    end
+
+    it "multiplies a matrix-vector chain right to left" do
+      a = NMatrix.new([20,20], (0...400).to_a, :int64)
+      x = NMatrix.new([20,1], (0...20).to_a, :int64)
+
+      NMatrix.multi_dot_order([a,a,a,x]).should == [0,[1,[2,3]]]
+      NMatrix.multi_dot([a,a,a,x]).should == a.dot(a).dot(a).dot(x)
+    end
+
+    it "returns a lone matrix unchanged" do
+      a = NMatrix.new([2,2], [1,2,3,4], :int32)
+      NMatrix.multi_dot([a]).should == a
+    end
+
+    it "raises on incompatible shapes" do
+      a = NMatrix.new([2,3], 0, :int32)
+      expect { NMatrix.multi_dot([a,a]) }.to raise_error(ArgumentError)
+    end
+  end
 end
@@ -278,6 +278,34 @@ describe NMatrix do
   end
 
 
+  it "does not share changes between a dense matrix and its duplicate" do
+    n = NMatrix.new(:dense, 2, [1,2,3,4], :int64)
+    m = n.dup
+
+    n[0,0] = 10
+    m[0,0].should == 1
+
+    m[1,1] = 40
+    n[1,1].should == 4
+
+    r = n.dup
+    r[0..1,0][1,0] = 30 # write through a reference into the duplicate
+    r[1,0].should == 30
+    n[1,0].should == 3
+  end
+
+  it "allows huge-page backed dense matrices to be requested" do
+    NMatrix.huge_page_threshold.should be_nil
+    NMatrix.huge_page_threshold = 1024
+    NMatrix.huge_page_threshold.should == 1024
+
+    n = NMatrix.new(:dense, [32,32], 1.0, :float64)
+    n[31,31].should == 1.0
+
+    NMatrix.huge_page_threshold = nil
+    NMatrix.huge_page_threshold.should be_nil
+  end
+
   it "handles dense construction" do
     NMatrix.new(3,0)[1,1].should == 0
     lambda { NMatrix.new(3,:int8)[1,1] }.should_not raise_error
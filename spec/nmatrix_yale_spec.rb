@@ -201,6 +201,27 @@ describe NMatrix do
       end
     end
 
+    it "sets a slice from another Yale matrix without storing its zeros" do
+      n = NMatrix.new(:yale, [4,5], :float64)
+      n.extend(NMatrix::YaleFunctions)
+      n[0,0] = 1.0
+      n[1,2] = 2.0
+      n[1,3] = 3.0
+      n[2,2] = 4.0
+      n[3,4] = 5.0
+
+      m = NMatrix.new(:yale, [3,3], :int64)
+      m[0,0] = 7
+      m[2,1] = 8
+
+      n[1..3,2..4] = m
+      n.yale_d.should == [1.0, 0.0, 0.0, 8.0]
+      n.yale_ja.compact.should == [2]
+      n.yale_lu.compact.should == [7.0]
+      n[1,3].should == 0.0
+      n[0,0].should == 1.0
+    end
+
     it "dots two identical matrices" do
       a = NMatrix.new(:yale, 4, :float64)
       a[0,1] = 4.0
@@ -299,6 +320,268 @@ describe NMatrix do
       mn[0,0].should == 541
     end
 
+    it "multiplies by a vector without the general sparse product" do
+      a = NMatrix.new(:yale, [4,3], :int64)
+      a[0,0] = 2
+      a[0,2] = 1
+      a[1,1] = -3
+      a[3,0] = 4
+      a[3,2] = 5
+
+      x = NVector.new([3,1], [1,2,3], :int64)
+      y = a.dot(x)
+
+      y.stype.should == :dense
+      y.should == a.cast(:dense, :int64).dot(x)
+
+      yale_y = a.dot(x.cast(:yale, :int64))
+      yale_y.stype.should == :yale
+      yale_y.cast(:dense, :int64).should == y
+
+      z = NVector.new([4,1], [1,1,1,1], :int64)
+      NMatrix::BLAS.gemv(a, x, z, 2, 3)
+      z.should == NVector.new([4,1], [13,-9,3,41], :int64)
+    end
+
+    it "multiplies by vector slices, and checks their lengths" do
+      a = NMatrix.new(:yale, [4,3], :int64)
+      a[0,0] = 2
+      a[0,2] = 1
+      a[1,1] = -3
+      a[3,0] = 4
+      a[3,2] = 5
+
+      m = NMatrix.new([4,3], [9,9,9, 9,1,9, 9,2,9, 9,3,9], :int64)
+      x = m[1..3,1]
+
+      r = NMatrix.new([2,4], 0, :int64)
+      NMatrix::BLAS.gemv(a, x, r[1,0..3])
+      r.should == NMatrix.new([2,4], [0,0,0,0, 5,-6,0,19], :int64)
+
+      lambda { NMatrix::BLAS.gemv(a, m[0..1,1]) }.should raise_error(ArgumentError)
+      lambda { NMatrix::BLAS.gemv(a, x, NVector.new([3,1], 0, :int64)) }.should raise_error(ArgumentError)
+      lambda { NMatrix::BLAS.cblas_gemv(false, 4, 3, 1, a, 3, m[0..1,1], 1, 0, NVector.new([4,1], 0, :int64), 1) }.should raise_error(ArgumentError)
+    end
+
+    it "multiplies dense slices, and checks their shapes" do
+      a = NMatrix.new(:yale, [4,3], :int64)
+      a[0,0] = 2
+      a[0,2] = 1
+      a[1,1] = -3
+      a[3,0] = 4
+      a[3,2] = 5
+
+      m = NMatrix.new([4,3], (1..12).to_a, :int64)
+      c = NMatrix.new([5,3], 0, :int64)
+      NMatrix::BLAS.gemm(a, m[1..3,1..2], c[1..4,0..1])
+      c[1..4,0..1].should == a.cast(:dense, :int64).dot(m[1..3,1..2])
+      c[0,0..2].should == NMatrix.new([1,3], 0, :int64)
+      c[0..4,2].should == NMatrix.new([5,1], 0, :int64)
+
+      lambda { NMatrix::BLAS.gemm(a, m[0..1,0..1]) }.should raise_error(ArgumentError)
+      lambda { NMatrix::BLAS.gemm(a, m[1..3,1..2], NMatrix.new([3,2], 0, :int64)) }.should raise_error(ArgumentError)
+      lambda { NMatrix::BLAS.cblas_gemm(:row, false, false, 4, 2, 3, 1, a, 3, m[0..1,0..1], 2, 0, NMatrix.new([4,2], 0, :int64), 2) }.should raise_error(ArgumentError)
+    end
+
+    it "multiplies by a dense matrix on either side, giving a dense matrix" do
+      a = NMatrix.new(:yale, [4,3], :int64)
+      a[0,0] = 2
+      a[0,2] = 1
+      a[1,1] = -3
+      a[3,0] = 4
+      a[3,2] = 5
+
+      b = NMatrix.new([3,5], (0...15).to_a, :int64)
+      c = NMatrix.new([2,4], [1,0,2,-1, 3,1,0,2], :int32)
+
+      ab = a.dot(b)
+      ab.stype.should == :dense
+      ab.should == a.cast(:dense, :int64).dot(b)
+
+      ca = c.dot(a)
+      ca.stype.should == :dense
+      ca.dtype.should == :int64
+      ca.should == c.cast(:dense, :int64).dot(a.cast(:dense, :int64))
+    end
+
+    it "multiplies by its transpose without forming it" do
+      a = NMatrix.new(:yale, [4,3], :int64)
+      a[0,0] = 2
+      a[0,2] = 1
+      a[1,1] = -3
+      a[3,0] = 4
+      a[3,2] = 5
+
+      x = NVector.new([4,1], [1,2,3,4], :int64)
+      NMatrix::BLAS.gemv(a, x, nil, 1, 0, :transpose).should == NVector.new([3,1], [18,-6,21], :int64)
+
+      y = NVector.new([3,1], [1,1,1], :int64)
+      NMatrix::BLAS.gemv(a, x, y, 2, 3, :transpose)
+      y.should == NVector.new([3,1], [39,-9,45], :int64)
+
+      b = NMatrix.new([4,2], [1,0, 2,-1, 0,3, 1,1], :int64)
+      NMatrix::BLAS.gemm(a, b, nil, 1, 0, :transpose).should == a.cast(:dense, :int64).transpose.dot(b)
+    end
+
+    it "multiplies only where a mask is nonzero" do
+      # A triangle (0, 1, 2) with a tail (2, 3).
+      a = NMatrix.new(:yale, [4,4], :int64)
+      [[0,1], [1,2], [0,2], [2,3]].each { |i,j| a[i,j] = 1; a[j,i] = 1 }
+
+      c = a.masked_dot(a, a)
+      c.stype.should == :yale
+
+      expected = a.dot(a).cast(:dense, :int64)
+      4.times { |i| 4.times { |j| expected[i,j] = 0 if a[i,j] == 0 } }
+      c.cast(:dense, :int64).should == expected
+
+      # Only the two directions of each triangle edge are stored.
+      c.extend(NMatrix::YaleFunctions)
+      c.yale_size.should == 4 + 1 + 6
+
+      # A float mask isn't cast to the product's dtype, so 0.5 still counts as nonzero.
+      m = NMatrix.new(:yale, [4,4], :float64)
+      m[0,1] = 0.5
+      m[2,2] = 0.25
+      d = a.masked_dot(a, m)
+      d.dtype.should == :int64
+      d[0,1].should == 1
+      d[2,2].should == 3
+      d[1,1].should == 0
+    end
+
+    it "solves triangular systems from either triangle" do
+      a = NMatrix.new(:yale, [4,4], :float64)
+      a[0,0] = 2
+      a[1,0] = 1
+      a[1,1] = 4
+      a[2,2] = 1
+      a[3,1] = -2
+      a[3,3] = 5
+      a[0,3] = 3 # only seen by the upper triangle
+
+      x = NMatrix.new([4,2], [1,2, -1,0, 3,1, 2,-2], :float64)
+      lower = NMatrix.new([4,4], [2,0,0,0, 1,4,0,0, 0,0,1,0, 0,-2,0,5], :float64)
+      upper = NMatrix.new([4,4], [2,0,0,3, 0,4,0,0, 0,0,1,0, 0,0,0,5], :float64)
+
+      NMatrix::BLAS.trsm(a, lower.dot(x)).should == x
+      NMatrix::BLAS.trsm(a, upper.dot(x), :upper).should == x
+      NMatrix::BLAS.trsm(a, lower.transpose.dot(x), :lower, :transpose).should == x
+
+      # trmm multiplies by the same triangles.
+      [[:lower, false, lower], [:upper, false, upper], [:lower, :transpose, lower.transpose], [:upper, :transpose, upper.transpose]].each do |uplo, trans, t|
+        b = x.clone
+        NMatrix::BLAS.cblas_trmm(:row, :left, uplo, trans, :nonunit, 4, 2, 2.0, a, 4, b, 2)
+        b.should == t.dot(x) * 2
+      end
+
+      b = NMatrix.new([4,1], [1,2,3,4], :float64)
+      a[2,2] = 0
+      expect { NMatrix::BLAS.trsm(a, b) }.to raise_error(ZeroDivisionError)
+    end
+
+    it "factorizes sparse matrices, reusing the symbolic analysis" do
+      n = 12
+
+      # A 2D Laplacian on a 3x4 grid, which is symmetric positive definite.
+      a = NMatrix.new(:yale, [n,n], :float64)
+      n.times do |i|
+        a[i,i] = 4
+        [i+1, i+4].each { |j| a[i,j] = a[j,i] = -1 if j < n and (j == i+4 or j % 4 != 0) }
+      end
+
+      x = NMatrix.new([n,2], (0...2*n).map { |i| i % 5 - 2 }, :float64)
+      check = lambda do |y|
+        n.times { |i| 2.times { |j| y[i,j].should be_within(1e-10).of(x[i,j]) } }
+      end
+
+      analysis = a.analyze_cholesky
+      check.call(a.factorize_cholesky(analysis).solve(a.dot(x)))
+
+      # Same pattern, new values.
+      c = a * 2
+      check.call(c.factorize_cholesky(analysis).solve(c.dot(x)))
+
+      # Only the lower triangle stored, which would otherwise lose the upper one.
+      lower = NMatrix.new(:yale, [n,n], :float64)
+      n.times { |i| (0..i).each { |j| lower[i,j] = a[i,j] if a[i,j] != 0 } }
+      expect { lower.analyze_cholesky }.to raise_error(ArgumentError)
+      expect { lower.factorize_cholesky(analysis) }.to raise_error(ArgumentError)
+
+      # Not symmetric and needs pivoting, with a zero on the diagonal.
+      a[0,0] = 0
+      a[2,7] = 3
+      a[7,2] = 0.5
+      check.call(a.factorize_lu.solve(a.dot(x)))
+      check.call(a.factorize_lu(a.analyze_lu).solve(a.dot(x)))
+
+      expect { a.factorize_cholesky(analysis) }.to raise_error(ArgumentError)
+    end
+
+    it "solves iteratively, with and without preconditioners" do
+      n = 12
+
+      # The same Laplacian, then a variant that isn't symmetric, even in its pattern.
+      a = NMatrix.new(:yale, [n,n], :float64)
+      n.times do |i|
+        a[i,i] = 4
+        [i+1, i+4].each { |j| a[i,j] = a[j,i] = -1 if j < n and (j == i+4 or j % 4 != 0) }
+      end
+
+      x = NMatrix.new([n,1], (0...n).map { |i| i % 5 - 2 }, :float64)
+      check = lambda do |m, opts|
+        y, residuals = m.solve_iterative(m.dot(x), opts.merge(tol: 1e-10, max_iter: 100))
+        residuals.last.should <= 1e-10
+        n.times { |i| y[i,0].should be_within(1e-8).of(x[i,0]) }
+      end
+
+      check.call(a, {})
+      check.call(a, preconditioner: :jacobi)
+      check.call(a, preconditioner: :ic0)
+      check.call(a.cast(:dense, :float64), method: :cg, preconditioner: :jacobi)
+
+      a[2,7] = 3
+      a[7,3] = 0.5
+      check.call(a, method: :bicgstab, preconditioner: :ilu0)
+      check.call(a, method: :gmres, preconditioner: :ilu0, restart: 5)
+      check.call(a, method: :gmres)
+
+      expect { a.solve_iterative(a.dot(x), preconditioner: :ic0) }.to raise_error(ArgumentError)
+    end
+
+    it "gives the same sparse products whatever the number of threads" do
+      threads = NMatrix::BLAS.num_threads
+      n = 3000
+
+      # A few dense rows among many short ones.
+      a = NMatrix.new(:yale, [n,n], :int64)
+      n.times { |i| a[i,i] = i % 7 + 1; a[i,(i*31) % n] = 2 }
+      [5, 1000, 2999].each { |i| (0...n).step(2) { |j| a[i,j] = j % 5 - 2 } }
+
+      x = NVector.new([n,1], (0...n).map { |i| i % 11 - 5 }, :int64)
+      b = NMatrix.new([n,300], (0...n*300).map { |i| i % 13 - 6 }, :int64)
+
+      begin
+        NMatrix::BLAS.num_threads = 1
+        serial_v = NMatrix::BLAS.gemv(a, x)
+        serial_m = NMatrix::BLAS.gemm(a, b)
+        serial_tv = NMatrix::BLAS.gemv(a, x, nil, 1, 0, :transpose)
+        serial_tm = NMatrix::BLAS.gemm(a, b, nil, 1, 0, :transpose)
+        serial_p = a.dot(a)
+
+        NMatrix::BLAS.num_threads = 4
+        NMatrix::BLAS.gemv(a, x).should == serial_v
+        NMatrix::BLAS.gemm(a, b).should == serial_m
+        NMatrix::BLAS.gemv(a, x, nil, 1, 0, :transpose).should == serial_tv
+        NMatrix::BLAS.gemm(a, b, nil, 1, 0, :transpose).should == serial_tm
+        a.dot(a).should == serial_p
+      ensure
+        NMatrix::BLAS.num_threads = threads
+      end
+
+      [0, 299].each { |j| serial_m.column(j).should == a.dot(b.column(j)) }
+    end
+
     it "transposes" do
       a = NMatrix.new(:yale, 4, :float64)
       a[0,0] = 1.0
@@ -108,6 +108,30 @@ describe "Set slice operation" do
         end
       end
 
+      it "should correctly set a range of entries from another matrix" do
+        n = NMatrix.new(:dense, 2, [10, 11, 12, 13], :float64).cast(stype)
+        m = @m.clone
+        m[1..2,0..1] = n
+        m[1,0].should == 10
+        m[1,1].should == 11
+        m[2,0].should == 12
+        m[2,1].should == 13
+        m[0,0..2].should == @m[0,0..2]
+        m[1..2,2].should == @m[1..2,2]
+
+        expect { m[0..1,0..2] = n }.to raise_error(ArgumentError)
+      end
+
+      it "should correctly set a range of entries from an overlapping reference" do
+        m = @m.clone
+        m[0..1,0..1] = m[1..2,1..2]
+        m[0,0].should == 4
+        m[0,1].should == 5
+        m[1,0].should == 7
+        m[1,1].should == 8
+        m[2,0..2].should == @m[2,0..2]
+      end
+
       it "should correctly set a single entry" do
         #pending if stype == :yale
         n = @m.clone
@@ -134,6 +134,27 @@ describe "Slice operation" do
         b.is_ref?.should be_false
       end
 
+      it "should read and write single elements through a reference" do
+        r = @m[1..2, 1..2]
+        r[1,0].should == 7
+        r[1,0] = 70
+        @m[2,1].should == 70
+        r.slice(1,0).should == 70
+      end
+
+      it "should raise on an element index past the end" do
+        expect { @m[3,0] }.to raise_error(RangeError)
+        expect { @m[0,3] = 1 }.to raise_error(RangeError)
+      end
+
+      it "should give each of many references its own offset and shape" do
+        refs = (0...3).map { |i| @m[i, 0..2] }
+        GC.start
+        refs += (0...3).map { |j| @m[0..2, j] }
+        refs.map { |r| r.shape }.should == [[1,3]]*3 + [[3,1]]*3
+        refs.map { |r| (0...3).map { |k| r.shape[0] == 1 ? r[0,k] : r[k,0] } }.should == [[0,1,2],[3,4,5],[6,7,8],[0,3,6],[1,4,7],[2,5,8]]
+      end
+
       it "reference should compare with non-reference" do
         @m.slice(1..2,0..1).should == @m[1..2, 0..1]
         @m[1..2,0..1].should == @m.slice(1..2, 0..1)
@@ -295,6 +316,14 @@ describe "Slice operation" do
 
           context "operations" do
 
+            it "multiplies a slice by a column slice in place" do
+              r = @m[1..2,0..1].dot(@m[0..1,2])
+              r.shape.should == [2,1]
+              r[0,0].should == 3*2 + 4*5
+              r[1,0].should == 6*2 + 7*5
+              @m[1..2,0..1].dot(@m[0..1,1..2]).should == @m.slice(1..2,0..1).dot(@m.slice(0..1,1..2))
+            end
+
             it "correctly transposes slices" do
               @m[0...3,0].transpose.should eq NMatrix[[0, 3, 6]]
             end